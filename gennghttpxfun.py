@@ -175,6 +175,26 @@ OPTIONS = [
     "tls13-ciphers",
     "tls13-client-ciphers",
     "no-strip-incoming-early-data",
+    "accesslog-async",
+    "accesslog-async-buffer",
+    "accesslog-async-overflow",
+    "accesslog-async-sample-rate",
+    "accesslog-encoding",
+    "worker-buffer-pool-high-watermark",
+    "worker-buffer-pool-low-watermark",
+    "tls-dyn-rec-adaptive",
+    "backend-outlier-failure-rate",
+    "backend-outlier-min-requests",
+    "backend-outlier-window",
+    "backend-outlier-ejection-time",
+    "backend-outlier-max-ejection-time",
+    "backend-outlier-max-ejection-percent",
+    "cache-size",
+    "cache-max-object-size",
+    "tls-session-cache-size",
+    "tls-private-key-threads",
+    "rewrite-rule",
+    "http1-splice",
 ]
 
 LOGVARS = [
@@ -209,6 +229,7 @@ LOGVARS = [
     "path",
     "path_without_query",
     "protocol_version",
+    "backend_queue_time",
 ]
 
 if __name__ == '__main__':
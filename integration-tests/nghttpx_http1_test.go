@@ -3,13 +3,19 @@ package nghttp2
 import (
 	"bufio"
 	"bytes"
+	"compress/gzip"
 	"encoding/json"
 	"fmt"
 	"golang.org/x/net/http2/hpack"
 	"golang.org/x/net/websocket"
 	"io"
+	"io/ioutil"
+	"math/rand"
+	"net"
 	"net/http"
 	"regexp"
+	"strconv"
+	"sync"
 	"syscall"
 	"testing"
 	"time"
@@ -654,6 +660,385 @@ func TestH1H1POSTRequests(t *testing.T) {
 	}
 }
 
+// TestH1H1Pipelining tests that requests are pipelined on a backend
+// connection, and that each response is delivered to the request it
+// answers even if it arrives together with the preceding response.
+func TestH1H1Pipelining(t *testing.T) {
+	started := make(chan struct{})
+	st := newServerTester([]string{"--pipeline"}, t, func(w http.ResponseWriter, r *http.Request) {
+		if r.URL.Path != "/alpha" {
+			t.Errorf("Request to %v was not pipelined", r.URL.Path)
+			return
+		}
+		hj, ok := w.(http.Hijacker)
+		if !ok {
+			http.Error(w, "Could not hijack the connection", http.StatusInternalServerError)
+			return
+		}
+		conn, bufrw, err := hj.Hijack()
+		if err != nil {
+			http.Error(w, err.Error(), http.StatusInternalServerError)
+			return
+		}
+		defer conn.Close()
+
+		close(started)
+
+		conn.SetReadDeadline(time.Now().Add(5 * time.Second))
+
+		paths := []string{r.URL.Path}
+		for i := 0; i < 2; i++ {
+			req, err := http.ReadRequest(bufrw.Reader)
+			if err != nil {
+				t.Errorf("Error http.ReadRequest() = %v", err)
+				return
+			}
+			paths = append(paths, req.URL.Path)
+		}
+
+		var buf bytes.Buffer
+		split := 0
+		for i, p := range paths {
+			fmt.Fprintf(&buf, "HTTP/1.1 200 OK\r\nContent-Length: %v\r\n\r\n%v", len(p), p)
+			if i == 0 {
+				// The first write ends in the middle of the second
+				// response.
+				split = buf.Len() + 10
+			}
+		}
+
+		b := buf.Bytes()
+		conn.Write(b[:split])
+		time.Sleep(100 * time.Millisecond)
+		conn.Write(b[split:])
+	})
+	defer st.Close()
+
+	type result struct {
+		path string
+		res  *serverResponse
+		err  error
+	}
+
+	ch := make(chan result, 3)
+	request := func(conn net.Conn, path string) {
+		res, err := st.http1Conn(conn, requestParam{
+			name: "TestH1H1Pipelining",
+			path: path,
+		})
+		ch <- result{path, res, err}
+	}
+
+	go request(st.conn, "/alpha")
+
+	select {
+	case <-started:
+	case <-time.After(5 * time.Second):
+		t.Fatalf("Timeout waiting for the first request")
+	}
+
+	for _, path := range []string{"/bravo", "/charlie"} {
+		conn, err := net.Dial("tcp", st.frontendHost)
+		if err != nil {
+			t.Fatalf("Error net.Dial() = %v", err)
+		}
+		defer conn.Close()
+
+		go request(conn, path)
+	}
+
+	for i := 0; i < 3; i++ {
+		var r result
+		select {
+		case r = <-ch:
+		case <-time.After(5 * time.Second):
+			t.Fatalf("Timeout waiting for responses")
+		}
+		if r.err != nil {
+			t.Errorf("Error st.http1Conn(%v) = %v", r.path, r.err)
+			continue
+		}
+		if got, want := r.res.status, 200; got != want {
+			t.Errorf("%v: status = %v; want %v", r.path, got, want)
+		}
+		if got, want := string(r.res.body), r.path; got != want {
+			t.Errorf("%v: body = %v; want %v", r.path, got, want)
+		}
+	}
+}
+
+// TestH1H1PipeliningBackendClose tests that pipelined requests are
+// retried with another backend connection if the backend closes the
+// connection without responding to them.
+func TestH1H1PipeliningBackendClose(t *testing.T) {
+	started := make(chan struct{})
+	var mu sync.Mutex
+	seen := make(map[string]int)
+	st := newServerTester([]string{"--pipeline"}, t, func(w http.ResponseWriter, r *http.Request) {
+		mu.Lock()
+		seen[r.URL.Path]++
+		mu.Unlock()
+
+		if r.URL.Path != "/alpha" {
+			io.WriteString(w, r.URL.Path)
+			return
+		}
+		hj, ok := w.(http.Hijacker)
+		if !ok {
+			http.Error(w, "Could not hijack the connection", http.StatusInternalServerError)
+			return
+		}
+		conn, bufrw, err := hj.Hijack()
+		if err != nil {
+			http.Error(w, err.Error(), http.StatusInternalServerError)
+			return
+		}
+		defer conn.Close()
+
+		close(started)
+
+		conn.SetReadDeadline(time.Now().Add(5 * time.Second))
+
+		for i := 0; i < 2; i++ {
+			req, err := http.ReadRequest(bufrw.Reader)
+			if err != nil {
+				t.Errorf("Error http.ReadRequest() = %v", err)
+				return
+			}
+			mu.Lock()
+			seen[req.URL.Path]++
+			mu.Unlock()
+		}
+
+		// Close the connection after responding to the first request
+		// only.
+		fmt.Fprintf(conn, "HTTP/1.1 200 OK\r\nContent-Length: %v\r\n\r\n%v", len(r.URL.Path), r.URL.Path)
+	})
+	defer st.Close()
+
+	type result struct {
+		path string
+		res  *serverResponse
+		err  error
+	}
+
+	ch := make(chan result, 3)
+	request := func(conn net.Conn, path string) {
+		res, err := st.http1Conn(conn, requestParam{
+			name: "TestH1H1PipeliningBackendClose",
+			path: path,
+		})
+		ch <- result{path, res, err}
+	}
+
+	go request(st.conn, "/alpha")
+
+	select {
+	case <-started:
+	case <-time.After(5 * time.Second):
+		t.Fatalf("Timeout waiting for the first request")
+	}
+
+	for _, path := range []string{"/bravo", "/charlie"} {
+		conn, err := net.Dial("tcp", st.frontendHost)
+		if err != nil {
+			t.Fatalf("Error net.Dial() = %v", err)
+		}
+		defer conn.Close()
+
+		go request(conn, path)
+	}
+
+	for i := 0; i < 3; i++ {
+		var r result
+		select {
+		case r = <-ch:
+		case <-time.After(5 * time.Second):
+			t.Fatalf("Timeout waiting for responses")
+		}
+		if r.err != nil {
+			t.Errorf("Error st.http1Conn(%v) = %v", r.path, r.err)
+			continue
+		}
+		if got, want := r.res.status, 200; got != want {
+			t.Errorf("%v: status = %v; want %v", r.path, got, want)
+		}
+		if got, want := string(r.res.body), r.path; got != want {
+			t.Errorf("%v: body = %v; want %v", r.path, got, want)
+		}
+	}
+
+	mu.Lock()
+	defer mu.Unlock()
+
+	for _, path := range []string{"/bravo", "/charlie"} {
+		// Once pipelined, and once retried.
+		if got, want := seen[path], 2; got != want {
+			t.Errorf("%v: received %v times; want %v", path, got, want)
+		}
+	}
+}
+
+// TestH1H1Splice tests that response body which is larger than the
+// pipe buffer is moved from backend to frontend with --http1-splice.
+// The second request reuses the pipe of the frontend connection.
+func TestH1H1Splice(t *testing.T) {
+	body := make([]byte, 1<<20)
+	rand.New(rand.NewSource(1)).Read(body)
+
+	st := newServerTester([]string{"--http1-splice"}, t, func(w http.ResponseWriter, r *http.Request) {
+		w.Header().Set("Content-Length", strconv.Itoa(len(body)))
+		w.Write(body)
+	})
+	defer st.Close()
+
+	for i := 0; i < 2; i++ {
+		res, err := st.http1(requestParam{
+			name: "TestH1H1Splice",
+		})
+		if err != nil {
+			t.Fatalf("Error st.http1() = %v", err)
+		}
+
+		if got, want := res.status, 200; got != want {
+			t.Errorf("status = %v; want %v", got, want)
+		}
+		if !bytes.Equal(res.body, body) {
+			t.Errorf("body differs; len(res.body) = %v; want %v", len(res.body), len(body))
+		}
+	}
+}
+
+// TestH1H1SpliceChunked tests that chunked response body is not
+// spliced, and forwarded through response buffer.
+func TestH1H1SpliceChunked(t *testing.T) {
+	body := make([]byte, 1<<20)
+	rand.New(rand.NewSource(1)).Read(body)
+
+	st := newServerTester([]string{"--http1-splice"}, t, func(w http.ResponseWriter, r *http.Request) {
+		for b := body; len(b) > 0; b = b[65536:] {
+			w.Write(b[:65536])
+			w.(http.Flusher).Flush()
+		}
+	})
+	defer st.Close()
+
+	res, err := st.http1(requestParam{
+		name: "TestH1H1SpliceChunked",
+	})
+	if err != nil {
+		t.Fatalf("Error st.http1() = %v", err)
+	}
+
+	if got, want := res.status, 200; got != want {
+		t.Errorf("status = %v; want %v", got, want)
+	}
+	if !bytes.Equal(res.body, body) {
+		t.Errorf("body differs; len(res.body) = %v; want %v", len(res.body), len(body))
+	}
+}
+
+// TestH1H1SpliceTLS tests that response body is not spliced to TLS
+// frontend connection, and forwarded through response buffer.
+func TestH1H1SpliceTLS(t *testing.T) {
+	body := make([]byte, 1<<20)
+	rand.New(rand.NewSource(1)).Read(body)
+
+	st := newServerTesterTLS([]string{"--http1-splice", "--alpn-h1"}, t, func(w http.ResponseWriter, r *http.Request) {
+		w.Header().Set("Content-Length", strconv.Itoa(len(body)))
+		w.Write(body)
+	})
+	defer st.Close()
+
+	res, err := st.http1(requestParam{
+		name: "TestH1H1SpliceTLS",
+	})
+	if err != nil {
+		t.Fatalf("Error st.http1() = %v", err)
+	}
+
+	if got, want := res.status, 200; got != want {
+		t.Errorf("status = %v; want %v", got, want)
+	}
+	if !bytes.Equal(res.body, body) {
+		t.Errorf("body differs; len(res.body) = %v; want %v", len(res.body), len(body))
+	}
+}
+
+// TestH1H1SpliceCompress tests that response body which is compressed
+// is not spliced.
+func TestH1H1SpliceCompress(t *testing.T) {
+	body := make([]byte, 1<<20)
+	rand.New(rand.NewSource(1)).Read(body)
+
+	st := newServerTester([]string{"--http1-splice", "--compress"}, t, func(w http.ResponseWriter, r *http.Request) {
+		w.Header().Set("Content-Type", "text/plain")
+		w.Header().Set("Content-Length", strconv.Itoa(len(body)))
+		w.Write(body)
+	})
+	defer st.Close()
+
+	res, err := st.http1(requestParam{
+		name: "TestH1H1SpliceCompress",
+		header: []hpack.HeaderField{
+			pair("accept-encoding", "gzip"),
+		},
+	})
+	if err != nil {
+		t.Fatalf("Error st.http1() = %v", err)
+	}
+
+	if got, want := res.status, 200; got != want {
+		t.Errorf("status = %v; want %v", got, want)
+	}
+	if got, want := res.header.Get("Content-Encoding"), "gzip"; got != want {
+		t.Fatalf("Content-Encoding = %v; want %v", got, want)
+	}
+
+	zr, err := gzip.NewReader(bytes.NewReader(res.body))
+	if err != nil {
+		t.Fatalf("Error gzip.NewReader() = %v", err)
+	}
+	decoded, err := ioutil.ReadAll(zr)
+	if err != nil {
+		t.Fatalf("Error reading gzip body: %v", err)
+	}
+	if !bytes.Equal(decoded, body) {
+		t.Errorf("decoded body differs; len(decoded) = %v; want %v", len(decoded), len(body))
+	}
+}
+
+// TestH1H1SpliceRewrite tests that response body is spliced after
+// response header fields are rewritten.  Rewrite rules cannot change
+// the header fields which determine message framing.
+func TestH1H1SpliceRewrite(t *testing.T) {
+	body := make([]byte, 1<<20)
+	rand.New(rand.NewSource(1)).Read(body)
+
+	st := newServerTester([]string{"--http1-splice", "--rewrite-rule=path=/;add-response-header=x-rewritten:yes"}, t, func(w http.ResponseWriter, r *http.Request) {
+		w.Header().Set("Content-Length", strconv.Itoa(len(body)))
+		w.Write(body)
+	})
+	defer st.Close()
+
+	res, err := st.http1(requestParam{
+		name: "TestH1H1SpliceRewrite",
+	})
+	if err != nil {
+		t.Fatalf("Error st.http1() = %v", err)
+	}
+
+	if got, want := res.status, 200; got != want {
+		t.Errorf("status = %v; want %v", got, want)
+	}
+	if got, want := res.header.Get("X-Rewritten"), "yes"; got != want {
+		t.Errorf("X-Rewritten = %v; want %v", got, want)
+	}
+	if !bytes.Equal(res.body, body) {
+		t.Errorf("body differs; len(res.body) = %v; want %v", len(res.body), len(body))
+	}
+}
+
 // // TestH1H2ConnectFailure tests that server handles the situation that
 // // connection attempt to HTTP/2 backend failed.
 // func TestH1H2ConnectFailure(t *testing.T) {
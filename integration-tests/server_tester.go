@@ -99,7 +99,7 @@ func newServerTesterInternal(src_args []string, t *testing.T, handler http.Handl
 
 	args := []string{}
 
-	var backendTLS, dns, externalDNS, acceptProxyProtocol, redirectIfNotTLS, affinityCookie, alpnH1 bool
+	var backendTLS, dns, externalDNS, acceptProxyProtocol, redirectIfNotTLS, affinityCookie, alpnH1, pipeline, compress bool
 
 	for _, k := range src_args {
 		switch k {
@@ -118,6 +118,10 @@ func newServerTesterInternal(src_args []string, t *testing.T, handler http.Handl
 			affinityCookie = true
 		case "--alpn-h1":
 			alpnH1 = true
+		case "--pipeline":
+			pipeline = true
+		case "--compress":
+			compress = true
 		default:
 			args = append(args, k)
 		}
@@ -174,6 +178,14 @@ func newServerTesterInternal(src_args []string, t *testing.T, handler http.Handl
 		b += ";affinity=cookie;affinity-cookie-name=affinity;affinity-cookie-path=/foo/bar"
 	}
 
+	if pipeline {
+		b += ";pipeline-depth=4"
+	}
+
+	if compress {
+		b += ";compress"
+	}
+
 	noTLS := ";no-tls"
 	if frontendTLS {
 		noTLS = ""
@@ -376,6 +388,12 @@ func (st *serverTester) websocket(rp requestParam) (*serverResponse, error) {
 }
 
 func (st *serverTester) http1(rp requestParam) (*serverResponse, error) {
+	return st.http1Conn(st.conn, rp)
+}
+
+// http1Conn sends HTTP/1 request over conn, which is connected to the
+// frontend server, and reads its response.
+func (st *serverTester) http1Conn(conn net.Conn, rp requestParam) (*serverResponse, error) {
 	method := "GET"
 	if rp.method != "" {
 		method = rp.method
@@ -423,10 +441,10 @@ func (st *serverTester) http1(rp requestParam) (*serverResponse, error) {
 			req.Trailer.Set(h.Name, "")
 		}
 	}
-	if err := req.Write(st.conn); err != nil {
+	if err := req.Write(conn); err != nil {
 		return nil, err
 	}
-	resp, err := http.ReadResponse(bufio.NewReader(st.conn), req)
+	resp, err := http.ReadResponse(bufio.NewReader(conn), req)
 	if err != nil {
 		return nil, err
 	}
@@ -1227,6 +1227,14 @@ void Client::record_ttfb() {
   cstat.ttfb = std::chrono::steady_clock::now();
 }
 
+void Client::record_data_time(RequestStat *req_stat) {
+  if (recorded(req_stat->data_time)) {
+    return;
+  }
+
+  req_stat->data_time = std::chrono::steady_clock::now();
+}
+
 void Client::clear_connect_times() {
   cstat.connect_start_time = std::chrono::steady_clock::time_point();
   cstat.connect_time = std::chrono::steady_clock::time_point();
@@ -1481,8 +1489,9 @@ process_time_stats(const std::vector<std::unique_ptr<Worker>> &workers) {
     client_times_sampling = w->client_smp.n > w->stats.client_stats.size();
   }
 
-  std::vector<double> request_times;
+  std::vector<double> request_times, data_times;
   request_times.reserve(nrequest_times);
+  data_times.reserve(nrequest_times);
 
   std::vector<double> connect_times, ttfb_times, rps_values;
   connect_times.reserve(nclient_times);
@@ -1498,6 +1507,15 @@ process_time_stats(const std::vector<std::unique_ptr<Worker>> &workers) {
           std::chrono::duration_cast<std::chrono::duration<double>>(
               req_stat.stream_close_time - req_stat.request_time)
               .count());
+
+      if (!recorded(req_stat.data_time)) {
+        continue;
+      }
+
+      data_times.push_back(
+          std::chrono::duration_cast<std::chrono::duration<double>>(
+              req_stat.data_time - req_stat.request_time)
+              .count());
     }
 
     const auto &stat = w->stats;
@@ -1538,6 +1556,7 @@ process_time_stats(const std::vector<std::unique_ptr<Worker>> &workers) {
   return {compute_time_stat(request_times, request_times_sampling),
           compute_time_stat(connect_times, client_times_sampling),
           compute_time_stat(ttfb_times, client_times_sampling),
+          compute_time_stat(data_times, request_times_sampling),
           compute_time_stat(rps_values, client_times_sampling)};
 }
 } // namespace
@@ -2801,6 +2820,12 @@ time for request: )"
             << util::format_duration(ts.ttfb.mean) << "  " << std::setw(10)
             << util::format_duration(ts.ttfb.sd) << std::setw(9)
             << util::dtos(ts.ttfb.within_sd) << "%"
+            << "\ntime to 1st data: " << std::setw(10)
+            << util::format_duration(ts.data.min) << "  " << std::setw(10)
+            << util::format_duration(ts.data.max) << "  " << std::setw(10)
+            << util::format_duration(ts.data.mean) << "  " << std::setw(10)
+            << util::format_duration(ts.data.sd) << std::setw(9)
+            << util::dtos(ts.data.within_sd) << "%"
             << "\nreq/s           : " << std::setw(10) << ts.rps.min << "  "
             << std::setw(10) << ts.rps.max << "  " << std::setw(10)
             << ts.rps.mean << "  " << std::setw(10) << ts.rps.sd << std::setw(9)
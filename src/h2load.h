@@ -130,6 +130,8 @@ struct RequestStat {
   std::chrono::system_clock::time_point request_wall_time;
   // time point when stream was closed
   std::chrono::steady_clock::time_point stream_close_time;
+  // time point when the first byte of response body was received
+  std::chrono::steady_clock::time_point data_time;
   // upload data length sent so far
   int64_t data_offset;
   // HTTP status code
@@ -174,6 +176,8 @@ struct SDStats {
   SDStat connect;
   // time to first byte (TTFB)
   SDStat ttfb;
+  // time to first byte of response body for each request
+  SDStat data;
   // request per second for each client
   SDStat rps;
 };
@@ -397,6 +401,7 @@ struct Client {
   void record_connect_start_time();
   void record_connect_time();
   void record_ttfb();
+  void record_data_time(RequestStat *req_stat);
   void clear_connect_times();
   void record_client_start_time();
   void record_client_end_time();
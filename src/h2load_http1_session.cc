@@ -139,6 +139,10 @@ int htp_body_cb(llhttp_t *htp, const char *data, size_t len) {
   auto client = session->get_client();
 
   client->record_ttfb();
+  auto req_stat = client->get_req_stat(session->stream_resp_counter_);
+  if (req_stat) {
+    client->record_data_time(req_stat);
+  }
   client->worker->stats.bytes_body += len;
 
   return 0;
@@ -90,6 +90,10 @@ int on_data_chunk_recv_callback(nghttp2_session *session, uint8_t flags,
                                 size_t len, void *user_data) {
   auto client = static_cast<Client *>(user_data);
   client->record_ttfb();
+  auto req_stat = client->get_req_stat(stream_id);
+  if (req_stat) {
+    client->record_data_time(req_stat);
+  }
   client->worker->stats.bytes_body += len;
   return 0;
 }
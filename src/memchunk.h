@@ -41,6 +41,7 @@ struct iovec {
 #include <cassert>
 #include <cstring>
 #include <memory>
+#include <limits>
 #include <array>
 #include <algorithm>
 #include <string>
@@ -60,19 +61,30 @@ namespace nghttp2 {
 
 template <size_t N> struct Memchunk {
   Memchunk(Memchunk *next_chunk)
-      : pos(std::begin(buf)), last(pos), knext(next_chunk), next(nullptr) {}
+      : pos(std::begin(buf)),
+        last(pos),
+        knext(next_chunk),
+        kprev(nullptr),
+        next(nullptr) {}
   size_t len() const { return last - pos; }
   size_t left() const { return std::end(buf) - last; }
   void reset() { pos = last = std::begin(buf); }
   std::array<uint8_t, N> buf;
   uint8_t *pos, *last;
-  Memchunk *knext;
+  Memchunk *knext, *kprev;
   Memchunk *next;
   static const size_t size = N;
 };
 
 template <typename T> struct Pool {
-  Pool() : pool(nullptr), freelist(nullptr), poolsize(0), freelistsize(0) {}
+  Pool()
+      : pool(nullptr),
+        freelist(nullptr),
+        poolsize(0),
+        freelistsize(0),
+        max_freelistsize(std::numeric_limits<size_t>::max()),
+        peak_poolsize(0),
+        releasedsize(0) {}
   ~Pool() { clear(); }
   T *get() {
     if (freelist) {
@@ -84,15 +96,34 @@ template <typename T> struct Pool {
       return m;
     }
 
-    pool = new T{pool};
+    auto m = new T{pool};
+    if (pool) {
+      pool->kprev = m;
+    }
+    pool = m;
     poolsize += T::size;
+    peak_poolsize = std::max(peak_poolsize, poolsize);
     return pool;
   }
   void recycle(T *m) {
+    if (freelistsize + T::size > max_freelistsize) {
+      destroy(m);
+      return;
+    }
     m->next = freelist;
     freelist = m;
     freelistsize += T::size;
   }
+  // Deletes the objects in the free list until freelistsize becomes
+  // at most |target|.
+  void shrink(size_t target) {
+    while (freelist && freelistsize > target) {
+      auto m = freelist;
+      freelist = freelist->next;
+      freelistsize -= T::size;
+      destroy(m);
+    }
+  }
   void clear() {
     freelist = nullptr;
     freelistsize = 0;
@@ -102,13 +133,37 @@ template <typename T> struct Pool {
       p = knext;
     }
     pool = nullptr;
+    releasedsize += poolsize;
     poolsize = 0;
   }
+  // Deletes |m| which is not in the free list.
+  void destroy(T *m) {
+    if (m->kprev) {
+      m->kprev->knext = m->knext;
+    } else {
+      pool = m->knext;
+    }
+    if (m->knext) {
+      m->knext->kprev = m->kprev;
+    }
+    delete m;
+    poolsize -= T::size;
+    releasedsize += T::size;
+  }
   using value_type = T;
   T *pool;
   T *freelist;
+  // The number of bytes allocated, including the free list.
   size_t poolsize;
+  // The number of bytes in the free list.
   size_t freelistsize;
+  // The maximum number of bytes kept in the free list.  The objects
+  // recycled beyond this limit are deleted immediately.
+  size_t max_freelistsize;
+  // The maximum value of poolsize so far.
+  size_t peak_poolsize;
+  // The total number of bytes deleted so far.
+  uint64_t releasedsize;
 };
 
 template <typename Memchunk> struct Memchunks {
@@ -191,6 +246,39 @@ template <typename Memchunk> struct Memchunks {
   size_t append(const ImmutableString &s) {
     return append(s.c_str(), s.size());
   }
+  // Returns the number of bytes which can be written to the tail
+  // chunk directly from tail->last without allocating new chunk.
+  size_t wleft() const { return tail ? tail->left() : 0; }
+  // Commits |count| bytes written directly to tail->last.  |count|
+  // must not exceed wleft().
+  size_t write(size_t count) {
+    assert(count <= wleft());
+    if (count == 0) {
+      return 0;
+    }
+    tail->last += count;
+    len += count;
+    return count;
+  }
+  // Appends |m| to the end of this object without copying its data.
+  // |m| must be obtained from pool, and must contain data.  This
+  // object takes the ownership of |m|.
+  size_t append_chunk(Memchunk *m) {
+    assert(m->len());
+
+    m->next = nullptr;
+
+    if (!tail) {
+      head = tail = m;
+    } else {
+      tail->next = m;
+      tail = m;
+    }
+
+    len += m->len();
+
+    return m->len();
+  }
   size_t copy(Memchunks &dest) {
     auto m = head;
     while (m) {
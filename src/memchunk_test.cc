@@ -81,6 +81,58 @@ void test_pool_recycle(void) {
   CU_ASSERT(nullptr == m2->next);
 }
 
+void test_pool_shrink(void) {
+  MemchunkPool pool;
+  constexpr auto N = MemchunkPool::value_type::size;
+
+  pool.max_freelistsize = 2 * N;
+
+  auto m1 = pool.get();
+  auto m2 = pool.get();
+  auto m3 = pool.get();
+  auto m4 = pool.get();
+
+  CU_ASSERT(4 * N == pool.poolsize);
+  CU_ASSERT(4 * N == pool.peak_poolsize);
+
+  // m2 is in the middle of the list of allocated objects.
+  pool.recycle(m2);
+  pool.recycle(m3);
+
+  CU_ASSERT(m3 == pool.freelist);
+  CU_ASSERT(2 * N == pool.freelistsize);
+
+  // The free list is full, and m1 is deleted.
+  pool.recycle(m1);
+
+  CU_ASSERT(3 * N == pool.poolsize);
+  CU_ASSERT(2 * N == pool.freelistsize);
+  CU_ASSERT(N == pool.releasedsize);
+  CU_ASSERT(m4 == pool.pool);
+  CU_ASSERT(m3 == m4->knext);
+  CU_ASSERT(m2 == m3->knext);
+  CU_ASSERT(nullptr == m2->knext);
+
+  pool.shrink(N);
+
+  CU_ASSERT(2 * N == pool.poolsize);
+  CU_ASSERT(N == pool.freelistsize);
+  CU_ASSERT(2 * N == pool.releasedsize);
+  CU_ASSERT(m2 == pool.freelist);
+  CU_ASSERT(m4 == pool.pool);
+  CU_ASSERT(m2 == m4->knext);
+  CU_ASSERT(m4 == m2->kprev);
+  CU_ASSERT(4 * N == pool.peak_poolsize);
+
+  pool.shrink(0);
+
+  CU_ASSERT(N == pool.poolsize);
+  CU_ASSERT(0 == pool.freelistsize);
+  CU_ASSERT(nullptr == pool.freelist);
+  CU_ASSERT(m4 == pool.pool);
+  CU_ASSERT(nullptr == m4->knext);
+}
+
 using Memchunk16 = Memchunk<16>;
 using MemchunkPool16 = Pool<Memchunk16>;
 using Memchunks16 = Memchunks<Memchunk16>;
@@ -147,6 +199,42 @@ void test_memchunks_drain(void) {
   CU_ASSERT(0 == memcmp("3456789", buf, nread));
 }
 
+void test_memchunks_append_chunk(void) {
+  MemchunkPool16 pool;
+  Memchunks16 chunks(&pool);
+
+  CU_ASSERT(0 == chunks.wleft());
+
+  auto m = pool.get();
+  m->last = std::copy_n("0123456789", 10, m->last);
+
+  CU_ASSERT(10 == chunks.append_chunk(m));
+  CU_ASSERT(10 == chunks.rleft());
+  CU_ASSERT(m == chunks.head);
+  CU_ASSERT(m == chunks.tail);
+  CU_ASSERT(6 == chunks.wleft());
+
+  auto p = std::copy_n("abcdef", 6, chunks.tail->last);
+
+  CU_ASSERT(std::end(m->buf) == p);
+  CU_ASSERT(6 == chunks.write(6));
+  CU_ASSERT(16 == chunks.rleft());
+  CU_ASSERT(0 == chunks.wleft());
+
+  m = pool.get();
+  *m->last++ = 'x';
+
+  CU_ASSERT(1 == chunks.append_chunk(m));
+  CU_ASSERT(17 == chunks.rleft());
+  CU_ASSERT(m == chunks.tail);
+
+  char buf[17];
+
+  CU_ASSERT(17 == chunks.remove(buf, sizeof(buf)));
+  CU_ASSERT(0 == memcmp("0123456789abcdefx", buf, sizeof(buf)));
+  CU_ASSERT(nullptr == chunks.head);
+}
+
 void test_memchunks_riovec(void) {
   MemchunkPool16 pool;
   Memchunks16 chunks(&pool);
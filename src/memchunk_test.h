@@ -32,8 +32,10 @@
 namespace nghttp2 {
 
 void test_pool_recycle(void);
+void test_pool_shrink(void);
 void test_memchunks_append(void);
 void test_memchunks_drain(void);
+void test_memchunks_append_chunk(void);
 void test_memchunks_riovec(void);
 void test_memchunks_recycle(void);
 void test_memchunks_reset(void);
@@ -0,0 +1,155 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2013 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif // HAVE_CONFIG_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "shrpx_router.h"
+#include "shrpx_log.h"
+#include "template.h"
+
+using namespace nghttp2;
+using namespace shrpx;
+
+// Benchmarks Router with synthetic routing table.  The table has the
+// given number of patterns spread over hosts, each of which has
+// several path patterns.  It reports lookups per second of the tree
+// and compiled forms.
+
+namespace {
+constexpr size_t PATHS_PER_HOST = 10;
+} // namespace
+
+namespace {
+std::string random_label(std::mt19937 &gen, size_t len) {
+  static constexpr char chars[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+  std::uniform_int_distribution<size_t> dist(0, str_size(chars) - 1);
+
+  std::string s;
+  for (size_t i = 0; i < len; ++i) {
+    s += chars[dist(gen)];
+  }
+  return s;
+}
+} // namespace
+
+namespace {
+struct Query {
+  std::string host;
+  std::string path;
+};
+} // namespace
+
+namespace {
+// Returns the number of matched queries, so that the lookups are not
+// optimized away.
+size_t run(const Router &router, const std::vector<Query> &queries,
+           size_t num_lookups, double *elapsed) {
+  size_t matched = 0;
+
+  auto start = std::chrono::steady_clock::now();
+
+  for (size_t i = 0; i < num_lookups; ++i) {
+    auto &q = queries[i % queries.size()];
+    if (router.match(StringRef{q.host}, StringRef{q.path}) != -1) {
+      ++matched;
+    }
+  }
+
+  *elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                           start)
+                 .count();
+
+  return matched;
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  size_t num_routes = 20000;
+  size_t num_lookups = 10000000;
+
+  if (argc > 1) {
+    num_routes = strtoul(argv[1], nullptr, 10);
+  }
+  if (argc > 2) {
+    num_lookups = strtoul(argv[2], nullptr, 10);
+  }
+
+  if (num_routes == 0 || num_lookups == 0) {
+    fprintf(stderr, "Usage: %s [NUM_ROUTES [NUM_LOOKUPS]]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  std::mt19937 gen(1000000007);
+  std::uniform_int_distribution<size_t> len_dist(3, 12);
+
+  Router router, compiled;
+  std::vector<Query> queries;
+
+  auto num_hosts = (num_routes + PATHS_PER_HOST - 1) / PATHS_PER_HOST;
+
+  for (size_t i = 0, idx = 0; i < num_hosts && idx < num_routes; ++i) {
+    auto host = random_label(gen, len_dist(gen)) + ".example.com";
+
+    for (size_t j = 0; j < PATHS_PER_HOST && idx < num_routes; ++j, ++idx) {
+      auto path = '/' + random_label(gen, len_dist(gen)) + '/';
+      auto pattern = host + path;
+
+      router.add_route(StringRef{pattern}, idx);
+      compiled.add_route(StringRef{pattern}, idx);
+
+      // Matching query, and the one which falls back to the shorter
+      // pattern.
+      queries.push_back({host, path + "index.html"});
+      queries.push_back({host, path.substr(0, path.size() / 2)});
+    }
+  }
+
+  compiled.compile();
+
+  std::shuffle(std::begin(queries), std::end(queries), gen);
+
+  printf("routes: %zu, queries: %zu, lookups: %zu\n", num_routes,
+         queries.size(), num_lookups);
+
+  for (auto r : {std::make_pair("tree", &router),
+                 std::make_pair("compiled", &compiled)}) {
+    double elapsed;
+    auto matched = run(*r.second, queries, num_lookups, &elapsed);
+
+    printf("%-8s: %.0f lookups/sec (%.3fs, %zu matched)\n", r.first,
+           num_lookups / elapsed, elapsed, matched);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -45,6 +45,20 @@
 #include "shrpx_config.h"
 #include "tls.h"
 #include "shrpx_router_test.h"
+#include "shrpx_accesslog_writer_test.h"
+#include "shrpx_metrics_test.h"
+#include "shrpx_load_balancer_test.h"
+#include "shrpx_hedge_test.h"
+#include "shrpx_outlier_detector_test.h"
+#include "shrpx_concurrency_limiter_test.h"
+#include "shrpx_single_flight_test.h"
+#include "shrpx_cache_test.h"
+#include "shrpx_dns_cache_test.h"
+#include "shrpx_tls_session_store_test.h"
+#include "shrpx_private_key_pool_test.h"
+#include "shrpx_rewrite_test.h"
+#include "shrpx_compress_test.h"
+#include "shrpx_backend_health_test.h"
 #include "shrpx_log.h"
 
 static int init_suite1(void) { return 0; }
@@ -119,16 +133,24 @@ int main(int argc, char *argv[]) {
                    shrpx::test_downstream_supports_non_final_response) ||
       !CU_add_test(pSuite, "downstream_find_affinity_cookie",
                    shrpx::test_downstream_find_affinity_cookie) ||
+      !CU_add_test(pSuite, "downstream_request_pipelinable",
+                   shrpx::test_downstream_request_pipelinable) ||
+      !CU_add_test(pSuite, "downstream_start_response_compression",
+                   shrpx::test_downstream_start_response_compression) ||
       !CU_add_test(pSuite, "config_parse_header",
                    shrpx::test_shrpx_config_parse_header) ||
       !CU_add_test(pSuite, "config_parse_log_format",
                    shrpx::test_shrpx_config_parse_log_format) ||
+      !CU_add_test(pSuite, "config_compile_log_format",
+                   shrpx::test_shrpx_config_compile_log_format) ||
       !CU_add_test(pSuite, "config_read_tls_ticket_key_file",
                    shrpx::test_shrpx_config_read_tls_ticket_key_file) ||
       !CU_add_test(pSuite, "config_read_tls_ticket_key_file_aes_256",
                    shrpx::test_shrpx_config_read_tls_ticket_key_file_aes_256) ||
       !CU_add_test(pSuite, "worker_match_downstream_addr_group",
                    shrpx::test_shrpx_worker_match_downstream_addr_group) ||
+      !CU_add_test(pSuite, "worker_replace_downstream_config",
+                   shrpx::test_shrpx_worker_replace_downstream_config) ||
       !CU_add_test(pSuite, "http_create_forwarded",
                    shrpx::test_shrpx_http_create_forwarded) ||
       !CU_add_test(pSuite, "http_create_via_header_value",
@@ -140,6 +162,91 @@ int main(int argc, char *argv[]) {
                    shrpx::test_shrpx_router_match_wildcard) ||
       !CU_add_test(pSuite, "router_match_prefix",
                    shrpx::test_shrpx_router_match_prefix) ||
+      !CU_add_test(pSuite, "router_compile",
+                   shrpx::test_shrpx_router_compile) ||
+      !CU_add_test(pSuite, "accesslog_ring_push",
+                   shrpx::test_shrpx_accesslog_ring_push) ||
+      !CU_add_test(pSuite, "accesslog_ring_sample",
+                   shrpx::test_shrpx_accesslog_ring_sample) ||
+      !CU_add_test(pSuite, "metrics_latency_histogram_bucket",
+                   shrpx::test_shrpx_metrics_latency_histogram_bucket) ||
+      !CU_add_test(pSuite, "metrics_latency_histogram_quantile",
+                   shrpx::test_shrpx_metrics_latency_histogram_quantile) ||
+      !CU_add_test(pSuite, "load_balancer_latency",
+                   shrpx::test_shrpx_load_balancer_latency) ||
+      !CU_add_test(pSuite, "load_balancer_select",
+                   shrpx::test_shrpx_load_balancer_select) ||
+      !CU_add_test(pSuite, "load_balancer_affinity_table",
+                   shrpx::test_shrpx_load_balancer_affinity_table) ||
+      !CU_add_test(pSuite, "load_balancer_select_affinity",
+                   shrpx::test_shrpx_load_balancer_select_affinity) ||
+      !CU_add_test(pSuite, "load_balancer_need_http2_session",
+                   shrpx::test_shrpx_load_balancer_need_http2_session) ||
+      !CU_add_test(pSuite, "hedge_retry_budget",
+                   shrpx::test_shrpx_hedge_retry_budget) ||
+      !CU_add_test(pSuite, "hedge_latency_histogram",
+                   shrpx::test_shrpx_hedge_latency_histogram) ||
+      !CU_add_test(pSuite, "backend_health_table",
+                   shrpx::test_shrpx_backend_health_table) ||
+      !CU_add_test(pSuite, "backend_health_shared_blocker",
+                   shrpx::test_shrpx_backend_health_shared_blocker) ||
+      !CU_add_test(pSuite, "outlier_detector",
+                   shrpx::test_shrpx_outlier_detector) ||
+      !CU_add_test(pSuite, "outlier_detector_max_ejections",
+                   shrpx::test_shrpx_outlier_detector_max_ejections) ||
+      !CU_add_test(pSuite, "gradient_limit",
+                   shrpx::test_shrpx_gradient_limit) ||
+      !CU_add_test(pSuite, "concurrency_limiter",
+                   shrpx::test_shrpx_concurrency_limiter) ||
+      !CU_add_test(pSuite, "single_flight_create_key",
+                   shrpx::test_shrpx_single_flight_create_key) ||
+      !CU_add_test(pSuite, "single_flight_response_shareable",
+                   shrpx::test_shrpx_single_flight_response_shareable) ||
+      !CU_add_test(pSuite, "single_flight_call",
+                   shrpx::test_shrpx_single_flight_call) ||
+      !CU_add_test(pSuite, "cache_parse_cache_control",
+                   shrpx::test_shrpx_cache_parse_cache_control) ||
+      !CU_add_test(pSuite, "cache_response_storable",
+                   shrpx::test_shrpx_cache_response_storable) ||
+      !CU_add_test(pSuite, "cache_create_entry",
+                   shrpx::test_shrpx_cache_create_entry) ||
+      !CU_add_test(pSuite, "cache_not_modified",
+                   shrpx::test_shrpx_cache_not_modified) ||
+      !CU_add_test(pSuite, "cache_request_requires_validation",
+                   shrpx::test_shrpx_cache_request_requires_validation) ||
+      !CU_add_test(pSuite, "cache_shard", shrpx::test_shrpx_cache_shard) ||
+      !CU_add_test(pSuite, "dns_cache_lifetime",
+                   shrpx::test_shrpx_dns_cache_lifetime) ||
+      !CU_add_test(pSuite, "dns_cache", shrpx::test_shrpx_dns_cache) ||
+      !CU_add_test(pSuite, "dns_cache_refresh_failure",
+                   shrpx::test_shrpx_dns_cache_refresh_failure) ||
+      !CU_add_test(pSuite, "tls_session_store",
+                   shrpx::test_shrpx_tls_session_store) ||
+      !CU_add_test(pSuite, "tls_session_store_eviction",
+                   shrpx::test_shrpx_tls_session_store_eviction) ||
+      !CU_add_test(pSuite, "private_key_pool_rsa",
+                   shrpx::test_shrpx_private_key_pool_rsa) ||
+      !CU_add_test(pSuite, "private_key_pool_ecdsa",
+                   shrpx::test_shrpx_private_key_pool_ecdsa) ||
+      !CU_add_test(pSuite, "private_key_pool_async",
+                   shrpx::test_shrpx_private_key_pool_async) ||
+      !CU_add_test(pSuite, "private_key_pool_cancel",
+                   shrpx::test_shrpx_private_key_pool_cancel) ||
+      !CU_add_test(pSuite, "rewrite_parse_rewrite_rule",
+                   shrpx::test_shrpx_rewrite_parse_rewrite_rule) ||
+      !CU_add_test(pSuite, "rewrite_rule_match",
+                   shrpx::test_shrpx_rewrite_rule_match) ||
+      !CU_add_test(pSuite, "rewrite_apply_request",
+                   shrpx::test_shrpx_rewrite_apply_request) ||
+      !CU_add_test(pSuite, "compress_select_coding",
+                   shrpx::test_shrpx_compress_select_coding) ||
+      !CU_add_test(pSuite, "compress_content_type",
+                   shrpx::test_shrpx_compress_content_type) ||
+      !CU_add_test(pSuite, "compress_vary_covered",
+                   shrpx::test_shrpx_compress_vary_covered) ||
+      !CU_add_test(pSuite, "compress_level",
+                   shrpx::test_shrpx_compress_level) ||
+      !CU_add_test(pSuite, "compress_gzip", shrpx::test_shrpx_compress_gzip) ||
       !CU_add_test(pSuite, "util_streq", shrpx::test_util_streq) ||
       !CU_add_test(pSuite, "util_strieq", shrpx::test_util_strieq) ||
       !CU_add_test(pSuite, "util_inp_strlower",
@@ -200,8 +307,11 @@ int main(int argc, char *argv[]) {
       !CU_add_test(pSuite, "gzip_inflate", test_nghttp2_gzip_inflate) ||
       !CU_add_test(pSuite, "buffer_write", nghttp2::test_buffer_write) ||
       !CU_add_test(pSuite, "pool_recycle", nghttp2::test_pool_recycle) ||
+      !CU_add_test(pSuite, "pool_shrink", nghttp2::test_pool_shrink) ||
       !CU_add_test(pSuite, "memchunk_append", nghttp2::test_memchunks_append) ||
       !CU_add_test(pSuite, "memchunk_drain", nghttp2::test_memchunks_drain) ||
+      !CU_add_test(pSuite, "memchunk_append_chunk",
+                   nghttp2::test_memchunks_append_chunk) ||
       !CU_add_test(pSuite, "memchunk_riovec", nghttp2::test_memchunks_riovec) ||
       !CU_add_test(pSuite, "memchunk_recycle",
                    nghttp2::test_memchunks_recycle) ||
@@ -85,6 +85,7 @@
 #include "shrpx_process.h"
 #include "shrpx_signal.h"
 #include "shrpx_connection.h"
+#include "shrpx_private_key_pool.h"
 #include "shrpx_log.h"
 #include "util.h"
 #include "app_helper.h"
@@ -1456,9 +1457,11 @@ void fill_default_config(Config *config) {
     auto &dyn_recconf = tlsconf.dyn_rec;
     dyn_recconf.warmup_threshold = 1_m;
     dyn_recconf.idle_timeout = 1_s;
+    dyn_recconf.adaptive = false;
   }
 
   tlsconf.session_timeout = std::chrono::hours(12);
+  tlsconf.session_cache.size = 20480;
   tlsconf.ciphers = StringRef::from_lit(nghttp2::tls::DEFAULT_CIPHER_LIST);
   tlsconf.tls13_ciphers =
       StringRef::from_lit(nghttp2::tls::DEFAULT_TLS13_CIPHER_LIST);
@@ -1486,6 +1489,8 @@ void fill_default_config(Config *config) {
   httpconf.max_response_header_fields = 500;
   httpconf.redirect_https_port = StringRef::from_lit("443");
   httpconf.max_requests = std::numeric_limits<size_t>::max();
+  httpconf.cache.size = 64_m;
+  httpconf.cache.max_object_size = 1_m;
   httpconf.xfp.add = true;
   httpconf.xfp.strip_incoming = true;
   httpconf.early_data.strip_incoming = true;
@@ -1554,6 +1559,13 @@ void fill_default_config(Config *config) {
     accessconf.format =
         parse_log_format(config->balloc, DEFAULT_ACCESSLOG_FORMAT);
 
+    auto &asyncconf = accessconf.async;
+    asyncconf.buffer_size = 1_m;
+    asyncconf.sample_rate = 10;
+    asyncconf.overflow = AccessLogOverflow::BLOCK;
+
+    accessconf.encoding = AccessLogEncoding::TEXT;
+
     auto &errorconf = loggingconf.error;
     errorconf.file = StringRef::from_lit("/dev/stderr");
   }
@@ -1589,6 +1601,12 @@ void fill_default_config(Config *config) {
     }
   }
 
+  {
+    auto &bufpoolconf = connconf.buffer_pool;
+    bufpoolconf.high_watermark = 64_m;
+    bufpoolconf.low_watermark = 4_m;
+  }
+
   {
     connconf.downstream = std::make_shared<DownstreamConfig>();
     auto &downstreamconf = *connconf.downstream;
@@ -1603,6 +1621,15 @@ void fill_default_config(Config *config) {
       timeoutconf.max_backoff = 120_s;
     }
 
+    {
+      auto &outlierconf = downstreamconf.outlier;
+      outlierconf.window = 10_s;
+      outlierconf.base_ejection_time = 30_s;
+      outlierconf.max_ejection_time = 5_min;
+      outlierconf.min_requests = 20;
+      outlierconf.max_ejection_percent = 10;
+    }
+
     downstreamconf.connections_per_host = 8;
     downstreamconf.request_buffer_size = 16_k;
     downstreamconf.response_buffer_size = 128_k;
@@ -1737,10 +1764,18 @@ Connections:
               The  parameters are  delimited  by  ";".  The  available
               parameters       are:      "proto=<PROTO>",       "tls",
               "sni=<SNI_HOST>",         "fall=<N>",        "rise=<N>",
-              "affinity=<METHOD>",    "dns",    "redirect-if-not-tls",
-              "upgrade-scheme",                        "mruby=<PATH>",
+              "affinity=<METHOD>",   "balance=<METHOD>",   "dns",
+              "redirect-if-not-tls",   "upgrade-scheme",   "mruby=<PATH>",
               "read-timeout=<DURATION>",   "write-timeout=<DURATION>",
-              "group=<GROUP>",  "group-weight=<N>", and  "weight=<N>".
+              "group=<GROUP>",  "group-weight=<N>",  "weight=<N>",
+              "pool-min-idle=<N>",  "pool-max-idle=<N>",
+              "h2-sessions=<N>", "pipeline-depth=<N>",
+              "hedge-delay=<DURATION>", "hedge-percentile=<P>",
+              "retry-budget=<PERCENT>",
+              "adaptive-concurrency", "queue-timeout=<DURATION>",
+              "single-flight",
+              "single-flight-key=<HEADER>[:<HEADER>...]", "cache", and
+              "compress".
               The  parameter  consists   of  keyword,  and  optionally
               followed by  "=" and value.  For  example, the parameter
               "proto=h2"  consists of  the keyword  "proto" and  value
@@ -1778,23 +1813,32 @@ Connections:
               row, the backend is assumed to  be online, and it is now
               eligible  for load  balancing target.   If <N>  is 0,  a
               backend  is permanently  offline, once  it goes  in that
-              state, and this is the default behaviour.
-
-              The     session     affinity    is     enabled     using
-              "affinity=<METHOD>"  parameter.   If  "ip" is  given  in
-              <METHOD>, client  IP based session affinity  is enabled.
-              If "cookie"  is given in <METHOD>,  cookie based session
-              affinity is  enabled.  If  "none" is given  in <METHOD>,
-              session affinity  is disabled, and this  is the default.
-              The session  affinity is  enabled per <PATTERN>.   If at
-              least  one backend  has  "affinity"  parameter, and  its
-              <METHOD> is not "none",  session affinity is enabled for
-              all backend  servers sharing the same  <PATTERN>.  It is
-              advised  to  set  "affinity" parameter  to  all  backend
-              explicitly if session affinity  is desired.  The session
-              affinity  may   break  if   one  of  the   backend  gets
-              unreachable,  or   backend  settings  are   reloaded  or
-              replaced by API.
+              state, and this is the default behaviour.  The
+              connection failures and the offline state of a backend
+              are shared by all worker threads, so that "fall" counts
+              the failures seen by any of them, and only one worker
+              thread checks whether the offline backend is back
+              online.
+
+              The session affinity is enabled using
+              "affinity=<METHOD>" parameter.  If "ip" is given in
+              <METHOD>, client IP based session affinity is enabled.
+              If "cookie" is given in <METHOD>, cookie based session
+              affinity is enabled.  If "header" is given in <METHOD>,
+              session affinity based on the value of a request header
+              field is enabled.  If "none" is given in <METHOD>,
+              session affinity is disabled, and this is the default.
+              The session affinity is enabled per <PATTERN>.  If at
+              least one backend has "affinity" parameter, and its
+              <METHOD> is not "none", session affinity is enabled for
+              all backend servers sharing the same <PATTERN>.  It is
+              advised to set "affinity" parameter to all backend
+              explicitly if session affinity is desired.  A client is
+              mapped to a backend using Maglev consistent hashing.  If
+              the backend gets unreachable, its clients are spread
+              over the remaining backends.  If a backend is added or
+              removed by reloading or replacing backend settings,
+              mostly only the clients of that backend are moved.
 
               If   "affinity=cookie"    is   used,    the   additional
               configuration                is                required.
@@ -1810,6 +1854,32 @@ Connections:
               the  Secure attribute  is  always set.   If <SECURE>  is
               "no", the Secure attribute is always omitted.
 
+              If "affinity=header" is used,
+              "affinity-header-name=<NAME>" must be used to specify a
+              name of request header field to use.  If the header
+              field is missing in a request, client IP address is used
+              instead.
+
+              The load balancing method is selected using
+              "balance=<METHOD>" parameter.  If "round-robin" is given
+              in <METHOD>, requests are distributed by weighted round
+              robin, and this is the default.  If "least-request" is
+              given, a request is forwarded to the backend which has
+              the least number of outstanding requests divided by its
+              weight.  If "peak-ewma" is given, the backend is chosen
+              by the peak exponentially weighted moving average of
+              response latency multiplied by the number of outstanding
+              requests, divided by its weight.  The average decays
+              toward 0 with a time constant of 10 seconds, so that a
+              backend which was slow once is probed again.  If "p2c" is
+              given, 2 backends are chosen at random, and the one with
+              the lower "peak-ewma" cost is used.  Outstanding requests
+              and latency are tracked per worker thread.  The method is
+              configured per <PATTERN> like "affinity".  "group" and
+              "group-weight" are ignored unless <METHOD> is
+              "round-robin".  "balance" is ignored if session affinity
+              is enabled.
+
               By default, name resolution of backend host name is done
               at  start  up,  or reloading  configuration.   If  "dns"
               parameter   is  given,   name  resolution   takes  place
@@ -1818,6 +1888,13 @@ Connections:
               backend   host   name   at  start   up,   or   reloading
               configuration is skipped.
 
+              If  "dns"  is  given, all A and AAAA records of the host
+              name  are  used in turn.  If connection to an address is
+              not  established within 250ms, or it fails, nghttpx also
+              connects  to  another  address,  preferably of the other
+              address  family,  and  uses  the  connection established
+              first.
+
               If "redirect-if-not-tls" parameter  is used, the matched
               backend  requires   that  frontend  connection   is  TLS
               encrypted.  If it isn't, nghttpx responds to the request
@@ -1876,6 +1953,143 @@ Connections:
               weight  becomes  1.   "weight"  is  ignored  if  session
               affinity is enabled.
 
+              "pool-min-idle=<N>" parameter makes nghttpx keep at
+              least <N> idle connections to this backend established
+              in advance in each worker, so that a request does not
+              wait for TCP and TLS handshake.  Connections are made in
+              background with a small random delay when the pool falls
+              below <N>, including at startup and after backend
+              configuration is replaced.  Those <N> connections are
+              not closed by --backend-keep-alive-timeout.
+              "pool-max-idle=<N>" parameter limits the number of idle
+              connections to <N>, and the one which has been idle for
+              the longest time is closed first.  The most recently
+              used connection is reused first.  If <N> is 0, the
+              number of idle connections is unlimited, and this is the
+              default.  These parameters are only available for HTTP/1
+              backend without "dns" parameter.
+
+              "h2-sessions=<N>" parameter specifies the number of
+              HTTP/2 connections per worker which streams to this
+              backend are spread over.  A new stream is assigned to
+              the connection which has the least number of streams in
+              flight, and then the least number of bytes in flight.
+              nghttpx opens an additional connection before all
+              connections reach the maximum concurrent streams
+              advertised by the backend, that is when the least loaded
+              connection is 3/4 full.  If this parameter is omitted,
+              <N> becomes 1.  This parameter is only available for
+              HTTP/2 backend.
+
+              "pipeline-depth=<N>" parameter enables HTTP/1.1
+              pipelining to this backend, and specifies the maximum
+              number of requests in flight on one connection.  A
+              request is pipelined on the connection which is carrying
+              a request only if there is no idle connection, and both
+              requests are GET, HEAD, or OPTIONS without request body.
+              Responses are delivered in the order of requests.  If
+              the connection is lost before the response arrives, the
+              pipelined request is retried with another connection.
+              If this parameter is omitted, <N> becomes 1, which
+              disables pipelining.  This parameter is only available
+              for HTTP/1 backend, and cannot be used with
+              "hedge-delay" or "hedge-percentile" parameter.
+
+              "hedge-delay=<DURATION>" parameter enables hedged
+              requests.  If a GET or HEAD request without request body
+              gets no response from a backend within <DURATION>, the
+              same request is sent to the least loaded address in the
+              same group, and the response which arrives first is
+              used.  The connection of the other request is closed.
+              "hedge-percentile=<P>" parameter enables hedged requests
+              as well, and the delay becomes the <P>th percentile of
+              the recent response latency of the group, where <P> must
+              be [1, 99] inclusive.  If both are given, "hedge-delay"
+              is the minimum delay.  These parameters are only
+              available for HTTP/1 backend, and ignored if session
+              affinity is enabled.
+
+              "retry-budget=<PERCENT>" parameter limits the number of
+              retried and hedged requests to <PERCENT> of requests in
+              each worker, plus a small allowance for bursts, so that
+              retries do not amplify the load of an overloaded
+              backend.  <PERCENT> must be [0, 100] inclusive.  If this
+              parameter is omitted, retries are not limited, and
+              hedged requests are limited to 10% of requests.
+
+              "adaptive-concurrency" parameter limits the number of
+              outstanding requests to the group in each worker.  The
+              limit is adjusted based on response latency.  It is
+              raised while latency stays around its long term average,
+              and lowered when latency grows, that is when the backend
+              starts queueing requests.  A request which exceeds the
+              limit is rejected with 503 status code without being
+              forwarded to backend.  "queue-timeout=<DURATION>"
+              parameter lets such request wait for at most <DURATION>
+              instead.  If it cannot be forwarded within <DURATION>,
+              or the number of waiting requests reaches the limit, it
+              is rejected with 503.  "queue-timeout" requires
+              "adaptive-concurrency".
+
+              "single-flight" parameter coalesces identical GET
+              requests to the group in each worker.  While a request
+              is in flight to backend, the other requests which have
+              the same scheme, authority, and path wait for it, and
+              get the copy of its response, instead of being forwarded
+              to backend.  The requests which arrive after the
+              response header fields are received are forwarded to
+              backend as usual.  If the response contains Set-Cookie
+              header field, or Cache-Control header field with
+              "private" or "no-store" directive, or Vary header field
+              which lists a header field not in "single-flight-key",
+              it is not shared, and the waiting requests are forwarded
+              to backend.  The requests with Authorization header
+              field, or Cookie header field unless "cookie" is in
+              "single-flight-key", are not coalesced.  Requests are
+              coalesced only with the requests in the same worker, so
+              up to N identical requests can reach backend at the same
+              time, where N is the number of workers (see --workers).
+              "single-flight-key=<HEADER>[:<HEADER>...]" adds the
+              values of the given request header fields to the key
+              which identifies requests, for example,
+              "single-flight-key=accept-encoding:accept-language".
+              "single-flight-key" requires "single-flight".
+
+              "cache" parameter stores the responses from the group in
+              response cache, and serves GET and HEAD requests from it
+              while  the stored response is fresh.  Only the responses
+              which  have explicit freshness lifetime in Cache-Control
+              or   Expires   header   field,  or  validator  (ETag  or
+              Last-Modified   header   field)  are  stored.   A  stale
+              response  is  revalidated  with backend by a conditional
+              request,  and if backend responds with 304, it is served
+              from  cache.   Responses  with  Set-Cookie header field,
+              Cache-Control "no-store" or "private" directive, or Vary
+              header field with "*" are not stored.  The requests with
+              Authorization  or  Range header field bypass cache.  The
+              stored response is also revalidated if the request has
+              Cache-Control "no-cache" directive, or its age or
+              remaining freshness does not satisfy "max-age" or
+              "min-fresh" directive of the request.  "max-stale"
+              directive is ignored, and a stale response is never
+              served without revalidation.  See also --cache-size and
+              --cache-max-object-size.
+
+              "compress" parameter compresses the response bodies from
+              the group with gzip, or brotli if nghttpx is built with
+              libbrotlienc, according to Accept-Encoding request header
+              field.  Only the responses of text, JSON, JavaScript,
+              XML, and WebAssembly which are at least 256 bytes long
+              are compressed.  The responses which already have
+              Content-Encoding, or have Cache-Control "no-transform"
+              directive, and 206 responses are not compressed.  The
+              compression level is chosen by the response body size.
+              ETag of the compressed response is made weak, and Vary
+              header field with "accept-encoding" is added.  So is 304
+              response to the client which accepts compression.
+              Response cache stores uncompressed responses.
+              --http1-splice is not used for the compressed responses.
+
               Since ";" and ":" are  used as delimiter, <PATTERN> must
               not contain  these characters.  In order  to include ":"
               in  <PATTERN>,  one  has  to  specify  "%3A"  (which  is
@@ -1945,6 +2159,55 @@ Connections:
               timeouts when connecting and  making CONNECT request can
               be     specified    by     --backend-read-timeout    and
               --backend-write-timeout options.
+  --backend-outlier-failure-rate=<PERCENT>
+              Enable passive outlier detection, and eject a backend
+              address from load balancing when <PERCENT> or more of
+              the requests to it failed within the window specified by
+              --backend-outlier-window.  A request fails if the
+              backend responds with 5xx status code, resets the stream
+              or connection before the response completes, or times
+              out.  Each worker counts the failures on its own.
+              <PERCENT> must be [0, 100] inclusive.  0 disables
+              outlier detection.
+              Default: 0
+  --backend-outlier-min-requests=<N>
+              Specify the minimum number of requests to a backend
+              address within the window before it is considered for
+              ejection.
+              Default: )"
+      << config->conn.downstream->outlier.min_requests << R"(
+  --backend-outlier-window=<DURATION>
+              Specify the length of the sliding window in which the
+              failures of requests are counted.
+              Default: )"
+      << util::duration_str(config->conn.downstream->outlier.window)
+      << R"(
+  --backend-outlier-ejection-time=<DURATION>
+              Specify the duration of the first ejection of a backend
+              address.  If the address is ejected again soon after it
+              returns, the duration grows by this amount, up to
+              --backend-outlier-max-ejection-time.  The duration is
+              reset once the address stays in load balancing for
+              --backend-outlier-max-ejection-time.
+              Default: )"
+      << util::duration_str(
+             config->conn.downstream->outlier.base_ejection_time)
+      << R"(
+  --backend-outlier-max-ejection-time=<DURATION>
+              Specify the maximum duration of an ejection.
+              Default: )"
+      << util::duration_str(
+             config->conn.downstream->outlier.max_ejection_time)
+      << R"(
+  --backend-outlier-max-ejection-percent=<PERCENT>
+              Specify the maximum ratio of ejected addresses in a
+              backend group, so that ejection does not overload the
+              rest of addresses.  Even if the ratio rounds down to 0,
+              one address can be ejected from a group which has 2 or
+              more addresses.  The last address in a group is never
+              ejected.  <PERCENT> must be [0, 100] inclusive.
+              Default: )"
+      << config->conn.downstream->outlier.max_ejection_percent << R"(
 
 Performance:
   -n, --workers=<N>
@@ -2024,6 +2287,18 @@ Performance:
               --backend-connections-per-host.
               Default: )"
       << config->conn.downstream->connections_per_frontend << R"(
+  --worker-buffer-pool-high-watermark=<SIZE>
+              Set the maximum size of unused I/O buffers each worker
+              keeps for reuse.  The buffers released beyond this limit
+              are freed immediately.  Setting 0 means unlimited.
+              Default: )"
+      << util::utos_unit(config->conn.buffer_pool.high_watermark) << R"(
+  --worker-buffer-pool-low-watermark=<SIZE>
+              When the size of unused I/O buffers in a worker exceeds
+              this value, the worker frees half of the excess every second
+              until it drops to this value.
+              Default: )"
+      << util::utos_unit(config->conn.buffer_pool.low_watermark) << R"(
   --rlimit-nofile=<N>
               Set maximum number of open files (RLIMIT_NOFILE) to <N>.
               If 0 is given, nghttpx does not set the limit.
@@ -2037,6 +2312,16 @@ Performance:
               Set buffer size used to store backend response.
               Default: )"
       << util::utos_unit(config->conn.downstream->response_buffer_size) << R"(
+  --http1-splice
+              Move   response  body  from  HTTP/1  backend  to  HTTP/1
+              frontend  with  splice(2),  so  that it is not copied to
+              user  space.   This  is  done only if neither connection
+              uses  TLS,  and  the  response  has Content-Length.  The
+              response  body  is not moved this way if it is stored in
+              response cache, or shared with coalesced requests.  This
+              option  is  only applicable for the platforms which have
+              splice(2).   For  other  platforms,  this option will be
+              simply ignored.
   --fastopen=<N>
               Enables  "TCP Fast  Open" for  the listening  socket and
               limits the  maximum length for the  queue of connections
@@ -2349,6 +2634,26 @@ SSL/TLS:
   --no-verify-ocsp
               nghttpx does not verify OCSP response.
   --no-ocsp   Disable OCSP stapling.
+  --tls-session-cache-size=<N>
+              Set  the  maximum  number  of TLS sessions stored in the
+              in-memory session cache shared by all workers.  Frontend
+              and   backend  sessions  are  counted  separately.   The
+              in-memory   cache   for   frontend   is   not   used  if
+              --tls-session-cache-memcached    is    given.    TLSv1.3
+              frontend  sessions  are  resumed by session tickets, and
+              they are not stored.  0 disables the in-memory cache.
+              Default: )"
+      << config->tls.session_cache.size << R"(
+  --tls-private-key-threads=<N>
+              Set  the number of threads which perform the private key
+              operations  of frontend TLS handshakes.  A worker thread
+              continues  to  serve other connections while the signing
+              of  a handshake is in progress, instead of being blocked
+              by  it.   This  is  effective  for RSA and ECDSA private
+              keys.  The operations are performed by worker threads if
+              0 is given.
+              Default: )"
+      << config->tls.private_key_threads << R"(
   --tls-session-cache-memcached=<HOST>,<PORT>[;tls]
               Specify  address of  memcached server  to store  session
               cache.   This  enables   shared  session  cache  between
@@ -2388,6 +2693,17 @@ SSL/TLS:
               TLS HTTP/2 backends.
               Default: )"
       << util::duration_str(config->tls.dyn_rec.idle_timeout) << R"(
+  --tls-dyn-rec-adaptive
+              Derive TLS dynamic record size from the TCP congestion
+              window instead of the number of bytes written.  While the
+              congestion window is small, each TLS record is sized to
+              fit in a single TCP segment.  Once the window can carry 2
+              maximum size records, the record size is increased to
+              16K.  --tls-dyn-rec-warmup-threshold still bounds the
+              warm up period, and setting it to 0 disables dynamic
+              record sizing.  --tls-dyn-rec-idle-timeout still resets
+              the record size.  If TCP_INFO is not available, only the
+              byte threshold is used.
   --no-http2-cipher-black-list
               Allow  black  listed  cipher suite  on  frontend  HTTP/2
               connection.                                          See
@@ -2610,6 +2926,9 @@ Logging:
                 request.  "-" if backend host is not available.
               * $backend_port:  backend  port   used  to  fulfill  the
                 request.  "-" if backend host is not available.
+              * $backend_queue_time: time in seconds with milliseconds
+                resolution the request waited for a slot of adaptive
+                concurrency limit of backend.
               * $method: HTTP method
               * $path:  Request  path  including query.   For  CONNECT
                 request, authority is recorded.
@@ -2624,10 +2943,54 @@ Logging:
 
               Default: )"
       << DEFAULT_ACCESSLOG_FORMAT << R"(
+  --accesslog-encoding=(text|json|binary)
+              Specify the encoding of access log records.  If
+              "text" is given, a record is written as specified by
+              --accesslog-format.  If "json" is given, a record is
+              written as a single line JSON object.  Each variable in
+              --accesslog-format becomes a member whose name is the
+              variable name without "$", and literal strings are
+              ignored.  Numeric values are written as JSON number, and
+              unavailable values are written as null.  If "binary" is
+              given, a record is written in the length-prefixed
+              binary format: 4 bytes record length, 1 byte version,
+              and fields.  Each field consists of 1 byte field id (and
+              1 byte length and header field name for $http_<VAR>),
+              1 byte value type (0: unavailable, 1: string, 2:
+              number), 2 bytes value length, and value.  Integers are
+              in network byte order.  "binary" cannot be used with
+              --accesslog-syslog.
+              Default: text
   --accesslog-write-early
               Write  access  log  when   response  header  fields  are
               received   from  backend   rather   than  when   request
               transaction finishes.
+  --accesslog-async
+              Write access log from a dedicated thread.  Each worker
+              queues formatted records in its own buffer, and the
+              thread writes the records of all workers in batches.
+              This keeps slow storage from blocking worker threads.
+              This option has no effect if --single-thread is used.
+  --accesslog-async-buffer=<SIZE>
+              Set the size of the per-worker buffer used by
+              --accesslog-async.  The size is rounded up to the power
+              of 2.
+              Default: )"
+      << util::utos_unit(config->logging.access.async.buffer_size) << R"(
+  --accesslog-async-overflow=(block|drop|sample)
+              Specify what to do when the buffer of --accesslog-async
+              is full.  If "block" is given, the worker waits until
+              the writer thread makes room.  If "drop" is given, the
+              record is discarded.  If "sample" is given, only 1 out
+              of N records is kept once the buffer becomes half
+              full, where N is given by --accesslog-async-sample-rate,
+              and the record is discarded if the buffer is full.  The
+              number of discarded records is reported to error log.
+              Default: block
+  --accesslog-async-sample-rate=<N>
+              Set N for --accesslog-async-overflow=sample.
+              Default: )"
+      << config->logging.access.async.sample_rate << R"(
   --errorlog-file=<PATH>
               Set path to write error  log.  To reopen file, send USR1
               signal  to nghttpx.   stderr will  be redirected  to the
@@ -2723,6 +3086,47 @@ HTTP:
               won't replace anything already  set.  This option can be
               used several  times to  specify multiple  header fields.
               Example: --add-response-header="foo: bar"
+  --rewrite-rule=<RULE>
+              Add a rule which rewrites requests and responses without
+              mruby.  <RULE> is a list of parameters separated by ";".
+              The  rule  matches  a  request  if  all  conditions  are
+              satisfied,  and  then  its actions are performed.  Rules
+              are  evaluated  in  the  order of appearance against the
+              request  modified  by  the  preceding  rules.   They are
+              evaluated  after the request phase hook of --mruby-file,
+              and before backend is selected.
+
+              The     following     parameters     are     conditions.
+              "method=<METHOD>" matches request method.  "host=<HOST>"
+              matches  the  host  of authority case-insensitively.  If
+              <HOST>  starts  with  "*.",  it  matches its subdomains.
+              "path=<PATH>" matches request path, excluding query.  If
+              <PATH>  ends  with "/", it matches the paths which start
+              with  <PATH>.   "header=<NAME>"  matches if header field
+              <NAME>  is  present, and "header=<NAME>:<VALUE>" matches
+              if it has <VALUE>.
+
+              The      following      parameters      are     actions.
+              "set-request-header=<NAME>:<VALUE>"   replaces   request
+              header       field       <NAME>       with      <VALUE>.
+              "add-request-header=<NAME>:<VALUE>"  adds request header
+              field.   "remove-request-header=<NAME>"  removes request
+              header     field     <NAME>.      "set-response-header",
+              "add-response-header",  and  "remove-response-header" do
+              the same for response header fields, before the response
+              phase  hooks  of  mruby  scripts.  "rewrite-path=<PATH>"
+              rewrites request path to <PATH>.  If path condition is a
+              prefix,  only  the  matched  part is replaced.  Query is
+              preserved.   "redirect=<URI>"  responds with redirect to
+              <URI>,  and  "return"  responds  with empty body without
+              forwarding  request  to backend.  The status code of the
+              response  is  specified by "status=<CODE>".  The default
+              is 308 for redirect, and 200 for return.
+
+              <VALUE>   cannot   contain  ";".   Header  fields  which
+              determine  message  framing  cannot  be  changed.   This
+              option can be used several times.
+              Example: --rewrite-rule="path=/old/;rewrite-path=/new/"
   --request-header-field-buffer=<SIZE>
               Set maximum buffer size for incoming HTTP request header
               field list.  This is the sum of header name and value in
@@ -2770,6 +3174,17 @@ HTTP:
               "redirect-if-not-tls" parameter in --backend option.
               Default: )"
       << config->http.redirect_https_port << R"(
+  --cache-size=<SIZE>
+              Set  the  maximum number of bytes used by response cache
+              shared  by  all  workers.  Responses are cached only for
+              the backends with "cache" parameter in --backend option.
+              Default: )"
+      << util::utos_unit(config->http.cache.size) << R"(
+  --cache-max-object-size=<SIZE>
+              Set the maximum size of response body which is stored in
+              response cache.
+              Default: )"
+      << util::utos_unit(config->http.cache.max_object_size) << R"(
 
 API:
   --api-max-request-body=<SIZE>
@@ -2779,8 +3194,11 @@ API:
 
 DNS:
   --dns-cache-timeout=<DURATION>
-              Set duration that cached DNS results remain valid.  Note
-              that nghttpx caches the unsuccessful results as well.
+              Set  duration  that cached DNS results remain valid.  If
+              the  TTL of records is shorter, it is used instead.  The
+              results  are shared by all worker threads, and refreshed
+              before  they  expire  while  they are in use.  Note that
+              nghttpx caches the unsuccessful results as well.
               Default: )"
       << util::duration_str(config->dns.timeout.cache) << R"(
   --dns-lookup-timeout=<DURATION>
@@ -2841,7 +3259,9 @@ Process:
 
 Scripting:
   --mruby-file=<PATH>
-              Set mruby script file
+              Set  mruby  script  file.   The  file  may contain mruby
+              bytecode  compiled  by  mrbc,  which  is  loaded without
+              parsing the script.
   --ignore-per-pattern-mruby-error
               Ignore mruby compile error  for per-pattern mruby script
               file.  If error  occurred, it is treated as  if no mruby
@@ -2913,6 +3333,16 @@ int process_options(Config *config,
 
   auto &loggingconf = config->logging;
 
+  if (loggingconf.access.encoding == AccessLogEncoding::BINARY &&
+      loggingconf.access.syslog) {
+    LOG(FATAL) << "accesslog-encoding: binary cannot be used with "
+                  "accesslog-syslog";
+    return -1;
+  }
+
+  compile_log_format(config->balloc, loggingconf.access.format,
+                     loggingconf.access.encoding);
+
   if (loggingconf.access.syslog || loggingconf.error.syslog) {
     openlog("nghttpx", LOG_NDELAY | LOG_NOWAIT | LOG_PID,
             loggingconf.syslog_facility);
@@ -3036,6 +3466,18 @@ int process_options(Config *config,
     upstreamconf.worker_connections = std::numeric_limits<size_t>::max();
   }
 
+  auto &bufpoolconf = config->conn.buffer_pool;
+
+  if (bufpoolconf.high_watermark == 0) {
+    bufpoolconf.high_watermark = std::numeric_limits<size_t>::max();
+  }
+
+  if (bufpoolconf.low_watermark > bufpoolconf.high_watermark) {
+    LOG(FATAL) << "worker-buffer-pool-low-watermark must be less than or "
+                  "equal to worker-buffer-pool-high-watermark";
+    return -1;
+  }
+
   if (tls::upstream_tls_enabled(config->conn) &&
       (tlsconf.private_key_file.empty() || tlsconf.cert_file.empty())) {
     LOG(FATAL) << "TLS private key and certificate files are required.  "
@@ -3054,6 +3496,20 @@ int process_options(Config *config,
     }
   }
 
+  if (tlsconf.private_key_threads) {
+#ifdef HAVE_NEVERBLEED
+    LOG(WARN) << "tls-private-key-threads: private key operations are "
+                 "performed by neverbleed.  Disabled.";
+    tlsconf.private_key_threads = 0;
+#else  // !HAVE_NEVERBLEED
+    if (!private_key_offload_supported()) {
+      LOG(WARN) << "tls-private-key-threads: asynchronous private key "
+                   "operations are not supported by TLS library.  Disabled.";
+      tlsconf.private_key_threads = 0;
+    }
+#endif // !HAVE_NEVERBLEED
+  }
+
   if (configure_downstream_group(config, config->http2_proxy, false, tlsconf) !=
       0) {
     return -1;
@@ -3531,6 +3987,40 @@ int main(int argc, char **argv) {
         {SHRPX_OPT_TLS13_CLIENT_CIPHERS.c_str(), required_argument, &flag, 165},
         {SHRPX_OPT_NO_STRIP_INCOMING_EARLY_DATA.c_str(), no_argument, &flag,
          166},
+        {SHRPX_OPT_ACCESSLOG_ASYNC.c_str(), no_argument, &flag, 167},
+        {SHRPX_OPT_ACCESSLOG_ASYNC_BUFFER.c_str(), required_argument, &flag,
+         168},
+        {SHRPX_OPT_ACCESSLOG_ASYNC_OVERFLOW.c_str(), required_argument, &flag,
+         169},
+        {SHRPX_OPT_ACCESSLOG_ASYNC_SAMPLE_RATE.c_str(), required_argument,
+         &flag, 170},
+        {SHRPX_OPT_ACCESSLOG_ENCODING.c_str(), required_argument, &flag, 171},
+        {SHRPX_OPT_WORKER_BUFFER_POOL_HIGH_WATERMARK.c_str(), required_argument,
+         &flag, 172},
+        {SHRPX_OPT_WORKER_BUFFER_POOL_LOW_WATERMARK.c_str(), required_argument,
+         &flag, 173},
+        {SHRPX_OPT_TLS_DYN_REC_ADAPTIVE.c_str(), no_argument, &flag, 174},
+        {SHRPX_OPT_BACKEND_OUTLIER_FAILURE_RATE.c_str(), required_argument,
+         &flag, 175},
+        {SHRPX_OPT_BACKEND_OUTLIER_MIN_REQUESTS.c_str(), required_argument,
+         &flag, 176},
+        {SHRPX_OPT_BACKEND_OUTLIER_WINDOW.c_str(), required_argument, &flag,
+         177},
+        {SHRPX_OPT_BACKEND_OUTLIER_EJECTION_TIME.c_str(), required_argument,
+         &flag, 178},
+        {SHRPX_OPT_BACKEND_OUTLIER_MAX_EJECTION_TIME.c_str(),
+         required_argument, &flag, 179},
+        {SHRPX_OPT_BACKEND_OUTLIER_MAX_EJECTION_PERCENT.c_str(),
+         required_argument, &flag, 180},
+        {SHRPX_OPT_CACHE_SIZE.c_str(), required_argument, &flag, 181},
+        {SHRPX_OPT_CACHE_MAX_OBJECT_SIZE.c_str(), required_argument, &flag,
+         182},
+        {SHRPX_OPT_TLS_SESSION_CACHE_SIZE.c_str(), required_argument, &flag,
+         183},
+        {SHRPX_OPT_TLS_PRIVATE_KEY_THREADS.c_str(), required_argument, &flag,
+         184},
+        {SHRPX_OPT_REWRITE_RULE.c_str(), required_argument, &flag, 185},
+        {SHRPX_OPT_HTTP1_SPLICE.c_str(), no_argument, &flag, 186},
         {nullptr, 0, nullptr, 0}};
 
     int option_index = 0;
@@ -4324,6 +4814,103 @@ int main(int argc, char **argv) {
         cmdcfgs.emplace_back(SHRPX_OPT_NO_STRIP_INCOMING_EARLY_DATA,
                              StringRef::from_lit("yes"));
         break;
+      case 167:
+        // --accesslog-async
+        cmdcfgs.emplace_back(SHRPX_OPT_ACCESSLOG_ASYNC,
+                             StringRef::from_lit("yes"));
+        break;
+      case 168:
+        // --accesslog-async-buffer
+        cmdcfgs.emplace_back(SHRPX_OPT_ACCESSLOG_ASYNC_BUFFER,
+                             StringRef{optarg});
+        break;
+      case 169:
+        // --accesslog-async-overflow
+        cmdcfgs.emplace_back(SHRPX_OPT_ACCESSLOG_ASYNC_OVERFLOW,
+                             StringRef{optarg});
+        break;
+      case 170:
+        // --accesslog-async-sample-rate
+        cmdcfgs.emplace_back(SHRPX_OPT_ACCESSLOG_ASYNC_SAMPLE_RATE,
+                             StringRef{optarg});
+        break;
+      case 171:
+        // --accesslog-encoding
+        cmdcfgs.emplace_back(SHRPX_OPT_ACCESSLOG_ENCODING, StringRef{optarg});
+        break;
+      case 172:
+        // --worker-buffer-pool-high-watermark
+        cmdcfgs.emplace_back(SHRPX_OPT_WORKER_BUFFER_POOL_HIGH_WATERMARK,
+                             StringRef{optarg});
+        break;
+      case 173:
+        // --worker-buffer-pool-low-watermark
+        cmdcfgs.emplace_back(SHRPX_OPT_WORKER_BUFFER_POOL_LOW_WATERMARK,
+                             StringRef{optarg});
+        break;
+      case 174:
+        // --tls-dyn-rec-adaptive
+        cmdcfgs.emplace_back(SHRPX_OPT_TLS_DYN_REC_ADAPTIVE,
+                             StringRef::from_lit("yes"));
+        break;
+      case 175:
+        // --backend-outlier-failure-rate
+        cmdcfgs.emplace_back(SHRPX_OPT_BACKEND_OUTLIER_FAILURE_RATE,
+                             StringRef{optarg});
+        break;
+      case 176:
+        // --backend-outlier-min-requests
+        cmdcfgs.emplace_back(SHRPX_OPT_BACKEND_OUTLIER_MIN_REQUESTS,
+                             StringRef{optarg});
+        break;
+      case 177:
+        // --backend-outlier-window
+        cmdcfgs.emplace_back(SHRPX_OPT_BACKEND_OUTLIER_WINDOW,
+                             StringRef{optarg});
+        break;
+      case 178:
+        // --backend-outlier-ejection-time
+        cmdcfgs.emplace_back(SHRPX_OPT_BACKEND_OUTLIER_EJECTION_TIME,
+                             StringRef{optarg});
+        break;
+      case 179:
+        // --backend-outlier-max-ejection-time
+        cmdcfgs.emplace_back(SHRPX_OPT_BACKEND_OUTLIER_MAX_EJECTION_TIME,
+                             StringRef{optarg});
+        break;
+      case 180:
+        // --backend-outlier-max-ejection-percent
+        cmdcfgs.emplace_back(SHRPX_OPT_BACKEND_OUTLIER_MAX_EJECTION_PERCENT,
+                             StringRef{optarg});
+        break;
+      case 181:
+        // --cache-size
+        cmdcfgs.emplace_back(SHRPX_OPT_CACHE_SIZE, StringRef{optarg});
+        break;
+      case 182:
+        // --cache-max-object-size
+        cmdcfgs.emplace_back(SHRPX_OPT_CACHE_MAX_OBJECT_SIZE,
+                             StringRef{optarg});
+        break;
+      case 183:
+        // --tls-session-cache-size
+        cmdcfgs.emplace_back(SHRPX_OPT_TLS_SESSION_CACHE_SIZE,
+                             StringRef{optarg});
+        break;
+      case 184:
+        // --tls-private-key-threads
+        cmdcfgs.emplace_back(SHRPX_OPT_TLS_PRIVATE_KEY_THREADS,
+                             StringRef{optarg});
+        break;
+      case 185:
+        // --rewrite-rule
+        cmdcfgs.emplace_back(SHRPX_OPT_REWRITE_RULE, StringRef{optarg});
+        break;
+      case 186:
+        // --http1-splice
+        cmdcfgs.emplace_back(SHRPX_OPT_HTTP1_SPLICE,
+                             StringRef::from_lit("yes"));
+        break;
       default:
         break;
       }
@@ -0,0 +1,404 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_accesslog_writer.h"
+
+#ifdef HAVE_SYSLOG_H
+#  include <syslog.h>
+#endif // HAVE_SYSLOG_H
+#ifdef HAVE_UNISTD_H
+#  include <unistd.h>
+#endif // HAVE_UNISTD_H
+#include <limits.h>
+
+#include <cerrno>
+#include <array>
+#include <thread>
+#include <chrono>
+
+#include "shrpx_log.h"
+#include "shrpx_log_config.h"
+#include "util.h"
+#include "template.h"
+
+using namespace nghttp2;
+
+namespace shrpx {
+
+namespace {
+// The interval that writer thread wakes up to write queued records
+// even if nobody notifies it.
+constexpr auto ACCESSLOG_FLUSH_INTERVAL = std::chrono::milliseconds(100);
+} // namespace
+
+namespace {
+size_t round_up_pow2(size_t n) {
+  size_t m = 1;
+  for (; m < n; m <<= 1)
+    ;
+  return m;
+}
+} // namespace
+
+AccessLogRing::AccessLogRing(AccessLogWriter *writer, size_t capacity,
+                             AccessLogOverflow overflow, size_t sample_rate)
+    : writer_(writer),
+      capacity_(round_up_pow2(std::max(capacity, static_cast<size_t>(4_k)))),
+      sample_count_(0),
+      sample_rate_(std::max(sample_rate, static_cast<size_t>(1))),
+      overflow_(overflow),
+      num_dropped_(0),
+      head_(0),
+      tail_(0) {
+  buf_ = std::make_unique<uint8_t[]>(capacity_);
+}
+
+bool AccessLogRing::push(const uint8_t *data, size_t len) {
+  auto head = head_.load(std::memory_order_relaxed);
+  auto used = head - tail_.load(std::memory_order_acquire);
+
+  if (len > capacity_) {
+    num_dropped_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  // When sampling, we start discarding records when the buffer is
+  // half full.
+  if (overflow_ == AccessLogOverflow::SAMPLE && used >= capacity_ / 2 &&
+      ++sample_count_ % sample_rate_ != 0) {
+    num_dropped_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  while (capacity_ - used < len) {
+    writer_->notify();
+
+    if (overflow_ != AccessLogOverflow::BLOCK) {
+      num_dropped_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+
+    std::this_thread::yield();
+
+    used = head - tail_.load(std::memory_order_acquire);
+  }
+
+  auto pos = head & (capacity_ - 1);
+  auto n = std::min(len, capacity_ - pos);
+  std::copy_n(data, n, buf_.get() + pos);
+  std::copy_n(data + n, len - n, buf_.get());
+
+  head_.store(head + len, std::memory_order_release);
+
+  // Wake up writer early if the buffer becomes half full.
+  if (used < capacity_ / 2 && used + len >= capacity_ / 2) {
+    writer_->notify();
+  }
+
+  return true;
+}
+
+size_t AccessLogRing::riovec(struct iovec *iov, size_t iovcnt) const {
+  auto tail = tail_.load(std::memory_order_relaxed);
+  auto len = head_.load(std::memory_order_acquire) - tail;
+
+  if (len == 0 || iovcnt == 0) {
+    return 0;
+  }
+
+  auto pos = tail & (capacity_ - 1);
+  auto n = std::min(len, capacity_ - pos);
+
+  iov[0].iov_base = buf_.get() + pos;
+  iov[0].iov_len = n;
+
+  if (n == len || iovcnt == 1) {
+    return 1;
+  }
+
+  iov[1].iov_base = buf_.get();
+  iov[1].iov_len = len - n;
+
+  return 2;
+}
+
+void AccessLogRing::drain(size_t n) {
+  tail_.store(tail_.load(std::memory_order_relaxed) + n,
+              std::memory_order_release);
+}
+
+size_t AccessLogRing::rleft() const {
+  return head_.load(std::memory_order_acquire) -
+         tail_.load(std::memory_order_relaxed);
+}
+
+uint64_t AccessLogRing::get_num_dropped() const {
+  return num_dropped_.load(std::memory_order_relaxed);
+}
+
+size_t AccessLogRing::get_capacity() const { return capacity_; }
+
+AccessLogWriter::AccessLogWriter()
+    : num_dropped_reported_(0), reopen_(false), stop_(false) {}
+
+AccessLogWriter::~AccessLogWriter() { stop(); }
+
+AccessLogRing *AccessLogWriter::add_ring() {
+  auto &asyncconf = get_config()->logging.access.async;
+
+  rings_.push_back(std::make_unique<AccessLogRing>(
+      this, asyncconf.buffer_size, asyncconf.overflow, asyncconf.sample_rate));
+
+  return rings_.back().get();
+}
+
+void AccessLogWriter::run_async() {
+#ifndef NOTHREADS
+  fut_ = std::async(std::launch::async, [this] { run(); });
+#endif // !NOTHREADS
+}
+
+void AccessLogWriter::notify() {
+  // We do not take m_ here in order not to contend with the other
+  // workers.  A lost wakeup only delays writing until the next
+  // ACCESSLOG_FLUSH_INTERVAL.
+  cv_.notify_one();
+}
+
+void AccessLogWriter::reopen_log_files() {
+  {
+    std::lock_guard<std::mutex> g(m_);
+    reopen_ = true;
+  }
+
+  cv_.notify_one();
+}
+
+void AccessLogWriter::stop() {
+#ifndef NOTHREADS
+  if (!fut_.valid()) {
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> g(m_);
+    stop_ = true;
+  }
+
+  cv_.notify_one();
+
+  fut_.get();
+#endif // !NOTHREADS
+}
+
+void AccessLogWriter::run() {
+  auto &loggingconf = get_config()->logging;
+
+  // This opens access log file for this thread.
+  (void)::shrpx::reopen_log_files(loggingconf);
+
+  std::unique_lock<std::mutex> lk(m_);
+
+  for (;;) {
+    if (!stop_ && !reopen_) {
+      cv_.wait_for(lk, ACCESSLOG_FLUSH_INTERVAL);
+    }
+
+    auto stop = stop_;
+    auto reopen = reopen_;
+    reopen_ = false;
+
+    lk.unlock();
+
+    if (loggingconf.access.syslog) {
+      flush_syslog();
+    } else {
+      flush();
+    }
+
+    report_dropped();
+
+    if (reopen) {
+      LOG(NOTICE) << "Reopening log files: access log writer";
+
+      (void)::shrpx::reopen_log_files(loggingconf);
+    }
+
+    if (stop) {
+      break;
+    }
+
+    lk.lock();
+  }
+
+  delete_log_config();
+}
+
+void AccessLogWriter::flush() {
+  auto lgconf = log_config();
+
+  // Each ring gives us at most 2 buffers.
+  constexpr size_t MAX_IOVCNT = std::min(IOV_MAX, 1024);
+  std::array<struct iovec, MAX_IOVCNT> iov;
+  std::array<std::pair<AccessLogRing *, size_t>, MAX_IOVCNT / 2> pending;
+
+  auto it = std::begin(rings_);
+
+  while (it != std::end(rings_)) {
+    size_t iovcnt = 0;
+    size_t npending = 0;
+
+    // Gather records from as many rings as possible, so that they
+    // are written in a single writev call.
+    for (; it != std::end(rings_) && iovcnt + 2 <= iov.size(); ++it) {
+      auto &ring = *it;
+      auto n = ring->riovec(iov.data() + iovcnt, 2);
+      if (n == 0) {
+        continue;
+      }
+
+      size_t len = 0;
+      for (size_t i = iovcnt; i < iovcnt + n; ++i) {
+        len += iov[i].iov_len;
+      }
+
+      iovcnt += n;
+      pending[npending++] = {ring.get(), len};
+    }
+
+    if (iovcnt == 0) {
+      return;
+    }
+
+    auto iovp = iov.data();
+    auto pendp = pending.data();
+
+    while (iovcnt) {
+      ssize_t nwrite;
+      while ((nwrite = writev(lgconf->accesslog_fd, iovp, iovcnt)) == -1 &&
+             errno == EINTR)
+        ;
+
+      if (nwrite == -1) {
+        // There is nothing we can do except for discarding records.
+        // Otherwise we keep retrying forever.
+        for (auto p = pendp; p != pending.data() + npending; ++p) {
+          (*p).first->drain((*p).second);
+        }
+
+        break;
+      }
+
+      // Consume written bytes from rings, and adjust iovecs for the
+      // remaining data in case of partial write.
+      auto n = static_cast<size_t>(nwrite);
+      for (; n;) {
+        auto m = std::min(n, (*pendp).second);
+        (*pendp).first->drain(m);
+        (*pendp).second -= m;
+        if ((*pendp).second == 0) {
+          ++pendp;
+        }
+        n -= m;
+      }
+
+      n = static_cast<size_t>(nwrite);
+      for (; iovcnt && n >= iovp->iov_len; ++iovp, --iovcnt) {
+        n -= iovp->iov_len;
+      }
+
+      if (iovcnt) {
+        iovp->iov_base = static_cast<uint8_t *>(iovp->iov_base) + n;
+        iovp->iov_len -= n;
+      }
+    }
+  }
+}
+
+void AccessLogWriter::flush_syslog() {
+  // Each record is terminated by '\n'.  A record may be split into 2
+  // buffers when it wraps around the end of ring.  In that case, we
+  // reassemble it in |line|.
+  std::array<char, 4_k> line;
+
+  for (auto &ring : rings_) {
+    std::array<struct iovec, 2> iov;
+    auto iovcnt = ring->riovec(iov.data(), iov.size());
+    size_t linelen = 0;
+    size_t nread = 0;
+
+    for (size_t i = 0; i < iovcnt; ++i) {
+      auto first = static_cast<const char *>(iov[i].iov_base);
+      auto last = first + iov[i].iov_len;
+
+      for (;;) {
+        auto eol = std::find(first, last, '\n');
+        if (eol == last) {
+          auto n = std::min(static_cast<size_t>(last - first),
+                            line.size() - linelen);
+          std::copy_n(first, n, std::begin(line) + linelen);
+          linelen += n;
+          nread += last - first;
+          break;
+        }
+
+        if (linelen) {
+          auto n = std::min(static_cast<size_t>(eol - first),
+                            line.size() - linelen);
+          std::copy_n(first, n, std::begin(line) + linelen);
+          linelen += n;
+          syslog(LOG_INFO, "%.*s", static_cast<int>(linelen), line.data());
+          linelen = 0;
+        } else {
+          syslog(LOG_INFO, "%.*s", static_cast<int>(eol - first), first);
+        }
+
+        nread += eol + 1 - first;
+        first = eol + 1;
+      }
+    }
+
+    ring->drain(nread);
+  }
+}
+
+void AccessLogWriter::report_dropped() {
+  uint64_t num_dropped = 0;
+
+  for (auto &ring : rings_) {
+    num_dropped += ring->get_num_dropped();
+  }
+
+  if (num_dropped == num_dropped_reported_) {
+    return;
+  }
+
+  LOG(WARN) << "Access log buffer overflow: "
+            << num_dropped - num_dropped_reported_
+            << " record(s) discarded; total " << num_dropped;
+
+  num_dropped_reported_ = num_dropped;
+}
+
+} // namespace shrpx
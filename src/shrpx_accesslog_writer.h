@@ -0,0 +1,147 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHRPX_ACCESSLOG_WRITER_H
+#define SHRPX_ACCESSLOG_WRITER_H
+
+#include "shrpx.h"
+
+#include <sys/uio.h>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#ifndef NOTHREADS
+#  include <future>
+#endif // NOTHREADS
+
+#include "shrpx_config.h"
+
+namespace shrpx {
+
+class AccessLogWriter;
+
+// AccessLogRing is a single producer, single consumer lock-free ring
+// buffer which stores formatted access log records.  The producer is
+// a worker thread, and the consumer is the writer thread run by
+// AccessLogWriter.  A record is made visible to the consumer only
+// after it is entirely copied, so that the consumer always sees the
+// complete records.
+class AccessLogRing {
+public:
+  // |capacity| is rounded up to the power of 2.
+  AccessLogRing(AccessLogWriter *writer, size_t capacity,
+                AccessLogOverflow overflow, size_t sample_rate);
+
+  AccessLogRing(const AccessLogRing &) = delete;
+  AccessLogRing &operator=(const AccessLogRing &) = delete;
+
+  // Queues a record of length |len| pointed by |data|.  This function
+  // is called by the producer.  If the buffer has no space left,
+  // the behaviour is determined by AccessLogOverflow given in
+  // constructor.  It returns true if the record has been queued, or
+  // false if it has been discarded.
+  bool push(const uint8_t *data, size_t len);
+
+  // Fills at most |iovcnt| elements of |iov| with the buffers which
+  // contain queued data, and returns the number of elements filled.
+  // This function is called by the consumer.
+  size_t riovec(struct iovec *iov, size_t iovcnt) const;
+  // Consumes |n| bytes from the buffer.  This function is called by
+  // the consumer.
+  void drain(size_t n);
+  // Returns the number of bytes queued.
+  size_t rleft() const;
+  // Returns the number of records discarded so far.
+  uint64_t get_num_dropped() const;
+  size_t get_capacity() const;
+
+private:
+  std::unique_ptr<uint8_t[]> buf_;
+  AccessLogWriter *writer_;
+  size_t capacity_;
+  // The number of records presented while sampling is in effect.
+  // Only accessed by the producer.
+  size_t sample_count_;
+  size_t sample_rate_;
+  AccessLogOverflow overflow_;
+  // The number of records discarded.  Only written by the producer.
+  std::atomic<uint64_t> num_dropped_;
+  // The position of next write.  Only written by the producer.
+  std::atomic<size_t> head_;
+  // head_ and tail_ are written by the different threads.  Keep them
+  // in the separate cache lines.
+  uint8_t pad_[64];
+  // The position of next read.  Only written by the consumer.
+  std::atomic<size_t> tail_;
+};
+
+// AccessLogWriter runs a dedicated thread which drains
+// AccessLogRings of all workers in a worker process and writes their
+// records to access log file (or syslog).  This keeps slow disk or
+// stalled pipe from blocking the event loop of worker threads.
+class AccessLogWriter {
+public:
+  AccessLogWriter();
+  ~AccessLogWriter();
+
+  // Creates new AccessLogRing for a worker.  This function must be
+  // called before run_async().
+  AccessLogRing *add_ring();
+  void run_async();
+  // Wakes up writer thread.  This function may be called from any
+  // thread.
+  void notify();
+  // Makes writer thread reopen log files after writing all records
+  // queued so far.
+  void reopen_log_files();
+  // Writes all queued records, and stops writer thread.  The
+  // producers must not push records after this call.
+  void stop();
+
+private:
+  void run();
+  // Writes all queued records in rings_.
+  void flush();
+  void flush_syslog();
+  void report_dropped();
+
+  std::vector<std::unique_ptr<AccessLogRing>> rings_;
+#ifndef NOTHREADS
+  std::future<void> fut_;
+#endif // NOTHREADS
+  std::mutex m_;
+  std::condition_variable cv_;
+  // The total number of records dropped which has been reported to
+  // error log.
+  uint64_t num_dropped_reported_;
+  bool reopen_;
+  bool stop_;
+};
+
+} // namespace shrpx
+
+#endif // SHRPX_ACCESSLOG_WRITER_H
@@ -0,0 +1,126 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_accesslog_writer_test.h"
+
+#include <string>
+
+#include <CUnit/CUnit.h>
+
+#include "shrpx_accesslog_writer.h"
+#include "shrpx_log.h"
+#include "template.h"
+
+using namespace nghttp2;
+
+namespace shrpx {
+
+void test_shrpx_accesslog_ring_push(void) {
+  AccessLogWriter writer;
+  AccessLogRing ring(&writer, 3000, AccessLogOverflow::DROP, 1);
+  std::array<struct iovec, 2> iov;
+
+  CU_ASSERT(4_k == ring.get_capacity());
+
+  auto a = std::string(1000, 'a');
+  for (size_t i = 0; i < 4; ++i) {
+    CU_ASSERT(ring.push(reinterpret_cast<const uint8_t *>(a.c_str()),
+                        a.size()));
+  }
+
+  CU_ASSERT(4000 == ring.rleft());
+
+  // No space left.
+  CU_ASSERT(!ring.push(reinterpret_cast<const uint8_t *>(a.c_str()),
+                       a.size()));
+  CU_ASSERT(1 == ring.get_num_dropped());
+  CU_ASSERT(4000 == ring.rleft());
+
+  CU_ASSERT(1 == ring.riovec(iov.data(), iov.size()));
+  CU_ASSERT(4000 == iov[0].iov_len);
+
+  ring.drain(3000);
+
+  CU_ASSERT(1000 == ring.rleft());
+
+  // This record wraps around the end of buffer.
+  auto b = std::string(2000, 'b');
+  CU_ASSERT(ring.push(reinterpret_cast<const uint8_t *>(b.c_str()),
+                      b.size()));
+
+  CU_ASSERT(3000 == ring.rleft());
+  CU_ASSERT(2 == ring.riovec(iov.data(), iov.size()));
+  CU_ASSERT(1096 == iov[0].iov_len);
+  CU_ASSERT(1904 == iov[1].iov_len);
+
+  auto p = static_cast<const uint8_t *>(iov[0].iov_base);
+  CU_ASSERT('a' == p[999]);
+  CU_ASSERT('b' == p[1000]);
+  CU_ASSERT('b' == p[1095]);
+  p = static_cast<const uint8_t *>(iov[1].iov_base);
+  CU_ASSERT('b' == p[0]);
+  CU_ASSERT('b' == p[1903]);
+
+  // Record which is larger than the buffer is always discarded.
+  auto c = std::string(5000, 'c');
+  CU_ASSERT(!ring.push(reinterpret_cast<const uint8_t *>(c.c_str()),
+                       c.size()));
+  CU_ASSERT(2 == ring.get_num_dropped());
+
+  ring.drain(3000);
+
+  CU_ASSERT(0 == ring.rleft());
+  CU_ASSERT(0 == ring.riovec(iov.data(), iov.size()));
+}
+
+void test_shrpx_accesslog_ring_sample(void) {
+  AccessLogWriter writer;
+  AccessLogRing ring(&writer, 4_k, AccessLogOverflow::SAMPLE, 2);
+
+  auto a = std::string(2048, 'a');
+  CU_ASSERT(ring.push(reinterpret_cast<const uint8_t *>(a.c_str()),
+                      a.size()));
+
+  // Buffer is half full.  Only 1 out of 2 records is kept.
+  auto b = std::string(10, 'b');
+  for (size_t i = 0; i < 4; ++i) {
+    CU_ASSERT((i % 2 == 1) ==
+              ring.push(reinterpret_cast<const uint8_t *>(b.c_str()),
+                        b.size()));
+  }
+
+  CU_ASSERT(2048 + 20 == ring.rleft());
+  CU_ASSERT(2 == ring.get_num_dropped());
+
+  // The record which does not fit in the buffer is discarded even if
+  // it is chosen by sampling.
+  auto c = std::string(2040, 'c');
+  CU_ASSERT(!ring.push(reinterpret_cast<const uint8_t *>(c.c_str()),
+                       c.size()));
+  CU_ASSERT(!ring.push(reinterpret_cast<const uint8_t *>(c.c_str()),
+                       c.size()));
+  CU_ASSERT(4 == ring.get_num_dropped());
+}
+
+} // namespace shrpx
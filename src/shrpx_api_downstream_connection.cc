@@ -35,13 +35,14 @@
 #include "shrpx_worker.h"
 #include "shrpx_connection_handler.h"
 #include "shrpx_log.h"
+#include "shrpx_metrics.h"
 
 namespace shrpx {
 
 namespace {
 // List of API endpoints
-const std::array<APIEndpoint, 2> &apis() {
-  static const auto apis = new std::array<APIEndpoint, 2>{
+const std::array<APIEndpoint, 3> &apis() {
+  static const auto apis = new std::array<APIEndpoint, 3>{
       APIEndpoint{
           StringRef::from_lit("/api/v1beta1/backendconfig"),
           true,
@@ -54,6 +55,12 @@ const std::array<APIEndpoint, 2> &apis() {
           (1 << API_METHOD_GET),
           &APIDownstreamConnection::handle_configrevision,
       },
+      APIEndpoint{
+          StringRef::from_lit("/api/v1beta1/metrics"),
+          false,
+          (1 << API_METHOD_GET),
+          &APIDownstreamConnection::handle_metrics,
+      },
   };
 
   return *apis;
@@ -167,6 +174,15 @@ int APIDownstreamConnection::send_reply(unsigned int http_status,
 namespace {
 const APIEndpoint *lookup_api(const StringRef &path) {
   switch (path.size()) {
+  case 20:
+    switch (path[19]) {
+    case 's':
+      if (util::streq_l("/api/v1beta1/metric", std::begin(path), 19)) {
+        return &apis()[2];
+      }
+      break;
+    }
+    break;
   case 26:
     switch (path[25]) {
     case 'g':
@@ -366,6 +382,7 @@ int APIDownstreamConnection::handle_backendconfig() {
   auto &src = config->conn.downstream;
 
   downstreamconf->timeout = src->timeout;
+  downstreamconf->outlier = src->outlier;
   downstreamconf->connections_per_host = src->connections_per_host;
   downstreamconf->connections_per_frontend = src->connections_per_frontend;
   downstreamconf->request_buffer_size = src->request_buffer_size;
@@ -451,6 +468,34 @@ int APIDownstreamConnection::handle_configrevision() {
   return 0;
 }
 
+int APIDownstreamConnection::handle_metrics() {
+  shutdown_read_ = true;
+
+  auto upstream = downstream_->get_upstream();
+  auto &resp = downstream_->response();
+  auto &balloc = downstream_->get_block_allocator();
+
+  // Unlike the other APIs, the response body is Prometheus text
+  // exposition format, rather than JSON.
+  auto data = make_string_ref(
+      balloc, StringRef{format_metrics(worker_->get_connection_handler())});
+
+  resp.http_status = 200;
+
+  resp.fs.add_header_token(StringRef::from_lit("content-type"),
+                           StringRef::from_lit("text/plain; version=0.0.4"),
+                           false, http2::HD_CONTENT_TYPE);
+  resp.fs.add_header_token(StringRef::from_lit("content-length"),
+                           util::make_string_ref_uint(balloc, data.size()),
+                           false, http2::HD_CONTENT_LENGTH);
+
+  if (upstream->send_reply(downstream_, data.byte(), data.size()) != 0) {
+    return -1;
+  }
+
+  return 0;
+}
+
 void APIDownstreamConnection::pause_read(IOCtrlReason reason) {}
 
 int APIDownstreamConnection::resume_read(IOCtrlReason reason, size_t consumed) {
@@ -98,6 +98,8 @@ public:
   int handle_backendconfig();
   // Handles configrevision API request.
   int handle_configrevision();
+  // Handles metrics API request.
+  int handle_metrics();
 
 private:
   Worker *worker_;
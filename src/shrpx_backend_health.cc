@@ -0,0 +1,76 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_backend_health.h"
+
+#include <chrono>
+
+#include "shrpx_log.h"
+
+namespace shrpx {
+
+int64_t backend_health_now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+std::shared_ptr<BackendHealth>
+BackendHealthTable::get(const StringRef &hostport, const StringRef &sni,
+                        Proto proto, bool tls) {
+  std::string key;
+  key.reserve(hostport.size() + sni.size() + 8);
+  key += static_cast<char>('0' + static_cast<int>(proto));
+  if (tls) {
+    key += "tls ";
+    key.append(std::begin(sni), std::end(sni));
+  }
+  key += ' ';
+  key.append(std::begin(hostport), std::end(hostport));
+
+  std::lock_guard<std::mutex> g(mu_);
+
+  // Forget the backends which are no longer used.  This runs only
+  // when backend configuration is loaded.
+  for (auto it = std::begin(entries_); it != std::end(entries_);) {
+    if ((*it).second.expired()) {
+      it = entries_.erase(it);
+      continue;
+    }
+    ++it;
+  }
+
+  auto &ent = entries_[key];
+  auto health = ent.lock();
+  if (health) {
+    return health;
+  }
+
+  health = std::make_shared<BackendHealth>();
+  ent = health;
+
+  return health;
+}
+
+} // namespace shrpx
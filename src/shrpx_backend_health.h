@@ -0,0 +1,78 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHRPX_BACKEND_HEALTH_H
+#define SHRPX_BACKEND_HEALTH_H
+
+#include "shrpx.h"
+
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "shrpx_config.h"
+
+namespace shrpx {
+
+// BackendHealth is the connection health of a backend address shared
+// by all workers.  Each worker reads it without locking before
+// connecting to the backend, so that a failure seen by one worker
+// blocks the backend for all of them.
+struct BackendHealth {
+  // The time point in nanoseconds of steady clock until which
+  // connection attempts are blocked.  0 if not blocked.
+  std::atomic<int64_t> blocked_until{0};
+  // The number of consecutive connection failures among all workers.
+  std::atomic<size_t> fail_count{0};
+  // true if the backend is considered offline.
+  std::atomic<bool> offline{false};
+  // true if a worker is running liveness check for the backend.
+  std::atomic<bool> probing{false};
+};
+
+// Returns the current time of steady clock in nanoseconds.
+int64_t backend_health_now();
+
+// BackendHealthTable maps backend addresses to their BackendHealth.
+// It is shared by all workers in a process.
+class BackendHealthTable {
+public:
+  // Returns BackendHealth for the backend address |hostport| which
+  // is connected by |proto|.  If |tls| is true, |sni| is the TLS SNI
+  // sent to the backend.  The same object is returned as long as any
+  // one holds it.  This function is thread-safe.
+  std::shared_ptr<BackendHealth> get(const StringRef &hostport,
+                                     const StringRef &sni, Proto proto,
+                                     bool tls);
+
+private:
+  std::mutex mu_;
+  std::unordered_map<std::string, std::weak_ptr<BackendHealth>> entries_;
+};
+
+} // namespace shrpx
+
+#endif // SHRPX_BACKEND_HEALTH_H
@@ -0,0 +1,125 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_backend_health_test.h"
+
+#include <random>
+
+#include <CUnit/CUnit.h>
+
+#include "shrpx_backend_health.h"
+#include "shrpx_connect_blocker.h"
+#include "shrpx_log.h"
+
+namespace shrpx {
+
+void test_shrpx_backend_health_table(void) {
+  BackendHealthTable table;
+
+  auto a = table.get(StringRef::from_lit("127.0.0.1:3000"), StringRef{},
+                     Proto::HTTP1, false);
+  auto b = table.get(StringRef::from_lit("127.0.0.1:3000"), StringRef{},
+                     Proto::HTTP1, false);
+
+  CU_ASSERT(a == b);
+
+  CU_ASSERT(a != table.get(StringRef::from_lit("127.0.0.1:3001"), StringRef{},
+                           Proto::HTTP1, false));
+  CU_ASSERT(a != table.get(StringRef::from_lit("127.0.0.1:3000"), StringRef{},
+                           Proto::HTTP2, false));
+  CU_ASSERT(a != table.get(StringRef::from_lit("127.0.0.1:3000"),
+                           StringRef::from_lit("example.com"), Proto::HTTP1,
+                           true));
+
+  // An entry nobody holds is created again.
+  a->offline = true;
+  a.reset();
+  b.reset();
+
+  a = table.get(StringRef::from_lit("127.0.0.1:3000"), StringRef{},
+                Proto::HTTP1, false);
+
+  CU_ASSERT(!a->offline);
+}
+
+void test_shrpx_backend_health_shared_blocker(void) {
+  std::mt19937 gen(0);
+  auto loop = EV_DEFAULT;
+  BackendHealthTable table;
+
+  auto health = table.get(StringRef::from_lit("127.0.0.1:3000"), StringRef{},
+                          Proto::HTTP1, false);
+
+  auto a = std::make_unique<ConnectBlocker>(gen, loop, nullptr, nullptr,
+                                            health);
+  auto b = std::make_unique<ConnectBlocker>(gen, loop, nullptr, nullptr,
+                                            health);
+
+  CU_ASSERT(!a->blocked());
+  CU_ASSERT(!b->blocked());
+
+  // Offline state set by one blocker is seen by the other.
+  a->offline();
+
+  CU_ASSERT(a->in_offline());
+  CU_ASSERT(b->in_offline());
+  CU_ASSERT(b->blocked());
+
+  // Only one of them checks liveness.
+  CU_ASSERT(a->acquire_probe());
+  CU_ASSERT(!a->acquire_probe());
+  CU_ASSERT(!b->acquire_probe());
+
+  a->online();
+
+  CU_ASSERT(!a->in_offline());
+  CU_ASSERT(!b->in_offline());
+  CU_ASSERT(!health->probing);
+
+  // If the blocker which checks liveness goes away, the peer is no
+  // longer considered offline.
+  b->offline();
+
+  CU_ASSERT(b->acquire_probe());
+  CU_ASSERT(a->in_offline());
+
+  b.reset();
+
+  CU_ASSERT(!a->in_offline());
+  CU_ASSERT(a->acquire_probe());
+
+  // Backoff started by another worker is seen through
+  // blocked_until.
+  a->online();
+  health->blocked_until = backend_health_now() + 60000000000LL;
+
+  auto c = std::make_unique<ConnectBlocker>(gen, loop, nullptr, nullptr,
+                                            health);
+
+  CU_ASSERT(c->blocked());
+
+  health->blocked_until = 0;
+}
+
+} // namespace shrpx
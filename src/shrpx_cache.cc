@@ -0,0 +1,966 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_cache.h"
+
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+
+#include "shrpx_downstream.h"
+#include "shrpx_upstream.h"
+#include "shrpx_client_handler.h"
+#include "shrpx_log.h"
+#include "util.h"
+
+namespace shrpx {
+
+namespace {
+// Returns |s| without leading and trailing white spaces.
+StringRef trim(const StringRef &s) {
+  auto first = std::begin(s);
+  auto last = std::end(s);
+
+  for (; first != last && (*first == ' ' || *first == '\t'); ++first)
+    ;
+  for (; first != last && (*(last - 1) == ' ' || *(last - 1) == '\t'); --last)
+    ;
+
+  return StringRef{first, last};
+}
+} // namespace
+
+namespace {
+// Parses the value of delta-seconds |s|.  Invalid value is treated as
+// 0, so that the response is considered stale.
+int64_t parse_delta_seconds(const StringRef &s) {
+  auto n = util::parse_uint(s);
+  if (n == -1) {
+    return 0;
+  }
+
+  return n;
+}
+} // namespace
+
+void parse_cache_control(CacheControl &cc, const StringRef &value) {
+  for (auto &d : util::split_str(value, ',')) {
+    d = trim(d);
+
+    auto eq = std::find(std::begin(d), std::end(d), '=');
+    auto name = trim(StringRef{std::begin(d), eq});
+    auto arg = eq == std::end(d) ? StringRef{}
+                                 : trim(StringRef{eq + 1, std::end(d)});
+
+    if (arg.size() >= 2 && arg[0] == '"' && arg[arg.size() - 1] == '"') {
+      arg = StringRef{std::begin(arg) + 1, std::end(arg) - 1};
+    }
+
+    // no-cache and private with field names are treated as the ones
+    // without them, which is more restrictive.
+    if (util::strieq_l("max-age", name)) {
+      cc.max_age = parse_delta_seconds(arg);
+    } else if (util::strieq_l("s-maxage", name)) {
+      cc.s_maxage = parse_delta_seconds(arg);
+    } else if (util::strieq_l("min-fresh", name)) {
+      cc.min_fresh = parse_delta_seconds(arg);
+    } else if (util::strieq_l("no-store", name)) {
+      cc.no_store = true;
+    } else if (util::strieq_l("no-cache", name)) {
+      cc.no_cache = true;
+    } else if (util::strieq_l("private", name)) {
+      cc.private_ = true;
+    } else if (util::strieq_l("no-transform", name)) {
+      cc.no_transform = true;
+    }
+  }
+}
+
+CacheBody::CacheBody() : length(0) {}
+
+void CacheBody::append(const uint8_t *data, size_t len) {
+  while (len) {
+    auto offset = length % CACHE_BODY_CHUNK_SIZE;
+    if (offset == 0) {
+      chunks.push_back(std::make_unique<uint8_t[]>(CACHE_BODY_CHUNK_SIZE));
+    }
+
+    auto n = std::min(len, CACHE_BODY_CHUNK_SIZE - offset);
+    memcpy(chunks.back().get() + offset, data, n);
+
+    data += n;
+    len -= n;
+    length += n;
+  }
+}
+
+CacheEntry::CacheEntry()
+    : balloc(1024, 1024),
+      response_time(0.),
+      initial_age(0.),
+      freshness_lifetime(0.),
+      size(0),
+      http_status(0) {}
+
+ev_tstamp CacheEntry::age(ev_tstamp now) const {
+  return initial_age + std::max(0., now - response_time);
+}
+
+bool CacheEntry::fresh(ev_tstamp now) const {
+  return freshness_lifetime > age(now);
+}
+
+std::string cache_create_key(const Request &req) {
+  if (req.regular_connect_method() || req.path.empty()) {
+    return "";
+  }
+
+  std::string key;
+
+  key += req.scheme;
+  key += "://";
+  key += req.authority;
+  key += req.path;
+
+  return key;
+}
+
+bool cache_request_cacheable(const Request &req) {
+  if ((req.method != HTTP_GET && req.method != HTTP_HEAD) ||
+      req.upgrade_request || req.http2_upgrade_seen ||
+      req.connect_proto != ConnectProto::NONE) {
+    return false;
+  }
+
+  if (req.http_major == 2) {
+    if (req.http2_expect_body) {
+      return false;
+    }
+  } else if (req.fs.content_length > 0 ||
+             req.fs.header(http2::HD_TRANSFER_ENCODING)) {
+    return false;
+  }
+
+  CacheControl cc;
+
+  for (auto &kv : req.fs.headers()) {
+    // A shared cache must not serve the response to a request with
+    // Authorization unless the response explicitly allows it.  We
+    // do not bother checking it.
+    if (util::streq_l("authorization", kv.name) ||
+        util::streq_l("range", kv.name)) {
+      return false;
+    }
+
+    if (kv.token == http2::HD_CACHE_CONTROL) {
+      parse_cache_control(cc, kv.value);
+    }
+  }
+
+  return !cc.no_store;
+}
+
+bool cache_request_requires_validation(const Request &req,
+                                       const CacheEntry &entry,
+                                       ev_tstamp now) {
+  CacheControl cc;
+  auto cc_seen = false;
+
+  for (auto &kv : req.fs.headers()) {
+    if (kv.token == http2::HD_CACHE_CONTROL) {
+      parse_cache_control(cc, kv.value);
+      cc_seen = true;
+    }
+  }
+
+  if (cc.no_cache || cc.max_age == 0) {
+    return true;
+  }
+
+  auto age = entry.age(now);
+
+  // The client does not accept the response older than max-age, or
+  // the one which will be stale within min-fresh (RFC 9111, section
+  // 5.2.1).
+  if ((cc.max_age != -1 && age > cc.max_age) ||
+      (cc.min_fresh != -1 &&
+       entry.freshness_lifetime - age < cc.min_fresh)) {
+    return true;
+  }
+
+  if (cc_seen) {
+    return false;
+  }
+
+  // Pragma is only honored if there is no Cache-Control.
+  auto pragma = req.fs.header(StringRef::from_lit("pragma"));
+
+  return pragma &&
+         util::strifind(pragma->value, StringRef::from_lit("no-cache"));
+}
+
+bool cache_request_conditional(const Request &req) {
+  for (auto &kv : req.fs.headers()) {
+    if (kv.token == http2::HD_IF_MODIFIED_SINCE ||
+        util::streq_l("if-none-match", kv.name) ||
+        util::streq_l("if-match", kv.name) ||
+        util::streq_l("if-unmodified-since", kv.name) ||
+        util::streq_l("if-range", kv.name)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+namespace {
+// Returns |etag| without weakness indicator.
+StringRef strip_weak(const StringRef &etag) {
+  if (util::starts_with(etag, StringRef::from_lit("W/"))) {
+    return StringRef{std::begin(etag) + 2, std::end(etag)};
+  }
+
+  return etag;
+}
+} // namespace
+
+bool cache_not_modified(const CacheEntry &entry, const Request &req) {
+  auto inm = req.fs.header(StringRef::from_lit("if-none-match"));
+  if (inm) {
+    if (entry.etag.empty()) {
+      return false;
+    }
+
+    // If-None-Match uses weak comparison.
+    auto etag = strip_weak(entry.etag);
+
+    for (auto &t : util::split_str(inm->value, ',')) {
+      t = trim(t);
+      if (t == StringRef::from_lit("*") || strip_weak(t) == etag) {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  auto ims = req.fs.header(http2::HD_IF_MODIFIED_SINCE);
+  if (!ims || entry.last_modified.empty()) {
+    return false;
+  }
+
+  auto t = util::parse_http_date(ims->value);
+  auto lm = util::parse_http_date(entry.last_modified);
+
+  return t != 0 && lm != 0 && lm <= t;
+}
+
+namespace {
+// Returns true if the response with status code |status| can be
+// stored.  These are the status codes which are cacheable by default
+// in RFC 7231, and 308.
+bool cacheable_status(unsigned int status) {
+  switch (status) {
+  case 200:
+  case 203:
+  case 204:
+  case 300:
+  case 301:
+  case 308:
+  case 404:
+  case 405:
+  case 410:
+  case 414:
+  case 501:
+    return true;
+  default:
+    return false;
+  }
+}
+} // namespace
+
+bool cache_response_storable(const Request &req, unsigned int status,
+                             const HeaderRefs &headers) {
+  if (req.method != HTTP_GET || !cacheable_status(status)) {
+    return false;
+  }
+
+  CacheControl cc;
+  auto has_expires = false;
+  auto has_validator = false;
+
+  for (auto &kv : headers) {
+    if (util::streq_l("set-cookie", kv.name)) {
+      return false;
+    }
+
+    if (util::streq_l("vary", kv.name)) {
+      for (auto &name : util::split_str(kv.value, ',')) {
+        if (trim(name) == StringRef::from_lit("*")) {
+          return false;
+        }
+      }
+      continue;
+    }
+
+    if (kv.token == http2::HD_CACHE_CONTROL) {
+      parse_cache_control(cc, kv.value);
+      continue;
+    }
+
+    if (util::streq_l("expires", kv.name)) {
+      has_expires = true;
+      continue;
+    }
+
+    if (util::streq_l("etag", kv.name) ||
+        util::streq_l("last-modified", kv.name)) {
+      has_validator = true;
+    }
+  }
+
+  if (cc.no_store || cc.private_) {
+    return false;
+  }
+
+  // We do not compute heuristic freshness.  The response without
+  // freshness information is stored only if it can be revalidated.
+  return cc.s_maxage != -1 || cc.max_age != -1 || has_expires ||
+         has_validator;
+}
+
+namespace {
+// Returns true if the header field |kv| must not be stored.
+// Content-Length is added when the stored response is served.
+bool skip_stored_header(const HeaderRefs::value_type &kv) {
+  switch (kv.token) {
+  case http2::HD_CONNECTION:
+  case http2::HD_KEEP_ALIVE:
+  case http2::HD_PROXY_CONNECTION:
+  case http2::HD_TE:
+  case http2::HD_TRAILER:
+  case http2::HD_TRANSFER_ENCODING:
+  case http2::HD_UPGRADE:
+  case http2::HD_CONTENT_LENGTH:
+    return true;
+  }
+
+  return util::streq_l("age", kv.name);
+}
+} // namespace
+
+std::shared_ptr<CacheEntry> cache_create_entry(const Request &req,
+                                               unsigned int status,
+                                               const HeaderRefs &headers,
+                                               ev_tstamp now) {
+  auto entry = std::make_shared<CacheEntry>();
+  auto &balloc = entry->balloc;
+
+  CacheControl cc;
+  StringRef date, expires;
+  int64_t age_value = 0;
+
+  entry->headers.reserve(headers.size());
+
+  for (auto &kv : headers) {
+    if (util::streq_l("age", kv.name)) {
+      age_value = parse_delta_seconds(kv.value);
+      continue;
+    }
+
+    if (skip_stored_header(kv)) {
+      continue;
+    }
+
+    entry->headers.emplace_back(make_string_ref(balloc, kv.name),
+                                make_string_ref(balloc, kv.value), kv.no_index,
+                                kv.token);
+
+    auto &stored = entry->headers.back();
+
+    entry->size += stored.name.size() + stored.value.size();
+
+    switch (kv.token) {
+    case http2::HD_CACHE_CONTROL:
+      parse_cache_control(cc, kv.value);
+      continue;
+    case http2::HD_DATE:
+      date = stored.value;
+      continue;
+    }
+
+    if (util::streq_l("expires", kv.name)) {
+      expires = stored.value;
+    } else if (util::streq_l("etag", kv.name)) {
+      entry->etag = stored.value;
+    } else if (util::streq_l("last-modified", kv.name)) {
+      entry->last_modified = stored.value;
+    } else if (util::streq_l("vary", kv.name)) {
+      for (auto &name : util::split_str(kv.value, ',')) {
+        name = trim(name);
+        if (name.empty()) {
+          continue;
+        }
+
+        auto iov = make_byte_ref(balloc, name.size() + 1);
+        auto p = std::copy(std::begin(name), std::end(name), iov.base);
+        *p = '\0';
+        util::inp_strlower(iov.base, p);
+
+        auto lname = StringRef{iov.base, p};
+        auto value = req.fs.header(lname);
+
+        entry->vary.emplace_back(
+            lname, value ? make_string_ref(balloc, value->value) : StringRef{},
+            false, -1);
+      }
+    }
+  }
+
+  auto date_value = date.empty() ? 0 : util::parse_http_date(date);
+  auto response_date = date_value ? static_cast<ev_tstamp>(date_value) : now;
+
+  entry->http_status = status;
+  entry->response_time = now;
+  entry->initial_age = std::max(static_cast<ev_tstamp>(age_value),
+                                std::max(0., now - response_date));
+
+  if (cc.no_cache) {
+    entry->freshness_lifetime = 0.;
+  } else if (cc.s_maxage != -1) {
+    entry->freshness_lifetime = cc.s_maxage;
+  } else if (cc.max_age != -1) {
+    entry->freshness_lifetime = cc.max_age;
+  } else if (!expires.empty()) {
+    auto t = util::parse_http_date(expires);
+    // Invalid Expires, e.g., "0", means already expired.
+    entry->freshness_lifetime =
+        t == 0 ? 0. : std::max(0., static_cast<ev_tstamp>(t) - response_date);
+  }
+
+  entry->size += sizeof(CacheEntry);
+
+  return entry;
+}
+
+std::shared_ptr<CacheEntry> cache_refresh_entry(const CacheEntry &entry,
+                                                const Request &req,
+                                                const HeaderRefs &headers,
+                                                ev_tstamp now) {
+  HeaderRefs merged;
+
+  merged.reserve(entry.headers.size() + headers.size());
+
+  // The header fields in 304 response replace the stored ones.
+  for (auto &kv : entry.headers) {
+    if (std::find_if(std::begin(headers), std::end(headers),
+                     [&kv](const HeaderRefs::value_type &nkv) {
+                       return !skip_stored_header(nkv) && kv.name == nkv.name;
+                     }) == std::end(headers)) {
+      merged.push_back(kv);
+    }
+  }
+
+  for (auto &kv : headers) {
+    if (util::streq_l("age", kv.name) || !skip_stored_header(kv)) {
+      merged.push_back(kv);
+    }
+  }
+
+  auto refreshed = cache_create_entry(req, entry.http_status, merged, now);
+
+  refreshed->body = entry.body;
+  if (refreshed->body) {
+    refreshed->size += refreshed->body->length;
+  }
+
+  return refreshed;
+}
+
+bool cache_vary_match(const CacheEntry &entry, const Request &req) {
+  for (auto &kv : entry.vary) {
+    auto h = req.fs.header(kv.name);
+    auto value = h ? h->value : StringRef{};
+
+    if (value != kv.value) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+namespace {
+// Returns true if |a| and |b| are selected by the same Vary header
+// field names.
+bool same_vary_names(const CacheEntry &a, const CacheEntry &b) {
+  return a.vary.size() == b.vary.size() &&
+         std::equal(std::begin(a.vary), std::end(a.vary), std::begin(b.vary),
+                    [](const HeaderRefs::value_type &lhs,
+                       const HeaderRefs::value_type &rhs) {
+                      return lhs.name == rhs.name;
+                    });
+}
+} // namespace
+
+namespace {
+// Returns true if |a| and |b| are the same variant.
+bool same_variant(const CacheEntry &a, const CacheEntry &b) {
+  return same_vary_names(a, b) &&
+         std::equal(std::begin(a.vary), std::end(a.vary), std::begin(b.vary),
+                    [](const HeaderRefs::value_type &lhs,
+                       const HeaderRefs::value_type &rhs) {
+                      return lhs.value == rhs.value;
+                    });
+}
+} // namespace
+
+CacheShard::CacheShard(size_t capacity)
+    : capacity_(capacity),
+      protected_capacity_(capacity / 10 * 8),
+      probation_size_(0),
+      protected_size_(0) {}
+
+CacheShard::~CacheShard() {}
+
+std::shared_ptr<const CacheEntry> CacheShard::get(const StringRef &key,
+                                                  const Request &req) {
+  auto it = nodes_.find(key);
+  if (it == std::end(nodes_)) {
+    return nullptr;
+  }
+
+  auto node = (*it).second.get();
+
+  auto vit = std::find_if(std::begin(node->variants),
+                          std::end(node->variants),
+                          [&req](const std::shared_ptr<const CacheEntry> &e) {
+                            return cache_vary_match(*e, req);
+                          });
+  if (vit == std::end(node->variants)) {
+    return nullptr;
+  }
+
+  unlink(node);
+
+  node->protected_segment = true;
+  protected_.append(node);
+  protected_size_ += node->size;
+
+  while (protected_size_ > protected_capacity_ && protected_.head != node) {
+    auto victim = protected_.head;
+
+    unlink(victim);
+
+    victim->protected_segment = false;
+    probation_.append(victim);
+    probation_size_ += victim->size;
+  }
+
+  return *vit;
+}
+
+size_t CacheShard::put(const StringRef &key,
+                       std::shared_ptr<const CacheEntry> entry) {
+  auto it = nodes_.find(key);
+
+  if (entry->size + key.size() + sizeof(CacheNode) > capacity_) {
+    if (it != std::end(nodes_)) {
+      erase((*it).second.get());
+    }
+
+    return 0;
+  }
+
+  CacheNode *node;
+
+  if (it == std::end(nodes_)) {
+    auto n = std::make_unique<CacheNode>();
+    n->key = std::string{std::begin(key), std::end(key)};
+    n->protected_segment = false;
+    n->dlnext = n->dlprev = nullptr;
+
+    node = n.get();
+
+    nodes_.emplace(StringRef{node->key}, std::move(n));
+  } else {
+    node = (*it).second.get();
+
+    unlink(node);
+
+    auto &variants = node->variants;
+
+    // If Vary has changed, the other variants are no longer selected.
+    variants.erase(
+        std::remove_if(std::begin(variants), std::end(variants),
+                       [&entry](const std::shared_ptr<const CacheEntry> &e) {
+                         return !same_vary_names(*e, *entry) ||
+                                same_variant(*e, *entry);
+                       }),
+        std::end(variants));
+
+    if (variants.size() >= RESPONSE_CACHE_MAX_VARIANTS) {
+      variants.erase(std::begin(variants));
+    }
+  }
+
+  node->variants.push_back(std::move(entry));
+
+  node->size = node->key.size() + sizeof(CacheNode);
+  for (auto &e : node->variants) {
+    node->size += e->size;
+  }
+
+  if (node->protected_segment) {
+    protected_.append(node);
+    protected_size_ += node->size;
+  } else {
+    probation_.append(node);
+    probation_size_ += node->size;
+  }
+
+  return evict();
+}
+
+void CacheShard::remove(const StringRef &key) {
+  auto it = nodes_.find(key);
+  if (it == std::end(nodes_)) {
+    return;
+  }
+
+  erase((*it).second.get());
+}
+
+void CacheShard::unlink(CacheNode *node) {
+  if (node->protected_segment) {
+    protected_.remove(node);
+    protected_size_ -= node->size;
+  } else {
+    probation_.remove(node);
+    probation_size_ -= node->size;
+  }
+}
+
+void CacheShard::erase(CacheNode *node) {
+  unlink(node);
+
+  nodes_.erase(nodes_.find(StringRef{node->key}));
+}
+
+size_t CacheShard::evict() {
+  size_t n = 0;
+
+  while (probation_size_ + protected_size_ > capacity_) {
+    auto victim = probation_.head ? probation_.head : protected_.head;
+
+    erase(victim);
+
+    ++n;
+  }
+
+  return n;
+}
+
+size_t CacheShard::get_size() const {
+  return probation_size_ + protected_size_;
+}
+
+size_t CacheShard::get_num_entries() const { return nodes_.size(); }
+
+ResponseCache::ResponseCache(size_t capacity)
+    : lookups_{}, not_modified_(0), stores_(0), evictions_(0),
+      capacity_(capacity) {
+  shards_.reserve(RESPONSE_CACHE_NUM_SHARDS);
+
+  for (size_t i = 0; i < RESPONSE_CACHE_NUM_SHARDS; ++i) {
+    shards_.push_back(
+        std::make_unique<Shard>(capacity / RESPONSE_CACHE_NUM_SHARDS));
+  }
+}
+
+ResponseCache::Shard &ResponseCache::get_shard(const StringRef &key) {
+  return *shards_[std::hash<StringRef>{}(key) % shards_.size()];
+}
+
+std::shared_ptr<const CacheEntry> ResponseCache::get(const StringRef &key,
+                                                     const Request &req) {
+  auto &shard = get_shard(key);
+
+  std::lock_guard<std::mutex> g(shard.mu);
+
+  return shard.cache.get(key, req);
+}
+
+void ResponseCache::put(const StringRef &key,
+                        std::shared_ptr<const CacheEntry> entry) {
+  auto &shard = get_shard(key);
+  size_t n;
+
+  {
+    std::lock_guard<std::mutex> g(shard.mu);
+
+    n = shard.cache.put(key, std::move(entry));
+  }
+
+  stores_.fetch_add(1, std::memory_order_relaxed);
+  evictions_.fetch_add(n, std::memory_order_relaxed);
+}
+
+void ResponseCache::remove(const StringRef &key) {
+  auto &shard = get_shard(key);
+
+  std::lock_guard<std::mutex> g(shard.mu);
+
+  shard.cache.remove(key);
+}
+
+void ResponseCache::record_lookup(CacheLookupResult result) {
+  lookups_[static_cast<size_t>(result)].fetch_add(1,
+                                                  std::memory_order_relaxed);
+}
+
+void ResponseCache::record_not_modified() {
+  not_modified_.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t ResponseCache::get_num_lookups(CacheLookupResult result) const {
+  return lookups_[static_cast<size_t>(result)].load(std::memory_order_relaxed);
+}
+
+uint64_t ResponseCache::get_num_not_modified() const {
+  return not_modified_.load(std::memory_order_relaxed);
+}
+
+uint64_t ResponseCache::get_num_stores() const {
+  return stores_.load(std::memory_order_relaxed);
+}
+
+uint64_t ResponseCache::get_num_evictions() const {
+  return evictions_.load(std::memory_order_relaxed);
+}
+
+size_t ResponseCache::get_size() {
+  size_t n = 0;
+
+  for (auto &shard : shards_) {
+    std::lock_guard<std::mutex> g(shard->mu);
+
+    n += shard->cache.get_size();
+  }
+
+  return n;
+}
+
+size_t ResponseCache::get_num_entries() {
+  size_t n = 0;
+
+  for (auto &shard : shards_) {
+    std::lock_guard<std::mutex> g(shard->mu);
+
+    n += shard->cache.get_num_entries();
+  }
+
+  return n;
+}
+
+size_t ResponseCache::get_capacity() const { return capacity_; }
+
+CacheWriter::CacheWriter(ResponseCache *cache, std::string key,
+                         std::shared_ptr<const CacheEntry> stale,
+                         size_t max_object_size)
+    : key_(std::move(key)),
+      stale_(std::move(stale)),
+      cache_(cache),
+      max_object_size_(max_object_size),
+      state_(CacheWriterState::INITIAL),
+      validators_added_(false) {}
+
+void CacheWriter::add_validators(Downstream *downstream) {
+  if (validators_added_ || !stale_ ||
+      (stale_->etag.empty() && stale_->last_modified.empty())) {
+    return;
+  }
+
+  validators_added_ = true;
+
+  auto &req = downstream->request();
+  auto &balloc = downstream->get_block_allocator();
+
+  if (!stale_->etag.empty()) {
+    req.fs.add_header_token(StringRef::from_lit("if-none-match"),
+                            make_string_ref(balloc, stale_->etag), false, -1);
+  }
+
+  if (!stale_->last_modified.empty()) {
+    req.fs.add_header_token(StringRef::from_lit("if-modified-since"),
+                            make_string_ref(balloc, stale_->last_modified),
+                            false, http2::HD_IF_MODIFIED_SINCE);
+  }
+}
+
+void CacheWriter::on_header(Downstream *downstream) {
+  if (state_ != CacheWriterState::INITIAL) {
+    return;
+  }
+
+  const auto &req = downstream->request();
+  auto &resp = downstream->response();
+  auto handler = downstream->get_upstream()->get_client_handler();
+  auto now = ev_now(handler->get_loop());
+
+  state_ = CacheWriterState::DONE;
+
+  if (resp.http_status == 304 && validators_added_) {
+    entry_ = cache_refresh_entry(*stale_, req, resp.fs.headers(), now);
+
+    cache_->record_not_modified();
+
+    if (cache_response_storable(req, entry_->http_status, entry_->headers)) {
+      cache_->put(StringRef{key_}, entry_);
+    } else {
+      cache_->remove(StringRef{key_});
+    }
+
+    if (LOG_ENABLED(INFO)) {
+      DLOG(INFO, downstream) << "Cached response revalidated";
+    }
+
+    // Replace 304 response with the stored one.  Backend connection
+    // still sees the end of 304 response.
+    auto &balloc = downstream->get_block_allocator();
+    auto body_length = entry_->body ? entry_->body->length : 0;
+
+    resp.http_status = entry_->http_status;
+    resp.fs.clear_headers();
+
+    for (auto &kv : entry_->headers) {
+      resp.fs.add_header_token(make_string_ref(balloc, kv.name),
+                               make_string_ref(balloc, kv.value), kv.no_index,
+                               kv.token);
+    }
+
+    resp.fs.add_header_token(
+        StringRef::from_lit("content-length"),
+        util::make_string_ref_uint(balloc, body_length), false,
+        http2::HD_CONTENT_LENGTH);
+    resp.fs.content_length = body_length;
+    resp.headers_only = false;
+    downstream->set_chunked_response(false);
+
+    state_ = CacheWriterState::REVALIDATED;
+
+    return;
+  }
+
+  if (!cache_response_storable(req, resp.http_status, resp.fs.headers()) ||
+      resp.fs.content_length > static_cast<int64_t>(max_object_size_)) {
+    if (stale_) {
+      // The stored response is obsolete.
+      cache_->remove(StringRef{key_});
+    }
+
+    return;
+  }
+
+  entry_ = cache_create_entry(req, resp.http_status, resp.fs.headers(), now);
+  body_ = std::make_shared<CacheBody>();
+
+  state_ = CacheWriterState::WRITING;
+}
+
+void CacheWriter::on_body(const uint8_t *data, size_t len) {
+  if (state_ != CacheWriterState::WRITING) {
+    return;
+  }
+
+  if (body_->length + len > max_object_size_) {
+    state_ = CacheWriterState::DONE;
+    entry_.reset();
+    body_.reset();
+
+    return;
+  }
+
+  body_->append(data, len);
+}
+
+int CacheWriter::on_body_complete(Downstream *downstream) {
+  auto &resp = downstream->response();
+
+  switch (state_) {
+  case CacheWriterState::WRITING: {
+    state_ = CacheWriterState::DONE;
+
+    if (!resp.fs.trailers().empty() ||
+        (resp.fs.content_length != -1 &&
+         resp.fs.content_length != static_cast<int64_t>(body_->length))) {
+      return 0;
+    }
+
+    entry_->size += body_->length;
+    entry_->body = std::move(body_);
+
+    if (LOG_ENABLED(INFO)) {
+      DLOG(INFO, downstream) << "Response stored in cache, "
+                             << entry_->size << " bytes";
+    }
+
+    cache_->put(StringRef{key_}, std::move(entry_));
+
+    return 0;
+  }
+  case CacheWriterState::REVALIDATED: {
+    state_ = CacheWriterState::DONE;
+
+    auto &body = entry_->body;
+    if (!body || !downstream->expect_response_body()) {
+      return 0;
+    }
+
+    auto upstream = downstream->get_upstream();
+
+    for (size_t offset = 0; offset < body->length;) {
+      auto &chunk = body->chunks[offset / CACHE_BODY_CHUNK_SIZE];
+      auto len = std::min(CACHE_BODY_CHUNK_SIZE, body->length - offset);
+
+      resp.recv_body_length += len;
+
+      if (upstream->on_downstream_body(downstream, chunk.get(), len, true) !=
+          0) {
+        return -1;
+      }
+
+      offset += len;
+    }
+
+    return 0;
+  }
+  default:
+    return 0;
+  }
+}
+
+CacheWriterState CacheWriter::get_state() const { return state_; }
+
+} // namespace shrpx
@@ -0,0 +1,324 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHRPX_CACHE_H
+#define SHRPX_CACHE_H
+
+#include "shrpx.h"
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include <ev.h>
+
+#include "http2.h"
+#include "allocator.h"
+#include "template.h"
+
+using namespace nghttp2;
+
+namespace shrpx {
+
+class Downstream;
+struct Request;
+
+// The number of shards of ResponseCache.  Each shard has its own lock
+// and LRU lists.
+constexpr size_t RESPONSE_CACHE_NUM_SHARDS = 16;
+// The maximum number of variants stored for a URI.
+constexpr size_t RESPONSE_CACHE_MAX_VARIANTS = 8;
+// The size of a chunk of CacheBody.
+constexpr size_t CACHE_BODY_CHUNK_SIZE = 16_k;
+
+// CacheControl is the directives in Cache-Control header fields which
+// the response cache cares about.
+struct CacheControl {
+  // The value of max-age directive, or -1.
+  int64_t max_age = -1;
+  // The value of s-maxage directive, or -1.
+  int64_t s_maxage = -1;
+  // The value of min-fresh directive, or -1.
+  int64_t min_fresh = -1;
+  bool no_store = false;
+  bool no_cache = false;
+  bool private_ = false;
+  bool no_transform = false;
+};
+
+// Parses the value of Cache-Control header field |value|, and adds
+// the directives to |cc|.
+void parse_cache_control(CacheControl &cc, const StringRef &value);
+
+// CacheBody is a response body stored in fixed size chunks.  It is
+// immutable once the entry is stored, and shared by all clients
+// served from it, and by the entries refreshed by revalidation.
+struct CacheBody {
+  CacheBody();
+
+  void append(const uint8_t *data, size_t len);
+
+  std::vector<std::unique_ptr<uint8_t[]>> chunks;
+  // The number of bytes stored.
+  size_t length;
+};
+
+// CacheEntry is a response stored in ResponseCache.  It is immutable
+// once it is stored.
+struct CacheEntry {
+  CacheEntry();
+
+  // Returns the current age of this response in seconds.
+  ev_tstamp age(ev_tstamp now) const;
+  // Returns true if this response can be served without
+  // revalidation.
+  bool fresh(ev_tstamp now) const;
+
+  BlockAllocator balloc;
+  // Response header fields, excluding hop-by-hop header fields and
+  // Age.
+  HeaderRefs headers;
+  // The request header fields nominated by Vary header field and
+  // their values in the request which this response is for.  The
+  // value is empty if the request does not have the header field.
+  HeaderRefs vary;
+  std::shared_ptr<const CacheBody> body;
+  // Validators.  They are empty if response does not have them.
+  StringRef etag;
+  StringRef last_modified;
+  // The time when the response was received.
+  ev_tstamp response_time;
+  // The age of the response when it was received.
+  ev_tstamp initial_age;
+  // The duration after the response was generated while it is fresh.
+  ev_tstamp freshness_lifetime;
+  // The number of bytes charged to ResponseCache.
+  size_t size;
+  unsigned int http_status;
+};
+
+// Returns the cache key of |req|.  It returns empty string if |req|
+// does not identify a resource, e.g., CONNECT.
+std::string cache_create_key(const Request &req);
+
+// Returns true if the response to |req| may be served from cache.
+bool cache_request_cacheable(const Request &req);
+
+// Returns true if |req| requires the stored response |entry|, which
+// is fresh, to be revalidated at |now|.  This is the case if |req|
+// has no-cache, or the age or remaining freshness of |entry| does not
+// satisfy max-age or min-fresh directive.  max-stale directive is
+// ignored because stale response is always revalidated.
+bool cache_request_requires_validation(const Request &req,
+                                       const CacheEntry &entry,
+                                       ev_tstamp now);
+
+// Returns true if |req| has its own validators.
+bool cache_request_conditional(const Request &req);
+
+// Returns true if the stored response |entry| is not modified against
+// the validators in |req|, so that 304 response can be sent.
+bool cache_not_modified(const CacheEntry &entry, const Request &req);
+
+// Returns true if the response which has status code |status| and
+// header fields |headers| to |req| can be stored.
+bool cache_response_storable(const Request &req, unsigned int status,
+                             const HeaderRefs &headers);
+
+// Creates CacheEntry from the response which has status code |status|
+// and header fields |headers|, and is received at |now|.  The body is
+// not set.
+std::shared_ptr<CacheEntry> cache_create_entry(const Request &req,
+                                               unsigned int status,
+                                               const HeaderRefs &headers,
+                                               ev_tstamp now);
+
+// Creates CacheEntry which updates |entry| with 304 response which
+// has header fields |headers|, and is received at |now|.
+std::shared_ptr<CacheEntry> cache_refresh_entry(const CacheEntry &entry,
+                                                const Request &req,
+                                                const HeaderRefs &headers,
+                                                ev_tstamp now);
+
+// Returns true if |entry| is the response for |req| with regard to
+// Vary header field.
+bool cache_vary_match(const CacheEntry &entry, const Request &req);
+
+// CacheNode holds all variants of a URI.  It is in one of the LRU
+// lists of CacheShard.
+struct CacheNode {
+  std::string key;
+  std::vector<std::shared_ptr<const CacheEntry>> variants;
+  // The sum of the size of variants.
+  size_t size;
+  // true if this node is in protected segment.
+  bool protected_segment;
+  CacheNode *dlnext, *dlprev;
+};
+
+// CacheShard is a segmented LRU cache.  A new entry is put into
+// probationary segment, and it is promoted to protected segment when
+// it is hit.  The entries which overflow from protected segment are
+// demoted to probationary segment, and the least recently used entry
+// in probationary segment is evicted first.  Thus entries requested
+// only once do not evict frequently used ones.  CacheShard is not
+// thread-safe.
+class CacheShard {
+public:
+  CacheShard(size_t capacity);
+  ~CacheShard();
+
+  // Returns the variant of |key| which matches |req|, or nullptr.
+  std::shared_ptr<const CacheEntry> get(const StringRef &key,
+                                        const Request &req);
+  // Stores |entry| for |key|.  It replaces the variant which has the
+  // same Vary values.  Returns the number of nodes evicted.
+  size_t put(const StringRef &key, std::shared_ptr<const CacheEntry> entry);
+  // Removes all variants of |key|.
+  void remove(const StringRef &key);
+
+  size_t get_size() const;
+  size_t get_num_entries() const;
+
+private:
+  void unlink(CacheNode *node);
+  void erase(CacheNode *node);
+  // Evicts entries until size does not exceed capacity.
+  size_t evict();
+
+  std::unordered_map<StringRef, std::unique_ptr<CacheNode>> nodes_;
+  DList<CacheNode> probation_;
+  DList<CacheNode> protected_;
+  size_t capacity_;
+  size_t protected_capacity_;
+  size_t probation_size_;
+  size_t protected_size_;
+};
+
+// The results of cache lookup.
+enum class CacheLookupResult {
+  // Served from cache.
+  HIT,
+  // Stale response found, and revalidated with backend.
+  STALE,
+  // No response found.
+  MISS,
+};
+
+// ResponseCache is an in-memory HTTP response cache shared by all
+// workers.  Keys are distributed to shards, so that workers rarely
+// contend for a lock.  Entries are reference counted, so that they
+// can be served after being evicted.
+class ResponseCache {
+public:
+  ResponseCache(size_t capacity);
+
+  std::shared_ptr<const CacheEntry> get(const StringRef &key,
+                                        const Request &req);
+  void put(const StringRef &key, std::shared_ptr<const CacheEntry> entry);
+  void remove(const StringRef &key);
+
+  void record_lookup(CacheLookupResult result);
+  // Records that backend responded with 304 to revalidation.
+  void record_not_modified();
+
+  uint64_t get_num_lookups(CacheLookupResult result) const;
+  uint64_t get_num_not_modified() const;
+  uint64_t get_num_stores() const;
+  uint64_t get_num_evictions() const;
+  // Returns the number of bytes used.  This function locks all
+  // shards.
+  size_t get_size();
+  size_t get_num_entries();
+  size_t get_capacity() const;
+
+private:
+  struct Shard {
+    Shard(size_t capacity) : cache(capacity) {}
+
+    std::mutex mu;
+    CacheShard cache;
+  };
+
+  Shard &get_shard(const StringRef &key);
+
+  std::vector<std::unique_ptr<Shard>> shards_;
+  std::array<std::atomic<uint64_t>, 3> lookups_;
+  std::atomic<uint64_t> not_modified_;
+  std::atomic<uint64_t> stores_;
+  std::atomic<uint64_t> evictions_;
+  size_t capacity_;
+};
+
+enum class CacheWriterState {
+  // Waiting for response header fields.
+  INITIAL,
+  // Storing response body.
+  WRITING,
+  // Backend responded with 304, and stored response is served.
+  REVALIDATED,
+  // Response is not stored.
+  DONE,
+};
+
+// CacheWriter stores the response which Downstream receives from
+// backend into ResponseCache.  If it has a stale response, it adds
+// validators to the request, and if backend responds with 304, it
+// replaces the response with the stored one.
+class CacheWriter {
+public:
+  CacheWriter(ResponseCache *cache, std::string key,
+              std::shared_ptr<const CacheEntry> stale, size_t max_object_size);
+
+  // Adds validators of stale response to the request of
+  // |downstream|.  It does nothing if it is already done.
+  void add_validators(Downstream *downstream);
+
+  // The following functions are called when |downstream| receives
+  // response.
+  void on_header(Downstream *downstream);
+  void on_body(const uint8_t *data, size_t len);
+  // Returns -1 if it fails to send the stored response body.
+  int on_body_complete(Downstream *downstream);
+
+  CacheWriterState get_state() const;
+
+private:
+  std::string key_;
+  std::shared_ptr<const CacheEntry> stale_;
+  std::shared_ptr<CacheEntry> entry_;
+  std::shared_ptr<CacheBody> body_;
+  ResponseCache *cache_;
+  size_t max_object_size_;
+  CacheWriterState state_;
+  bool validators_added_;
+};
+
+} // namespace shrpx
+
+#endif // SHRPX_CACHE_H
@@ -0,0 +1,406 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_cache_test.h"
+
+#include <CUnit/CUnit.h>
+
+#include "shrpx_cache.h"
+#include "shrpx_downstream.h"
+#include "shrpx_log.h"
+
+namespace shrpx {
+
+namespace {
+void add_header(HeaderRefs &headers, const StringRef &name,
+                const StringRef &value) {
+  headers.emplace_back(name, value, false,
+                       http2::lookup_token(name.byte(), name.size()));
+}
+} // namespace
+
+void test_shrpx_cache_parse_cache_control(void) {
+  {
+    CacheControl cc;
+
+    parse_cache_control(cc, StringRef::from_lit("max-age=60, s-maxage=\"30\""));
+
+    CU_ASSERT(60 == cc.max_age);
+    CU_ASSERT(30 == cc.s_maxage);
+    CU_ASSERT(-1 == cc.min_fresh);
+    CU_ASSERT(!cc.no_store);
+    CU_ASSERT(!cc.no_cache);
+    CU_ASSERT(!cc.private_);
+    CU_ASSERT(!cc.no_transform);
+  }
+
+  {
+    CacheControl cc;
+
+    parse_cache_control(cc,
+                        StringRef::from_lit("No-Cache=\"set-cookie\",private"));
+    parse_cache_control(cc, StringRef::from_lit(" no-store , no-transform"));
+
+    CU_ASSERT(-1 == cc.max_age);
+    CU_ASSERT(cc.no_store);
+    CU_ASSERT(cc.no_cache);
+    CU_ASSERT(cc.private_);
+    CU_ASSERT(cc.no_transform);
+  }
+
+  {
+    CacheControl cc;
+
+    // Invalid delta-seconds makes the response stale.
+    parse_cache_control(cc, StringRef::from_lit("max-age=foo"));
+
+    CU_ASSERT(0 == cc.max_age);
+  }
+}
+
+void test_shrpx_cache_response_storable(void) {
+  BlockAllocator balloc(4096, 4096);
+  Request req(balloc);
+
+  req.method = HTTP_GET;
+
+  {
+    HeaderRefs headers;
+    add_header(headers, StringRef::from_lit("cache-control"),
+               StringRef::from_lit("max-age=60"));
+
+    CU_ASSERT(cache_response_storable(req, 200, headers));
+    CU_ASSERT(!cache_response_storable(req, 206, headers));
+    CU_ASSERT(!cache_response_storable(req, 302, headers));
+
+    req.method = HTTP_HEAD;
+
+    CU_ASSERT(!cache_response_storable(req, 200, headers));
+
+    req.method = HTTP_GET;
+  }
+
+  {
+    // No freshness information nor validator.
+    HeaderRefs headers;
+    add_header(headers, StringRef::from_lit("content-type"),
+               StringRef::from_lit("text/plain"));
+
+    CU_ASSERT(!cache_response_storable(req, 200, headers));
+
+    add_header(headers, StringRef::from_lit("etag"),
+               StringRef::from_lit("\"alpha\""));
+
+    CU_ASSERT(cache_response_storable(req, 200, headers));
+  }
+
+  for (auto &kv : {std::make_pair(StringRef::from_lit("cache-control"),
+                                  StringRef::from_lit("max-age=60, private")),
+                   std::make_pair(StringRef::from_lit("cache-control"),
+                                  StringRef::from_lit("no-store")),
+                   std::make_pair(StringRef::from_lit("vary"),
+                                  StringRef::from_lit("accept, *")),
+                   std::make_pair(StringRef::from_lit("set-cookie"),
+                                  StringRef::from_lit("a=b"))}) {
+    HeaderRefs headers;
+    add_header(headers, StringRef::from_lit("expires"),
+               StringRef::from_lit("Thu, 01 Jan 2037 00:00:00 GMT"));
+    add_header(headers, kv.first, kv.second);
+
+    CU_ASSERT(!cache_response_storable(req, 200, headers));
+  }
+}
+
+void test_shrpx_cache_create_entry(void) {
+  BlockAllocator balloc(4096, 4096);
+  Request req(balloc);
+
+  req.method = HTTP_GET;
+  req.fs.add_header_token(StringRef::from_lit("accept-encoding"),
+                          StringRef::from_lit("gzip"), false,
+                          http2::HD_ACCEPT_ENCODING);
+
+  // Mon, 01 Jan 2018 00:00:00 GMT
+  constexpr ev_tstamp date = 1514764800.;
+
+  HeaderRefs headers;
+  add_header(headers, StringRef::from_lit("date"),
+             StringRef::from_lit("Mon, 01 Jan 2018 00:00:00 GMT"));
+  add_header(headers, StringRef::from_lit("age"), StringRef::from_lit("10"));
+  add_header(headers, StringRef::from_lit("cache-control"),
+             StringRef::from_lit("max-age=60"));
+  add_header(headers, StringRef::from_lit("content-length"),
+             StringRef::from_lit("100"));
+  add_header(headers, StringRef::from_lit("etag"),
+             StringRef::from_lit("\"alpha\""));
+  add_header(headers, StringRef::from_lit("vary"),
+             StringRef::from_lit("Accept-Encoding, X-Bravo"));
+
+  auto entry = cache_create_entry(req, 200, headers, date + 5);
+
+  CU_ASSERT(200 == entry->http_status);
+  // Age and Content-Length are not stored.
+  CU_ASSERT(4 == entry->headers.size());
+  CU_ASSERT("\"alpha\"" == entry->etag);
+  CU_ASSERT(60. == entry->freshness_lifetime);
+  CU_ASSERT(10. == entry->initial_age);
+  CU_ASSERT(15. == entry->age(date + 10));
+  CU_ASSERT(entry->fresh(date + 54));
+  CU_ASSERT(!entry->fresh(date + 55));
+
+  CU_ASSERT(2 == entry->vary.size());
+  CU_ASSERT("accept-encoding" == entry->vary[0].name);
+  CU_ASSERT("gzip" == entry->vary[0].value);
+  CU_ASSERT("x-bravo" == entry->vary[1].name);
+  CU_ASSERT(entry->vary[1].value.empty());
+
+  CU_ASSERT(cache_vary_match(*entry, req));
+
+  Request req2(balloc);
+  req2.method = HTTP_GET;
+  req2.fs.add_header_token(StringRef::from_lit("accept-encoding"),
+                           StringRef::from_lit("br"), false,
+                           http2::HD_ACCEPT_ENCODING);
+
+  CU_ASSERT(!cache_vary_match(*entry, req2));
+
+  // 304 response updates freshness, and keeps the other header
+  // fields.
+  HeaderRefs nm_headers;
+  add_header(nm_headers, StringRef::from_lit("date"),
+             StringRef::from_lit("Mon, 01 Jan 2018 00:01:40 GMT"));
+  add_header(nm_headers, StringRef::from_lit("cache-control"),
+             StringRef::from_lit("max-age=120"));
+
+  auto refreshed = cache_refresh_entry(*entry, req, nm_headers, date + 100);
+
+  CU_ASSERT(120. == refreshed->freshness_lifetime);
+  CU_ASSERT("\"alpha\"" == refreshed->etag);
+  CU_ASSERT(0. == refreshed->initial_age);
+  CU_ASSERT(refreshed->fresh(date + 219));
+  CU_ASSERT(!refreshed->fresh(date + 220));
+}
+
+void test_shrpx_cache_not_modified(void) {
+  BlockAllocator balloc(4096, 4096);
+  CacheEntry entry;
+
+  entry.etag = StringRef::from_lit("W/\"alpha\"");
+  entry.last_modified = StringRef::from_lit("Mon, 01 Jan 2018 00:00:00 GMT");
+
+  {
+    Request req(balloc);
+
+    CU_ASSERT(!cache_not_modified(entry, req));
+  }
+
+  {
+    Request req(balloc);
+    req.fs.add_header_token(StringRef::from_lit("if-none-match"),
+                            StringRef::from_lit("\"bravo\", \"alpha\""),
+                            false, -1);
+
+    CU_ASSERT(cache_not_modified(entry, req));
+  }
+
+  {
+    // If-Modified-Since is ignored if If-None-Match is present.
+    Request req(balloc);
+    req.fs.add_header_token(StringRef::from_lit("if-none-match"),
+                            StringRef::from_lit("\"bravo\""), false, -1);
+    req.fs.add_header_token(
+        StringRef::from_lit("if-modified-since"),
+        StringRef::from_lit("Tue, 02 Jan 2018 00:00:00 GMT"), false,
+        http2::HD_IF_MODIFIED_SINCE);
+
+    CU_ASSERT(!cache_not_modified(entry, req));
+  }
+
+  {
+    Request req(balloc);
+    req.fs.add_header_token(
+        StringRef::from_lit("if-modified-since"),
+        StringRef::from_lit("Tue, 02 Jan 2018 00:00:00 GMT"), false,
+        http2::HD_IF_MODIFIED_SINCE);
+
+    CU_ASSERT(cache_not_modified(entry, req));
+  }
+
+  {
+    Request req(balloc);
+    req.fs.add_header_token(
+        StringRef::from_lit("if-modified-since"),
+        StringRef::from_lit("Sun, 31 Dec 2017 00:00:00 GMT"), false,
+        http2::HD_IF_MODIFIED_SINCE);
+
+    CU_ASSERT(!cache_not_modified(entry, req));
+  }
+}
+
+void test_shrpx_cache_request_requires_validation(void) {
+  BlockAllocator balloc(4096, 4096);
+  CacheEntry entry;
+
+  // The entry is 30 seconds old at 1030, and fresh until 1100.
+  entry.response_time = 1000.;
+  entry.initial_age = 0.;
+  entry.freshness_lifetime = 100.;
+
+  auto now = 1030.;
+
+  auto cache_control = [&balloc](const StringRef &value) {
+    Request req(balloc);
+    req.fs.add_header_token(StringRef::from_lit("cache-control"), value,
+                            false, http2::HD_CACHE_CONTROL);
+    return req;
+  };
+
+  {
+    Request req(balloc);
+
+    CU_ASSERT(!cache_request_requires_validation(req, entry, now));
+  }
+
+  {
+    auto req = cache_control(StringRef::from_lit("no-cache"));
+
+    CU_ASSERT(cache_request_requires_validation(req, entry, now));
+  }
+
+  {
+    auto req = cache_control(StringRef::from_lit("max-age=0"));
+
+    CU_ASSERT(cache_request_requires_validation(req, entry, now));
+  }
+
+  {
+    // The entry is older than the client accepts.
+    auto req = cache_control(StringRef::from_lit("max-age=20"));
+
+    CU_ASSERT(cache_request_requires_validation(req, entry, now));
+  }
+
+  {
+    auto req = cache_control(StringRef::from_lit("max-age=30"));
+
+    CU_ASSERT(!cache_request_requires_validation(req, entry, now));
+  }
+
+  {
+    // The entry is fresh only for 70 seconds.
+    auto req = cache_control(StringRef::from_lit("min-fresh=71"));
+
+    CU_ASSERT(cache_request_requires_validation(req, entry, now));
+  }
+
+  {
+    auto req = cache_control(StringRef::from_lit("min-fresh=70"));
+
+    CU_ASSERT(!cache_request_requires_validation(req, entry, now));
+  }
+
+  {
+    // max-stale does not make a difference for the fresh entry.
+    auto req = cache_control(StringRef::from_lit("max-stale=3600"));
+
+    CU_ASSERT(!cache_request_requires_validation(req, entry, now));
+  }
+
+  {
+    Request req(balloc);
+    req.fs.add_header_token(StringRef::from_lit("pragma"),
+                            StringRef::from_lit("no-cache"), false, -1);
+
+    CU_ASSERT(cache_request_requires_validation(req, entry, now));
+  }
+
+  {
+    // Pragma is ignored if Cache-Control is present.
+    auto req = cache_control(StringRef::from_lit("max-age=60"));
+    req.fs.add_header_token(StringRef::from_lit("pragma"),
+                            StringRef::from_lit("no-cache"), false, -1);
+
+    CU_ASSERT(!cache_request_requires_validation(req, entry, now));
+  }
+}
+
+namespace {
+std::shared_ptr<CacheEntry> create_entry(size_t size) {
+  auto entry = std::make_shared<CacheEntry>();
+  entry->size = size;
+  return entry;
+}
+} // namespace
+
+void test_shrpx_cache_shard(void) {
+  BlockAllocator balloc(4096, 4096);
+  Request req(balloc);
+
+  auto node_size = [](const StringRef &key, size_t size) {
+    return key.size() + sizeof(CacheNode) + size;
+  };
+
+  auto alpha = StringRef::from_lit("alpha");
+  auto bravo = StringRef::from_lit("bravo");
+  auto charlie = StringRef::from_lit("charlie");
+  auto delta = StringRef::from_lit("delta");
+
+  // Room for 3 nodes.
+  CacheShard shard(node_size(charlie, 100) * 3 + 10);
+
+  CU_ASSERT(0 == shard.put(alpha, create_entry(100)));
+  CU_ASSERT(0 == shard.put(bravo, create_entry(100)));
+  CU_ASSERT(0 == shard.put(charlie, create_entry(100)));
+  CU_ASSERT(3 == shard.get_num_entries());
+  CU_ASSERT(node_size(alpha, 100) + node_size(bravo, 100) +
+                node_size(charlie, 100) ==
+            shard.get_size());
+
+  // alpha is promoted to protected segment, and survives eviction.
+  CU_ASSERT(nullptr != shard.get(alpha, req));
+  CU_ASSERT(nullptr == shard.get(delta, req));
+
+  CU_ASSERT(1 == shard.put(delta, create_entry(100)));
+  CU_ASSERT(nullptr != shard.get(alpha, req));
+  CU_ASSERT(nullptr == shard.get(bravo, req));
+  CU_ASSERT(nullptr != shard.get(charlie, req));
+  CU_ASSERT(nullptr != shard.get(delta, req));
+
+  // Replacing the variant does not change the number of entries.
+  CU_ASSERT(0 == shard.put(delta, create_entry(50)));
+  CU_ASSERT(3 == shard.get_num_entries());
+
+  // The entry larger than the capacity is not stored, and removes the
+  // existing one.
+  CU_ASSERT(0 == shard.put(alpha, create_entry(1000000)));
+  CU_ASSERT(nullptr == shard.get(alpha, req));
+  CU_ASSERT(2 == shard.get_num_entries());
+
+  shard.remove(charlie);
+
+  CU_ASSERT(1 == shard.get_num_entries());
+  CU_ASSERT(node_size(delta, 50) == shard.get_size());
+}
+
+} // namespace shrpx
@@ -35,6 +35,7 @@
 #endif // HAVE_NETDB_H
 
 #include <cerrno>
+#include <tuple>
 
 #include "shrpx_upstream.h"
 #include "shrpx_http2_upstream.h"
@@ -42,12 +43,14 @@
 #include "shrpx_config.h"
 #include "shrpx_http_downstream_connection.h"
 #include "shrpx_http2_downstream_connection.h"
+#include "shrpx_pipelined_downstream_connection.h"
 #include "shrpx_tls.h"
 #include "shrpx_worker.h"
 #include "shrpx_downstream_connection_pool.h"
 #include "shrpx_downstream.h"
 #include "shrpx_http2_session.h"
 #include "shrpx_connect_blocker.h"
+#include "shrpx_load_balancer.h"
 #include "shrpx_api_downstream_connection.h"
 #include "shrpx_health_monitor_downstream_connection.h"
 #include "shrpx_log.h"
@@ -156,6 +159,12 @@ int ClientHandler::write_clear() {
 
     auto iovcnt = upstream_->response_riovec(iov.data(), iov.size());
     if (iovcnt == 0) {
+      if (!upstream_->response_empty()) {
+        // Response body moved by splice(2) is pending.  Wait for the
+        // connection to become writable.
+        return 0;
+      }
+
       break;
     }
 
@@ -188,10 +197,23 @@ int ClientHandler::tls_handshake() {
     return 0;
   }
 
+  auto &metrics = worker_->get_metrics();
+
   if (rv < 0) {
+    metrics_add(metrics.tls_handshakes_failed);
+
     return -1;
   }
 
+  if (SSL_session_reused(conn_.tls.ssl)) {
+    metrics_add(metrics.tls_handshakes_resumed);
+  } else {
+    metrics_add(metrics.tls_handshakes_full);
+  }
+
+  metrics.tls_handshake_duration.record(
+      static_cast<uint64_t>((ev_now(conn_.loop) - accept_time_) * 1000000));
+
   if (LOG_ENABLED(INFO)) {
     CLOG(INFO, this) << "SSL/TLS handshake completed";
   }
@@ -407,11 +429,13 @@ ClientHandler::ClientHandler(Worker *worker, int fd, SSL *ssl,
       faddr_(faddr),
       worker_(worker),
       left_connhd_len_(NGHTTP2_CLIENT_MAGIC_LEN),
+      accept_time_(ev_now(worker->get_loop())),
       affinity_hash_(0),
       should_close_after_write_(false),
       affinity_hash_computed_(false) {
 
   ++worker_->get_worker_stat()->num_connections;
+  metrics_add(worker_->get_metrics().connections_accepted);
 
   ev_timer_init(&reneg_shutdown_timer_, shutdowncb, 0., 0.);
 
@@ -422,6 +446,9 @@ ClientHandler::ClientHandler(Worker *worker, int fd, SSL *ssl,
 
   auto config = get_config();
 
+  conn_.tls_dyn_rec_adaptive = config->tls.dyn_rec.adaptive;
+  conn_.tls.private_key_op_queue = worker_->get_private_key_op_queue();
+
   if (faddr_->accept_proxy_protocol ||
       config->conn.upstream.accept_proxy_protocol) {
     read_ = &ClientHandler::read_clear;
@@ -668,16 +695,17 @@ void ClientHandler::pool_downstream_connection(
 }
 
 namespace {
-// Computes 32bits hash for session affinity for IP address |ip|.
-uint32_t compute_affinity_from_ip(const StringRef &ip) {
+// Computes 32bits hash for session affinity for |s|, which is client
+// IP address or request header field value.
+uint32_t compute_affinity_hash(const StringRef &s) {
   int rv;
   std::array<uint8_t, 32> buf;
 
-  rv = util::sha256(buf.data(), ip);
+  rv = util::sha256(buf.data(), s);
   if (rv != 0) {
     // Not sure when sha256 failed.  Just fall back to another
     // function.
-    return util::hash32(ip);
+    return util::hash32(s);
   }
 
   return (static_cast<uint32_t>(buf[0]) << 24) |
@@ -695,6 +723,11 @@ Http2Session *ClientHandler::get_http2_session(
                      << ", index=" << (addr - shared_addr->addrs.data());
   }
 
+  // Pick the session which has the least number of streams, and then
+  // the least number of bytes in flight.
+  Http2Session *best = nullptr;
+  size_t best_nstreams = 0, best_nbytes = 0;
+
   for (auto session = addr->http2_extra_freelist.head; session;) {
     auto next = session->dlnext;
 
@@ -711,20 +744,37 @@ Http2Session *ClientHandler::get_http2_session(
       continue;
     }
 
+    auto nstreams = session->get_num_dconns();
+    auto nbytes = session->get_num_inflight_bytes();
+
+    if (!best ||
+        std::tie(nstreams, nbytes) < std::tie(best_nstreams, best_nbytes)) {
+      best = session;
+      best_nstreams = nstreams;
+      best_nbytes = nbytes;
+    }
+
+    session = next;
+  }
+
+  if (best && !load_balancer_need_http2_session(
+                  addr->num_http2_session, addr->http2_sessions,
+                  best_nstreams, best->get_max_concurrent_streams())) {
     if (LOG_ENABLED(INFO)) {
-      CLOG(INFO, this) << "Use Http2Session " << session
-                       << " from http2_extra_freelist";
+      CLOG(INFO, this) << "Use Http2Session " << best
+                       << " from http2_extra_freelist, streams="
+                       << best_nstreams << ", inflight=" << best_nbytes;
     }
 
-    if (session->max_concurrency_reached(1)) {
+    if (best->max_concurrency_reached(1)) {
       if (LOG_ENABLED(INFO)) {
         CLOG(INFO, this) << "Maximum streams are reached for Http2Session("
-                         << session << ").";
+                         << best << ").";
       }
 
-      session->remove_from_freelist();
+      best->remove_from_freelist();
     }
-    return session;
+    return best;
   }
 
   auto session = new Http2Session(conn_.loop, worker_->get_cl_ssl_ctx(),
@@ -805,7 +855,7 @@ DownstreamAddr *ClientHandler::get_downstream_addr(int &err,
     switch (shared_addr->affinity.type) {
     case SessionAffinity::IP:
       if (!affinity_hash_computed_) {
-        affinity_hash_ = compute_affinity_from_ip(ipaddr_);
+        affinity_hash_ = compute_affinity_hash(ipaddr_);
         affinity_hash_computed_ = true;
       }
       hash = affinity_hash_;
@@ -813,42 +863,41 @@ DownstreamAddr *ClientHandler::get_downstream_addr(int &err,
     case SessionAffinity::COOKIE:
       hash = get_affinity_cookie(downstream, shared_addr->affinity.cookie.name);
       break;
+    case SessionAffinity::HEADER: {
+      auto kv = downstream->request().fs.header(
+          shared_addr->affinity.header.name);
+      if (kv && !kv->value.empty()) {
+        hash = compute_affinity_hash(kv->value);
+        break;
+      }
+      // Fall back to client IP address if header field is missing.
+      if (!affinity_hash_computed_) {
+        affinity_hash_ = compute_affinity_hash(ipaddr_);
+        affinity_hash_computed_ = true;
+      }
+      hash = affinity_hash_;
+      break;
+    }
     default:
       assert(0);
     }
 
-    const auto &affinity_hash = shared_addr->affinity_hash;
-
-    auto it = std::lower_bound(
-        std::begin(affinity_hash), std::end(affinity_hash), hash,
-        [](const AffinityHash &lhs, uint32_t rhs) { return lhs.hash < rhs; });
-
-    if (it == std::end(affinity_hash)) {
-      it = std::begin(affinity_hash);
+    auto addr = load_balancer_select_affinity(shared_addr.get(), hash);
+    if (addr == nullptr) {
+      err = -1;
+      return nullptr;
     }
 
-    auto aff_idx =
-        static_cast<size_t>(std::distance(std::begin(affinity_hash), it));
-    auto idx = (*it).idx;
-    auto addr = &shared_addr->addrs[idx];
+    return addr;
+  }
 
-    if (addr->connect_blocker->blocked()) {
-      size_t i;
-      for (i = aff_idx + 1; i != aff_idx; ++i) {
-        if (i == shared_addr->affinity_hash.size()) {
-          i = 0;
-        }
-        addr = &shared_addr->addrs[shared_addr->affinity_hash[i].idx];
-        if (addr->connect_blocker->blocked()) {
-          continue;
-        }
-        break;
-      }
-      if (i == aff_idx) {
-        err = -1;
-        return nullptr;
-      }
-      aff_idx = i;
+  if (shared_addr->balance != LoadBalancing::ROUND_ROBIN) {
+    auto addr = load_balancer_select(shared_addr.get(), worker_->get_randgen(),
+                                     ev_now(conn_.loop));
+    if (addr == nullptr) {
+      CLOG(INFO, this) << "No working downstream address found";
+      err = -1;
+      return nullptr;
     }
 
     return addr;
@@ -973,6 +1022,28 @@ ClientHandler::get_downstream_connection(int &err, Downstream *downstream) {
   }
 
   auto &group = groups[group_idx];
+
+  downstream->select_response_coding(group);
+
+  err = downstream->lookup_cache(group);
+  if (err != 0) {
+    return nullptr;
+  }
+
+  err = downstream->join_single_flight(group);
+  if (err != 0) {
+    return nullptr;
+  }
+
+  // Validators are added after joining single-flight, because the
+  // request which has them is not coalesced.
+  downstream->add_cache_validators();
+
+  err = downstream->acquire_concurrency_slot(group);
+  if (err != 0) {
+    return nullptr;
+  }
+
   auto addr = get_downstream_addr(err, group.get(), downstream);
   if (addr == nullptr) {
     return nullptr;
@@ -985,6 +1056,19 @@ ClientHandler::get_downstream_connection(int &err, Downstream *downstream) {
       return dconn;
     }
 
+    auto carrier = addr->http1_pipeline_freelist.head;
+    if (carrier && downstream->request_pipelinable()) {
+      if (LOG_ENABLED(INFO)) {
+        CLOG(INFO, this) << "Pipeline request on backend connection "
+                         << carrier;
+      }
+
+      dconn =
+          std::make_unique<PipelinedDownstreamConnection>(carrier, conn_.loop);
+      dconn->set_client_handler(this);
+      return dconn;
+    }
+
     if (worker_->get_connect_blocker()->blocked()) {
       if (LOG_ENABLED(INFO)) {
         DCLOG(INFO, this)
@@ -1015,6 +1099,54 @@ ClientHandler::get_downstream_connection(int &err, Downstream *downstream) {
   return dconn;
 }
 
+std::unique_ptr<DownstreamConnection>
+ClientHandler::get_hedge_downstream_connection(
+    const std::shared_ptr<DownstreamAddrGroup> &group,
+    const DownstreamAddr *exclude) {
+  auto &shared_addr = group->shared_addr;
+  auto balance = shared_addr->balance == LoadBalancing::ROUND_ROBIN
+                     ? LoadBalancing::LEAST_REQUEST
+                     : shared_addr->balance;
+  auto now = ev_now(conn_.loop);
+
+  DownstreamAddr *addr = nullptr;
+  double min_cost = 0.;
+
+  for (auto &a : shared_addr->addrs) {
+    if (&a == exclude || a.proto != Proto::HTTP1 ||
+        a.connect_blocker->blocked()) {
+      continue;
+    }
+
+    auto cost = load_balancer_get_cost(&a, balance, now);
+    if (!addr || cost < min_cost) {
+      addr = &a;
+      min_cost = cost;
+    }
+  }
+
+  if (!addr) {
+    if (LOG_ENABLED(INFO)) {
+      CLOG(INFO, this) << "No backend address available for hedged request";
+    }
+    return nullptr;
+  }
+
+  auto dconn = addr->dconn_pool->pop_downstream_connection();
+  if (!dconn) {
+    if (worker_->get_connect_blocker()->blocked()) {
+      return nullptr;
+    }
+
+    dconn = std::make_unique<HttpDownstreamConnection>(group, addr, conn_.loop,
+                                                       worker_);
+  }
+
+  dconn->set_client_handler(this);
+
+  return dconn;
+}
+
 MemchunkPool *ClientHandler::get_mcpool() { return worker_->get_mcpool(); }
 
 SSL *ClientHandler::get_ssl() const { return conn_.tls.ssl; }
@@ -1090,6 +1222,20 @@ void ClientHandler::write_accesslog(Downstream *downstream) {
     req.tstamp = lgconf->tstamp;
   }
 
+  auto request_end_time = std::chrono::high_resolution_clock::now();
+
+  auto request_start_time = downstream->get_request_start_time();
+  uint64_t duration_us = 0;
+  if (request_start_time.time_since_epoch().count() &&
+      request_end_time > request_start_time) {
+    duration_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                      request_end_time - request_start_time)
+                      .count();
+  }
+
+  metrics_record_request(worker_->get_metrics(),
+                         downstream->response().http_status, duration_us);
+
   upstream_accesslog(
       config->logging.access.format,
       LogSpec{
@@ -1098,7 +1244,7 @@ void ClientHandler::write_accesslog(Downstream *downstream) {
           alpn_,
           sni_,
           conn_.tls.ssl,
-          std::chrono::high_resolution_clock::now(), // request_end_time
+          request_end_time,
           port_,
           faddr_->port,
           config->pid,
@@ -108,6 +108,12 @@ public:
   // error code to |err|.
   std::unique_ptr<DownstreamConnection>
   get_downstream_connection(int &err, Downstream *downstream);
+  // Returns HTTP/1 backend connection to send hedged request to the
+  // least loaded address in |group| other than |exclude|.  This
+  // function returns nullptr if no such address is available.
+  std::unique_ptr<DownstreamConnection> get_hedge_downstream_connection(
+      const std::shared_ptr<DownstreamAddrGroup> &group,
+      const DownstreamAddr *exclude);
   MemchunkPool *get_mcpool();
   SSL *get_ssl() const;
   // Call this function when HTTP/2 connection header is received at
@@ -204,6 +210,8 @@ private:
   Worker *worker_;
   // The number of bytes of HTTP/2 client connection header to read
   size_t left_connhd_len_;
+  // The time when this connection was accepted.
+  ev_tstamp accept_time_;
   // hash for session affinity using client IP
   uint32_t affinity_hash_;
   bool should_close_after_write_;
@@ -0,0 +1,410 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_compress.h"
+
+#include <algorithm>
+
+#include <zlib.h>
+
+#ifdef HAVE_LIBBROTLIENC
+#  include <brotli/encode.h>
+#endif // HAVE_LIBBROTLIENC
+
+#include "shrpx_log.h"
+#include "util.h"
+
+namespace shrpx {
+
+namespace {
+// Strips leading and trailing OWS from |s|.
+StringRef trim_ows(const StringRef &s) {
+  auto first = std::begin(s);
+  auto last = std::end(s);
+
+  for (; first != last && (*first == ' ' || *first == '\t'); ++first)
+    ;
+  for (; first != last && (*(last - 1) == ' ' || *(last - 1) == '\t'); --last)
+    ;
+
+  return StringRef{first, last};
+}
+} // namespace
+
+namespace {
+// Parses qvalue |s| (RFC 7231, section 5.3.1), and returns it in
+// thousandths, or -1 if |s| is malformed.
+int parse_qvalue(const StringRef &s) {
+  auto first = std::begin(s);
+  auto last = std::end(s);
+
+  if (first == last || (*first != '0' && *first != '1')) {
+    return -1;
+  }
+
+  int q = (*first++ - '0') * 1000;
+
+  if (first == last) {
+    return q;
+  }
+
+  if (*first++ != '.' || last - first > 3) {
+    return -1;
+  }
+
+  for (int mul = 100; first != last; ++first, mul /= 10) {
+    if (!util::is_digit(*first)) {
+      return -1;
+    }
+    q += (*first - '0') * mul;
+  }
+
+  if (q > 1000) {
+    return -1;
+  }
+
+  return q;
+}
+} // namespace
+
+ContentCoding compress_select_coding(const StringRef &accept_encoding) {
+  // -1 means that the coding is not listed.
+  int gzip_q = -1;
+  int br_q = -1;
+  int any_q = -1;
+
+  for (auto &elem : util::split_str(accept_encoding, ',')) {
+    auto semi = std::find(std::begin(elem), std::end(elem), ';');
+    auto coding = trim_ows(StringRef{std::begin(elem), semi});
+    if (coding.empty()) {
+      continue;
+    }
+
+    auto q = 1000;
+
+    if (semi != std::end(elem)) {
+      for (auto &param :
+           util::split_str(StringRef{semi + 1, std::end(elem)}, ';')) {
+        param = trim_ows(param);
+        if (util::istarts_with_l(param, "q=")) {
+          q = parse_qvalue(
+              StringRef{std::begin(param) + str_size("q="), std::end(param)});
+        }
+      }
+    }
+
+    if (q == -1) {
+      continue;
+    }
+
+    if (util::strieq_l("gzip", coding) || util::strieq_l("x-gzip", coding)) {
+      gzip_q = std::max(gzip_q, q);
+    } else if (util::strieq_l("br", coding)) {
+      br_q = std::max(br_q, q);
+    } else if (coding == StringRef::from_lit("*")) {
+      any_q = std::max(any_q, q);
+    }
+  }
+
+  if (gzip_q == -1) {
+    gzip_q = any_q;
+  }
+  if (br_q == -1) {
+    br_q = any_q;
+  }
+
+#ifdef HAVE_LIBBROTLIENC
+  if (br_q > 0 && br_q >= gzip_q) {
+    return ContentCoding::BROTLI;
+  }
+#endif // HAVE_LIBBROTLIENC
+
+  if (gzip_q > 0) {
+    return ContentCoding::GZIP;
+  }
+
+  return ContentCoding::IDENTITY;
+}
+
+bool compress_content_type(const StringRef &content_type) {
+  auto media_type = trim_ows(
+      StringRef{std::begin(content_type),
+                std::find(std::begin(content_type), std::end(content_type),
+                          ';')});
+
+  if (util::istarts_with_l(media_type, "text/")) {
+    // Event stream must be delivered as soon as each event arrives,
+    // which does not work well with the buffering in compressor.
+    return !util::strieq_l("text/event-stream", media_type);
+  }
+
+  return util::strieq_l("application/json", media_type) ||
+         util::strieq_l("application/javascript", media_type) ||
+         util::strieq_l("application/x-javascript", media_type) ||
+         util::strieq_l("application/xml", media_type) ||
+         util::strieq_l("application/wasm", media_type) ||
+         util::iends_with_l(media_type, "+json") ||
+         util::iends_with_l(media_type, "+xml");
+}
+
+bool compress_vary_covered(const StringRef &vary) {
+  for (auto &f : util::split_str(vary, ',')) {
+    auto name = trim_ows(f);
+    if (name == StringRef::from_lit("*") ||
+        util::strieq_l("accept-encoding", name)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+int compress_level(ContentCoding coding, int64_t content_length) {
+  if (content_length != -1 && content_length <= static_cast<int64_t>(64_k)) {
+    return coding == ContentCoding::BROTLI ? 5 : 6;
+  }
+
+  if (content_length == -1 || content_length <= static_cast<int64_t>(1_m)) {
+    return 4;
+  }
+
+  return 1;
+}
+
+StringRef compress_coding_name(ContentCoding coding) {
+  switch (coding) {
+  case ContentCoding::GZIP:
+    return StringRef::from_lit("gzip");
+  case ContentCoding::BROTLI:
+    return StringRef::from_lit("br");
+  default:
+    return StringRef::from_lit("identity");
+  }
+}
+
+namespace {
+// Returns the chunk which compressed data is written to.  It is the
+// tail chunk of |out| if it has free space.  Otherwise, new chunk is
+// obtained from the pool of |out|.
+Memchunk16K *get_output_chunk(DefaultMemchunks &out) {
+  if (out.wleft()) {
+    return out.tail;
+  }
+
+  return out.pool->get();
+}
+} // namespace
+
+namespace {
+// Commits |n| bytes written to |chunk| which is returned from
+// get_output_chunk.  New chunk is appended to |out| if data are
+// written to it, and is returned to the pool otherwise.
+void commit_output_chunk(DefaultMemchunks &out, Memchunk16K *chunk, size_t n) {
+  if (chunk == out.tail) {
+    out.write(n);
+    return;
+  }
+
+  if (n == 0) {
+    out.pool->recycle(chunk);
+    return;
+  }
+
+  chunk->last += n;
+  out.append_chunk(chunk);
+}
+} // namespace
+
+namespace {
+// The window size of gzip compressor in bits.  Together with
+// GZIP_MEM_LEVEL, the memory used by deflate is about 128KiB per
+// stream.
+constexpr int GZIP_WINDOW_BITS = 14;
+constexpr int GZIP_MEM_LEVEL = 7;
+} // namespace
+
+namespace {
+class GzipCompressor : public ResponseCompressor {
+public:
+  GzipCompressor() : strm_{}, initialized_(false) {}
+  virtual ~GzipCompressor() {
+    if (initialized_) {
+      deflateEnd(&strm_);
+    }
+  }
+
+  int init(int level) {
+    // Adding 16 to windowBits writes gzip header and trailer.
+    if (deflateInit2(&strm_, level, Z_DEFLATED, GZIP_WINDOW_BITS + 16,
+                     GZIP_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+      return -1;
+    }
+
+    initialized_ = true;
+
+    return 0;
+  }
+
+  virtual int compress(DefaultMemchunks &out, const uint8_t *data, size_t len,
+                       bool finish) {
+    strm_.next_in = const_cast<uint8_t *>(data);
+    strm_.avail_in = len;
+
+    for (;;) {
+      auto chunk = get_output_chunk(out);
+
+      strm_.next_out = chunk->last;
+      strm_.avail_out = chunk->left();
+
+      auto rv = deflate(&strm_, finish ? Z_FINISH : Z_NO_FLUSH);
+
+      commit_output_chunk(out, chunk, strm_.next_out - chunk->last);
+
+      if (rv == Z_STREAM_ERROR) {
+        return -1;
+      }
+
+      if (finish) {
+        if (rv == Z_STREAM_END) {
+          return 0;
+        }
+        continue;
+      }
+
+      // deflate has consumed all input if it leaves output space.
+      if (strm_.avail_out > 0) {
+        return 0;
+      }
+    }
+  }
+
+private:
+  z_stream strm_;
+  bool initialized_;
+};
+} // namespace
+
+#ifdef HAVE_LIBBROTLIENC
+namespace {
+// The window size of brotli compressor in bits.  It bounds the ring
+// buffer of the compressor to 64KiB per stream.
+constexpr uint32_t BROTLI_WINDOW_BITS = 16;
+} // namespace
+
+namespace {
+class BrotliCompressor : public ResponseCompressor {
+public:
+  BrotliCompressor() : state_(nullptr) {}
+  virtual ~BrotliCompressor() {
+    if (state_) {
+      BrotliEncoderDestroyInstance(state_);
+    }
+  }
+
+  int init(int level, int64_t content_length) {
+    state_ = BrotliEncoderCreateInstance(nullptr, nullptr, nullptr);
+    if (!state_) {
+      return -1;
+    }
+
+    if (!BrotliEncoderSetParameter(state_, BROTLI_PARAM_QUALITY, level) ||
+        !BrotliEncoderSetParameter(state_, BROTLI_PARAM_LGWIN,
+                                   BROTLI_WINDOW_BITS)) {
+      return -1;
+    }
+
+    // Size hint lets the encoder allocate smaller buffers for short
+    // body.
+    if (content_length != -1 &&
+        !BrotliEncoderSetParameter(
+            state_, BROTLI_PARAM_SIZE_HINT,
+            std::min(content_length, static_cast<int64_t>(1_g)))) {
+      return -1;
+    }
+
+    return 0;
+  }
+
+  virtual int compress(DefaultMemchunks &out, const uint8_t *data, size_t len,
+                       bool finish) {
+    auto op = finish ? BROTLI_OPERATION_FINISH : BROTLI_OPERATION_PROCESS;
+    auto next_in = data;
+    auto avail_in = len;
+
+    for (;;) {
+      auto chunk = get_output_chunk(out);
+
+      auto next_out = chunk->last;
+      auto avail_out = chunk->left();
+
+      auto rv = BrotliEncoderCompressStream(state_, op, &avail_in, &next_in,
+                                            &avail_out, &next_out, nullptr);
+
+      commit_output_chunk(out, chunk, next_out - chunk->last);
+
+      if (!rv) {
+        return -1;
+      }
+
+      if (avail_in == 0 && !BrotliEncoderHasMoreOutput(state_) &&
+          (!finish || BrotliEncoderIsFinished(state_))) {
+        return 0;
+      }
+    }
+  }
+
+private:
+  BrotliEncoderState *state_;
+};
+} // namespace
+#endif // HAVE_LIBBROTLIENC
+
+std::unique_ptr<ResponseCompressor>
+create_response_compressor(ContentCoding coding, int level,
+                           int64_t content_length) {
+  switch (coding) {
+  case ContentCoding::GZIP: {
+    auto compressor = std::make_unique<GzipCompressor>();
+    if (compressor->init(level) != 0) {
+      LOG(ERROR) << "deflateInit2() failed";
+      return nullptr;
+    }
+    return compressor;
+  }
+#ifdef HAVE_LIBBROTLIENC
+  case ContentCoding::BROTLI: {
+    auto compressor = std::make_unique<BrotliCompressor>();
+    if (compressor->init(level, content_length) != 0) {
+      LOG(ERROR) << "Could not initialize brotli encoder";
+      return nullptr;
+    }
+    return compressor;
+  }
+#endif // HAVE_LIBBROTLIENC
+  default:
+    return nullptr;
+  }
+}
+
+} // namespace shrpx
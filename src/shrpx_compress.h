@@ -0,0 +1,101 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHRPX_COMPRESS_H
+#define SHRPX_COMPRESS_H
+
+#include "shrpx.h"
+
+#include <memory>
+
+#include "memchunk.h"
+#include "template.h"
+
+using namespace nghttp2;
+
+namespace shrpx {
+
+enum class ContentCoding {
+  IDENTITY,
+  GZIP,
+  // Only available if nghttpx is built with libbrotlienc.
+  BROTLI,
+};
+
+// The response body shorter than this is not compressed because the
+// coding overhead outweighs the saving.
+constexpr int64_t COMPRESS_MIN_LENGTH = 256;
+
+// Returns the content-coding which the response body is compressed
+// with, selected from the value of Accept-Encoding request header
+// field |accept_encoding|.  The coding with the highest qvalue is
+// chosen, and brotli is preferred to gzip if they are equal.
+// ContentCoding::IDENTITY is returned if neither of them is
+// acceptable.
+ContentCoding compress_select_coding(const StringRef &accept_encoding);
+
+// Returns true if the media type in the value of Content-Type header
+// field |content_type| is worth compressing.
+bool compress_content_type(const StringRef &content_type);
+
+// Returns true if the value of Vary header field |vary| already
+// covers Accept-Encoding, that is, it lists Accept-Encoding or "*".
+bool compress_vary_covered(const StringRef &vary);
+
+// Returns the compression level of |coding| for the response body of
+// length |content_length|, or -1 if it is unknown.  Small body is
+// compressed hard because it costs little CPU time in total, and
+// large body is compressed fast to keep the cost per byte low.
+int compress_level(ContentCoding coding, int64_t content_length);
+
+// Returns the token of |coding| in Content-Encoding header field.
+StringRef compress_coding_name(ContentCoding coding);
+
+// ResponseCompressor compresses the response body in streaming
+// fashion.  The memory used by the compressor is bounded by its
+// window, regardless of the length of response body.
+class ResponseCompressor {
+public:
+  virtual ~ResponseCompressor() {}
+  // Compresses |data| of length |len|, and appends the output to
+  // |out|.  The output is written directly to the free space of the
+  // tail chunk of |out|, and to the chunks obtained from its pool,
+  // which are appended without copying.  The compressor may buffer
+  // the input internally.  If |finish| is true, all buffered data
+  // are flushed, and the compressed stream is ended.  This function
+  // returns 0 if it succeeds, or -1.
+  virtual int compress(DefaultMemchunks &out, const uint8_t *data, size_t len,
+                       bool finish) = 0;
+};
+
+// Creates ResponseCompressor for |coding| with compression |level|.
+// |content_length| is the length of the uncompressed body, or -1 if
+// it is unknown.  This function returns nullptr if it fails.
+std::unique_ptr<ResponseCompressor>
+create_response_compressor(ContentCoding coding, int level,
+                           int64_t content_length);
+
+} // namespace shrpx
+
+#endif // SHRPX_COMPRESS_H
@@ -0,0 +1,173 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_compress_test.h"
+
+#include <string>
+
+#include <zlib.h>
+
+#include <CUnit/CUnit.h>
+
+#include "shrpx_compress.h"
+
+namespace shrpx {
+
+void test_shrpx_compress_select_coding(void) {
+  CU_ASSERT(ContentCoding::IDENTITY ==
+            compress_select_coding(StringRef::from_lit("")));
+  CU_ASSERT(ContentCoding::IDENTITY ==
+            compress_select_coding(StringRef::from_lit("identity")));
+  CU_ASSERT(ContentCoding::GZIP ==
+            compress_select_coding(StringRef::from_lit("deflate, gzip")));
+  CU_ASSERT(ContentCoding::GZIP ==
+            compress_select_coding(StringRef::from_lit("X-GZIP")));
+  CU_ASSERT(ContentCoding::GZIP ==
+            compress_select_coding(StringRef::from_lit("gzip ; q=0.5")));
+  CU_ASSERT(ContentCoding::IDENTITY ==
+            compress_select_coding(StringRef::from_lit("gzip;q=0")));
+  CU_ASSERT(ContentCoding::IDENTITY ==
+            compress_select_coding(StringRef::from_lit("gzip;q=0.000")));
+  // Malformed qvalue is ignored.
+  CU_ASSERT(ContentCoding::IDENTITY ==
+            compress_select_coding(StringRef::from_lit("gzip;q=2")));
+  CU_ASSERT(ContentCoding::IDENTITY ==
+            compress_select_coding(StringRef::from_lit("gzip;q=0.1234")));
+  CU_ASSERT(ContentCoding::IDENTITY ==
+            compress_select_coding(StringRef::from_lit("*;q=0, deflate")));
+
+#ifdef HAVE_LIBBROTLIENC
+  CU_ASSERT(ContentCoding::BROTLI ==
+            compress_select_coding(StringRef::from_lit("gzip, deflate, br")));
+  CU_ASSERT(ContentCoding::BROTLI ==
+            compress_select_coding(StringRef::from_lit("*")));
+  CU_ASSERT(ContentCoding::GZIP ==
+            compress_select_coding(StringRef::from_lit("gzip, br;q=0.9")));
+  CU_ASSERT(ContentCoding::GZIP ==
+            compress_select_coding(StringRef::from_lit("*, br;q=0")));
+  CU_ASSERT(ContentCoding::BROTLI ==
+            compress_select_coding(StringRef::from_lit("*, gzip;q=0")));
+#else  // !HAVE_LIBBROTLIENC
+  CU_ASSERT(ContentCoding::GZIP ==
+            compress_select_coding(StringRef::from_lit("gzip, deflate, br")));
+  CU_ASSERT(ContentCoding::GZIP ==
+            compress_select_coding(StringRef::from_lit("*")));
+  CU_ASSERT(ContentCoding::IDENTITY ==
+            compress_select_coding(StringRef::from_lit("br")));
+  CU_ASSERT(ContentCoding::IDENTITY ==
+            compress_select_coding(StringRef::from_lit("*, gzip;q=0")));
+#endif // !HAVE_LIBBROTLIENC
+}
+
+void test_shrpx_compress_content_type(void) {
+  CU_ASSERT(compress_content_type(StringRef::from_lit("text/html")));
+  CU_ASSERT(
+      compress_content_type(StringRef::from_lit("Text/Plain; charset=utf-8")));
+  CU_ASSERT(compress_content_type(StringRef::from_lit("application/json")));
+  CU_ASSERT(
+      compress_content_type(StringRef::from_lit("application/javascript")));
+  CU_ASSERT(compress_content_type(StringRef::from_lit("image/svg+xml")));
+  CU_ASSERT(compress_content_type(
+      StringRef::from_lit("application/problem+json ;charset=utf-8")));
+  CU_ASSERT(compress_content_type(StringRef::from_lit("application/wasm")));
+  CU_ASSERT(!compress_content_type(StringRef::from_lit("text/event-stream")));
+  CU_ASSERT(!compress_content_type(StringRef::from_lit("image/png")));
+  CU_ASSERT(
+      !compress_content_type(StringRef::from_lit("application/octet-stream")));
+  CU_ASSERT(!compress_content_type(StringRef::from_lit("")));
+}
+
+void test_shrpx_compress_vary_covered(void) {
+  CU_ASSERT(compress_vary_covered(StringRef::from_lit("Accept-Encoding")));
+  CU_ASSERT(compress_vary_covered(
+      StringRef::from_lit("accept-language , accept-encoding")));
+  CU_ASSERT(compress_vary_covered(StringRef::from_lit("*")));
+  CU_ASSERT(!compress_vary_covered(StringRef::from_lit("accept-language")));
+  CU_ASSERT(!compress_vary_covered(StringRef::from_lit("")));
+}
+
+void test_shrpx_compress_level(void) {
+  CU_ASSERT(6 == compress_level(ContentCoding::GZIP, 1000));
+  CU_ASSERT(5 == compress_level(ContentCoding::BROTLI, 64_k));
+  CU_ASSERT(4 == compress_level(ContentCoding::GZIP, 64_k + 1));
+  CU_ASSERT(4 == compress_level(ContentCoding::BROTLI, -1));
+  CU_ASSERT(4 == compress_level(ContentCoding::GZIP, 1_m));
+  CU_ASSERT(1 == compress_level(ContentCoding::GZIP, 1_m + 1));
+  CU_ASSERT(1 == compress_level(ContentCoding::BROTLI, 100_m));
+}
+
+void test_shrpx_compress_gzip(void) {
+  MemchunkPool pool;
+  DefaultMemchunks out(&pool);
+
+  std::string body;
+  for (size_t i = 0; body.size() < 100_k; ++i) {
+    body += "{\"id\":";
+    body += std::to_string(i);
+    body += ",\"name\":\"nghttpx\"},";
+  }
+
+  auto compressor = create_response_compressor(ContentCoding::GZIP, 6, -1);
+
+  CU_ASSERT_FATAL(compressor != nullptr);
+
+  auto p = reinterpret_cast<const uint8_t *>(body.c_str());
+  auto end = p + body.size();
+
+  for (; p != end;) {
+    auto n = std::min(static_cast<size_t>(end - p), static_cast<size_t>(5000));
+
+    CU_ASSERT(0 == compressor->compress(out, p, n, false));
+
+    p += n;
+  }
+
+  CU_ASSERT(0 == compressor->compress(out, nullptr, 0, true));
+  CU_ASSERT(out.rleft() > 0);
+  CU_ASSERT(out.rleft() < body.size() / 4);
+
+  std::string compressed(out.rleft(), '\0');
+  out.remove(&compressed[0], compressed.size());
+
+  std::string decompressed(body.size() + 1, '\0');
+
+  z_stream zst{};
+
+  CU_ASSERT_FATAL(Z_OK == inflateInit2(&zst, 15 + 16));
+
+  zst.next_in = reinterpret_cast<uint8_t *>(&compressed[0]);
+  zst.avail_in = compressed.size();
+  zst.next_out = reinterpret_cast<uint8_t *>(&decompressed[0]);
+  zst.avail_out = decompressed.size();
+
+  CU_ASSERT(Z_STREAM_END == inflate(&zst, Z_FINISH));
+
+  decompressed.resize(decompressed.size() - zst.avail_out);
+
+  inflateEnd(&zst);
+
+  CU_ASSERT(body == decompressed);
+}
+
+} // namespace shrpx
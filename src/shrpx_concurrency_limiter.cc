@@ -0,0 +1,211 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_concurrency_limiter.h"
+
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+
+#include "shrpx_downstream.h"
+#include "shrpx_upstream.h"
+#include "shrpx_client_handler.h"
+#include "shrpx_log.h"
+
+namespace shrpx {
+
+namespace {
+// The number of samples which the long term average of latency
+// roughly covers.
+constexpr double LONG_RTT_WINDOW = 100.;
+// The ratio of latency increase which is tolerated before the limit
+// is decreased.
+constexpr double RTT_TOLERANCE = 1.5;
+// The weight of a new limit.
+constexpr double LIMIT_SMOOTHING = 0.2;
+} // namespace
+
+GradientLimit::GradientLimit()
+    : limit_(CONCURRENCY_LIMIT_INITIAL), long_rtt_(0.) {}
+
+void GradientLimit::update(ev_tstamp rtt, size_t inflight) {
+  if (rtt <= 0.) {
+    return;
+  }
+
+  if (long_rtt_ == 0.) {
+    long_rtt_ = rtt;
+  } else {
+    long_rtt_ += (rtt - long_rtt_) / LONG_RTT_WINDOW;
+
+    // If latency drops sharply, the average is far from the current
+    // state.  Let it catch up faster.
+    if (long_rtt_ / rtt > 2.) {
+      long_rtt_ *= 0.95;
+    }
+  }
+
+  // The backend is not utilized enough to tell whether it is
+  // overloaded or not.
+  if (static_cast<double>(inflight) < limit_ / 2) {
+    return;
+  }
+
+  auto gradient =
+      std::max(0.5, std::min(1., RTT_TOLERANCE * long_rtt_ / rtt));
+  auto new_limit = limit_ * gradient + std::sqrt(limit_);
+
+  limit_ = limit_ * (1 - LIMIT_SMOOTHING) + new_limit * LIMIT_SMOOTHING;
+  limit_ = std::max(CONCURRENCY_LIMIT_MIN,
+                    std::min(CONCURRENCY_LIMIT_MAX, limit_));
+}
+
+size_t GradientLimit::get_limit() const {
+  return static_cast<size_t>(limit_);
+}
+
+ev_tstamp GradientLimit::get_long_rtt() const { return long_rtt_; }
+
+namespace {
+void queuecb(struct ev_loop *loop, ev_timer *w, int revents) {
+  auto limiter = static_cast<ConcurrencyLimiter *>(w->data);
+  limiter->process_queue();
+}
+} // namespace
+
+ConcurrencyLimiter::ConcurrencyLimiter(struct ev_loop *loop,
+                                       ev_tstamp queue_timeout)
+    : loop_(loop), queue_timeout_(queue_timeout), num_inflight_(0) {
+  ev_timer_init(&timer_, queuecb, 0., 0.);
+  timer_.data = this;
+}
+
+ConcurrencyLimiter::~ConcurrencyLimiter() {
+  ev_timer_stop(loop_, &timer_);
+
+  // Downstream holds a reference to this object while it is queued,
+  // so the queue must be empty here.
+  assert(queue_.head == nullptr);
+}
+
+bool ConcurrencyLimiter::try_acquire() {
+  if (queue_.head || num_inflight_ >= limit_.get_limit()) {
+    return false;
+  }
+
+  ++num_inflight_;
+
+  return true;
+}
+
+void ConcurrencyLimiter::release() {
+  assert(num_inflight_ > 0);
+
+  --num_inflight_;
+
+  if (queue_.head) {
+    // Do not admit queued request here because we may be in the
+    // middle of the request processing of the other Downstream.
+    schedule(0.);
+  }
+}
+
+bool ConcurrencyLimiter::enqueue(AdmissionLink *link) {
+  // The queue holds at most as many requests as the limit, so that
+  // waiting time is at most twice as long as the latency.
+  if (queue_timeout_ == 0. || queue_.len >= limit_.get_limit()) {
+    return false;
+  }
+
+  link->deadline = ev_now(loop_) + queue_timeout_;
+
+  if (!queue_.head) {
+    schedule(queue_timeout_);
+  }
+
+  queue_.append(link);
+
+  return true;
+}
+
+void ConcurrencyLimiter::remove(AdmissionLink *link) { queue_.remove(link); }
+
+void ConcurrencyLimiter::update(ev_tstamp rtt) {
+  limit_.update(rtt, num_inflight_);
+
+  if (queue_.head && num_inflight_ < limit_.get_limit()) {
+    schedule(0.);
+  }
+}
+
+void ConcurrencyLimiter::process_queue() {
+  // Deleting ClientHandler may drop the last reference to this
+  // object if the backend configuration has been replaced.
+  auto self = shared_from_this();
+  auto now = ev_now(loop_);
+
+  for (auto link = queue_.head; link; link = queue_.head) {
+    auto admitted = link->deadline > now;
+    if (admitted && num_inflight_ >= limit_.get_limit()) {
+      break;
+    }
+
+    queue_.remove(link);
+
+    auto downstream = link->downstream;
+
+    if (admitted) {
+      ++num_inflight_;
+    } else if (LOG_ENABLED(INFO)) {
+      DLOG(INFO, downstream) << "Request waited too long in queue";
+    }
+
+    downstream->set_admitted(admitted);
+
+    auto upstream = downstream->get_upstream();
+    if (upstream->on_downstream_admitted(downstream) != 0) {
+      delete upstream->get_client_handler();
+    }
+  }
+
+  if (queue_.head) {
+    schedule(queue_.head->deadline - now);
+  } else {
+    ev_timer_stop(loop_, &timer_);
+  }
+}
+
+void ConcurrencyLimiter::schedule(ev_tstamp t) {
+  ev_timer_stop(loop_, &timer_);
+  ev_timer_set(&timer_, t, 0.);
+  ev_timer_start(loop_, &timer_);
+}
+
+size_t ConcurrencyLimiter::get_limit() const { return limit_.get_limit(); }
+
+size_t ConcurrencyLimiter::get_num_inflight() const { return num_inflight_; }
+
+size_t ConcurrencyLimiter::get_num_queued() const { return queue_.len; }
+
+} // namespace shrpx
@@ -0,0 +1,128 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHRPX_CONCURRENCY_LIMITER_H
+#define SHRPX_CONCURRENCY_LIMITER_H
+
+#include "shrpx.h"
+
+#include <memory>
+
+#include <ev.h>
+
+#include "template.h"
+
+using namespace nghttp2;
+
+namespace shrpx {
+
+class Downstream;
+
+// The concurrency limit which GradientLimit starts with.
+constexpr double CONCURRENCY_LIMIT_INITIAL = 20.;
+constexpr double CONCURRENCY_LIMIT_MIN = 1.;
+constexpr double CONCURRENCY_LIMIT_MAX = 1000.;
+
+// GradientLimit estimates the number of concurrent requests which a
+// backend group can serve without queueing them.  It compares the
+// long term average of response latency with a new sample.  If the
+// sample is larger than the average, the backend starts queueing
+// requests, and the limit is decreased in proportion to the ratio.
+// Otherwise, the limit is increased by its square root.
+class GradientLimit {
+public:
+  GradientLimit();
+
+  // Updates the limit with the response latency |rtt| observed when
+  // |inflight| requests are outstanding.
+  void update(ev_tstamp rtt, size_t inflight);
+  // Returns the current limit.  It is at least 1.
+  size_t get_limit() const;
+  ev_tstamp get_long_rtt() const;
+
+private:
+  double limit_;
+  // Exponentially weighted moving average of response latency.
+  ev_tstamp long_rtt_;
+};
+
+// Link entry in the wait queue of ConcurrencyLimiter.  Downstream
+// owns this object, so that it can leave the queue in O(1) when it is
+// deleted.
+struct AdmissionLink {
+  Downstream *downstream;
+  // The time when the request is rejected if it is still queued.
+  ev_tstamp deadline;
+  AdmissionLink *dlnext, *dlprev;
+};
+
+// ConcurrencyLimiter limits the number of outstanding requests to a
+// backend group to the limit estimated by GradientLimit.  The requests
+// which exceed the limit wait in FIFO queue for at most
+// |queue_timeout|.  If |queue_timeout| is 0, or queue is full, they
+// are rejected immediately.  ConcurrencyLimiter is private to a
+// worker.
+class ConcurrencyLimiter
+    : public std::enable_shared_from_this<ConcurrencyLimiter> {
+public:
+  ConcurrencyLimiter(struct ev_loop *loop, ev_tstamp queue_timeout);
+  ~ConcurrencyLimiter();
+
+  // Takes a slot for a new request if the number of outstanding
+  // requests is below the limit, and no request is queued.  Returns
+  // true if it succeeds.
+  bool try_acquire();
+  // Returns the slot taken by try_acquire() or given to queued
+  // request.  This may admit queued requests asynchronously.
+  void release();
+  // Appends |link| to the wait queue.  Returns false if the request
+  // cannot wait, and it should be rejected.
+  bool enqueue(AdmissionLink *link);
+  // Removes |link| from the wait queue.
+  void remove(AdmissionLink *link);
+  // Updates the limit with the response latency |rtt|.
+  void update(ev_tstamp rtt);
+  // Admits the queued requests while slots are available, and
+  // rejects the ones which waited too long.
+  void process_queue();
+
+  size_t get_limit() const;
+  size_t get_num_inflight() const;
+  size_t get_num_queued() const;
+
+private:
+  // Schedules process_queue() to be called in |t| seconds.
+  void schedule(ev_tstamp t);
+
+  DList<AdmissionLink> queue_;
+  GradientLimit limit_;
+  ev_timer timer_;
+  struct ev_loop *loop_;
+  ev_tstamp queue_timeout_;
+  size_t num_inflight_;
+};
+
+} // namespace shrpx
+
+#endif // SHRPX_CONCURRENCY_LIMITER_H
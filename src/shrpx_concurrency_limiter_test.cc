@@ -0,0 +1,123 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_concurrency_limiter_test.h"
+
+#include <CUnit/CUnit.h>
+
+#include "shrpx_concurrency_limiter.h"
+#include "shrpx_log.h"
+
+namespace shrpx {
+
+void test_shrpx_gradient_limit(void) {
+  GradientLimit gl;
+
+  CU_ASSERT(CONCURRENCY_LIMIT_INITIAL == gl.get_limit());
+
+  // The limit is not changed if the backend is not utilized enough.
+  for (size_t i = 0; i < 100; ++i) {
+    gl.update(0.1, 1);
+  }
+
+  CU_ASSERT(CONCURRENCY_LIMIT_INITIAL == gl.get_limit());
+  CU_ASSERT(0.1 == gl.get_long_rtt());
+
+  // The limit grows while latency is stable.
+  for (size_t i = 0; i < 10; ++i) {
+    gl.update(0.1, gl.get_limit());
+  }
+
+  auto limit = gl.get_limit();
+
+  CU_ASSERT(limit > CONCURRENCY_LIMIT_INITIAL);
+
+  // The limit shrinks if latency grows.
+  for (size_t i = 0; i < 10; ++i) {
+    gl.update(1., gl.get_limit());
+  }
+
+  CU_ASSERT(gl.get_limit() < limit);
+
+  for (size_t i = 0; i < 1000; ++i) {
+    gl.update(100., gl.get_limit());
+  }
+
+  CU_ASSERT(gl.get_limit() >= CONCURRENCY_LIMIT_MIN);
+
+  for (size_t i = 0; i < 1000; ++i) {
+    gl.update(0.001, gl.get_limit());
+  }
+
+  CU_ASSERT(CONCURRENCY_LIMIT_MAX == gl.get_limit());
+}
+
+void test_shrpx_concurrency_limiter(void) {
+  auto loop = EV_DEFAULT;
+
+  {
+    ConcurrencyLimiter limiter(loop, 0.);
+    AdmissionLink link{};
+
+    for (size_t i = 0; i < CONCURRENCY_LIMIT_INITIAL; ++i) {
+      CU_ASSERT(limiter.try_acquire());
+    }
+
+    CU_ASSERT(!limiter.try_acquire());
+    CU_ASSERT(CONCURRENCY_LIMIT_INITIAL == limiter.get_num_inflight());
+    // Requests are rejected immediately without queue timeout.
+    CU_ASSERT(!limiter.enqueue(&link));
+
+    limiter.release();
+
+    CU_ASSERT(limiter.try_acquire());
+  }
+
+  {
+    ConcurrencyLimiter limiter(loop, 1.);
+    AdmissionLink link1{}, link2{};
+
+    for (size_t i = 0; i < CONCURRENCY_LIMIT_INITIAL; ++i) {
+      CU_ASSERT(limiter.try_acquire());
+    }
+
+    CU_ASSERT(limiter.enqueue(&link1));
+    CU_ASSERT(limiter.enqueue(&link2));
+    CU_ASSERT(2 == limiter.get_num_queued());
+    CU_ASSERT(ev_now(loop) + 1. == link1.deadline);
+
+    limiter.release();
+
+    // A new request must not overtake the queued ones.
+    CU_ASSERT(!limiter.try_acquire());
+
+    limiter.remove(&link1);
+    limiter.remove(&link2);
+
+    CU_ASSERT(0 == limiter.get_num_queued());
+    CU_ASSERT(limiter.try_acquire());
+  }
+}
+
+} // namespace shrpx
@@ -56,6 +56,7 @@
 #include "shrpx_log.h"
 #include "shrpx_tls.h"
 #include "shrpx_http.h"
+#include "shrpx_load_balancer.h"
 #ifdef HAVE_MRUBY
 #  include "shrpx_mruby.h"
 #endif // HAVE_MRUBY
@@ -540,6 +541,11 @@ LogFragmentType log_var_lookup_token(const char *name, size_t namelen) {
         return LogFragmentType::TLS_SESSION_REUSED;
       }
       break;
+    case 'e':
+      if (util::strieq_l("backend_queue_tim", name, 17)) {
+        return LogFragmentType::BACKEND_QUEUE_TIME;
+      }
+      break;
     case 'y':
       if (util::strieq_l("path_without_quer", name, 17)) {
         return LogFragmentType::PATH_WITHOUT_QUERY;
@@ -665,8 +671,10 @@ std::vector<LogFragment> parse_log_format(BlockAllocator &balloc,
 
     literal_start = p;
 
+    auto name = make_string_ref(balloc, StringRef{var_name, var_namelen});
+
     if (value == nullptr) {
-      res.emplace_back(type);
+      res.emplace_back(type, StringRef::from_lit(""), name);
       continue;
     }
 
@@ -681,7 +689,7 @@ std::vector<LogFragment> parse_log_format(BlockAllocator &balloc,
         }
       }
       *p = '\0';
-      res.emplace_back(type, StringRef{iov.base, p});
+      res.emplace_back(type, StringRef{iov.base, p}, name);
     }
   }
 
@@ -839,11 +847,20 @@ struct DownstreamParams {
   StringRef sni;
   StringRef mruby;
   StringRef group;
+  StringRef single_flight_key;
   AffinityConfig affinity;
+  LoadBalancing balance;
+  HedgeConfig hedge;
+  int32_t retry_budget;
+  ev_tstamp queue_timeout;
   ev_tstamp read_timeout;
   ev_tstamp write_timeout;
   size_t fall;
   size_t rise;
+  size_t pool_min_idle;
+  size_t pool_max_idle;
+  size_t http2_sessions;
+  size_t pipeline_depth;
   uint32_t weight;
   uint32_t group_weight;
   Proto proto;
@@ -851,6 +868,10 @@ struct DownstreamParams {
   bool dns;
   bool redirect_if_not_tls;
   bool upgrade_scheme;
+  bool adaptive_concurrency;
+  bool single_flight;
+  bool cache;
+  bool compress;
 };
 
 namespace {
@@ -938,9 +959,11 @@ int parse_downstream_params(DownstreamParams &out,
         out.affinity.type = SessionAffinity::IP;
       } else if (util::strieq_l("cookie", valstr)) {
         out.affinity.type = SessionAffinity::COOKIE;
+      } else if (util::strieq_l("header", valstr)) {
+        out.affinity.type = SessionAffinity::HEADER;
       } else {
-        LOG(ERROR)
-            << "backend: affinity: value must be one of none, ip, and cookie";
+        LOG(ERROR) << "backend: affinity: value must be one of none, ip, "
+                      "cookie, and header";
         return -1;
       }
     } else if (util::istarts_with_l(param, "affinity-cookie-name=")) {
@@ -967,12 +990,57 @@ int parse_downstream_params(DownstreamParams &out,
                       "auto, yes, and no";
         return -1;
       }
+    } else if (util::istarts_with_l(param, "affinity-header-name=")) {
+      auto val = StringRef{first + str_size("affinity-header-name="), end};
+      if (val.empty()) {
+        LOG(ERROR)
+            << "backend: affinity-header-name: non empty string is expected";
+        return -1;
+      }
+      out.affinity.header.name = val;
+    } else if (util::istarts_with_l(param, "balance=")) {
+      auto valstr = StringRef{first + str_size("balance="), end};
+      if (util::strieq_l("round-robin", valstr)) {
+        out.balance = LoadBalancing::ROUND_ROBIN;
+      } else if (util::strieq_l("least-request", valstr)) {
+        out.balance = LoadBalancing::LEAST_REQUEST;
+      } else if (util::strieq_l("peak-ewma", valstr)) {
+        out.balance = LoadBalancing::PEAK_EWMA;
+      } else if (util::strieq_l("p2c", valstr)) {
+        out.balance = LoadBalancing::P2C;
+      } else {
+        LOG(ERROR) << "backend: balance: value must be one of round-robin, "
+                      "least-request, peak-ewma, and p2c";
+        return -1;
+      }
     } else if (util::strieq_l("dns", param)) {
       out.dns = true;
     } else if (util::strieq_l("redirect-if-not-tls", param)) {
       out.redirect_if_not_tls = true;
     } else if (util::strieq_l("upgrade-scheme", param)) {
       out.upgrade_scheme = true;
+    } else if (util::strieq_l("adaptive-concurrency", param)) {
+      out.adaptive_concurrency = true;
+    } else if (util::istarts_with_l(param, "queue-timeout=")) {
+      if (parse_downstream_param_duration(
+              out.queue_timeout, StringRef::from_lit("queue-timeout"),
+              StringRef{first + str_size("queue-timeout="), end}) == -1) {
+        return -1;
+      }
+    } else if (util::strieq_l("single-flight", param)) {
+      out.single_flight = true;
+    } else if (util::strieq_l("cache", param)) {
+      out.cache = true;
+    } else if (util::strieq_l("compress", param)) {
+      out.compress = true;
+    } else if (util::istarts_with_l(param, "single-flight-key=")) {
+      auto val = StringRef{first + str_size("single-flight-key="), end};
+      if (val.empty()) {
+        LOG(ERROR)
+            << "backend: single-flight-key: non empty string is expected";
+        return -1;
+      }
+      out.single_flight_key = val;
     } else if (util::istarts_with_l(param, "mruby=")) {
       auto valstr = StringRef{first + str_size("mruby="), end};
       out.mruby = valstr;
@@ -988,6 +1056,68 @@ int parse_downstream_params(DownstreamParams &out,
               StringRef{first + str_size("write-timeout="), end}) == -1) {
         return -1;
       }
+    } else if (util::istarts_with_l(param, "pool-min-idle=")) {
+      auto valstr = StringRef{first + str_size("pool-min-idle="), end};
+      auto n = util::parse_uint(valstr);
+      if (n == -1) {
+        LOG(ERROR)
+            << "backend: pool-min-idle: non-negative integer is expected";
+        return -1;
+      }
+
+      out.pool_min_idle = n;
+    } else if (util::istarts_with_l(param, "pool-max-idle=")) {
+      auto valstr = StringRef{first + str_size("pool-max-idle="), end};
+      auto n = util::parse_uint(valstr);
+      if (n == -1) {
+        LOG(ERROR)
+            << "backend: pool-max-idle: non-negative integer is expected";
+        return -1;
+      }
+
+      out.pool_max_idle = n;
+    } else if (util::istarts_with_l(param, "hedge-delay=")) {
+      if (parse_downstream_param_duration(
+              out.hedge.delay, StringRef::from_lit("hedge-delay"),
+              StringRef{first + str_size("hedge-delay="), end}) == -1) {
+        return -1;
+      }
+    } else if (util::istarts_with_l(param, "hedge-percentile=")) {
+      auto valstr = StringRef{first + str_size("hedge-percentile="), end};
+      auto n = util::parse_uint(valstr);
+      if (n < 1 || n > 99) {
+        LOG(ERROR) << "backend: hedge-percentile: integer [1, 99] is expected";
+        return -1;
+      }
+
+      out.hedge.percentile = n;
+    } else if (util::istarts_with_l(param, "retry-budget=")) {
+      auto valstr = StringRef{first + str_size("retry-budget="), end};
+      auto n = util::parse_uint(valstr);
+      if (n < 0 || n > 100) {
+        LOG(ERROR) << "backend: retry-budget: integer [0, 100] is expected";
+        return -1;
+      }
+
+      out.retry_budget = n;
+    } else if (util::istarts_with_l(param, "h2-sessions=")) {
+      auto valstr = StringRef{first + str_size("h2-sessions="), end};
+      auto n = util::parse_uint(valstr);
+      if (n < 1) {
+        LOG(ERROR) << "backend: h2-sessions: positive integer is expected";
+        return -1;
+      }
+
+      out.http2_sessions = n;
+    } else if (util::istarts_with_l(param, "pipeline-depth=")) {
+      auto valstr = StringRef{first + str_size("pipeline-depth="), end};
+      auto n = util::parse_uint(valstr);
+      if (n < 1) {
+        LOG(ERROR) << "backend: pipeline-depth: positive integer is expected";
+        return -1;
+      }
+
+      out.pipeline_depth = n;
     } else if (util::istarts_with_l(param, "weight=")) {
       auto valstr = StringRef{first + str_size("weight="), end};
       if (valstr.empty()) {
@@ -1041,6 +1171,20 @@ int parse_downstream_params(DownstreamParams &out,
 }
 } // namespace
 
+namespace {
+// Returns lowercased copy of header field name |name| allocated by
+// |balloc|.
+StringRef make_header_name_ref(BlockAllocator &balloc, const StringRef &name) {
+  auto iov = make_byte_ref(balloc, name.size() + 1);
+  auto p = iov.base;
+  p = std::copy(std::begin(name), std::end(name), p);
+  util::inp_strlower(iov.base, p);
+  *p = '\0';
+
+  return StringRef{iov.base, p};
+}
+} // namespace
+
 namespace {
 // Parses host-path mapping patterns in |src_pattern|, and stores
 // mappings in config.  We will store each host-path pattern found in
@@ -1062,6 +1206,9 @@ int parse_mapping(Config *config, DownstreamAddrConfig &addr,
   DownstreamParams params{};
   params.proto = Proto::HTTP1;
   params.weight = 1;
+  params.http2_sessions = 1;
+  params.pipeline_depth = 1;
+  params.retry_budget = -1;
 
   if (parse_downstream_params(params, src_params) != 0) {
     return -1;
@@ -1079,8 +1226,67 @@ int parse_mapping(Config *config, DownstreamAddrConfig &addr,
     return -1;
   }
 
+  if (params.affinity.type == SessionAffinity::HEADER &&
+      params.affinity.header.name.empty()) {
+    LOG(ERROR) << "backend: affinity-header-name is mandatory if "
+                  "affinity=header is specified";
+    return -1;
+  }
+
+  if (params.pool_max_idle && params.pool_min_idle > params.pool_max_idle) {
+    LOG(ERROR) << "backend: pool-min-idle must not be larger than "
+                  "pool-max-idle";
+    return -1;
+  }
+
+  if (params.pool_min_idle && (params.proto != Proto::HTTP1 || params.dns)) {
+    LOG(ERROR) << "backend: pool-min-idle: cannot be used with HTTP/2 "
+                  "backend or dns parameter";
+    return -1;
+  }
+
+  if ((params.hedge.delay > 1e-9 || params.hedge.percentile) &&
+      params.proto != Proto::HTTP1) {
+    LOG(ERROR) << "backend: hedge-delay and hedge-percentile: cannot be used "
+                  "with HTTP/2 backend";
+    return -1;
+  }
+
+  if (params.queue_timeout > 1e-9 && !params.adaptive_concurrency) {
+    LOG(ERROR) << "backend: queue-timeout: requires adaptive-concurrency";
+    return -1;
+  }
+
+  if (!params.single_flight_key.empty() && !params.single_flight) {
+    LOG(ERROR) << "backend: single-flight-key: requires single-flight";
+    return -1;
+  }
+
+  if (params.http2_sessions > 1 && params.proto != Proto::HTTP2) {
+    LOG(ERROR) << "backend: h2-sessions: cannot be used with HTTP/1 backend";
+    return -1;
+  }
+
+  if (params.pipeline_depth > 1) {
+    if (params.proto != Proto::HTTP1) {
+      LOG(ERROR) << "backend: pipeline-depth: cannot be used with HTTP/2 "
+                    "backend";
+      return -1;
+    }
+
+    if (params.hedge.delay > 1e-9 || params.hedge.percentile) {
+      LOG(ERROR) << "backend: pipeline-depth: cannot be used with "
+                    "hedge-delay or hedge-percentile";
+      return -1;
+    }
+  }
+
   addr.fall = params.fall;
   addr.rise = params.rise;
+  addr.pool_min_idle = params.pool_min_idle;
+  addr.pool_max_idle = params.pool_max_idle;
+  addr.http2_sessions = params.http2_sessions;
+  addr.pipeline_depth = params.pipeline_depth;
   addr.weight = params.weight;
   addr.group = make_string_ref(downstreamconf.balloc, params.group);
   addr.group_weight = params.group_weight;
@@ -1138,21 +1344,101 @@ int parse_mapping(Config *config, DownstreamAddrConfig &addr,
                   downstreamconf.balloc, params.affinity.cookie.path);
             }
             g.affinity.cookie.secure = params.affinity.cookie.secure;
+          } else if (params.affinity.type == SessionAffinity::HEADER) {
+            g.affinity.header.name = make_header_name_ref(
+                downstreamconf.balloc, params.affinity.header.name);
           }
         } else if (g.affinity.type != params.affinity.type ||
                    g.affinity.cookie.name != params.affinity.cookie.name ||
                    g.affinity.cookie.path != params.affinity.cookie.path ||
-                   g.affinity.cookie.secure != params.affinity.cookie.secure) {
+                   g.affinity.cookie.secure != params.affinity.cookie.secure ||
+                   !util::strieq(g.affinity.header.name,
+                                 params.affinity.header.name)) {
           LOG(ERROR) << "backend: affinity: multiple different affinity "
                         "configurations found in a single group";
           return -1;
         }
       }
+      // All backends in the same group must use the same load
+      // balancing method.  The default round robin is overridden by
+      // the first backend which specifies the other method.
+      if (params.balance != LoadBalancing::ROUND_ROBIN) {
+        if (g.balance == LoadBalancing::ROUND_ROBIN) {
+          g.balance = params.balance;
+        } else if (g.balance != params.balance) {
+          LOG(ERROR) << "backend: balance: multiple different load balancing "
+                        "methods found in a single group";
+          return -1;
+        }
+      }
+      // All backends in the same group must have the same hedging
+      // configuration and retry budget.  If some backends do not
+      // specify them, the ones given by the other backends are used.
+      if (params.hedge.delay > 1e-9) {
+        if (g.hedge.delay < 1e-9) {
+          g.hedge.delay = params.hedge.delay;
+        } else if (fabs(g.hedge.delay - params.hedge.delay) > 1e-9) {
+          LOG(ERROR) << "backend: hedge-delay: multiple different "
+                        "hedge-delay found in a single group";
+          return -1;
+        }
+      }
+      if (params.hedge.percentile) {
+        if (g.hedge.percentile == 0) {
+          g.hedge.percentile = params.hedge.percentile;
+        } else if (g.hedge.percentile != params.hedge.percentile) {
+          LOG(ERROR) << "backend: hedge-percentile: multiple different "
+                        "hedge-percentile found in a single group";
+          return -1;
+        }
+      }
+      if (params.retry_budget != -1) {
+        if (g.retry_budget == -1) {
+          g.retry_budget = params.retry_budget;
+        } else if (g.retry_budget != params.retry_budget) {
+          LOG(ERROR) << "backend: retry-budget: multiple different "
+                        "retry-budget found in a single group";
+          return -1;
+        }
+      }
+      if (params.queue_timeout > 1e-9) {
+        if (g.queue_timeout < 1e-9) {
+          g.queue_timeout = params.queue_timeout;
+        } else if (fabs(g.queue_timeout - params.queue_timeout) > 1e-9) {
+          LOG(ERROR) << "backend: queue-timeout: multiple different "
+                        "queue-timeout found in a single group";
+          return -1;
+        }
+      }
       // If at least one backend requires frontend TLS connection,
       // enable it for all backends sharing the same pattern.
       if (params.redirect_if_not_tls) {
         g.redirect_if_not_tls = true;
       }
+      // Likewise, the concurrency limit applies to the whole group.
+      if (params.adaptive_concurrency) {
+        g.adaptive_concurrency = true;
+      }
+      if (params.single_flight) {
+        g.single_flight = true;
+      }
+      if (params.cache) {
+        g.cache = true;
+      }
+      if (params.compress) {
+        g.compress = true;
+      }
+      if (!params.single_flight_key.empty()) {
+        if (g.single_flight_key.empty()) {
+          g.single_flight_key = make_header_name_ref(
+              downstreamconf.balloc, params.single_flight_key);
+        } else if (!util::strieq(g.single_flight_key,
+                                 params.single_flight_key)) {
+          LOG(ERROR) << "backend: single-flight-key: multiple different "
+                        "single-flight-key found in a single group";
+          return -1;
+        }
+      }
       // All backends in the same group must have the same mruby path.
       // If some backends do not specify mruby file, and there is at
       // least one backend with mruby file, it is used for all
@@ -1208,8 +1494,23 @@ int parse_mapping(Config *config, DownstreamAddrConfig &addr,
             make_string_ref(downstreamconf.balloc, params.affinity.cookie.path);
       }
       g.affinity.cookie.secure = params.affinity.cookie.secure;
-    }
+    } else if (params.affinity.type == SessionAffinity::HEADER) {
+      g.affinity.header.name = make_header_name_ref(
+          downstreamconf.balloc, params.affinity.header.name);
+    }
+    g.balance = params.balance;
+    g.hedge = params.hedge;
+    g.retry_budget = params.retry_budget;
+    g.queue_timeout = params.queue_timeout;
     g.redirect_if_not_tls = params.redirect_if_not_tls;
+    g.adaptive_concurrency = params.adaptive_concurrency;
+    g.single_flight = params.single_flight;
+    g.cache = params.cache;
+    g.compress = params.compress;
+    if (!params.single_flight_key.empty()) {
+      g.single_flight_key =
+          make_header_name_ref(downstreamconf.balloc, params.single_flight_key);
+    }
     g.mruby_file = make_string_ref(downstreamconf.balloc, params.mruby);
     g.timeout.read = params.read_timeout;
     g.timeout.write = params.write_timeout;
@@ -1771,6 +2072,9 @@ int option_lookup_token(const char *name, size_t namelen) {
   case 10:
     switch (name[9]) {
     case 'e':
+      if (util::strieq_l("cache-siz", name, 9)) {
+        return SHRPX_OPTID_CACHE_SIZE;
+      }
       if (util::strieq_l("error-pag", name, 9)) {
         return SHRPX_OPTID_ERROR_PAGE;
       }
@@ -1842,9 +2146,15 @@ int option_lookup_token(const char *name, size_t namelen) {
       if (util::strieq_l("host-rewrit", name, 11)) {
         return SHRPX_OPTID_HOST_REWRITE;
       }
+      if (util::strieq_l("http1-splic", name, 11)) {
+        return SHRPX_OPTID_HTTP1_SPLICE;
+      }
       if (util::strieq_l("http2-bridg", name, 11)) {
         return SHRPX_OPTID_HTTP2_BRIDGE;
       }
+      if (util::strieq_l("rewrite-rul", name, 11)) {
+        return SHRPX_OPTID_REWRITE_RULE;
+      }
       break;
     case 'p':
       if (util::strieq_l("ocsp-startu", name, 11)) {
@@ -1936,6 +2246,11 @@ int option_lookup_token(const char *name, size_t namelen) {
     break;
   case 15:
     switch (name[14]) {
+    case 'c':
+      if (util::strieq_l("accesslog-asyn", name, 14)) {
+        return SHRPX_OPTID_ACCESSLOG_ASYNC;
+      }
+      break;
     case 'e':
       if (util::strieq_l("no-host-rewrit", name, 14)) {
         return SHRPX_OPTID_NO_HOST_REWRITE;
@@ -2021,6 +2336,11 @@ int option_lookup_token(const char *name, size_t namelen) {
         return SHRPX_OPTID_TLS_MAX_EARLY_DATA;
       }
       break;
+    case 'g':
+      if (util::strieq_l("accesslog-encodin", name, 17)) {
+        return SHRPX_OPTID_ACCESSLOG_ENCODING;
+      }
+      break;
     case 'r':
       if (util::strieq_l("add-request-heade", name, 17)) {
         return SHRPX_OPTID_ADD_REQUEST_HEADER;
@@ -2079,6 +2399,11 @@ int option_lookup_token(const char *name, size_t namelen) {
     break;
   case 20:
     switch (name[19]) {
+    case 'e':
+      if (util::strieq_l("tls-dyn-rec-adaptiv", name, 19)) {
+        return SHRPX_OPTID_TLS_DYN_REC_ADAPTIVE;
+      }
+      break;
     case 'g':
       if (util::strieq_l("frontend-frame-debu", name, 19)) {
         return SHRPX_OPTID_FRONTEND_FRAME_DEBUG;
@@ -2119,6 +2444,11 @@ int option_lookup_token(const char *name, size_t namelen) {
         return SHRPX_OPTID_BACKEND_TLS_SNI_FIELD;
       }
       break;
+    case 'e':
+      if (util::strieq_l("cache-max-object-siz", name, 20)) {
+        return SHRPX_OPTID_CACHE_MAX_OBJECT_SIZE;
+      }
+      break;
     case 'l':
       if (util::strieq_l("accept-proxy-protoco", name, 20)) {
         return SHRPX_OPTID_ACCEPT_PROXY_PROTOCOL;
@@ -2159,12 +2489,20 @@ int option_lookup_token(const char *name, size_t namelen) {
     break;
   case 22:
     switch (name[21]) {
+    case 'e':
+      if (util::strieq_l("tls-session-cache-siz", name, 21)) {
+        return SHRPX_OPTID_TLS_SESSION_CACHE_SIZE;
+      }
+      break;
     case 'i':
       if (util::strieq_l("backend-http-proxy-ur", name, 21)) {
         return SHRPX_OPTID_BACKEND_HTTP_PROXY_URI;
       }
       break;
     case 'r':
+      if (util::strieq_l("accesslog-async-buffe", name, 21)) {
+        return SHRPX_OPTID_ACCESSLOG_ASYNC_BUFFER;
+      }
       if (util::strieq_l("backend-request-buffe", name, 21)) {
         return SHRPX_OPTID_BACKEND_REQUEST_BUFFER;
       }
@@ -2174,6 +2512,11 @@ int option_lookup_token(const char *name, size_t namelen) {
         return SHRPX_OPTID_FRONTEND_WRITE_TIMEOUT;
       }
       break;
+    case 'w':
+      if (util::strieq_l("backend-outlier-windo", name, 21)) {
+        return SHRPX_OPTID_BACKEND_OUTLIER_WINDOW;
+      }
+      break;
     case 'y':
       if (util::strieq_l("backend-address-famil", name, 21)) {
         return SHRPX_OPTID_BACKEND_ADDRESS_FAMILY;
@@ -2196,6 +2539,11 @@ int option_lookup_token(const char *name, size_t namelen) {
         return SHRPX_OPTID_BACKEND_RESPONSE_BUFFER;
       }
       break;
+    case 's':
+      if (util::strieq_l("tls-private-key-thread", name, 22)) {
+        return SHRPX_OPTID_TLS_PRIVATE_KEY_THREADS;
+      }
+      break;
     case 't':
       if (util::strieq_l("backend-connect-timeou", name, 22)) {
         return SHRPX_OPTID_BACKEND_CONNECT_TIMEOUT;
@@ -2231,6 +2579,11 @@ int option_lookup_token(const char *name, size_t namelen) {
         return SHRPX_OPTID_TLS_DYN_REC_IDLE_TIMEOUT;
       }
       break;
+    case 'w':
+      if (util::strieq_l("accesslog-async-overflo", name, 23)) {
+        return SHRPX_OPTID_ACCESSLOG_ASYNC_OVERFLOW;
+      }
+      break;
     }
     break;
   case 25:
@@ -2292,6 +2645,11 @@ int option_lookup_token(const char *name, size_t namelen) {
         return SHRPX_OPTID_TLS_SESSION_CACHE_MEMCACHED;
       }
       break;
+    case 'e':
+      if (util::strieq_l("accesslog-async-sample-rat", name, 26)) {
+        return SHRPX_OPTID_ACCESSLOG_ASYNC_SAMPLE_RATE;
+      }
+      break;
     case 'r':
       if (util::strieq_l("request-header-field-buffe", name, 26)) {
         return SHRPX_OPTID_REQUEST_HEADER_FIELD_BUFFER;
@@ -2324,12 +2682,20 @@ int option_lookup_token(const char *name, size_t namelen) {
         return SHRPX_OPTID_TLS_DYN_REC_WARMUP_THRESHOLD;
       }
       break;
+    case 'e':
+      if (util::strieq_l("backend-outlier-failure-rat", name, 27)) {
+        return SHRPX_OPTID_BACKEND_OUTLIER_FAILURE_RATE;
+      }
+      break;
     case 'r':
       if (util::strieq_l("response-header-field-buffe", name, 27)) {
         return SHRPX_OPTID_RESPONSE_HEADER_FIELD_BUFFER;
       }
       break;
     case 's':
+      if (util::strieq_l("backend-outlier-min-request", name, 27)) {
+        return SHRPX_OPTID_BACKEND_OUTLIER_MIN_REQUESTS;
+      }
       if (util::strieq_l("http2-max-concurrent-stream", name, 27)) {
         return SHRPX_OPTID_HTTP2_MAX_CONCURRENT_STREAMS;
       }
@@ -2344,6 +2710,15 @@ int option_lookup_token(const char *name, size_t namelen) {
       break;
     }
     break;
+  case 29:
+    switch (name[28]) {
+    case 'e':
+      if (util::strieq_l("backend-outlier-ejection-tim", name, 28)) {
+        return SHRPX_OPTID_BACKEND_OUTLIER_EJECTION_TIME;
+      }
+      break;
+    }
+    break;
   case 30:
     switch (name[29]) {
     case 'd':
@@ -2387,10 +2762,25 @@ int option_lookup_token(const char *name, size_t namelen) {
         return SHRPX_OPTID_BACKEND_CONNECTIONS_PER_FRONTEND;
       }
       break;
+    case 'k':
+      if (util::strieq_l("worker-buffer-pool-low-watermar", name, 31)) {
+        return SHRPX_OPTID_WORKER_BUFFER_POOL_LOW_WATERMARK;
+      }
+      break;
     }
     break;
   case 33:
     switch (name[32]) {
+    case 'e':
+      if (util::strieq_l("backend-outlier-max-ejection-tim", name, 32)) {
+        return SHRPX_OPTID_BACKEND_OUTLIER_MAX_EJECTION_TIME;
+      }
+      break;
+    case 'k':
+      if (util::strieq_l("worker-buffer-pool-high-watermar", name, 32)) {
+        return SHRPX_OPTID_WORKER_BUFFER_POOL_HIGH_WATERMARK;
+      }
+      break;
     case 'l':
       if (util::strieq_l("tls-ticket-key-memcached-interva", name, 32)) {
         return SHRPX_OPTID_TLS_TICKET_KEY_MEMCACHED_INTERVAL;
@@ -2469,6 +2859,11 @@ int option_lookup_token(const char *name, size_t namelen) {
         return SHRPX_OPTID_BACKEND_HTTP2_MAX_CONCURRENT_STREAMS;
       }
       break;
+    case 't':
+      if (util::strieq_l("backend-outlier-max-ejection-percen", name, 35)) {
+        return SHRPX_OPTID_BACKEND_OUTLIER_MAX_EJECTION_PERCENT;
+      }
+      break;
     }
     break;
   case 37:
@@ -3765,6 +4160,159 @@ int parse_config(Config *config, int optid, const StringRef &opt,
   case SHRPX_OPTID_NO_STRIP_INCOMING_EARLY_DATA:
     config->http.early_data.strip_incoming = !util::strieq_l("yes", optarg);
 
+    return 0;
+  case SHRPX_OPTID_ACCESSLOG_ASYNC:
+    config->logging.access.async.enabled = util::strieq_l("yes", optarg);
+
+    return 0;
+  case SHRPX_OPTID_ACCESSLOG_ASYNC_BUFFER: {
+    size_t n;
+    if (parse_uint_with_unit(&n, opt, optarg) != 0) {
+      return -1;
+    }
+
+    if (n < 4_k) {
+      LOG(ERROR) << opt << ": must be greater than or equal to 4K";
+      return -1;
+    }
+
+    config->logging.access.async.buffer_size = n;
+
+    return 0;
+  }
+  case SHRPX_OPTID_ACCESSLOG_ASYNC_OVERFLOW:
+    if (util::strieq_l("block", optarg)) {
+      config->logging.access.async.overflow = AccessLogOverflow::BLOCK;
+    } else if (util::strieq_l("drop", optarg)) {
+      config->logging.access.async.overflow = AccessLogOverflow::DROP;
+    } else if (util::strieq_l("sample", optarg)) {
+      config->logging.access.async.overflow = AccessLogOverflow::SAMPLE;
+    } else {
+      LOG(ERROR) << opt
+                 << ": unsupported value, block, drop, or sample is allowed";
+      return -1;
+    }
+
+    return 0;
+  case SHRPX_OPTID_ACCESSLOG_ASYNC_SAMPLE_RATE: {
+    size_t n;
+    if (parse_uint(&n, opt, optarg) != 0) {
+      return -1;
+    }
+
+    if (n == 0) {
+      LOG(ERROR) << opt << ": must be greater than 0";
+      return -1;
+    }
+
+    config->logging.access.async.sample_rate = n;
+
+    return 0;
+  }
+  case SHRPX_OPTID_ACCESSLOG_ENCODING:
+    if (util::strieq_l("text", optarg)) {
+      config->logging.access.encoding = AccessLogEncoding::TEXT;
+    } else if (util::strieq_l("json", optarg)) {
+      config->logging.access.encoding = AccessLogEncoding::JSON;
+    } else if (util::strieq_l("binary", optarg)) {
+      config->logging.access.encoding = AccessLogEncoding::BINARY;
+    } else {
+      LOG(ERROR) << opt
+                 << ": unsupported value, text, json, or binary is allowed";
+      return -1;
+    }
+
+    return 0;
+  case SHRPX_OPTID_WORKER_BUFFER_POOL_HIGH_WATERMARK:
+    return parse_uint_with_unit(&config->conn.buffer_pool.high_watermark, opt,
+                                optarg);
+  case SHRPX_OPTID_WORKER_BUFFER_POOL_LOW_WATERMARK:
+    return parse_uint_with_unit(&config->conn.buffer_pool.low_watermark, opt,
+                                optarg);
+  case SHRPX_OPTID_TLS_DYN_REC_ADAPTIVE:
+    config->tls.dyn_rec.adaptive = util::strieq_l("yes", optarg);
+
+    return 0;
+  case SHRPX_OPTID_BACKEND_OUTLIER_FAILURE_RATE: {
+    uint32_t n;
+    if (parse_uint(&n, opt, optarg) != 0) {
+      return -1;
+    }
+
+    if (n > 100) {
+      LOG(ERROR) << opt << ": must be smaller than or equal to 100";
+      return -1;
+    }
+
+    config->conn.downstream->outlier.failure_rate = n;
+
+    return 0;
+  }
+  case SHRPX_OPTID_BACKEND_OUTLIER_MIN_REQUESTS:
+    return parse_uint(&config->conn.downstream->outlier.min_requests, opt,
+                      optarg);
+  case SHRPX_OPTID_BACKEND_OUTLIER_WINDOW: {
+    ev_tstamp d;
+    if (parse_duration(&d, opt, optarg) != 0) {
+      return -1;
+    }
+
+    if (d == 0.) {
+      LOG(ERROR) << opt << ": must be greater than 0";
+      return -1;
+    }
+
+    config->conn.downstream->outlier.window = d;
+
+    return 0;
+  }
+  case SHRPX_OPTID_BACKEND_OUTLIER_EJECTION_TIME:
+    return parse_duration(&config->conn.downstream->outlier.base_ejection_time,
+                          opt, optarg);
+  case SHRPX_OPTID_BACKEND_OUTLIER_MAX_EJECTION_TIME:
+    return parse_duration(&config->conn.downstream->outlier.max_ejection_time,
+                          opt, optarg);
+  case SHRPX_OPTID_BACKEND_OUTLIER_MAX_EJECTION_PERCENT: {
+    uint32_t n;
+    if (parse_uint(&n, opt, optarg) != 0) {
+      return -1;
+    }
+
+    if (n > 100) {
+      LOG(ERROR) << opt << ": must be smaller than or equal to 100";
+      return -1;
+    }
+
+    config->conn.downstream->outlier.max_ejection_percent = n;
+
+    return 0;
+  }
+  case SHRPX_OPTID_CACHE_SIZE:
+    return parse_uint_with_unit(&config->http.cache.size, opt, optarg);
+  case SHRPX_OPTID_CACHE_MAX_OBJECT_SIZE:
+    return parse_uint_with_unit(&config->http.cache.max_object_size, opt,
+                                optarg);
+  case SHRPX_OPTID_TLS_SESSION_CACHE_SIZE:
+    return parse_uint(&config->tls.session_cache.size, opt, optarg);
+  case SHRPX_OPTID_TLS_PRIVATE_KEY_THREADS:
+    return parse_uint(&config->tls.private_key_threads, opt, optarg);
+  case SHRPX_OPTID_REWRITE_RULE: {
+    RewriteRule rule;
+    if (parse_rewrite_rule(rule, config->balloc, optarg) != 0) {
+      return -1;
+    }
+
+    config->http.rewrite_rules.push_back(std::move(rule));
+
+    return 0;
+  }
+  case SHRPX_OPTID_HTTP1_SPLICE:
+#ifdef HAVE_SPLICE
+    config->http.http1_splice = util::strieq_l("yes", optarg);
+#else  // !HAVE_SPLICE
+    LOG(WARN) << opt << ": splice(2) is not supported on this platform";
+#endif // !HAVE_SPLICE
+
     return 0;
   case SHRPX_OPTID_CONF:
     LOG(WARN) << "conf: ignored";
@@ -3963,43 +4511,6 @@ StringRef strproto(Proto proto) {
   abort();
 }
 
-namespace {
-// Consistent hashing method described in
-// https://github.com/RJ/ketama.  Generate 160 32-bit hashes per |s|,
-// which is usually backend address.  The each hash is associated to
-// index of backend address.  When all hashes for every backend
-// address are calculated, sort it in ascending order of hash.  To
-// choose the index, compute 32-bit hash based on client IP address,
-// and do lower bound search in the array. The returned index is the
-// backend to use.
-int compute_affinity_hash(std::vector<AffinityHash> &res, size_t idx,
-                          const StringRef &s) {
-  int rv;
-  std::array<uint8_t, 32> buf;
-
-  for (auto i = 0; i < 20; ++i) {
-    auto t = s.str();
-    t += i;
-
-    rv = util::sha256(buf.data(), StringRef{t});
-    if (rv != 0) {
-      return -1;
-    }
-
-    for (int i = 0; i < 8; ++i) {
-      auto h = (static_cast<uint32_t>(buf[4 * i]) << 24) |
-               (static_cast<uint32_t>(buf[4 * i + 1]) << 16) |
-               (static_cast<uint32_t>(buf[4 * i + 2]) << 8) |
-               static_cast<uint32_t>(buf[4 * i + 3]);
-
-      res.emplace_back(idx, h);
-    }
-  }
-
-  return 0;
-}
-} // namespace
-
 // Configures the following member in |config|:
 // conn.downstream_router, conn.downstream.addr_groups,
 // conn.downstream.addr_group_catch_all.
@@ -4174,31 +4685,25 @@ int configure_downstream_group(Config *config, bool http2_proxy,
     }
 
     if (g.affinity.type != SessionAffinity::NONE) {
-      size_t idx = 0;
+      std::vector<StringRef> keys;
+      keys.reserve(g.addrs.size());
       for (auto &addr : g.addrs) {
-        StringRef key;
         if (addr.dns) {
           if (addr.host_unix) {
-            key = addr.host;
+            keys.push_back(addr.host);
           } else {
-            key = addr.hostport;
+            keys.push_back(addr.hostport);
           }
         } else {
           auto p = reinterpret_cast<uint8_t *>(&addr.addr.su);
-          key = StringRef{p, addr.addr.len};
-        }
-        rv = compute_affinity_hash(g.affinity_hash, idx, key);
-        if (rv != 0) {
-          return -1;
+          keys.push_back(StringRef{p, addr.addr.len});
         }
-
-        ++idx;
       }
 
-      std::sort(std::begin(g.affinity_hash), std::end(g.affinity_hash),
-                [](const AffinityHash &lhs, const AffinityHash &rhs) {
-                  return lhs.hash < rhs.hash;
-                });
+      rv = load_balancer_build_affinity_table(g.affinity_table, keys);
+      if (rv != 0) {
+        return -1;
+      }
     }
 
     auto &timeout = g.timeout;
@@ -4210,6 +4715,13 @@ int configure_downstream_group(Config *config, bool http2_proxy,
     }
   }
 
+  // All routes have been added.  Compile routers for faster lookup.
+  router.compile();
+  routerconf.rev_wildcard_router.compile();
+  for (auto &wc : routerconf.wildcard_patterns) {
+    wc.router.compile();
+  }
+
   return 0;
 }
 
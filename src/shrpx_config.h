@@ -51,6 +51,7 @@
 #include <nghttp2/nghttp2.h>
 
 #include "shrpx_router.h"
+#include "shrpx_rewrite.h"
 #include "template.h"
 #include "http2.h"
 #include "network.h"
@@ -356,6 +357,43 @@ constexpr auto SHRPX_OPT_TLS13_CLIENT_CIPHERS =
     StringRef::from_lit("tls13-client-ciphers");
 constexpr auto SHRPX_OPT_NO_STRIP_INCOMING_EARLY_DATA =
     StringRef::from_lit("no-strip-incoming-early-data");
+constexpr auto SHRPX_OPT_ACCESSLOG_ASYNC =
+    StringRef::from_lit("accesslog-async");
+constexpr auto SHRPX_OPT_ACCESSLOG_ASYNC_BUFFER =
+    StringRef::from_lit("accesslog-async-buffer");
+constexpr auto SHRPX_OPT_ACCESSLOG_ASYNC_OVERFLOW =
+    StringRef::from_lit("accesslog-async-overflow");
+constexpr auto SHRPX_OPT_ACCESSLOG_ASYNC_SAMPLE_RATE =
+    StringRef::from_lit("accesslog-async-sample-rate");
+constexpr auto SHRPX_OPT_ACCESSLOG_ENCODING =
+    StringRef::from_lit("accesslog-encoding");
+constexpr auto SHRPX_OPT_WORKER_BUFFER_POOL_HIGH_WATERMARK =
+    StringRef::from_lit("worker-buffer-pool-high-watermark");
+constexpr auto SHRPX_OPT_WORKER_BUFFER_POOL_LOW_WATERMARK =
+    StringRef::from_lit("worker-buffer-pool-low-watermark");
+constexpr auto SHRPX_OPT_TLS_DYN_REC_ADAPTIVE =
+    StringRef::from_lit("tls-dyn-rec-adaptive");
+constexpr auto SHRPX_OPT_BACKEND_OUTLIER_FAILURE_RATE =
+    StringRef::from_lit("backend-outlier-failure-rate");
+constexpr auto SHRPX_OPT_BACKEND_OUTLIER_MIN_REQUESTS =
+    StringRef::from_lit("backend-outlier-min-requests");
+constexpr auto SHRPX_OPT_BACKEND_OUTLIER_WINDOW =
+    StringRef::from_lit("backend-outlier-window");
+constexpr auto SHRPX_OPT_BACKEND_OUTLIER_EJECTION_TIME =
+    StringRef::from_lit("backend-outlier-ejection-time");
+constexpr auto SHRPX_OPT_BACKEND_OUTLIER_MAX_EJECTION_TIME =
+    StringRef::from_lit("backend-outlier-max-ejection-time");
+constexpr auto SHRPX_OPT_BACKEND_OUTLIER_MAX_EJECTION_PERCENT =
+    StringRef::from_lit("backend-outlier-max-ejection-percent");
+constexpr auto SHRPX_OPT_CACHE_SIZE = StringRef::from_lit("cache-size");
+constexpr auto SHRPX_OPT_CACHE_MAX_OBJECT_SIZE =
+    StringRef::from_lit("cache-max-object-size");
+constexpr auto SHRPX_OPT_TLS_SESSION_CACHE_SIZE =
+    StringRef::from_lit("tls-session-cache-size");
+constexpr auto SHRPX_OPT_TLS_PRIVATE_KEY_THREADS =
+    StringRef::from_lit("tls-private-key-threads");
+constexpr auto SHRPX_OPT_REWRITE_RULE = StringRef::from_lit("rewrite-rule");
+constexpr auto SHRPX_OPT_HTTP1_SPLICE = StringRef::from_lit("http1-splice");
 
 constexpr size_t SHRPX_OBFUSCATED_NODE_LENGTH = 8;
 
@@ -376,6 +414,19 @@ enum class SessionAffinity {
   IP,
   // Cookie based affinity
   COOKIE,
+  // Request header field based affinity
+  HEADER,
+};
+
+enum class LoadBalancing {
+  // Weighted round robin
+  ROUND_ROBIN,
+  // Least number of outstanding requests
+  LEAST_REQUEST,
+  // Least peak EWMA latency multiplied by outstanding requests
+  PEAK_EWMA,
+  // Better of 2 randomly chosen addresses by peak EWMA cost
+  P2C,
 };
 
 enum class SessionAffinityCookieSecure {
@@ -399,6 +450,39 @@ struct AffinityConfig {
     // Secure attribute
     SessionAffinityCookieSecure secure;
   } cookie;
+  struct {
+    // Lowercased name of a request header field to use.
+    StringRef name;
+  } header;
+};
+
+struct HedgeConfig {
+  // The delay before a hedged request is sent.  If |percentile| is
+  // nonzero, this is the minimum delay.
+  ev_tstamp delay;
+  // If nonzero, the delay is this percentile of response latency of
+  // the group.
+  uint32_t percentile;
+};
+
+struct OutlierDetectionConfig {
+  // The length of sliding window in which the outcome of requests is
+  // counted.
+  ev_tstamp window;
+  // The duration of the first ejection.  The subsequent ejections
+  // are made longer in proportion to the number of consecutive
+  // ejections.
+  ev_tstamp base_ejection_time;
+  // The maximum duration of ejection.
+  ev_tstamp max_ejection_time;
+  // The minimum number of requests in window before an address is
+  // considered for ejection.
+  size_t min_requests;
+  // The ratio of failed requests in percent at which an address is
+  // ejected.  0 disables outlier detection.
+  uint32_t failure_rate;
+  // The maximum ratio of ejected addresses in a group in percent.
+  uint32_t max_ejection_percent;
 };
 
 enum shrpx_forwarded_param {
@@ -472,6 +556,15 @@ struct DownstreamAddrConfig {
   StringRef group;
   size_t fall;
   size_t rise;
+  // The number of idle connections kept established in advance.
+  size_t pool_min_idle;
+  // The maximum number of idle connections.  0 means unlimited.
+  size_t pool_max_idle;
+  // The number of HTTP/2 sessions which streams are spread over.
+  size_t http2_sessions;
+  // The maximum number of requests in flight on one HTTP/1
+  // connection.  1 disables pipelining.
+  size_t pipeline_depth;
   // weight of this address inside a weight group.  Its range is [1,
   // 256], inclusive.
   uint32_t weight;
@@ -492,33 +585,59 @@ struct DownstreamAddrConfig {
   bool upgrade_scheme;
 };
 
-// Mapping hash to idx which is an index into
-// DownstreamAddrGroupConfig::addrs.
-struct AffinityHash {
-  AffinityHash(size_t idx, uint32_t hash) : idx(idx), hash(hash) {}
-
-  size_t idx;
-  uint32_t hash;
-};
-
 struct DownstreamAddrGroupConfig {
   DownstreamAddrGroupConfig(const StringRef &pattern)
       : pattern(pattern),
         affinity{SessionAffinity::NONE},
+        balance(LoadBalancing::ROUND_ROBIN),
+        hedge{},
+        retry_budget(-1),
+        queue_timeout(0.),
         redirect_if_not_tls(false),
+        adaptive_concurrency(false),
+        single_flight(false),
+        cache(false),
+        compress(false),
         timeout{} {}
 
   StringRef pattern;
   StringRef mruby_file;
+  // The names of request header fields, separated by ':', which are
+  // included in the key of single-flight in addition to URI.
+  StringRef single_flight_key;
   std::vector<DownstreamAddrConfig> addrs;
-  // Bunch of session affinity hash.  Only used if affinity ==
-  // SessionAffinity::IP.
-  std::vector<AffinityHash> affinity_hash;
-  // Cookie based session affinity configuration.
+  // Maglev lookup table which maps session affinity hash to an index
+  // into addrs.  Only used if affinity != SessionAffinity::NONE.
+  std::vector<uint32_t> affinity_table;
+  // Session affinity configuration.
   AffinityConfig affinity;
+  // Load balancing method among addresses.
+  LoadBalancing balance;
+  // Hedged request configuration.  Hedging is disabled if both delay
+  // and percentile are 0.
+  HedgeConfig hedge;
+  // The ratio of retried and hedged requests to requests in percent.
+  // -1 if retries are not limited.
+  int32_t retry_budget;
+  // The maximum duration a request waits for a slot if the
+  // concurrency limit is reached.  If it is 0, the request is
+  // rejected immediately.
+  ev_tstamp queue_timeout;
   // true if this group requires that client connection must be TLS,
   // and the request must be redirected to https URI.
   bool redirect_if_not_tls;
+  // true if the number of outstanding requests to this group is
+  // limited adaptively based on response latency.
+  bool adaptive_concurrency;
+  // true if identical GET requests in flight to this group are
+  // coalesced into one.
+  bool single_flight;
+  // true if the responses from this group are stored in response
+  // cache.
+  bool cache;
+  // true if the response body from this group is compressed with the
+  // content-coding which client accepts.
+  bool compress;
   // Timeouts for backend connection.
   struct {
     ev_tstamp read;
@@ -613,12 +732,19 @@ struct TLSConfig {
       int family;
       bool tls;
     } memcached;
+    // The maximum number of sessions stored in the session store
+    // shared by all workers.  Frontend and backend sessions are
+    // stored separately.
+    size_t size;
   } session_cache;
 
   // Dynamic record sizing configurations
   struct {
     size_t warmup_threshold;
     ev_tstamp idle_timeout;
+    // true if record size is derived from congestion window rather
+    // than from the number of bytes written.
+    bool adaptive;
   } dyn_rec;
 
   // OCSP realted configurations
@@ -681,6 +807,10 @@ struct TLSConfig {
   StringRef tls13_ciphers;
   StringRef ecdh_curves;
   StringRef cacert;
+  // The number of threads which perform private key operations of
+  // frontend TLS handshakes.  0 means that they are performed by
+  // worker threads.
+  size_t private_key_threads;
   // The maximum amount of 0-RTT data that server accepts.
   uint32_t max_early_data;
   // The minimum and maximum TLS version.  These values are defined in
@@ -733,6 +863,8 @@ struct HttpConfig {
   std::vector<ErrorPage> error_pages;
   HeaderRefs add_request_headers;
   HeaderRefs add_response_headers;
+  // The rules given by --rewrite-rule, in the order of appearance.
+  std::vector<RewriteRule> rewrite_rules;
   StringRef server_name;
   // Port number which appears in Location header field when https
   // redirect is made.
@@ -742,10 +874,19 @@ struct HttpConfig {
   size_t response_header_field_buffer;
   size_t max_response_header_fields;
   size_t max_requests;
+  struct {
+    // The maximum number of bytes used by response cache.
+    size_t size;
+    // The maximum size of response body which is cached.
+    size_t max_object_size;
+  } cache;
   bool no_via;
   bool no_location_rewrite;
   bool no_host_rewrite;
   bool no_server_rewrite;
+  // true if response body is moved from HTTP/1 backend to HTTP/1
+  // frontend with splice(2).
+  bool http1_splice;
 };
 
 struct Http2Config {
@@ -793,10 +934,40 @@ struct Http2Config {
   bool no_server_push;
 };
 
+// The behaviour when asynchronous access log buffer is full.
+enum class AccessLogOverflow {
+  // Wait until the writer thread makes room.
+  BLOCK,
+  // Discard the record.
+  DROP,
+  // Keep only a sample of records when the buffer is getting full.
+  SAMPLE,
+};
+
+enum class AccessLogEncoding {
+  // Text format specified by --accesslog-format.
+  TEXT,
+  // JSON object per line.
+  JSON,
+  // Length-prefixed binary record.
+  BINARY,
+};
+
 struct LoggingConfig {
   struct {
     std::vector<LogFragment> format;
     StringRef file;
+    struct {
+      // The size of the per-worker buffer.
+      size_t buffer_size;
+      // 1 out of |sample_rate| records is kept when overflow is
+      // AccessLogOverflow::SAMPLE.
+      size_t sample_rate;
+      AccessLogOverflow overflow;
+      // true if access log is written by a dedicated thread.
+      bool enabled;
+    } async;
+    AccessLogEncoding encoding;
     // Send accesslog to syslog, ignoring accesslog_file.
     bool syslog;
     // Write accesslog when response headers are received from
@@ -845,6 +1016,7 @@ struct DownstreamConfig {
   DownstreamConfig()
       : balloc(1024, 1024),
         timeout{},
+        outlier{},
         addr_group_catch_all{0},
         connections_per_host{0},
         connections_per_frontend{0},
@@ -872,6 +1044,8 @@ struct DownstreamConfig {
     // group temporarily.
     ev_tstamp max_backoff;
   } timeout;
+  // Passive outlier detection based on the outcome of requests.
+  OutlierDetectionConfig outlier;
   RouterConfig router;
   std::vector<DownstreamAddrGroupConfig> addr_groups;
   // The index of catch-all group in downstream_addr_groups.
@@ -915,6 +1089,15 @@ struct ConnectionConfig {
     bool accept_proxy_protocol;
   } upstream;
 
+  // Pool of I/O buffers owned by each worker
+  struct {
+    // The maximum number of bytes of unused buffers kept in the pool.
+    size_t high_watermark;
+    // The pool gradually releases unused buffers until their size
+    // becomes at most this number of bytes.
+    size_t low_watermark;
+  } buffer_pool;
+
   std::shared_ptr<DownstreamConfig> downstream;
 };
 
@@ -1019,6 +1202,11 @@ void create_config();
 // generated by gennghttpxfun.py
 enum {
   SHRPX_OPTID_ACCEPT_PROXY_PROTOCOL,
+  SHRPX_OPTID_ACCESSLOG_ASYNC,
+  SHRPX_OPTID_ACCESSLOG_ASYNC_BUFFER,
+  SHRPX_OPTID_ACCESSLOG_ASYNC_OVERFLOW,
+  SHRPX_OPTID_ACCESSLOG_ASYNC_SAMPLE_RATE,
+  SHRPX_OPTID_ACCESSLOG_ENCODING,
   SHRPX_OPTID_ACCESSLOG_FILE,
   SHRPX_OPTID_ACCESSLOG_FORMAT,
   SHRPX_OPTID_ACCESSLOG_SYSLOG,
@@ -1052,6 +1240,12 @@ enum {
   SHRPX_OPTID_BACKEND_KEEP_ALIVE_TIMEOUT,
   SHRPX_OPTID_BACKEND_MAX_BACKOFF,
   SHRPX_OPTID_BACKEND_NO_TLS,
+  SHRPX_OPTID_BACKEND_OUTLIER_EJECTION_TIME,
+  SHRPX_OPTID_BACKEND_OUTLIER_FAILURE_RATE,
+  SHRPX_OPTID_BACKEND_OUTLIER_MAX_EJECTION_PERCENT,
+  SHRPX_OPTID_BACKEND_OUTLIER_MAX_EJECTION_TIME,
+  SHRPX_OPTID_BACKEND_OUTLIER_MIN_REQUESTS,
+  SHRPX_OPTID_BACKEND_OUTLIER_WINDOW,
   SHRPX_OPTID_BACKEND_READ_TIMEOUT,
   SHRPX_OPTID_BACKEND_REQUEST_BUFFER,
   SHRPX_OPTID_BACKEND_RESPONSE_BUFFER,
@@ -1060,6 +1254,8 @@ enum {
   SHRPX_OPTID_BACKEND_WRITE_TIMEOUT,
   SHRPX_OPTID_BACKLOG,
   SHRPX_OPTID_CACERT,
+  SHRPX_OPTID_CACHE_MAX_OBJECT_SIZE,
+  SHRPX_OPTID_CACHE_SIZE,
   SHRPX_OPTID_CERTIFICATE_FILE,
   SHRPX_OPTID_CIPHERS,
   SHRPX_OPTID_CLIENT,
@@ -1105,6 +1301,7 @@ enum {
   SHRPX_OPTID_FRONTEND_WRITE_TIMEOUT,
   SHRPX_OPTID_HEADER_FIELD_BUFFER,
   SHRPX_OPTID_HOST_REWRITE,
+  SHRPX_OPTID_HTTP1_SPLICE,
   SHRPX_OPTID_HTTP2_BRIDGE,
   SHRPX_OPTID_HTTP2_MAX_CONCURRENT_STREAMS,
   SHRPX_OPTID_HTTP2_NO_COOKIE_CRUMBLING,
@@ -1143,6 +1340,7 @@ enum {
   SHRPX_OPTID_REDIRECT_HTTPS_PORT,
   SHRPX_OPTID_REQUEST_HEADER_FIELD_BUFFER,
   SHRPX_OPTID_RESPONSE_HEADER_FIELD_BUFFER,
+  SHRPX_OPTID_REWRITE_RULE,
   SHRPX_OPTID_RLIMIT_NOFILE,
   SHRPX_OPTID_SERVER_NAME,
   SHRPX_OPTID_SINGLE_PROCESS,
@@ -1153,12 +1351,14 @@ enum {
   SHRPX_OPTID_STRIP_INCOMING_X_FORWARDED_FOR,
   SHRPX_OPTID_SUBCERT,
   SHRPX_OPTID_SYSLOG_FACILITY,
+  SHRPX_OPTID_TLS_DYN_REC_ADAPTIVE,
   SHRPX_OPTID_TLS_DYN_REC_IDLE_TIMEOUT,
   SHRPX_OPTID_TLS_DYN_REC_WARMUP_THRESHOLD,
   SHRPX_OPTID_TLS_MAX_EARLY_DATA,
   SHRPX_OPTID_TLS_MAX_PROTO_VERSION,
   SHRPX_OPTID_TLS_MIN_PROTO_VERSION,
   SHRPX_OPTID_TLS_NO_POSTPONE_EARLY_DATA,
+  SHRPX_OPTID_TLS_PRIVATE_KEY_THREADS,
   SHRPX_OPTID_TLS_PROTO_LIST,
   SHRPX_OPTID_TLS_SCT_DIR,
   SHRPX_OPTID_TLS_SESSION_CACHE_MEMCACHED,
@@ -1166,6 +1366,7 @@ enum {
   SHRPX_OPTID_TLS_SESSION_CACHE_MEMCACHED_CERT_FILE,
   SHRPX_OPTID_TLS_SESSION_CACHE_MEMCACHED_PRIVATE_KEY_FILE,
   SHRPX_OPTID_TLS_SESSION_CACHE_MEMCACHED_TLS,
+  SHRPX_OPTID_TLS_SESSION_CACHE_SIZE,
   SHRPX_OPTID_TLS_TICKET_KEY_CIPHER,
   SHRPX_OPTID_TLS_TICKET_KEY_FILE,
   SHRPX_OPTID_TLS_TICKET_KEY_MEMCACHED,
@@ -1182,6 +1383,8 @@ enum {
   SHRPX_OPTID_VERIFY_CLIENT,
   SHRPX_OPTID_VERIFY_CLIENT_CACERT,
   SHRPX_OPTID_VERIFY_CLIENT_TOLERATE_EXPIRED,
+  SHRPX_OPTID_WORKER_BUFFER_POOL_HIGH_WATERMARK,
+  SHRPX_OPTID_WORKER_BUFFER_POOL_LOW_WATERMARK,
   SHRPX_OPTID_WORKER_FRONTEND_CONNECTIONS,
   SHRPX_OPTID_WORKER_READ_BURST,
   SHRPX_OPTID_WORKER_READ_RATE,
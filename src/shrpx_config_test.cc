@@ -160,6 +160,42 @@ void test_shrpx_config_parse_log_format(void) {
   CU_ASSERT("" == res[1].value);
 }
 
+void test_shrpx_config_compile_log_format(void) {
+  BlockAllocator balloc(4096, 4096);
+
+  auto res = parse_log_format(
+      balloc, StringRef::from_lit(R"($remote_addr [${status}] )"
+                                  R"($http_user_agent)"));
+  CU_ASSERT(5 == res.size());
+
+  CU_ASSERT("remote_addr" == res[0].name);
+  CU_ASSERT(res[1].name.empty());
+  CU_ASSERT("status" == res[2].name);
+  CU_ASSERT("http_user_agent" == res[4].name);
+
+  compile_log_format(balloc, res, AccessLogEncoding::TEXT);
+
+  for (auto &lf : res) {
+    CU_ASSERT(nullptr != lf.write);
+    CU_ASSERT(lf.key.empty());
+  }
+
+  compile_log_format(balloc, res, AccessLogEncoding::JSON);
+
+  CU_ASSERT("\"remote_addr\":" == res[0].key);
+  CU_ASSERT(res[1].key.empty());
+  CU_ASSERT(",\"status\":" == res[2].key);
+  CU_ASSERT(res[3].key.empty());
+  CU_ASSERT(",\"http_user_agent\":" == res[4].key);
+
+  compile_log_format(balloc, res, AccessLogEncoding::BINARY);
+
+  CU_ASSERT(StringRef::from_lit("\x02") == res[0].key);
+  CU_ASSERT(res[1].key.empty());
+  CU_ASSERT(StringRef::from_lit("\x06") == res[2].key);
+  CU_ASSERT(StringRef::from_lit("\x08\x0auser-agent") == res[4].key);
+}
+
 void test_shrpx_config_read_tls_ticket_key_file(void) {
   char file1[] = "/tmp/nghttpx-unittest.XXXXXX";
   auto fd1 = mkstemp(file1);
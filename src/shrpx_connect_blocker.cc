@@ -24,13 +24,27 @@
  */
 #include "shrpx_connect_blocker.h"
 #include "shrpx_config.h"
+#include "shrpx_backend_health.h"
 #include "shrpx_log.h"
 
 namespace shrpx {
 
+namespace {
+// The interval in seconds to see whether the offline peer shared
+// with the other workers has come back online.
+constexpr ev_tstamp SHARED_OFFLINE_RECHECK_INTERVAL = 1.;
+} // namespace
+
 namespace {
 void connect_blocker_cb(struct ev_loop *loop, ev_timer *w, int revents) {
   auto connect_blocker = static_cast<ConnectBlocker *>(w->data);
+
+  // The shared state may still block connection.  If so, blocked()
+  // restarts timer.
+  if (connect_blocker->blocked()) {
+    return;
+  }
+
   if (LOG_ENABLED(INFO)) {
     LOG(INFO) << "Unblock";
   }
@@ -41,20 +55,64 @@ void connect_blocker_cb(struct ev_loop *loop, ev_timer *w, int revents) {
 
 ConnectBlocker::ConnectBlocker(std::mt19937 &gen, struct ev_loop *loop,
                                std::function<void()> block_func,
-                               std::function<void()> unblock_func)
+                               std::function<void()> unblock_func,
+                               std::shared_ptr<BackendHealth> health)
     : gen_(gen),
       block_func_(block_func),
       unblock_func_(unblock_func),
       loop_(loop),
+      health_(std::move(health)),
       fail_count_(0),
-      offline_(false) {
+      offline_(false),
+      probing_(false) {
   ev_timer_init(&timer_, connect_blocker_cb, 0., 0.);
   timer_.data = this;
 }
 
-ConnectBlocker::~ConnectBlocker() { ev_timer_stop(loop_, &timer_); }
+ConnectBlocker::~ConnectBlocker() {
+  ev_timer_stop(loop_, &timer_);
+
+  if (probing_) {
+    // Nobody checks liveness of this peer anymore.  Forget that it
+    // is offline so that it is detected again by the other workers.
+    health_->offline.store(false, std::memory_order_relaxed);
+    health_->fail_count.store(0, std::memory_order_relaxed);
+    health_->probing.store(false, std::memory_order_release);
+  }
+}
+
+bool ConnectBlocker::blocked() {
+  if (ev_is_active(&timer_)) {
+    return true;
+  }
+
+  if (!health_) {
+    return false;
+  }
+
+  if (health_->offline.load(std::memory_order_relaxed)) {
+    ev_timer_set(&timer_, SHARED_OFFLINE_RECHECK_INTERVAL, 0.);
+    ev_timer_start(loop_, &timer_);
+
+    return true;
+  }
+
+  auto blocked_until = health_->blocked_until.load(std::memory_order_relaxed);
+  if (blocked_until == 0) {
+    return false;
+  }
+
+  auto now = backend_health_now();
+  if (blocked_until <= now) {
+    return false;
+  }
+
+  ev_timer_set(&timer_, static_cast<ev_tstamp>(blocked_until - now) / 1e9,
+               0.);
+  ev_timer_start(loop_, &timer_);
 
-bool ConnectBlocker::blocked() const { return ev_is_active(&timer_); }
+  return true;
+}
 
 void ConnectBlocker::on_success() {
   if (ev_is_active(&timer_)) {
@@ -62,6 +120,11 @@ void ConnectBlocker::on_success() {
   }
 
   fail_count_ = 0;
+
+  if (health_) {
+    health_->fail_count.store(0, std::memory_order_relaxed);
+    health_->blocked_until.store(0, std::memory_order_relaxed);
+  }
 }
 
 // Use the similar backoff algorithm described in
@@ -79,7 +142,12 @@ void ConnectBlocker::on_failure() {
 
   call_block_func();
 
-  ++fail_count_;
+  if (health_) {
+    fail_count_ =
+        health_->fail_count.fetch_add(1, std::memory_order_relaxed) + 1;
+  } else {
+    ++fail_count_;
+  }
 
   auto base_backoff =
       util::int_pow(MULTIPLIER, std::min(MAX_BACKOFF_EXP, fail_count_));
@@ -94,14 +162,31 @@ void ConnectBlocker::on_failure() {
   LOG(WARN) << "Could not connect " << fail_count_
             << " times in a row; sleep for " << backoff << " seconds";
 
+  if (health_) {
+    health_->blocked_until.store(
+        backend_health_now() + static_cast<int64_t>(backoff * 1e9),
+        std::memory_order_relaxed);
+  }
+
   ev_timer_set(&timer_, backoff, 0.);
   ev_timer_start(loop_, &timer_);
 }
 
+void ConnectBlocker::eject(ev_tstamp duration) {
+  if (ev_is_active(&timer_)) {
+    return;
+  }
+
+  call_block_func();
+
+  ev_timer_set(&timer_, duration, 0.);
+  ev_timer_start(loop_, &timer_);
+}
+
 size_t ConnectBlocker::get_fail_count() const { return fail_count_; }
 
 void ConnectBlocker::offline() {
-  if (offline_) {
+  if (in_offline()) {
     return;
   }
 
@@ -109,9 +194,21 @@ void ConnectBlocker::offline() {
     call_block_func();
   }
 
+  ev_timer_stop(loop_, &timer_);
+
+  if (health_) {
+    // The worker which runs liveness check may not be this one.  Keep
+    // looking at the shared state to know when it comes back.
+    health_->offline.store(true, std::memory_order_relaxed);
+
+    ev_timer_set(&timer_, SHARED_OFFLINE_RECHECK_INTERVAL, 0.);
+    ev_timer_start(loop_, &timer_);
+
+    return;
+  }
+
   offline_ = true;
 
-  ev_timer_stop(loop_, &timer_);
   ev_timer_set(&timer_, std::numeric_limits<double>::max(), 0.);
   ev_timer_start(loop_, &timer_);
 }
@@ -124,9 +221,46 @@ void ConnectBlocker::online() {
   fail_count_ = 0;
 
   offline_ = false;
+
+  if (health_) {
+    health_->fail_count.store(0, std::memory_order_relaxed);
+    health_->blocked_until.store(0, std::memory_order_relaxed);
+    health_->offline.store(false, std::memory_order_relaxed);
+
+    if (probing_) {
+      probing_ = false;
+      health_->probing.store(false, std::memory_order_release);
+    }
+  }
+}
+
+bool ConnectBlocker::in_offline() const {
+  if (health_) {
+    return health_->offline.load(std::memory_order_relaxed);
+  }
+
+  return offline_;
 }
 
-bool ConnectBlocker::in_offline() const { return offline_; }
+bool ConnectBlocker::acquire_probe() {
+  if (!health_) {
+    return true;
+  }
+
+  if (probing_) {
+    return false;
+  }
+
+  auto expected = false;
+  if (!health_->probing.compare_exchange_strong(expected, true,
+                                                std::memory_order_acquire)) {
+    return false;
+  }
+
+  probing_ = true;
+
+  return true;
+}
 
 void ConnectBlocker::call_block_func() {
   if (block_func_) {
@@ -29,20 +29,28 @@
 
 #include <random>
 #include <functional>
+#include <memory>
 
 #include <ev.h>
 
 namespace shrpx {
 
+struct BackendHealth;
+
 class ConnectBlocker {
 public:
+  // If |health| is not nullptr, the blocking state is shared through
+  // it with ConnectBlocker objects in the other workers.
   ConnectBlocker(std::mt19937 &gen, struct ev_loop *loop,
                  std::function<void()> block_func,
-                 std::function<void()> unblock_func);
+                 std::function<void()> unblock_func,
+                 std::shared_ptr<BackendHealth> health);
   ~ConnectBlocker();
 
-  // Returns true if making connection is not allowed.
-  bool blocked() const;
+  // Returns true if making connection is not allowed.  If the shared
+  // state blocks connection, this function starts timer so that
+  // unblock function is called when it is lifted.
+  bool blocked();
   // Call this function if connect operation succeeded.  This will
   // reset sleep_ to minimum value.
   void on_success();
@@ -51,6 +59,12 @@ public:
   // backoff.
   void on_failure();
 
+  // Blocks connection for |duration| seconds regardless of the
+  // connection health.  This is used to eject the peer from load
+  // balancing when it is found to be an outlier.  Unlike
+  // on_failure(), the blocking is not shared with the other workers.
+  void eject(ev_tstamp duration);
+
   size_t get_fail_count() const;
 
   // Peer is now considered offline.  This effectively means that the
@@ -63,6 +77,12 @@ public:
   // Returns true if peer is considered offline.
   bool in_offline() const;
 
+  // Returns true if the caller should run liveness check for the
+  // offline peer.  If the state is shared, only one ConnectBlocker
+  // among workers gets true until online() is called on it or it is
+  // destroyed.
+  bool acquire_probe();
+
   void call_block_func();
   void call_unblock_func();
 
@@ -74,11 +94,17 @@ private:
   std::function<void()> unblock_func_;
   ev_timer timer_;
   struct ev_loop *loop_;
+  // The state shared with the other workers.  nullptr if this
+  // object is not shared.
+  std::shared_ptr<BackendHealth> health_;
   // The number of consecutive connection failure.  Reset to 0 on
   // success.
   size_t fail_count_;
   // true if peer is considered offline.
   bool offline_;
+  // true if acquire_probe() returned true, and liveness check has not
+  // finished yet.
+  bool probing_;
 };
 
 } // namespace shrpx
@@ -27,6 +27,9 @@
 #ifdef HAVE_UNISTD_H
 #  include <unistd.h>
 #endif // HAVE_UNISTD_H
+#ifdef HAVE_FCNTL_H
+#  include <fcntl.h>
+#endif // HAVE_FCNTL_H
 #include <netinet/tcp.h>
 
 #include <limits>
@@ -35,6 +38,7 @@
 
 #include "shrpx_tls.h"
 #include "shrpx_memcached_request.h"
+#include "shrpx_private_key_pool.h"
 #include "shrpx_log.h"
 #include "memchunk.h"
 #include "util.h"
@@ -69,6 +73,7 @@ Connection::Connection(struct ev_loop *loop, int fd, SSL *ssl,
       fd(fd),
       tls_dyn_rec_warmup_threshold(tls_dyn_rec_warmup_threshold),
       tls_dyn_rec_idle_timeout(tls_dyn_rec_idle_timeout),
+      tls_dyn_rec_adaptive(false),
       proto(proto),
       last_read(0.),
       read_timeout(read_timeout) {
@@ -97,6 +102,17 @@ Connection::~Connection() { disconnect(); }
 
 void Connection::disconnect() {
   if (tls.ssl) {
+    if (tls.private_key_op) {
+      // Resume the handshake job paused for the private key operation
+      // so that it fails and finishes.  Otherwise, OpenSSL cannot
+      // release it.
+      tls.private_key_op->canceled.store(true, std::memory_order_relaxed);
+      private_key_offload_begin(this);
+      SSL_do_handshake(tls.ssl);
+      private_key_offload_end();
+      tls.private_key_op.reset();
+    }
+
     SSL_set_shutdown(tls.ssl,
                      SSL_get_shutdown(tls.ssl) | SSL_RECEIVED_SHUTDOWN);
     ERR_clear_error();
@@ -355,6 +371,7 @@ int Connection::tls_handshake() {
 
   switch (tls.handshake_state) {
   case TLSHandshakeState::WAIT_FOR_SESSION_CACHE:
+  case TLSHandshakeState::WAIT_FOR_PRIVATE_KEY_OP:
     return SHRPX_ERR_INPROGRESS;
   case TLSHandshakeState::GOT_SESSION_CACHE: {
     // Use the same trick invented by @kazuho in h2o project.
@@ -394,6 +411,8 @@ int Connection::tls_handshake() {
 
   ERR_clear_error();
 
+  private_key_offload_begin(this);
+
 #if OPENSSL_1_1_1_API
   if (!tls.server_handshake || tls.early_data_finish) {
     rv = SSL_do_handshake(tls.ssl);
@@ -450,6 +469,8 @@ int Connection::tls_handshake() {
   rv = SSL_do_handshake(tls.ssl);
 #endif // !OPENSSL_1_1_1_API
 
+  private_key_offload_end();
+
   if (rv <= 0) {
     auto err = SSL_get_error(tls.ssl, rv);
     switch (err) {
@@ -463,6 +484,12 @@ int Connection::tls_handshake() {
       break;
     case SSL_ERROR_WANT_WRITE:
       break;
+#ifdef SSL_ERROR_WANT_ASYNC
+    case SSL_ERROR_WANT_ASYNC:
+      // The handshake is paused until PrivateKeyPool completes the
+      // private key operation.
+      break;
+#endif // SSL_ERROR_WANT_ASYNC
     case SSL_ERROR_SSL: {
       if (LOG_ENABLED(INFO)) {
         LOG(INFO) << "tls: handshake libssl error: "
@@ -520,6 +547,10 @@ int Connection::tls_handshake() {
     }
   }
 
+  if (tls.private_key_op) {
+    tls.handshake_state = TLSHandshakeState::WAIT_FOR_PRIVATE_KEY_OP;
+  }
+
   if (!read_buffer_full(tls.rbuf)) {
     // We may have stopped reading
     rlimit.startw();
@@ -544,6 +575,11 @@ int Connection::tls_handshake() {
 
   tls.initial_handshake_done = true;
 
+#ifdef SSL_MODE_ASYNC
+  // The rest of I/O does not need async jobs.
+  SSL_clear_mode(tls.ssl, SSL_MODE_ASYNC);
+#endif // SSL_MODE_ASYNC
+
   return write_tls_pending_handshake();
 }
 
@@ -639,6 +675,25 @@ namespace {
 constexpr size_t SHRPX_SMALL_WRITE_LIMIT = 1300;
 } // namespace
 
+namespace {
+// Returns the number of bytes added to each TLS record by |ssl|.
+size_t get_tls_overhead(SSL *ssl) {
+  // TODO 29 (5 (header) + 8 (explicit nonce) + 16 (tag)) is TLS
+  // overhead for AES-GCM.  For CHACHA20_POLY1305, it is 21 since it
+  // does not need 8 bytes explicit nonce.
+  //
+  // For TLSv1.3, AES-GCM and CHACHA20_POLY1305 overhead are now 22
+  // bytes (5 (header) + 1 (ContentType) + 16 (tag)).
+#ifdef TLS1_3_VERSION
+  if (SSL_version(ssl) == TLS1_3_VERSION) {
+    return 22;
+  }
+#endif // TLS1_3_VERSION
+
+  return 29;
+}
+} // namespace
+
 size_t Connection::get_tls_write_limit() {
 
   if (tls_dyn_rec_warmup_threshold == 0) {
@@ -651,16 +706,67 @@ size_t Connection::get_tls_write_limit() {
       t - tls.last_write_idle > tls_dyn_rec_idle_timeout) {
     // Time out, use small record size
     tls.warmup_writelen = 0;
-    return SHRPX_SMALL_WRITE_LIMIT;
+    if (!tls_dyn_rec_adaptive) {
+      return SHRPX_SMALL_WRITE_LIMIT;
+    }
   }
 
   if (tls.warmup_writelen >= tls_dyn_rec_warmup_threshold) {
     return std::numeric_limits<ssize_t>::max();
   }
 
+  if (tls_dyn_rec_adaptive) {
+    auto limit = get_tls_adaptive_write_limit();
+    if (limit == 0) {
+      // The congestion window has grown enough.  Stay in max record
+      // size until idle timeout.
+      tls.warmup_writelen = tls_dyn_rec_warmup_threshold;
+      return std::numeric_limits<ssize_t>::max();
+    }
+    if (limit > 0) {
+      return limit;
+    }
+  }
+
   return SHRPX_SMALL_WRITE_LIMIT;
 }
 
+ssize_t Connection::get_tls_adaptive_write_limit() const {
+#ifdef TCP_INFO
+  struct tcp_info tcp_info;
+  socklen_t tcp_info_len = sizeof(tcp_info);
+  int rv;
+
+  rv = getsockopt(fd, IPPROTO_TCP, TCP_INFO, &tcp_info, &tcp_info_len);
+
+  if (rv != 0) {
+    return -1;
+  }
+
+  auto tls_overhead = get_tls_overhead(tls.ssl);
+
+  if (tcp_info.tcpi_snd_mss <= tls_overhead) {
+    return -1;
+  }
+
+  // Payload which fits in a single TCP segment.  Records of this
+  // size never straddle segment boundary, so that the peer can
+  // decrypt each record as soon as a segment arrives.
+  auto payload = static_cast<size_t>(tcp_info.tcpi_snd_mss) - tls_overhead;
+
+  // Switch to the maximum record size once the window can carry at
+  // least 2 full sized records in one round trip.  Until then, a
+  // lost or delayed segment would stall a whole 16K record.
+  if (static_cast<size_t>(tcp_info.tcpi_snd_cwnd) * payload >= 2 * 16_k) {
+    return 0;
+  }
+
+  return payload;
+#else  // !TCP_INFO
+  return -1;
+#endif // !TCP_INFO
+}
+
 void Connection::update_tls_warmup_writelen(size_t n) {
   if (tls.warmup_writelen < tls_dyn_rec_warmup_threshold) {
     tls.warmup_writelen += n;
@@ -920,6 +1026,64 @@ ssize_t Connection::read_clear(void *data, size_t len) {
   return nread;
 }
 
+#ifdef HAVE_SPLICE
+ssize_t Connection::splice_read_clear(int pipefd, size_t len) {
+  len = std::min(len, rlimit.avail());
+  if (len == 0) {
+    return 0;
+  }
+
+  ssize_t nread;
+  while ((nread = splice(fd, nullptr, pipefd, nullptr, len,
+                         SPLICE_F_MOVE | SPLICE_F_NONBLOCK)) == -1 &&
+         errno == EINTR)
+    ;
+  if (nread == -1) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return 0;
+    }
+    return SHRPX_ERR_NETWORK;
+  }
+
+  if (nread == 0) {
+    return SHRPX_ERR_EOF;
+  }
+
+  rlimit.drain(nread);
+
+  return nread;
+}
+
+ssize_t Connection::splice_write_clear(int pipefd, size_t len) {
+  len = std::min(len, wlimit.avail());
+  if (len == 0) {
+    return 0;
+  }
+
+  ssize_t nwrite;
+  while ((nwrite = splice(pipefd, nullptr, fd, nullptr, len,
+                          SPLICE_F_MOVE | SPLICE_F_NONBLOCK)) == -1 &&
+         errno == EINTR)
+    ;
+  if (nwrite == -1) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      wlimit.startw();
+      ev_timer_again(loop, &wt);
+      return 0;
+    }
+    return SHRPX_ERR_NETWORK;
+  }
+
+  wlimit.drain(nwrite);
+
+  if (ev_is_active(&wt)) {
+    ev_timer_again(loop, &wt);
+  }
+
+  return nwrite;
+}
+#endif // HAVE_SPLICE
+
 void Connection::handle_tls_pending_read() {
   if (!ev_is_active(&rev)) {
     return;
@@ -945,21 +1109,7 @@ int Connection::get_tcp_hint(TCPHint *hint) const {
 
   // http://www.slideshare.net/kazuho/programming-tcp-for-responsiveness
 
-  // TODO 29 (5 (header) + 8 (explicit nonce) + 16 (tag)) is TLS
-  // overhead for AES-GCM.  For CHACHA20_POLY1305, it is 21 since it
-  // does not need 8 bytes explicit nonce.
-  //
-  // For TLSv1.3, AES-GCM and CHACHA20_POLY1305 overhead are now 22
-  // bytes (5 (header) + 1 (ContentType) + 16 (tag)).
-  size_t tls_overhead;
-#  ifdef TLS1_3_VERSION
-  if (SSL_version(tls.ssl) == TLS1_3_VERSION) {
-    tls_overhead = 22;
-  } else
-#  endif // TLS1_3_VERSION
-  {
-    tls_overhead = 29;
-  }
+  auto tls_overhead = get_tls_overhead(tls.ssl);
 
   auto writable_size =
       (avail_packets + 2) * (tcp_info.tcpi_snd_mss - tls_overhead);
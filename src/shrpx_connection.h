@@ -29,6 +29,8 @@
 
 #include <sys/uio.h>
 
+#include <memory>
+
 #include <ev.h>
 
 #include <openssl/ssl.h>
@@ -40,6 +42,8 @@
 namespace shrpx {
 
 struct MemcachedRequest;
+struct PrivateKeyOp;
+class PrivateKeyOpQueue;
 
 namespace tls {
 struct TLSSessionCache;
@@ -51,6 +55,8 @@ enum class TLSHandshakeState {
   GOT_SESSION_CACHE,
   CANCEL_SESSION_CACHE,
   WRITE_STARTED,
+  // A private key operation is performed by PrivateKeyPool.
+  WAIT_FOR_PRIVATE_KEY_OP,
 };
 
 struct TLSConnection {
@@ -62,6 +68,11 @@ struct TLSConnection {
   SSL_SESSION *cached_session;
   MemcachedRequest *cached_session_lookup_req;
   tls::TLSSessionCache *client_session_cache;
+  // The queue to offload private key operations to PrivateKeyPool, or
+  // nullptr.
+  PrivateKeyOpQueue *private_key_op_queue;
+  // The private key operation which the handshake waits for.
+  std::shared_ptr<PrivateKeyOp> private_key_op;
   ev_tstamp last_write_idle;
   size_t warmup_writelen;
   // length passed to SSL_write and SSL_read last time.  This is
@@ -127,6 +138,11 @@ struct Connection {
   ssize_t read_tls(void *data, size_t len);
 
   size_t get_tls_write_limit();
+  // Returns the maximum TLS record payload which still fits in the
+  // current congestion window if it is too small to carry full
+  // sized records.  Returns 0 if the window is large enough, and -1
+  // if TCP_INFO is not available.
+  ssize_t get_tls_adaptive_write_limit() const;
   // Updates the number of bytes written in warm up period.
   void update_tls_warmup_writelen(size_t n);
   // Tells there is no immediate write now.  This triggers timer to
@@ -136,6 +152,17 @@ struct Connection {
   ssize_t write_clear(const void *data, size_t len);
   ssize_t writev_clear(struct iovec *iov, int iovcnt);
   ssize_t read_clear(void *data, size_t len);
+#ifdef HAVE_SPLICE
+  // Moves at most |len| bytes from this connection to the write end
+  // of pipe |pipefd| with splice(2).  It returns the number of bytes
+  // moved, 0 if no bytes can be moved now, or negative error code.
+  ssize_t splice_read_clear(int pipefd, size_t len);
+  // Moves at most |len| bytes from the read end of pipe |pipefd| to
+  // this connection with splice(2).  It returns the number of bytes
+  // moved, 0 if this connection is not writable now, or negative
+  // error code.
+  ssize_t splice_write_clear(int pipefd, size_t len);
+#endif // HAVE_SPLICE
 
   void handle_tls_pending_read();
 
@@ -166,6 +193,9 @@ struct Connection {
   int fd;
   size_t tls_dyn_rec_warmup_threshold;
   ev_tstamp tls_dyn_rec_idle_timeout;
+  // true if TLS record size during warm up is derived from TCP
+  // congestion window rather than from the number of bytes written.
+  bool tls_dyn_rec_adaptive;
   // Application protocol used over the connection.  This field is not
   // used in this object at the moment.  The rest of the program may
   // use this value when it is useful.
@@ -44,6 +44,7 @@
 #include "shrpx_accept_handler.h"
 #include "shrpx_memcached_dispatcher.h"
 #include "shrpx_signal.h"
+#include "shrpx_accesslog_writer.h"
 #include "shrpx_log.h"
 #include "util.h"
 #include "template.h"
@@ -113,6 +114,9 @@ void serial_event_async_cb(struct ev_loop *loop, ev_async *w, int revent) {
 
 ConnectionHandler::ConnectionHandler(struct ev_loop *loop, std::mt19937 &gen)
     : gen_(gen),
+      response_cache_(get_config()->http.cache.size),
+      frontend_tls_session_store_(get_config()->tls.session_cache.size),
+      backend_tls_session_store_(get_config()->tls.session_cache.size),
       single_worker_(nullptr),
       loop_(loop),
 #ifdef HAVE_NEVERBLEED
@@ -146,6 +150,13 @@ ConnectionHandler::ConnectionHandler(struct ev_loop *loop, std::mt19937 &gen)
   ocsp_.proc.rfd = -1;
 
   reset_ocsp();
+
+  auto &tlsconf = get_config()->tls;
+
+  if (tlsconf.private_key_threads) {
+    private_key_pool_ =
+        std::make_unique<PrivateKeyPool>(tlsconf.private_key_threads);
+  }
 }
 
 ConnectionHandler::~ConnectionHandler() {
@@ -166,6 +177,9 @@ ConnectionHandler::~ConnectionHandler() {
   // Free workers before destroying ev_loop
   workers_.clear();
 
+  // Workers have gone.  Write remaining access log records.
+  accesslog_writer_.reset();
+
   for (auto loop : worker_loops_) {
     ev_loop_destroy(loop);
   }
@@ -186,6 +200,10 @@ void ConnectionHandler::worker_reopen_log_files() {
   for (auto &worker : workers_) {
     worker->send(wev);
   }
+
+  if (accesslog_writer_) {
+    accesslog_writer_->reopen_log_files();
+  }
 }
 
 void ConnectionHandler::worker_replace_downstream(
@@ -312,6 +330,20 @@ int ConnectionHandler::create_worker_thread(size_t num) {
     LLOG(NOTICE, this) << "Created worker thread #" << workers_.size() - 1;
   }
 
+  auto &accessconf = config->logging.access;
+  if (accessconf.async.enabled &&
+      (accessconf.syslog || !accessconf.file.empty())) {
+    accesslog_writer_ = std::make_unique<AccessLogWriter>();
+
+    for (auto &worker : workers_) {
+      worker->set_accesslog_ring(accesslog_writer_->add_ring());
+    }
+
+    accesslog_writer_->run_async();
+
+    LLOG(NOTICE, this) << "Created access log writer thread";
+  }
+
   for (auto &worker : workers_) {
     worker->run_async();
   }
@@ -449,6 +481,33 @@ Worker *ConnectionHandler::get_single_worker() const {
   return single_worker_.get();
 }
 
+const std::vector<std::unique_ptr<Worker>> &
+ConnectionHandler::get_workers() const {
+  return workers_;
+}
+
+BackendHealthTable *ConnectionHandler::get_backend_health_table() {
+  return &backend_health_table_;
+}
+
+ResponseCache *ConnectionHandler::get_response_cache() {
+  return &response_cache_;
+}
+
+DNSCache *ConnectionHandler::get_dns_cache() { return &dns_cache_; }
+
+TLSSessionStore *ConnectionHandler::get_frontend_tls_session_store() {
+  return &frontend_tls_session_store_;
+}
+
+TLSSessionStore *ConnectionHandler::get_backend_tls_session_store() {
+  return &backend_tls_session_store_;
+}
+
+PrivateKeyPool *ConnectionHandler::get_private_key_pool() const {
+  return private_key_pool_.get();
+}
+
 void ConnectionHandler::add_acceptor(std::unique_ptr<AcceptHandler> h) {
   acceptors_.push_back(std::move(h));
 }
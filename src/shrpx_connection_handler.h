@@ -51,6 +51,11 @@
 #include "shrpx_downstream_connection_pool.h"
 #include "shrpx_config.h"
 #include "shrpx_exec.h"
+#include "shrpx_backend_health.h"
+#include "shrpx_cache.h"
+#include "shrpx_dns_cache.h"
+#include "shrpx_tls_session_store.h"
+#include "shrpx_private_key_pool.h"
 
 namespace shrpx {
 
@@ -62,6 +67,7 @@ struct WorkerStat;
 struct TicketKeys;
 class MemcachedDispatcher;
 struct UpstreamAddr;
+class AccessLogWriter;
 
 namespace tls {
 
@@ -117,6 +123,18 @@ public:
   const std::shared_ptr<TicketKeys> &get_ticket_keys() const;
   struct ev_loop *get_loop() const;
   Worker *get_single_worker() const;
+  // Returns Worker objects created by create_worker_thread().  The
+  // returned vector is not modified until ConnectionHandler is
+  // destroyed.
+  const std::vector<std::unique_ptr<Worker>> &get_workers() const;
+  BackendHealthTable *get_backend_health_table();
+  ResponseCache *get_response_cache();
+  DNSCache *get_dns_cache();
+  TLSSessionStore *get_frontend_tls_session_store();
+  TLSSessionStore *get_backend_tls_session_store();
+  // Returns the pool of threads which perform private key operations,
+  // or nullptr if they are performed by workers.
+  PrivateKeyPool *get_private_key_pool() const;
   void add_acceptor(std::unique_ptr<AcceptHandler> h);
   void delete_acceptor();
   void enable_acceptor();
@@ -191,10 +209,29 @@ private:
   std::mt19937 &gen_;
   // ev_loop for each worker
   std::vector<struct ev_loop *> worker_loops_;
+  // Backend connection health shared by all workers.  This must
+  // outlive workers_ and single_worker_.
+  BackendHealthTable backend_health_table_;
+  // Response cache shared by all workers.  This must outlive
+  // workers_ and single_worker_.
+  ResponseCache response_cache_;
+  // Name lookup results shared by all workers.  This must outlive
+  // workers_ and single_worker_.
+  DNSCache dns_cache_;
+  // TLS sessions shared by all workers.  They must outlive workers_
+  // and single_worker_.
+  TLSSessionStore frontend_tls_session_store_;
+  TLSSessionStore backend_tls_session_store_;
+  // Signing threads shared by all workers.  This must outlive
+  // workers_ and single_worker_.
+  std::unique_ptr<PrivateKeyPool> private_key_pool_;
   // Worker instances when multi threaded mode (-nN, N >= 2) is used.
   // If at least one frontend enables API request, we allocate 1
   // additional worker dedicated to API request .
   std::vector<std::unique_ptr<Worker>> workers_;
+  // Writes access log records queued by workers_ if
+  // --accesslog-async is enabled.  Otherwise, nullptr.
+  std::unique_ptr<AccessLogWriter> accesslog_writer_;
   // mutex for serial event resive buffer handling
   std::mutex serial_event_mu_;
   // SerialEvent receive buffer
@@ -0,0 +1,115 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_dns_cache.h"
+
+#include <algorithm>
+
+namespace shrpx {
+
+ev_tstamp dns_records_lifetime(int ttl, ev_tstamp cache_timeout) {
+  if (ttl < 0) {
+    return cache_timeout;
+  }
+
+  return std::min(std::max(static_cast<ev_tstamp>(ttl), 1.), cache_timeout);
+}
+
+ev_tstamp dns_records_refresh_time(const DNSRecords &records) {
+  // Refresh in the last quarter of the lifetime.
+  return records.created + (records.expiry - records.created) * 0.75;
+}
+
+std::shared_ptr<const DNSRecords> DNSCache::get(const StringRef &host) {
+  std::lock_guard<std::mutex> g(mu_);
+
+  auto it = entries_.find(host.str());
+  if (it == std::end(entries_)) {
+    return nullptr;
+  }
+
+  return (*it).second.records;
+}
+
+void DNSCache::put(const StringRef &host,
+                   std::shared_ptr<const DNSRecords> records) {
+  std::lock_guard<std::mutex> g(mu_);
+
+  auto &ent = entries_[host.str()];
+  ent.refresh_deadline = 0.;
+
+  if (ent.records && ent.records->created > records->created) {
+    return;
+  }
+
+  ent.records = std::move(records);
+}
+
+bool DNSCache::start_refresh(const StringRef &host, ev_tstamp now,
+                             ev_tstamp deadline) {
+  std::lock_guard<std::mutex> g(mu_);
+
+  auto &ent = entries_[host.str()];
+  if (ent.refresh_deadline > now) {
+    return false;
+  }
+
+  ent.refresh_deadline = deadline;
+
+  return true;
+}
+
+void DNSCache::cancel_refresh(const StringRef &host) {
+  std::lock_guard<std::mutex> g(mu_);
+
+  auto it = entries_.find(host.str());
+  if (it == std::end(entries_)) {
+    return;
+  }
+
+  (*it).second.refresh_deadline = 0.;
+}
+
+void DNSCache::remove_expired(ev_tstamp now) {
+  std::lock_guard<std::mutex> g(mu_);
+
+  for (auto it = std::begin(entries_); it != std::end(entries_);) {
+    auto &ent = (*it).second;
+    if (ent.refresh_deadline > now ||
+        (ent.records && ent.records->expiry >= now)) {
+      ++it;
+      continue;
+    }
+
+    it = entries_.erase(it);
+  }
+}
+
+size_t DNSCache::get_num_entries() {
+  std::lock_guard<std::mutex> g(mu_);
+
+  return entries_.size();
+}
+
+} // namespace shrpx
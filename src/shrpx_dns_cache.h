@@ -0,0 +1,106 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHRPX_DNS_CACHE_H
+#define SHRPX_DNS_CACHE_H
+
+#include "shrpx.h"
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include <ev.h>
+
+#include "shrpx_dns_resolver.h"
+#include "template.h"
+#include "network.h"
+
+using namespace nghttp2;
+
+namespace shrpx {
+
+// DNSRecords is the result of name lookup for a host.  It is
+// immutable once it is created, and shared by all workers.
+struct DNSRecords {
+  // Resolved addresses.  Port portion is undefined.  It is empty if
+  // status is DNSResolverStatus::ERROR.
+  std::vector<Address> addrs;
+  // The time when the name lookup finished.
+  ev_tstamp created;
+  // The time when this result expires.
+  ev_tstamp expiry;
+  // DNSResolverStatus::OK or DNSResolverStatus::ERROR.
+  DNSResolverStatus status;
+};
+
+// Returns the duration in seconds for which the result of name lookup
+// is used.  |ttl| is the TTL of records, or -1 if it is unknown.  It
+// is capped by |cache_timeout|.
+ev_tstamp dns_records_lifetime(int ttl, ev_tstamp cache_timeout);
+
+// Returns the time after which |records| should be refreshed in
+// background.
+ev_tstamp dns_records_refresh_time(const DNSRecords &records);
+
+// DNSCache holds the latest result of name lookup for each host, so
+// that a host resolved by a worker is not resolved again by the other
+// workers.  It is thread-safe.
+class DNSCache {
+public:
+  // Returns the result for |host|, or nullptr.  The result may have
+  // been expired.
+  std::shared_ptr<const DNSRecords> get(const StringRef &host);
+  // Stores |records| for |host| unless a newer one is stored.
+  void put(const StringRef &host, std::shared_ptr<const DNSRecords> records);
+  // Returns true if the caller should refresh the result for |host|.
+  // It returns false if another worker started refreshing it, and it
+  // has not finished until |now|.  The caller has to finish it by
+  // |deadline|.
+  bool start_refresh(const StringRef &host, ev_tstamp now,
+                     ev_tstamp deadline);
+  // Tells that the refresh of the result for |host| failed, so that
+  // it can be started again.
+  void cancel_refresh(const StringRef &host);
+  // Removes results which have been expired at |now|.
+  void remove_expired(ev_tstamp now);
+
+  size_t get_num_entries();
+
+private:
+  struct Entry {
+    std::shared_ptr<const DNSRecords> records;
+    // The time until which a worker is refreshing this entry, or 0.
+    ev_tstamp refresh_deadline;
+  };
+
+  std::mutex mu_;
+  std::unordered_map<std::string, Entry> entries_;
+};
+
+} // namespace shrpx
+
+#endif // SHRPX_DNS_CACHE_H
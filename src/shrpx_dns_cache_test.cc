@@ -0,0 +1,166 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_dns_cache_test.h"
+
+#include <arpa/inet.h>
+
+#include <CUnit/CUnit.h>
+
+#include "shrpx_dns_cache.h"
+#include "shrpx_dns_tracker.h"
+#include "shrpx_config.h"
+#include "shrpx_log.h"
+
+namespace shrpx {
+
+void test_shrpx_dns_cache_lifetime(void) {
+  CU_ASSERT(10. == dns_records_lifetime(-1, 10.));
+  CU_ASSERT(1. == dns_records_lifetime(0, 10.));
+  CU_ASSERT(5. == dns_records_lifetime(5, 10.));
+  CU_ASSERT(10. == dns_records_lifetime(3600, 10.));
+
+  DNSRecords records{};
+  records.created = 100.;
+  records.expiry = 120.;
+
+  CU_ASSERT(115. == dns_records_refresh_time(records));
+}
+
+namespace {
+std::shared_ptr<const DNSRecords> make_records(ev_tstamp created,
+                                               ev_tstamp expiry) {
+  auto records = std::make_shared<DNSRecords>();
+  records->created = created;
+  records->expiry = expiry;
+  records->status = DNSResolverStatus::OK;
+  records->addrs.emplace_back();
+  return records;
+}
+} // namespace
+
+void test_shrpx_dns_cache(void) {
+  DNSCache cache;
+  auto host = StringRef::from_lit("example.com");
+
+  CU_ASSERT(nullptr == cache.get(host));
+
+  auto r1 = make_records(100., 110.);
+  cache.put(host, r1);
+
+  CU_ASSERT(r1 == cache.get(host));
+  CU_ASSERT(nullptr == cache.get(StringRef::from_lit("example.org")));
+
+  // Older result does not replace newer one.
+  auto r0 = make_records(90., 100.);
+  cache.put(host, r0);
+
+  CU_ASSERT(r1 == cache.get(host));
+
+  // Only one worker refreshes the result until the deadline.
+  CU_ASSERT(cache.start_refresh(host, 108., 112.));
+  CU_ASSERT(!cache.start_refresh(host, 109., 113.));
+  CU_ASSERT(cache.start_refresh(host, 112., 116.));
+
+  auto r2 = make_records(113., 123.);
+  cache.put(host, r2);
+
+  CU_ASSERT(r2 == cache.get(host));
+  CU_ASSERT(cache.start_refresh(host, 114., 118.));
+
+  cache.put(host, make_records(115., 125.));
+
+  cache.remove_expired(124.);
+
+  CU_ASSERT(1 == cache.get_num_entries());
+
+  cache.remove_expired(126.);
+
+  CU_ASSERT(0 == cache.get_num_entries());
+}
+
+void test_shrpx_dns_cache_refresh_failure(void) {
+  auto loop = EV_DEFAULT;
+  auto &dnsconf = mod_config()->dns;
+  auto saved_dnsconf = dnsconf;
+
+  dnsconf.timeout.cache = 100.;
+  dnsconf.timeout.lookup = 1.;
+  dnsconf.max_try = 1;
+
+  // Names under "invalid" are never resolved (RFC 6761).
+  auto host = StringRef::from_lit("nghttpx.invalid");
+
+  ev_now_update(loop);
+  auto now = ev_now(loop);
+
+  Address addr{};
+  addr.su.in.sin_family = AF_INET;
+  inet_pton(AF_INET, "192.0.2.1", &addr.su.in.sin_addr);
+  addr.len = sizeof(addr.su.in);
+
+  // The records have been resolved by another worker, and are in the
+  // last quarter of their lifetime.
+  auto records = std::make_shared<DNSRecords>();
+  records->created = now - 90.;
+  records->expiry = now + 10.;
+  records->status = DNSResolverStatus::OK;
+  records->addrs.push_back(addr);
+
+  DNSCache cache;
+  cache.put(host, records);
+
+  {
+    DNSTracker tracker(loop, &cache);
+    DNSQuery dnsq(host, [](DNSResolverStatus, const Address *) {});
+    Address result{};
+
+    CU_ASSERT(DNSResolverStatus::OK == tracker.resolve(&result, &dnsq));
+    CU_ASSERT(0 == memcmp(&addr.su.in.sin_addr, &result.su.in.sin_addr,
+                          sizeof(addr.su.in.sin_addr)));
+    // The records are refreshed in background.
+    CU_ASSERT(!cache.start_refresh(host, now, now + 100.));
+
+    // The refresh fails, and it can be started again.
+    for (size_t i = 0;
+         i < 100 &&
+         !cache.start_refresh(host, ev_now(loop), ev_now(loop) + 100.);
+         ++i) {
+      ev_run(loop, EVRUN_ONCE);
+    }
+
+    // The failure does not replace the records which are still valid.
+    CU_ASSERT(records == cache.get(host));
+
+    result = Address{};
+
+    CU_ASSERT(DNSResolverStatus::OK == tracker.resolve(&result, &dnsq));
+    CU_ASSERT(0 == memcmp(&addr.su.in.sin_addr, &result.su.in.sin_addr,
+                          sizeof(addr.su.in.sin_addr)));
+  }
+
+  dnsconf = saved_dnsconf;
+}
+
+} // namespace shrpx
@@ -25,7 +25,10 @@
 #include "shrpx_dns_resolver.h"
 
 #include <cstring>
+#include <array>
+#include <algorithm>
 #include <sys/time.h>
+#include <arpa/inet.h>
 
 #include "shrpx_log.h"
 #include "shrpx_connection.h"
@@ -55,9 +58,18 @@ void sock_state_cb(void *data, int s, int read, int write) {
 } // namespace
 
 namespace {
-void host_cb(void *arg, int status, int timeouts, hostent *hostent) {
+// DNS class and types, which are defined in arpa/nameser.h, but its
+// availability varies.
+constexpr int DNS_CLASS_IN = 1;
+constexpr int DNS_TYPE_A = 1;
+constexpr int DNS_TYPE_AAAA = 28;
+} // namespace
+
+namespace {
+void search_cb(void *arg, int status, int timeouts, unsigned char *abuf,
+               int alen) {
   auto resolv = static_cast<DNSResolver *>(arg);
-  resolv->on_result(status, hostent);
+  resolv->on_result(status, abuf, alen);
 }
 } // namespace
 
@@ -115,10 +127,10 @@ void stop_ev(struct ev_loop *loop,
 } // namespace
 
 DNSResolver::DNSResolver(struct ev_loop *loop)
-    : result_{},
-      loop_(loop),
+    : loop_(loop),
       channel_(nullptr),
       family_(AF_UNSPEC),
+      ttl_(-1),
       status_(DNSResolverStatus::IDLE) {
   ev_timer_init(&timer_, timeoutcb, 0., 0.);
   timer_.data = this;
@@ -171,14 +183,97 @@ int DNSResolver::resolve(const StringRef &name, int family) {
   }
 
   channel_ = chan;
+
+  if (resolve_local() == 0) {
+    return 0;
+  }
+
   status_ = DNSResolverStatus::RUNNING;
 
-  ares_gethostbyname(channel_, name_.c_str(), family_, host_cb, this);
+  ares_search(channel_, name_.c_str(), DNS_CLASS_IN,
+              family_ == AF_INET ? DNS_TYPE_A : DNS_TYPE_AAAA, search_cb,
+              this);
   reset_timeout();
 
   return 0;
 }
 
+int DNSResolver::resolve_local() {
+  if (util::numeric_host(name_.c_str())) {
+    if (!util::numeric_host(name_.c_str(), family_)) {
+      status_ = DNSResolverStatus::ERROR;
+      return 0;
+    }
+
+    std::array<uint8_t, sizeof(in6_addr)> buf;
+    if (inet_pton(family_, name_.c_str(), buf.data()) != 1) {
+      status_ = DNSResolverStatus::ERROR;
+      return 0;
+    }
+
+    add_addr(buf.data());
+    status_ = DNSResolverStatus::OK;
+
+    return 0;
+  }
+
+  hostent *hostent;
+  if (ares_gethostbyname_file(channel_, name_.c_str(), family_, &hostent) !=
+      ARES_SUCCESS) {
+    return -1;
+  }
+
+  if (hostent->h_addrtype == family_) {
+    for (auto ap = hostent->h_addr_list;
+         *ap && addrs_.size() < DNS_RESOLVER_MAX_ADDRS; ++ap) {
+      add_addr(*ap);
+    }
+  }
+
+  ares_free_hostent(hostent);
+
+  if (addrs_.empty()) {
+    return -1;
+  }
+
+  if (LOG_ENABLED(INFO)) {
+    LOG(INFO) << "Name lookup succeeded (hosts file): " << name_ << " -> "
+              << util::numeric_name(&addrs_[0].su.sa, addrs_[0].len);
+  }
+
+  status_ = DNSResolverStatus::OK;
+
+  return 0;
+}
+
+void DNSResolver::add_addr(const void *addr) {
+  addrs_.emplace_back();
+  auto &result = addrs_.back();
+
+  switch (family_) {
+  case AF_INET:
+    result.len = sizeof(result.su.in);
+    result.su.in = {};
+    result.su.in.sin_family = AF_INET;
+#ifdef HAVE_SOCKADDR_IN_SIN_LEN
+    result.su.in.sin_len = sizeof(result.su.in);
+#endif // HAVE_SOCKADDR_IN_SIN_LEN
+    memcpy(&result.su.in.sin_addr, addr, sizeof(result.su.in.sin_addr));
+    break;
+  case AF_INET6:
+    result.len = sizeof(result.su.in6);
+    result.su.in6 = {};
+    result.su.in6.sin6_family = AF_INET6;
+#ifdef HAVE_SOCKADDR_IN6_SIN6_LEN
+    result.su.in6.sin6_len = sizeof(result.su.in6);
+#endif // HAVE_SOCKADDR_IN6_SIN6_LEN
+    memcpy(&result.su.in6.sin6_addr, addr, sizeof(result.su.in6.sin6_addr));
+    break;
+  default:
+    assert(0);
+  }
+}
+
 int DNSResolver::on_read(int fd) { return handle_event(fd, ARES_SOCKET_BAD); }
 
 int DNSResolver::on_write(int fd) { return handle_event(ARES_SOCKET_BAD, fd); }
@@ -230,12 +325,16 @@ DNSResolverStatus DNSResolver::get_status(Address *result) const {
   }
 
   if (result) {
-    memcpy(result, &result_, sizeof(result_));
+    memcpy(result, &addrs_[0], sizeof(*result));
   }
 
   return status_;
 }
 
+const std::vector<Address> &DNSResolver::get_addrs() const { return addrs_; }
+
+int DNSResolver::get_ttl() const { return ttl_; }
+
 namespace {
 void start_ev(std::vector<std::unique_ptr<ev_io>> &evs, struct ev_loop *loop,
               int fd, int event, IOCb cb, void *data) {
@@ -285,7 +384,8 @@ void DNSResolver::start_wev(int fd) {
 
 void DNSResolver::stop_wev(int fd) { stop_ev(wevs_, loop_, fd, EV_WRITE); }
 
-void DNSResolver::on_result(int status, hostent *hostent) {
+void DNSResolver::on_result(int status, const unsigned char *abuf,
+                            int alen) {
   stop_ev(loop_, revs_);
   stop_ev(loop_, wevs_);
   ev_timer_stop(loop_, &timer_);
@@ -299,49 +399,65 @@ void DNSResolver::on_result(int status, hostent *hostent) {
     return;
   }
 
-  auto ap = *hostent->h_addr_list;
-  if (!ap) {
-    if (LOG_ENABLED(INFO)) {
-      LOG(INFO) << "Name lookup for " << name_ << "failed: no address returned";
-    }
-    status_ = DNSResolverStatus::ERROR;
-    return;
-  }
+  auto naddrttls = static_cast<int>(DNS_RESOLVER_MAX_ADDRS);
+  int rv;
 
-  switch (hostent->h_addrtype) {
-  case AF_INET:
-    status_ = DNSResolverStatus::OK;
-    result_.len = sizeof(result_.su.in);
-    result_.su.in = {};
-    result_.su.in.sin_family = AF_INET;
-#ifdef HAVE_SOCKADDR_IN_SIN_LEN
-    result_.su.in.sin_len = sizeof(result_.su.in);
-#endif // HAVE_SOCKADDR_IN_SIN_LEN
-    memcpy(&result_.su.in.sin_addr, ap, sizeof(result_.su.in.sin_addr));
+  switch (family_) {
+  case AF_INET: {
+    std::array<ares_addrttl, DNS_RESOLVER_MAX_ADDRS> addrttls;
+    rv = ares_parse_a_reply(abuf, alen, nullptr, addrttls.data(), &naddrttls);
+    if (rv != ARES_SUCCESS) {
+      break;
+    }
+    for (int i = 0; i < naddrttls; ++i) {
+      add_addr(&addrttls[i].ipaddr);
+      ttl_ = ttl_ == -1 ? addrttls[i].ttl : std::min(ttl_, addrttls[i].ttl);
+    }
     break;
-  case AF_INET6:
-    status_ = DNSResolverStatus::OK;
-    result_.len = sizeof(result_.su.in6);
-    result_.su.in6 = {};
-    result_.su.in6.sin6_family = AF_INET6;
-#ifdef HAVE_SOCKADDR_IN6_SIN6_LEN
-    result_.su.in6.sin6_len = sizeof(result_.su.in6);
-#endif // HAVE_SOCKADDR_IN6_SIN6_LEN
-    memcpy(&result_.su.in6.sin6_addr, ap, sizeof(result_.su.in6.sin6_addr));
+  }
+  case AF_INET6: {
+    std::array<ares_addr6ttl, DNS_RESOLVER_MAX_ADDRS> addrttls;
+    rv =
+        ares_parse_aaaa_reply(abuf, alen, nullptr, addrttls.data(), &naddrttls);
+    if (rv != ARES_SUCCESS) {
+      break;
+    }
+    for (int i = 0; i < naddrttls; ++i) {
+      add_addr(&addrttls[i].ip6addr);
+      ttl_ = ttl_ == -1 ? addrttls[i].ttl : std::min(ttl_, addrttls[i].ttl);
+    }
     break;
+  }
   default:
     assert(0);
+    abort();
+  }
+
+  if (rv != ARES_SUCCESS) {
+    if (LOG_ENABLED(INFO)) {
+      LOG(INFO) << "Name lookup for " << name_
+                << " failed: " << ares_strerror(rv);
+    }
+    status_ = DNSResolverStatus::ERROR;
+    return;
   }
 
-  if (status_ == DNSResolverStatus::OK) {
+  if (addrs_.empty()) {
     if (LOG_ENABLED(INFO)) {
-      LOG(INFO) << "Name lookup succeeded: " << name_ << " -> "
-                << util::numeric_name(&result_.su.sa, result_.len);
+      LOG(INFO) << "Name lookup for " << name_
+                << " failed: no address returned";
     }
+    status_ = DNSResolverStatus::ERROR;
     return;
   }
 
-  status_ = DNSResolverStatus::ERROR;
+  if (LOG_ENABLED(INFO)) {
+    LOG(INFO) << "Name lookup succeeded: " << name_ << " -> "
+              << util::numeric_name(&addrs_[0].su.sa, addrs_[0].len) << " ("
+              << addrs_.size() << " address(es), TTL " << ttl_ << "s)";
+  }
+
+  status_ = DNSResolverStatus::OK;
 }
 
 void DNSResolver::set_complete_cb(CompleteCb cb) {
@@ -53,6 +53,9 @@ enum class DNSResolverStatus {
   ERROR,
 };
 
+// The maximum number of addresses DNSResolver keeps from a reply.
+constexpr size_t DNS_RESOLVER_MAX_ADDRS = 16;
+
 // Callback function called when host name lookup is finished.
 // |status| is either DNSResolverStatus::OK, or
 // DNSResolverStatus::ERROR.  If |status| is DNSResolverStatus::OK,
@@ -67,7 +70,9 @@ using CompleteCb =
     std::function<void(DNSResolverStatus status, const Address *result)>;
 
 // DNSResolver is asynchronous name resolver, backed by c-ares
-// library.
+// library.  It looks up numeric host and hosts file first, and then
+// queries A or AAAA records, keeping all addresses and the TTL in the
+// reply.
 class DNSResolver {
 public:
   DNSResolver(struct ev_loop *loop);
@@ -78,6 +83,12 @@ public:
   // Returns status.  If status_ is DNSResolverStatus::SUCCESS &&
   // |result| is not nullptr, |*result| is filled.
   DNSResolverStatus get_status(Address *result) const;
+  // Returns all resolved addresses.  It is empty unless status is
+  // DNSResolverStatus::OK.
+  const std::vector<Address> &get_addrs() const;
+  // Returns the minimum TTL of the resolved addresses in seconds, or
+  // -1 if it is unknown, e.g., the address came from hosts file.
+  int get_ttl() const;
   // Sets callback function when name lookup finishes.  The callback
   // function is called in a way that it can destroy this DNSResolver.
   void set_complete_cb(CompleteCb cb);
@@ -87,8 +98,9 @@ public:
   int on_read(int fd);
   int on_write(int fd);
   int on_timeout();
-  // Calls this function when DNS query finished.
-  void on_result(int staus, hostent *hostent);
+  // Calls this function when DNS query finished.  |abuf| of length
+  // |alen| is the DNS reply.
+  void on_result(int status, const unsigned char *abuf, int alen);
   void reset_timeout();
 
   void start_rev(int fd);
@@ -98,9 +110,13 @@ public:
 
 private:
   int handle_event(int rfd, int wfd);
+  // Resolves name_ without querying name servers, if it is a numeric
+  // host, or it is found in hosts file.  Returns 0 if it succeeds.
+  int resolve_local();
+  void add_addr(const void *addr);
 
   std::vector<std::unique_ptr<ev_io>> revs_, wevs_;
-  Address result_;
+  std::vector<Address> addrs_;
   CompleteCb completeCb_;
   ev_timer timer_;
   StringRef name_;
@@ -110,6 +126,7 @@ private:
   // AF_INET or AF_INET6.  AF_INET for A record lookup, and AF_INET6
   // for AAAA record lookup.
   int family_;
+  int ttl_;
   DNSResolverStatus status_;
 };
 
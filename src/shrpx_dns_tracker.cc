@@ -36,7 +36,8 @@ void gccb(struct ev_loop *loop, ev_timer *w, int revents) {
 }
 } // namespace
 
-DNSTracker::DNSTracker(struct ev_loop *loop) : loop_(loop) {
+DNSTracker::DNSTracker(struct ev_loop *loop, DNSCache *cache)
+    : cache_(cache), loop_(loop) {
   ev_timer_init(&gc_timer_, gccb, 0., 12_h);
   gc_timer_.data = this;
 }
@@ -57,52 +58,8 @@ DNSTracker::~DNSTracker() {
   }
 }
 
-ResolverEntry DNSTracker::make_entry(std::unique_ptr<DualDNSResolver> resolv,
-                                     ImmutableString host,
-                                     DNSResolverStatus status,
-                                     const Address *result) {
-  auto &dnsconf = get_config()->dns;
-
-  auto ent = ResolverEntry{};
-  ent.resolv = std::move(resolv);
-  ent.host = std::move(host);
-  ent.status = status;
-  switch (status) {
-  case DNSResolverStatus::ERROR:
-  case DNSResolverStatus::OK:
-    ent.expiry = ev_now(loop_) + dnsconf.timeout.cache;
-    break;
-  default:
-    break;
-  }
-  if (result) {
-    ent.result = *result;
-  }
-  return ent;
-}
-
-void DNSTracker::update_entry(ResolverEntry &ent,
-                              std::unique_ptr<DualDNSResolver> resolv,
-                              DNSResolverStatus status, const Address *result) {
-  auto &dnsconf = get_config()->dns;
-
-  ent.resolv = std::move(resolv);
-  ent.status = status;
-  switch (status) {
-  case DNSResolverStatus::ERROR:
-  case DNSResolverStatus::OK:
-    ent.expiry = ev_now(loop_) + dnsconf.timeout.cache;
-    break;
-  default:
-    break;
-  }
-  if (result) {
-    ent.result = *result;
-  }
-}
-
 DNSResolverStatus DNSTracker::resolve(Address *result, DNSQuery *dnsq) {
-  int rv;
+  auto now = ev_now(loop_);
 
   auto it = ents_.find(dnsq->host);
 
@@ -111,172 +68,280 @@ DNSResolverStatus DNSTracker::resolve(Address *result, DNSQuery *dnsq) {
       LOG(INFO) << "DNS entry not found for " << dnsq->host;
     }
 
-    auto resolv = std::make_unique<DualDNSResolver>(loop_);
     auto host_copy =
         ImmutableString{std::begin(dnsq->host), std::end(dnsq->host)};
     auto host = StringRef{host_copy};
 
-    rv = resolv->resolve(host);
-    if (rv != 0) {
-      if (LOG_ENABLED(INFO)) {
-        LOG(INFO) << "Name lookup failed for " << host;
-      }
-
-      ents_.emplace(host, make_entry(nullptr, std::move(host_copy),
-                                     DNSResolverStatus::ERROR, nullptr));
-
-      start_gc_timer();
+    auto ent = ResolverEntry{};
+    ent.host = std::move(host_copy);
 
-      return DNSResolverStatus::ERROR;
-    }
-
-    switch (resolv->get_status(result)) {
-    case DNSResolverStatus::ERROR:
-      if (LOG_ENABLED(INFO)) {
-        LOG(INFO) << "Name lookup failed for " << host;
-      }
-
-      ents_.emplace(host, make_entry(nullptr, std::move(host_copy),
-                                     DNSResolverStatus::ERROR, nullptr));
-
-      start_gc_timer();
-
-      return DNSResolverStatus::ERROR;
-    case DNSResolverStatus::OK:
-      if (LOG_ENABLED(INFO)) {
-        LOG(INFO) << "Name lookup succeeded: " << host << " -> "
-                  << util::numeric_name(&result->su.sa, result->len);
-      }
+    it = ents_.emplace(host, std::move(ent)).first;
 
-      ents_.emplace(host, make_entry(nullptr, std::move(host_copy),
-                                     DNSResolverStatus::OK, result));
-
-      start_gc_timer();
-
-      return DNSResolverStatus::OK;
-    case DNSResolverStatus::RUNNING: {
-      auto p = ents_.emplace(host,
-                             make_entry(std::move(resolv), std::move(host_copy),
-                                        DNSResolverStatus::RUNNING, nullptr));
-
-      start_gc_timer();
-
-      auto &ent = (*p.first).second;
-
-      add_to_qlist(ent, dnsq);
-
-      return DNSResolverStatus::RUNNING;
-    }
-    default:
-      assert(0);
-    }
+    start_gc_timer();
   }
 
   auto &ent = (*it).second;
+  auto host = StringRef{ent.host};
 
-  if (ent.status != DNSResolverStatus::RUNNING && ent.expiry < ev_now(loop_)) {
-    if (LOG_ENABLED(INFO)) {
-      LOG(INFO) << "DNS entry found for " << dnsq->host
-                << ", but it has been expired";
-    }
-
-    auto resolv = std::make_unique<DualDNSResolver>(loop_);
-    auto host = StringRef{ent.host};
-
-    rv = resolv->resolve(host);
-    if (rv != 0) {
+  // Another worker might have resolved this host.
+  if (!ent.records || dns_records_refresh_time(*ent.records) <= now) {
+    auto records = cache_->get(host);
+    if (records &&
+        (!ent.records || ent.records->created < records->created)) {
       if (LOG_ENABLED(INFO)) {
-        LOG(INFO) << "Name lookup failed for " << host;
+        LOG(INFO) << "DNS entry for " << host << " is updated by another "
+                  << "worker";
       }
-
-      update_entry(ent, nullptr, DNSResolverStatus::ERROR, nullptr);
-
-      return DNSResolverStatus::ERROR;
+      ent.records = std::move(records);
     }
+  }
 
-    switch (resolv->get_status(result)) {
-    case DNSResolverStatus::ERROR:
-      if (LOG_ENABLED(INFO)) {
-        LOG(INFO) << "Name lookup failed for " << host;
-      }
-
-      update_entry(ent, nullptr, DNSResolverStatus::ERROR, nullptr);
+  if (ent.records && ent.records->expiry >= now) {
+    prefetch(ent);
 
-      return DNSResolverStatus::ERROR;
-    case DNSResolverStatus::OK:
-      if (LOG_ENABLED(INFO)) {
-        LOG(INFO) << "Name lookup succeeded: " << host << " -> "
+    auto status = select_addr(ent, result);
+    if (LOG_ENABLED(INFO)) {
+      if (status == DNSResolverStatus::OK) {
+        LOG(INFO) << "Name lookup succeeded (cached): " << host << " -> "
                   << util::numeric_name(&result->su.sa, result->len);
+      } else {
+        LOG(INFO) << "Name lookup failed for " << host << " (cached)";
       }
-
-      update_entry(ent, nullptr, DNSResolverStatus::OK, result);
-
-      return DNSResolverStatus::OK;
-    case DNSResolverStatus::RUNNING:
-      update_entry(ent, std::move(resolv), DNSResolverStatus::RUNNING, nullptr);
-      add_to_qlist(ent, dnsq);
-
-      return DNSResolverStatus::RUNNING;
-    default:
-      assert(0);
     }
+    return status;
   }
 
-  switch (ent.status) {
-  case DNSResolverStatus::RUNNING:
+  if (ent.resolv) {
     if (LOG_ENABLED(INFO)) {
-      LOG(INFO) << "Waiting for name lookup complete for " << dnsq->host;
+      LOG(INFO) << "Waiting for name lookup complete for " << host;
     }
     ent.qlist.append(dnsq);
     dnsq->in_qlist = true;
     return DNSResolverStatus::RUNNING;
+  }
+
+  if (LOG_ENABLED(INFO) && ent.records) {
+    LOG(INFO) << "DNS entry found for " << host << ", but it has been expired";
+  }
+
+  auto status = start_lookup(ent, false);
+  switch (status) {
   case DNSResolverStatus::ERROR:
     if (LOG_ENABLED(INFO)) {
-      LOG(INFO) << "Name lookup failed for " << dnsq->host << " (cached)";
+      LOG(INFO) << "Name lookup failed for " << host;
     }
     return DNSResolverStatus::ERROR;
   case DNSResolverStatus::OK:
+    select_addr(ent, result);
     if (LOG_ENABLED(INFO)) {
-      LOG(INFO) << "Name lookup succeeded (cached): " << dnsq->host << " -> "
-                << util::numeric_name(&ent.result.su.sa, ent.result.len);
-    }
-    if (result) {
-      memcpy(result, &ent.result, sizeof(*result));
+      LOG(INFO) << "Name lookup succeeded: " << host << " -> "
+                << util::numeric_name(&result->su.sa, result->len);
     }
     return DNSResolverStatus::OK;
+  case DNSResolverStatus::RUNNING:
+    add_to_qlist(ent, dnsq);
+    return DNSResolverStatus::RUNNING;
   default:
     assert(0);
     abort();
   }
 }
 
-void DNSTracker::add_to_qlist(ResolverEntry &ent, DNSQuery *dnsq) {
-  auto loop = loop_;
-  ent.resolv->set_complete_cb(
-      [&ent, loop](DNSResolverStatus status, const Address *result) {
+DNSResolverStatus DNSTracker::start_lookup(ResolverEntry &ent, bool refresh) {
+  auto resolv = std::make_unique<DualDNSResolver>(loop_);
+
+  if (resolv->resolve(StringRef{ent.host}) != 0) {
+    return finish_lookup(ent, nullptr, DNSResolverStatus::ERROR, refresh);
+  }
+
+  auto status = resolv->get_status(nullptr);
+  switch (status) {
+  case DNSResolverStatus::ERROR:
+  case DNSResolverStatus::OK:
+    return finish_lookup(ent, resolv.get(), status, refresh);
+  case DNSResolverStatus::RUNNING:
+    break;
+  default:
+    assert(0);
+    abort();
+  }
+
+  resolv->set_complete_cb(
+      [&ent, refresh, this](DNSResolverStatus status, const Address *) {
+        status = finish_lookup(ent, ent.resolv.get(), status, refresh);
+
         auto &qlist = ent.qlist;
         while (!qlist.empty()) {
           auto head = qlist.head;
           qlist.remove(head);
           head->status = status;
           head->in_qlist = false;
+          Address result;
+          select_addr(ent, &result);
           auto cb = head->cb;
-          cb(status, result);
+          cb(status, &result);
         }
 
-        auto &dnsconf = get_config()->dns;
-
         ent.resolv.reset();
-        ent.status = status;
-        ent.expiry = ev_now(loop) + dnsconf.timeout.cache;
-        if (ent.status == DNSResolverStatus::OK) {
-          ent.result = *result;
-        }
       });
+
+  ent.resolv = std::move(resolv);
+
+  return DNSResolverStatus::RUNNING;
+}
+
+DNSResolverStatus DNSTracker::finish_lookup(ResolverEntry &ent,
+                                            const DualDNSResolver *resolv,
+                                            DNSResolverStatus status,
+                                            bool refresh) {
+  if (refresh && status != DNSResolverStatus::OK &&
+      ent.records->expiry >= ev_now(loop_)) {
+    auto host = StringRef{ent.host};
+
+    if (LOG_ENABLED(INFO)) {
+      LOG(INFO) << "Refreshing DNS entry for " << host
+                << " failed; keep using the current one";
+    }
+
+    // The current records are still valid.  Do not replace them, nor
+    // the ones shared with the other workers, with the error.  The
+    // refresh is retried later.
+    cache_->cancel_refresh(host);
+
+    return ent.records->status;
+  }
+
+  set_records(ent, resolv, status);
+
+  return status;
+}
+
+void DNSTracker::set_records(ResolverEntry &ent, const DualDNSResolver *resolv,
+                             DNSResolverStatus status) {
+  auto &dnsconf = get_config()->dns;
+
+  auto now = ev_now(loop_);
+
+  auto records = std::make_shared<DNSRecords>();
+  records->created = now;
+  records->status = status;
+
+  if (status == DNSResolverStatus::OK) {
+    int ttl;
+    resolv->get_records(&records->addrs, &ttl);
+    records->expiry = now + dns_records_lifetime(ttl, dnsconf.timeout.cache);
+  } else {
+    records->expiry = now + dnsconf.timeout.cache;
+  }
+
+  ent.records = records;
+
+  cache_->put(StringRef{ent.host}, std::move(records));
+}
+
+DNSResolverStatus DNSTracker::select_addr(ResolverEntry &ent,
+                                          Address *result) {
+  auto &records = *ent.records;
+
+  if (records.status != DNSResolverStatus::OK) {
+    return records.status;
+  }
+
+  auto &addrs = records.addrs;
+
+  if (result) {
+    *result = addrs[ent.next++ % addrs.size()];
+  }
+
+  return DNSResolverStatus::OK;
+}
+
+void DNSTracker::prefetch(ResolverEntry &ent) {
+  auto &dnsconf = get_config()->dns;
+
+  auto now = ev_now(loop_);
+
+  if (ent.resolv || ent.records->status != DNSResolverStatus::OK ||
+      dns_records_refresh_time(*ent.records) > now) {
+    return;
+  }
+
+  auto host = StringRef{ent.host};
+
+  if (!cache_->start_refresh(host, now,
+                             now + dnsconf.timeout.lookup * dnsconf.max_try *
+                                       2)) {
+    return;
+  }
+
+  if (LOG_ENABLED(INFO)) {
+    LOG(INFO) << "Refreshing DNS entry for " << host << " before it expires";
+  }
+
+  start_lookup(ent, true);
+}
+
+void DNSTracker::add_to_qlist(ResolverEntry &ent, DNSQuery *dnsq) {
   ent.qlist.append(dnsq);
   dnsq->in_qlist = true;
 }
 
+namespace {
+// Returns true if |a| and |b| have the same IP address.  Port is not
+// compared.
+bool same_host(const Address &a, const Address &b) {
+  if (a.su.sa.sa_family != b.su.sa.sa_family) {
+    return false;
+  }
+
+  switch (a.su.sa.sa_family) {
+  case AF_INET:
+    return memcmp(&a.su.in.sin_addr, &b.su.in.sin_addr,
+                  sizeof(a.su.in.sin_addr)) == 0;
+  case AF_INET6:
+    return memcmp(&a.su.in6.sin6_addr, &b.su.in6.sin6_addr,
+                  sizeof(a.su.in6.sin6_addr)) == 0;
+  default:
+    return false;
+  }
+}
+} // namespace
+
+bool DNSTracker::get_fallback(const StringRef &host, const Address &addr,
+                              Address *fallback) const {
+  auto it = ents_.find(host);
+  if (it == std::end(ents_)) {
+    return false;
+  }
+
+  auto &ent = (*it).second;
+  if (!ent.records || ent.records->status != DNSResolverStatus::OK) {
+    return false;
+  }
+
+  auto &addrs = ent.records->addrs;
+  const Address *cand = nullptr;
+
+  for (size_t i = 0; i < addrs.size(); ++i) {
+    auto &a = addrs[(ent.next + i) % addrs.size()];
+    if (a.su.sa.sa_family != addr.su.sa.sa_family) {
+      *fallback = a;
+      return true;
+    }
+    if (!cand && !same_host(a, addr)) {
+      cand = &a;
+    }
+  }
+
+  if (!cand) {
+    return false;
+  }
+
+  *fallback = *cand;
+
+  return true;
+}
+
 void DNSTracker::cancel(DNSQuery *dnsq) {
   if (!dnsq->in_qlist) {
     return;
@@ -308,7 +373,8 @@ void DNSTracker::gc() {
   auto now = ev_now(loop_);
   for (auto it = std::begin(ents_); it != std::end(ents_);) {
     auto &ent = (*it).second;
-    if (ent.expiry >= now) {
+    if (ent.resolv || !ent.qlist.empty() ||
+        (ent.records && ent.records->expiry >= now)) {
       ++it;
       continue;
     }
@@ -316,6 +382,8 @@ void DNSTracker::gc() {
     it = ents_.erase(it);
   }
 
+  cache_->remove_expired(now);
+
   if (ents_.empty()) {
     ev_timer_stop(loop_, &gc_timer_);
   }
@@ -28,8 +28,10 @@
 #include "shrpx.h"
 
 #include <map>
+#include <memory>
 
 #include "shrpx_dual_dns_resolver.h"
+#include "shrpx_dns_cache.h"
 
 using namespace nghttp2;
 
@@ -59,23 +61,23 @@ struct DNSQuery {
 struct ResolverEntry {
   // Host name this entry lookups for.
   ImmutableString host;
-  // DNS resolver.  Only non-nullptr if status is
-  // DNSResolverStatus::RUNNING.
+  // DNS resolver.  Only non-nullptr if name lookup is running, which
+  // might be a background refresh of unexpired records.
   std::unique_ptr<DualDNSResolver> resolv;
   // DNSQuery interested in this name lookup result.  The result is
   // notified to them all.
   DList<DNSQuery> qlist;
-  // Use the same enum with DNSResolverStatus
-  DNSResolverStatus status;
-  // result and its expiry time
-  Address result;
-  // time point when cached result expires.
-  ev_tstamp expiry;
+  // The latest result of name lookup, or nullptr if none.
+  std::shared_ptr<const DNSRecords> records;
+  // The index of records->addrs which is returned next.  Addresses
+  // are returned in round-robin.
+  size_t next;
 };
 
 class DNSTracker {
 public:
-  DNSTracker(struct ev_loop *loop);
+  // |cache| is shared with the other workers.
+  DNSTracker(struct ev_loop *loop, DNSCache *cache);
   ~DNSTracker();
 
   // Lookups host name described in |dnsq|.  If name lookup finishes
@@ -86,26 +88,50 @@ public:
   // filled.  If lookup failed, DNSResolverStatus::ERROR is returned.
   // If name lookup is being done background, it returns
   // DNSResolverStatus::RUNNING.  Its completion is notified by
-  // calling dnsq->cb.
+  // calling dnsq->cb.  If a host has several addresses, they are
+  // returned in turn.
   DNSResolverStatus resolve(Address *result, DNSQuery *dnsq);
   // Cancels name lookup requested by |dnsq|.
   void cancel(DNSQuery *dnsq);
+  // Finds the address to connect to when connection to |addr|, which
+  // is resolved for |host|, is not established soon.  The address of
+  // the other address family than |addr| is preferred.  If it is
+  // found, it is stored in |fallback|, and this function returns
+  // true.  Port portion of |fallback| is undefined.
+  bool get_fallback(const StringRef &host, const Address &addr,
+                    Address *fallback) const;
   // Removes expired entries from ents_.
   void gc();
   // Starts GC timer.
   void start_gc_timer();
 
 private:
-  ResolverEntry make_entry(std::unique_ptr<DualDNSResolver> resolv,
-                           ImmutableString host, DNSResolverStatus status,
-                           const Address *result);
-
-  void update_entry(ResolverEntry &ent, std::unique_ptr<DualDNSResolver> resolv,
-                    DNSResolverStatus status, const Address *result);
+  // Starts name lookup for |ent|.  It returns the status of lookup.
+  // If it returns DNSResolverStatus::RUNNING, ent.resolv is set.
+  // |refresh| is true if the lookup refreshes unexpired records in
+  // background.
+  DNSResolverStatus start_lookup(ResolverEntry &ent, bool refresh);
+  // Handles the result of name lookup for |ent|, and returns the
+  // status of ent.records.  If refresh of unexpired records failed,
+  // they are kept.  Otherwise, the result is stored by set_records().
+  DNSResolverStatus finish_lookup(ResolverEntry &ent,
+                                  const DualDNSResolver *resolv,
+                                  DNSResolverStatus status, bool refresh);
+  // Stores the result of |resolv| in |ent|, and shares it with the
+  // other workers.
+  void set_records(ResolverEntry &ent, const DualDNSResolver *resolv,
+                   DNSResolverStatus status);
+  // Selects the address from ent.records in round-robin.  It returns
+  // the status of ent.records.
+  DNSResolverStatus select_addr(ResolverEntry &ent, Address *result);
+  // Refreshes records of |ent| in background if it is about to
+  // expire.
+  void prefetch(ResolverEntry &ent);
 
   void add_to_qlist(ResolverEntry &ent, DNSQuery *dnsq);
 
   std::map<StringRef, ResolverEntry> ents_;
+  DNSCache *cache_;
   // Periodically iterates ents_, and removes expired entries to avoid
   // excessive use of memory.  Since only backend API can potentially
   // increase memory consumption, interval could be very long.
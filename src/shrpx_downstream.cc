@@ -35,6 +35,8 @@
 #include "shrpx_downstream_connection.h"
 #include "shrpx_downstream_queue.h"
 #include "shrpx_worker.h"
+#include "shrpx_connection_handler.h"
+#include "shrpx_outlier_detector.h"
 #include "shrpx_http2_session.h"
 #include "shrpx_log.h"
 #ifdef HAVE_MRUBY
@@ -94,6 +96,12 @@ void downstream_timeoutcb(struct ev_loop *loop, ev_timer *w, int revents) {
   auto dconn = downstream->get_downstream_connection();
 
   if (dconn) {
+    auto addr = dconn->get_addr();
+    if (addr) {
+      outlier_detector_record(dconn->get_downstream_addr_group().get(), addr,
+                              OutlierEvent::TIMEOUT, ev_now(loop));
+    }
+
     dconn->on_timeout();
   }
 }
@@ -111,6 +119,14 @@ void downstream_wtimeoutcb(struct ev_loop *loop, ev_timer *w, int revents) {
 }
 } // namespace
 
+namespace {
+void hedge_timeoutcb(struct ev_loop *loop, ev_timer *w, int revents) {
+  auto downstream = static_cast<Downstream *>(w->data);
+
+  downstream->send_hedged_request();
+}
+} // namespace
+
 // upstream could be nullptr for unittests
 Downstream::Downstream(Upstream *upstream, MemchunkPool *mcpool,
                        int32_t stream_id)
@@ -121,11 +137,18 @@ Downstream::Downstream(Upstream *upstream, MemchunkPool *mcpool,
       req_(balloc_),
       resp_(balloc_),
       request_start_time_(std::chrono::high_resolution_clock::now()),
+      backend_attach_time_(0.),
+      hedge_attach_time_(0.),
       blocked_request_buf_(mcpool),
       request_buf_(mcpool),
       response_buf_(mcpool),
       upstream_(upstream),
       blocked_link_(nullptr),
+      admission_link_{},
+      queue_start_time_(0.),
+      queue_time_(0.),
+      single_flight_link_{},
+      rewrite_matched_(nullptr),
       addr_(nullptr),
       num_retry_(0),
       stream_id_(stream_id),
@@ -136,6 +159,9 @@ Downstream::Downstream(Upstream *upstream, MemchunkPool *mcpool,
       request_state_(DownstreamState::INITIAL),
       response_state_(DownstreamState::INITIAL),
       dispatch_state_(DispatchState::NONE),
+      admission_state_(AdmissionState::NONE),
+      single_flight_role_(SingleFlightRole::NONE),
+      response_coding_(ContentCoding::IDENTITY),
       upgraded_(false),
       chunked_request_(false),
       chunked_response_(false),
@@ -145,7 +171,8 @@ Downstream::Downstream(Upstream *upstream, MemchunkPool *mcpool,
       accesslog_written_(false),
       new_affinity_cookie_(false),
       blocked_request_data_eof_(false),
-      expect_100_continue_(false) {
+      expect_100_continue_(false),
+      hedged_(false) {
 
   auto &timeoutconf = get_config()->http2.timeout;
 
@@ -163,6 +190,12 @@ Downstream::Downstream(Upstream *upstream, MemchunkPool *mcpool,
   downstream_rtimer_.data = this;
   downstream_wtimer_.data = this;
 
+  ev_timer_init(&hedge_timer_, hedge_timeoutcb, 0., 0.);
+  hedge_timer_.data = this;
+
+  admission_link_.downstream = this;
+  single_flight_link_.downstream = this;
+
   rcbufs_.reserve(32);
 }
 
@@ -180,6 +213,8 @@ Downstream::~Downstream() {
     ev_timer_stop(loop, &downstream_rtimer_);
     ev_timer_stop(loop, &downstream_wtimer_);
 
+    cancel_hedge();
+
 #ifdef HAVE_MRUBY
     auto handler = upstream_->get_client_handler();
     auto worker = handler->get_worker();
@@ -199,6 +234,32 @@ Downstream::~Downstream() {
   }
 #endif // HAVE_MRUBY
 
+  if (dconn_) {
+    remove_inflight();
+  }
+
+  switch (admission_state_) {
+  case AdmissionState::QUEUED:
+    concurrency_limiter_->remove(&admission_link_);
+    break;
+  case AdmissionState::ADMITTED:
+    concurrency_limiter_->release();
+    break;
+  default:
+    break;
+  }
+
+  switch (single_flight_role_) {
+  case SingleFlightRole::LEADER:
+    single_flight_call_->on_leader_detached(this);
+    break;
+  case SingleFlightRole::FOLLOWER:
+    single_flight_call_->remove_follower(&single_flight_link_);
+    break;
+  default:
+    break;
+  }
+
   // DownstreamConnection may refer to this object.  Delete it now
   // explicitly.
   dconn_.reset();
@@ -220,6 +281,15 @@ int Downstream::attach_downstream_connection(
 
   dconn_ = std::move(dconn);
 
+  add_inflight();
+
+  if (num_retry_ == 0) {
+    const auto &group = dconn_->get_downstream_addr_group();
+    if (group) {
+      group->shared_addr->retry_tokens.deposit();
+    }
+  }
+
   return 0;
 }
 
@@ -228,6 +298,8 @@ void Downstream::detach_downstream_connection() {
     return;
   }
 
+  cancel_hedge();
+
 #ifdef HAVE_MRUBY
   const auto &group = dconn_->get_downstream_addr_group();
   if (group) {
@@ -238,6 +310,15 @@ void Downstream::detach_downstream_connection() {
 
   dconn_->detach_downstream(this);
 
+  remove_inflight();
+
+  // The connection goes on to carry the pipelined request.
+  auto next = dconn_->get_downstream();
+  if (next) {
+    next->take_over_downstream_connection(std::move(dconn_));
+    return;
+  }
+
   auto handler = dconn_->get_client_handler();
 
   handler->pool_downstream_connection(
@@ -261,9 +342,47 @@ std::unique_ptr<DownstreamConnection> Downstream::pop_downstream_connection() {
   }
 #endif // HAVE_MRUBY
 
+  if (dconn_) {
+    cancel_hedge();
+    remove_inflight();
+  }
+
   return std::unique_ptr<DownstreamConnection>(dconn_.release());
 }
 
+void Downstream::take_over_downstream_connection(
+    std::unique_ptr<DownstreamConnection> dconn) {
+  assert(dconn_);
+  assert(dconn_->get_addr() == dconn->get_addr());
+
+  // num_inflight of the address has been incremented when the
+  // original connection was attached.
+  dconn_ = std::move(dconn);
+}
+
+void Downstream::add_inflight() {
+  auto addr = dconn_->get_addr();
+  if (!addr) {
+    return;
+  }
+
+  ++addr->num_inflight;
+
+  if (upstream_) {
+    backend_attach_time_ = ev_now(upstream_->get_client_handler()->get_loop());
+  }
+}
+
+void Downstream::remove_inflight() {
+  auto addr = dconn_->get_addr();
+  if (!addr) {
+    return;
+  }
+
+  assert(addr->num_inflight > 0);
+  --addr->num_inflight;
+}
+
 void Downstream::pause_read(IOCtrlReason reason) {
   if (dconn_) {
     dconn_->pause_read(reason);
@@ -275,6 +394,10 @@ int Downstream::resume_read(IOCtrlReason reason, size_t consumed) {
     return dconn_->resume_read(reason, consumed);
   }
 
+  if (single_flight_role_ == SingleFlightRole::FOLLOWER) {
+    single_flight_call_->signal();
+  }
+
   return 0;
 }
 
@@ -647,7 +770,14 @@ int Downstream::push_request_headers() {
     DLOG(INFO, this) << "dconn_ is NULL";
     return -1;
   }
-  return dconn_->push_request_headers();
+
+  if (dconn_->push_request_headers() != 0) {
+    return -1;
+  }
+
+  start_hedge_timer();
+
+  return 0;
 }
 
 int Downstream::push_upload_data_chunk(const uint8_t *data, size_t datalen) {
@@ -1064,6 +1194,606 @@ void Downstream::add_retry() { ++num_retry_; }
 
 bool Downstream::no_more_retry() const { return num_retry_ > 50; }
 
+bool Downstream::acquire_retry_budget() {
+  if (!dconn_) {
+    return true;
+  }
+
+  const auto &group = dconn_->get_downstream_addr_group();
+  if (!group) {
+    return true;
+  }
+
+  auto &shared_addr = group->shared_addr;
+
+  if (shared_addr->retry_budget == -1 || shared_addr->retry_tokens.withdraw()) {
+    return true;
+  }
+
+  if (LOG_ENABLED(INFO)) {
+    DLOG(INFO, this) << "Retry budget exhausted";
+  }
+
+  return false;
+}
+
+void Downstream::start_hedge_timer() {
+  if (hedged_ || !upstream_) {
+    return;
+  }
+
+  // Only one hedged request is sent per request.
+  hedged_ = true;
+
+  auto addr = dconn_->get_addr();
+  if (!addr || addr->proto != Proto::HTTP1) {
+    return;
+  }
+
+  const auto &shared_addr = dconn_->get_downstream_addr_group()->shared_addr;
+  auto &hedgeconf = shared_addr->hedge;
+
+  if ((hedgeconf.delay < 1e-9 && hedgeconf.percentile == 0) ||
+      shared_addr->affinity.type != SessionAffinity::NONE ||
+      shared_addr->addrs.size() < 2) {
+    return;
+  }
+
+  // Only idempotent requests without request body are hedged.
+  if ((req_.method != HTTP_GET && req_.method != HTTP_HEAD) ||
+      req_.upgrade_request || req_.http2_expect_body ||
+      req_.fs.content_length > 0 || chunked_request_ ||
+      expect_100_continue_) {
+    return;
+  }
+
+  auto delay = hedgeconf.delay;
+
+  if (hedgeconf.percentile) {
+    delay = std::max(delay, shared_addr->latency_histogram.get_percentile(
+                                hedgeconf.percentile));
+    if (delay < 1e-9) {
+      // Not enough samples yet.
+      return;
+    }
+  }
+
+  if (LOG_ENABLED(INFO)) {
+    DLOG(INFO, this) << "Hedged request will be sent after " << delay
+                     << " seconds";
+  }
+
+  auto loop = upstream_->get_client_handler()->get_loop();
+
+  ev_timer_set(&hedge_timer_, delay, 0.);
+  ev_timer_start(loop, &hedge_timer_);
+}
+
+void Downstream::send_hedged_request() {
+  if (!dconn_ || hedge_dconn_ ||
+      request_state_ != DownstreamState::MSG_COMPLETE ||
+      response_state_ != DownstreamState::INITIAL) {
+    return;
+  }
+
+  // The backend connection and the hedged one share request_buf_.
+  // Wait for the former to finish writing request.
+  if (request_buf_.rleft()) {
+    if (LOG_ENABLED(INFO)) {
+      DLOG(INFO, this) << "Request has not been sent yet; skip hedging";
+    }
+    return;
+  }
+
+  auto group = dconn_->get_downstream_addr_group();
+  auto &shared_addr = group->shared_addr;
+
+  if (!shared_addr->retry_tokens.withdraw()) {
+    if (LOG_ENABLED(INFO)) {
+      DLOG(INFO, this) << "Retry budget exhausted; skip hedging";
+    }
+    return;
+  }
+
+  auto handler = upstream_->get_client_handler();
+
+  auto dconn =
+      handler->get_hedge_downstream_connection(group, dconn_->get_addr());
+  if (!dconn) {
+    return;
+  }
+
+  if (dconn->attach_downstream(this) != 0) {
+    return;
+  }
+
+  hedge_dconn_ = std::move(dconn);
+
+  auto addr = hedge_dconn_->get_addr();
+
+  ++addr->num_inflight;
+
+  hedge_attach_time_ = ev_now(handler->get_loop());
+
+  if (LOG_ENABLED(INFO)) {
+    DLOG(INFO, this) << "Send hedged request to " << addr->hostport;
+  }
+
+  if (hedge_dconn_->push_request_headers() != 0) {
+    cancel_hedge();
+  }
+}
+
+void Downstream::resolve_hedge(DownstreamConnection *dconn) {
+  if (upstream_) {
+    ev_timer_stop(upstream_->get_client_handler()->get_loop(), &hedge_timer_);
+  }
+
+  if (!hedge_dconn_) {
+    return;
+  }
+
+  if (hedge_dconn_.get() != dconn) {
+    cancel_hedge();
+    return;
+  }
+
+  if (LOG_ENABLED(INFO)) {
+    DLOG(INFO, this) << "Hedged request got response first";
+  }
+
+  remove_inflight();
+
+  // This closes the connection of the original request.
+  dconn_ = std::move(hedge_dconn_);
+  backend_attach_time_ = hedge_attach_time_;
+}
+
+void Downstream::cancel_hedge() {
+  if (upstream_) {
+    ev_timer_stop(upstream_->get_client_handler()->get_loop(), &hedge_timer_);
+  }
+
+  if (!hedge_dconn_) {
+    return;
+  }
+
+  if (LOG_ENABLED(INFO)) {
+    DLOG(INFO, this) << "Cancel hedged request";
+  }
+
+  auto addr = hedge_dconn_->get_addr();
+
+  assert(addr->num_inflight > 0);
+  --addr->num_inflight;
+
+  hedge_dconn_.reset();
+}
+
+DownstreamConnection *Downstream::get_hedge_downstream_connection() {
+  return hedge_dconn_.get();
+}
+
+bool Downstream::hedge_pending() const {
+  return ev_is_active(&hedge_timer_) || hedge_dconn_;
+}
+
+int Downstream::acquire_concurrency_slot(
+    const std::shared_ptr<DownstreamAddrGroup> &group) {
+  switch (admission_state_) {
+  case AdmissionState::NONE:
+    break;
+  case AdmissionState::QUEUED:
+    return SHRPX_ERR_QUEUED;
+  case AdmissionState::ADMITTED:
+    return 0;
+  case AdmissionState::REJECTED:
+    return SHRPX_ERR_OVERLOADED;
+  }
+
+  auto &limiter = group->shared_addr->concurrency_limiter;
+  if (!limiter) {
+    return 0;
+  }
+
+  concurrency_limiter_ = limiter;
+
+  if (limiter->try_acquire()) {
+    admission_state_ = AdmissionState::ADMITTED;
+    return 0;
+  }
+
+  if (!limiter->enqueue(&admission_link_)) {
+    if (LOG_ENABLED(INFO)) {
+      DLOG(INFO, this) << "Concurrency limit " << limiter->get_limit()
+                       << " reached, reject request";
+    }
+
+    admission_state_ = AdmissionState::REJECTED;
+    return SHRPX_ERR_OVERLOADED;
+  }
+
+  if (LOG_ENABLED(INFO)) {
+    DLOG(INFO, this) << "Concurrency limit " << limiter->get_limit()
+                     << " reached, request is queued";
+  }
+
+  queue_start_time_ = ev_now(upstream_->get_client_handler()->get_loop());
+  admission_state_ = AdmissionState::QUEUED;
+
+  return SHRPX_ERR_QUEUED;
+}
+
+void Downstream::set_admitted(bool admitted) {
+  assert(admission_state_ == AdmissionState::QUEUED);
+
+  queue_time_ =
+      ev_now(upstream_->get_client_handler()->get_loop()) - queue_start_time_;
+  admission_state_ =
+      admitted ? AdmissionState::ADMITTED : AdmissionState::REJECTED;
+}
+
+AdmissionState Downstream::get_admission_state() const {
+  return admission_state_;
+}
+
+void Downstream::update_concurrency_limit(ev_tstamp rtt) {
+  if (admission_state_ != AdmissionState::ADMITTED) {
+    return;
+  }
+
+  concurrency_limiter_->update(rtt);
+}
+
+ev_tstamp Downstream::get_queue_time() const { return queue_time_; }
+
+int Downstream::join_single_flight(
+    const std::shared_ptr<DownstreamAddrGroup> &group) {
+  switch (single_flight_role_) {
+  case SingleFlightRole::NONE:
+    break;
+  case SingleFlightRole::FOLLOWER:
+    return SHRPX_ERR_COALESCED;
+  default:
+    return 0;
+  }
+
+  auto &single_flight = group->shared_addr->single_flight_calls;
+  if (!single_flight) {
+    return 0;
+  }
+
+  auto key = single_flight->create_key(req_);
+  if (key.empty()) {
+    return 0;
+  }
+
+  auto call = single_flight->find(StringRef{key});
+  if (call) {
+    call->add_follower(&single_flight_link_);
+
+    // Leader stores the response.
+    cache_writer_.reset();
+
+    single_flight_call_ = call->shared_from_this();
+    single_flight_role_ = SingleFlightRole::FOLLOWER;
+
+    if (LOG_ENABLED(INFO)) {
+      DLOG(INFO, this) << "Wait for the identical request in flight, "
+                       << call->get_num_followers() << " follower(s)";
+    }
+
+    return SHRPX_ERR_COALESCED;
+  }
+
+  auto handler = upstream_->get_client_handler();
+
+  single_flight_call_ = std::make_shared<SingleFlightCall>(
+      handler->get_loop(), handler->get_mcpool(), single_flight,
+      std::move(key));
+  single_flight_role_ = SingleFlightRole::LEADER;
+
+  return 0;
+}
+
+void Downstream::leave_single_flight(bool bypass) {
+  assert(single_flight_role_ == SingleFlightRole::FOLLOWER);
+
+  single_flight_call_.reset();
+  single_flight_role_ =
+      bypass ? SingleFlightRole::BYPASS : SingleFlightRole::NONE;
+}
+
+SingleFlightRole Downstream::get_single_flight_role() const {
+  return single_flight_role_;
+}
+
+int Downstream::lookup_cache(
+    const std::shared_ptr<DownstreamAddrGroup> &group) {
+  if (!group->shared_addr->cache || cache_writer_ ||
+      single_flight_role_ != SingleFlightRole::NONE) {
+    return 0;
+  }
+
+  auto key = cache_create_key(req_);
+  if (key.empty()) {
+    return 0;
+  }
+
+  auto handler = upstream_->get_client_handler();
+  auto worker = handler->get_worker();
+  auto cache = worker->get_connection_handler()->get_response_cache();
+
+  switch (req_.method) {
+  case HTTP_GET:
+  case HTTP_HEAD:
+    break;
+  case HTTP_OPTIONS:
+  case HTTP_TRACE:
+    return 0;
+  default:
+    // Unsafe method may change the resource.
+    cache->remove(StringRef{key});
+    return 0;
+  }
+
+  if (!cache_request_cacheable(req_)) {
+    return 0;
+  }
+
+  auto now = ev_now(handler->get_loop());
+  auto entry = cache->get(StringRef{key}, req_);
+
+  if (entry && entry->fresh(now) &&
+      !cache_request_requires_validation(req_, *entry, now)) {
+    cache->record_lookup(CacheLookupResult::HIT);
+
+    auto not_modified = cache_not_modified(*entry, req_);
+
+    if (LOG_ENABLED(INFO)) {
+      DLOG(INFO, this) << "Serve response from cache"
+                       << (not_modified ? " as 304" : "");
+    }
+
+    single_flight_call_ = std::make_shared<SingleFlightCall>(
+        handler->get_loop(), handler->get_mcpool(), nullptr, std::string{});
+    single_flight_call_->add_follower(&single_flight_link_);
+    single_flight_call_->load_cache_entry(*entry, group, not_modified,
+                                          req_.method != HTTP_HEAD, now);
+    single_flight_role_ = SingleFlightRole::FOLLOWER;
+
+    return SHRPX_ERR_COALESCED;
+  }
+
+  cache->record_lookup(entry ? CacheLookupResult::STALE
+                             : CacheLookupResult::MISS);
+
+  // Response to HEAD is not stored.
+  if (req_.method == HTTP_HEAD) {
+    return 0;
+  }
+
+  // If client has its own validators, backend may respond with 304
+  // to them, which we cannot use to refresh the stored response.
+  if (cache_request_conditional(req_)) {
+    entry.reset();
+  }
+
+  cache_writer_ = std::make_unique<CacheWriter>(
+      cache, std::move(key), std::move(entry),
+      get_config()->http.cache.max_object_size);
+
+  return 0;
+}
+
+void Downstream::add_cache_validators() {
+  if (!cache_writer_) {
+    return;
+  }
+
+  cache_writer_->add_validators(this);
+}
+
+void Downstream::share_response_header() {
+  if (get_non_final_response()) {
+    return;
+  }
+
+  // This may replace 304 response with the stored one, which is
+  // shared with followers.
+  if (cache_writer_) {
+    cache_writer_->on_header(this);
+  }
+
+  if (single_flight_role_ != SingleFlightRole::LEADER) {
+    return;
+  }
+
+  single_flight_call_->on_header(this);
+}
+
+void Downstream::share_response_body(const uint8_t *data, size_t len) {
+  if (cache_writer_) {
+    cache_writer_->on_body(data, len);
+  }
+
+  if (single_flight_role_ != SingleFlightRole::LEADER) {
+    return;
+  }
+
+  single_flight_call_->on_body(data, len);
+}
+
+bool Downstream::response_body_shared() const {
+  return cache_writer_ || single_flight_role_ == SingleFlightRole::LEADER;
+}
+
+int Downstream::share_response_complete() {
+  if (cache_writer_ && cache_writer_->on_body_complete(this) != 0) {
+    return -1;
+  }
+
+  if (single_flight_role_ != SingleFlightRole::LEADER) {
+    return 0;
+  }
+
+  single_flight_call_->on_body_complete(this);
+
+  return 0;
+}
+
+void Downstream::select_response_coding(
+    const std::shared_ptr<DownstreamAddrGroup> &group) {
+  if (!group->shared_addr->compress) {
+    response_coding_ = ContentCoding::IDENTITY;
+    return;
+  }
+
+  auto accept_encoding = req_.fs.header(http2::HD_ACCEPT_ENCODING);
+  if (!accept_encoding) {
+    response_coding_ = ContentCoding::IDENTITY;
+    return;
+  }
+
+  response_coding_ = compress_select_coding(accept_encoding->value);
+}
+
+namespace {
+// Returns true if the response which has header fields |fs| may be
+// compressed by us.
+bool response_transformable(const FieldStore &fs) {
+  auto content_encoding = fs.header(StringRef::from_lit("content-encoding"));
+  if (content_encoding &&
+      !util::strieq_l("identity", content_encoding->value)) {
+    return false;
+  }
+
+  CacheControl cc;
+  for (auto &kv : fs.headers()) {
+    if (kv.token == http2::HD_CACHE_CONTROL) {
+      parse_cache_control(cc, kv.value);
+    }
+  }
+
+  return !cc.no_transform;
+}
+} // namespace
+
+namespace {
+// Updates ETag and Vary in |fs| for the compressed representation.
+void add_compressed_validators(BlockAllocator &balloc, FieldStore &fs) {
+  auto vary_done = false;
+
+  for (auto &kv : fs.headers()) {
+    if (kv.name == StringRef::from_lit("etag")) {
+      // Compressed representation is no longer byte-for-byte
+      // identical to the one the strong validator is for.
+      if (!util::istarts_with_l(kv.value, "W/")) {
+        kv.value =
+            concat_string_ref(balloc, StringRef::from_lit("W/"), kv.value);
+      }
+      continue;
+    }
+
+    if (kv.name == StringRef::from_lit("vary") &&
+        compress_vary_covered(kv.value)) {
+      vary_done = true;
+    }
+  }
+
+  if (!vary_done) {
+    fs.add_header_token(StringRef::from_lit("vary"),
+                        StringRef::from_lit("accept-encoding"), false, -1);
+  }
+}
+} // namespace
+
+bool Downstream::start_response_compression() {
+  if (response_coding_ == ContentCoding::IDENTITY || response_compressor_ ||
+      get_non_final_response() || upgraded_ ||
+      req_.method == HTTP_CONNECT) {
+    return false;
+  }
+
+  auto &fs = resp_.fs;
+
+  if (resp_.http_status == 304) {
+    // 304 response has to carry ETag and Vary which 200 response
+    // would have (RFC 9110, section 15.4.5).  Since it has no body,
+    // we do not know whether the body would be compressed.  Assume
+    // that the client has the compressed representation because it
+    // accepts the coding.
+    if (response_transformable(fs)) {
+      add_compressed_validators(balloc_, fs);
+    }
+    return false;
+  }
+
+  if (!expect_response_body() || resp_.http_status == 206 ||
+      !response_transformable(fs)) {
+    return false;
+  }
+
+  auto content_type = fs.header(http2::HD_CONTENT_TYPE);
+  if (!content_type || !compress_content_type(content_type->value)) {
+    return false;
+  }
+
+  if (fs.content_length != -1 && fs.content_length < COMPRESS_MIN_LENGTH) {
+    return false;
+  }
+
+  response_compressor_ = create_response_compressor(
+      response_coding_, compress_level(response_coding_, fs.content_length),
+      fs.content_length);
+  if (!response_compressor_) {
+    return false;
+  }
+
+  if (LOG_ENABLED(INFO)) {
+    DLOG(INFO, this) << "Compress response body with "
+                     << compress_coding_name(response_coding_);
+  }
+
+  // fs.content_length is left intact so that the length of body
+  // received from backend is still validated.
+  fs.erase_content_length_and_transfer_encoding();
+
+  for (auto &kv : fs.headers()) {
+    if (kv.name == StringRef::from_lit("content-encoding")) {
+      // Drop "identity".
+      kv.name = StringRef{};
+      kv.token = -1;
+    }
+  }
+
+  fs.add_header_token(StringRef::from_lit("content-encoding"),
+                      compress_coding_name(response_coding_), false, -1);
+
+  add_compressed_validators(balloc_, fs);
+
+  return true;
+}
+
+bool Downstream::response_compressed() const {
+  return response_compressor_ != nullptr;
+}
+
+int Downstream::compress_response_body(DefaultMemchunks &out,
+                                       const uint8_t *data, size_t len,
+                                       bool finish) {
+  assert(response_compressor_);
+
+  if (response_compressor_->compress(out, data, len, finish) != 0) {
+    if (LOG_ENABLED(INFO)) {
+      DLOG(INFO, this) << "Could not compress response body";
+    }
+    return -1;
+  }
+
+  return 0;
+}
+
 void Downstream::set_request_downstream_host(const StringRef &host) {
   request_downstream_host_ = host;
 }
@@ -1111,6 +1841,25 @@ bool Downstream::can_detach_downstream_connection() const {
          !resp_.connection_close && request_buf_.rleft() == 0;
 }
 
+bool Downstream::request_pipelinable() const {
+  // Only idempotent requests without request body are pipelined, so
+  // that they can be retried if the connection is lost.
+  if ((req_.method != HTTP_GET && req_.method != HTTP_HEAD &&
+       req_.method != HTTP_OPTIONS) ||
+      req_.upgrade_request || req_.http2_upgrade_seen ||
+      req_.connect_proto != ConnectProto::NONE || req_.connection_close ||
+      expect_100_continue_) {
+    return false;
+  }
+
+  if (req_.http_major == 2) {
+    return !req_.http2_expect_body;
+  }
+
+  return req_.fs.content_length <= 0 &&
+         !req_.fs.header(http2::HD_TRANSFER_ENCODING);
+}
+
 DefaultMemchunks Downstream::pop_response_buf() {
   return std::move(response_buf_);
 }
@@ -1123,6 +1872,20 @@ int32_t Downstream::get_assoc_stream_id() const { return assoc_stream_id_; }
 
 BlockAllocator &Downstream::get_block_allocator() { return balloc_; }
 
+void Downstream::set_rewrite_rule_matched(size_t idx) {
+  if (!rewrite_matched_) {
+    auto n = (get_config()->http.rewrite_rules.size() + 7) / 8;
+    rewrite_matched_ = static_cast<uint8_t *>(balloc_.alloc(n));
+    std::fill_n(rewrite_matched_, n, 0);
+  }
+
+  rewrite_matched_[idx / 8] |= 1 << (idx % 8);
+}
+
+bool Downstream::get_rewrite_rule_matched(size_t idx) const {
+  return rewrite_matched_ && (rewrite_matched_[idx / 8] & (1 << (idx % 8)));
+}
+
 void Downstream::add_rcbuf(nghttp2_rcbuf *rcbuf) {
   nghttp2_rcbuf_incref(rcbuf);
   rcbufs_.push_back(rcbuf);
@@ -1135,8 +1898,17 @@ void Downstream::set_downstream_addr_group(
 
 void Downstream::set_addr(const DownstreamAddr *addr) { addr_ = addr; }
 
+const std::shared_ptr<DownstreamAddrGroup> &
+Downstream::get_downstream_addr_group() const {
+  return group_;
+}
+
 const DownstreamAddr *Downstream::get_addr() const { return addr_; }
 
+ev_tstamp Downstream::get_backend_attach_time() const {
+  return backend_attach_time_;
+}
+
 void Downstream::set_accesslog_written(bool f) { accesslog_written_ = f; }
 
 void Downstream::renew_affinity_cookie(uint32_t h) {
@@ -42,6 +42,10 @@
 
 #include "shrpx_io_control.h"
 #include "shrpx_log_config.h"
+#include "shrpx_concurrency_limiter.h"
+#include "shrpx_single_flight.h"
+#include "shrpx_cache.h"
+#include "shrpx_compress.h"
 #include "http2.h"
 #include "memchunk.h"
 #include "allocator.h"
@@ -317,6 +321,28 @@ enum class DispatchState {
   FAILURE,
 };
 
+enum class AdmissionState {
+  // Concurrency limit is not applied.
+  NONE,
+  // Waiting for a slot of ConcurrencyLimiter.
+  QUEUED,
+  // Holding a slot of ConcurrencyLimiter.
+  ADMITTED,
+  // Rejected by ConcurrencyLimiter.
+  REJECTED,
+};
+
+enum class SingleFlightRole {
+  // Request is not coalesced.
+  NONE,
+  // Forwarding request to backend on behalf of followers.
+  LEADER,
+  // Waiting for the response to leader.
+  FOLLOWER,
+  // Request must be forwarded to backend without coalescing.
+  BYPASS,
+};
+
 class Downstream {
 public:
   Downstream(Upstream *upstream, MemchunkPool *mcpool, int32_t stream_id);
@@ -339,6 +365,11 @@ public:
   DownstreamConnection *get_downstream_connection();
   // Returns dconn_ and nullifies dconn_.
   std::unique_ptr<DownstreamConnection> pop_downstream_connection();
+  // Replaces dconn_ with |dconn| which carries the pipelined request
+  // of this object, and has been attached to this object.  Both
+  // connections must be connected to the same address.
+  void take_over_downstream_connection(
+      std::unique_ptr<DownstreamConnection> dconn);
 
   // Returns true if output buffer is full. If underlying dconn_ is
   // NULL, this function always returns false.
@@ -473,6 +504,101 @@ public:
   void add_retry();
   // true if retry attempt should not be done.
   bool no_more_retry() const;
+  // Returns true if the retry budget of the backend group which the
+  // current backend connection belongs to allows one more retry, and
+  // consumes it.  If the retry budget is not configured, this
+  // function always returns true.
+  bool acquire_retry_budget();
+
+  // Returns the backend connection which the hedged request is sent
+  // over.  It returns nullptr if there is no outstanding hedged
+  // request.
+  DownstreamConnection *get_hedge_downstream_connection();
+  // Sends the hedged request of this request to another backend
+  // address.  This is called when the hedge timer expires.
+  void send_hedged_request();
+  // Settles the race between the backend connection and the hedged
+  // one.  |dconn| is the backend connection which starts receiving
+  // response.  If it is the hedged one, it becomes the backend
+  // connection of this object, and the other is closed.  Otherwise,
+  // the hedged connection is closed.
+  void resolve_hedge(DownstreamConnection *dconn);
+  // Closes the backend connection of the hedged request if any, and
+  // stops the hedge timer.
+  void cancel_hedge();
+  // Returns true if the hedge timer is running or the hedged request
+  // is outstanding.
+  bool hedge_pending() const;
+
+  // Applies the concurrency limit of |group| to this request.  This
+  // function returns 0 if the request can be forwarded to backend,
+  // SHRPX_ERR_QUEUED if it has to wait for a slot, or
+  // SHRPX_ERR_OVERLOADED if it is rejected.  If the request has
+  // already been admitted or rejected, the result is returned again.
+  int acquire_concurrency_slot(
+      const std::shared_ptr<DownstreamAddrGroup> &group);
+  // Called by ConcurrencyLimiter when this request leaves its wait
+  // queue.  |admitted| is false if it waited too long.
+  void set_admitted(bool admitted);
+  AdmissionState get_admission_state() const;
+  // Updates the concurrency limit with response latency |rtt|.
+  void update_concurrency_limit(ev_tstamp rtt);
+  // Returns the duration this request waited for a slot of
+  // ConcurrencyLimiter.
+  ev_tstamp get_queue_time() const;
+
+  // Makes this request follow the identical request in flight to
+  // |group| if single-flight is enabled for it.  This function
+  // returns 0 if the request should be forwarded to backend, or
+  // SHRPX_ERR_COALESCED if it waits for the response to the other
+  // request.
+  int join_single_flight(const std::shared_ptr<DownstreamAddrGroup> &group);
+  // Called by SingleFlightCall when this follower leaves the call.
+  // If |bypass| is true, this request is not coalesced again.
+  void leave_single_flight(bool bypass);
+  SingleFlightRole get_single_flight_role() const;
+  // Serves this request from response cache if it is enabled for
+  // |group|, and a fresh response is stored.  This function returns
+  // 0 if the request should be forwarded to backend, or
+  // SHRPX_ERR_COALESCED if the stored response is delivered.
+  int lookup_cache(const std::shared_ptr<DownstreamAddrGroup> &group);
+  // Adds validators of the stale stored response to the request, so
+  // that backend can respond with 304.
+  void add_cache_validators();
+  // The following functions share the response with followers if
+  // this request is a leader, and store it in response cache.
+  void share_response_header();
+  void share_response_body(const uint8_t *data, size_t len);
+  // Returns -1 if the response cannot be sent.
+  int share_response_complete();
+  // Returns true if response body is shared by the above functions.
+  bool response_body_shared() const;
+
+  // Selects the content-coding of response body from Accept-Encoding
+  // request header field if |group| compresses responses.
+  void
+  select_response_coding(const std::shared_ptr<DownstreamAddrGroup> &group);
+  // Starts compressing the final response body with the selected
+  // content-coding if the response is eligible, and updates response
+  // header fields accordingly.  Content-Length and Transfer-Encoding
+  // are removed, and the caller is responsible for the framing of
+  // compressed body.  This function returns true if the response
+  // body is compressed.  For 304 response, ETag and Vary are updated
+  // as if the body was compressed, and it returns false.
+  bool start_response_compression();
+  // Returns true if response body is compressed.
+  bool response_compressed() const;
+  // Compresses response body |data| of length |len|, and appends the
+  // output to |out|.  If |finish| is true, the compressed stream is
+  // ended.  This function returns 0 if it succeeds, or -1.
+  int compress_response_body(DefaultMemchunks &out, const uint8_t *data,
+                             size_t len, bool finish);
+
+  // Records that the rule at index |idx| of --rewrite-rule matched
+  // this request, so that its actions on response header fields are
+  // applied.
+  void set_rewrite_rule_matched(size_t idx);
+  bool get_rewrite_rule_matched(size_t idx) const;
 
   DispatchState get_dispatch_state() const;
   void set_dispatch_state(DispatchState s);
@@ -482,6 +608,9 @@ public:
 
   // Returns true if downstream_connection can be detached and reused.
   bool can_detach_downstream_connection() const;
+  // Returns true if the request can be pipelined on HTTP/1 backend
+  // connection.
+  bool request_pipelinable() const;
 
   DefaultMemchunks pop_response_buf();
 
@@ -493,8 +622,14 @@ public:
   set_downstream_addr_group(const std::shared_ptr<DownstreamAddrGroup> &group);
   void set_addr(const DownstreamAddr *addr);
 
+  const std::shared_ptr<DownstreamAddrGroup> &
+  get_downstream_addr_group() const;
   const DownstreamAddr *get_addr() const;
 
+  // Returns the time when the current backend connection was
+  // attached to this object.
+  ev_tstamp get_backend_attach_time() const;
+
   void set_accesslog_written(bool f);
 
   // Finds affinity cookie from request header fields.  The name of
@@ -524,6 +659,15 @@ public:
   int64_t response_sent_body_length;
 
 private:
+  // Counts this request in the outstanding requests of the backend
+  // address which |dconn_| connects to.
+  void add_inflight();
+  // Undoes add_inflight().  This must be called before |dconn_| is
+  // released.
+  void remove_inflight();
+  // Starts the hedge timer if the request is eligible for hedging.
+  void start_hedge_timer();
+
   BlockAllocator balloc_;
 
   std::vector<nghttp2_rcbuf *> rcbufs_;
@@ -532,6 +676,10 @@ private:
   Response resp_;
 
   std::chrono::high_resolution_clock::time_point request_start_time_;
+  // The time when |dconn_| was attached.
+  ev_tstamp backend_attach_time_;
+  // The time when |hedge_dconn_| was attached.
+  ev_tstamp hedge_attach_time_;
 
   // host we requested to downstream.  This is used to rewrite
   // location header field to decide the location should be rewritten
@@ -554,11 +702,36 @@ private:
   ev_timer downstream_rtimer_;
   ev_timer downstream_wtimer_;
 
+  // Expires when the hedged request should be sent.
+  ev_timer hedge_timer_;
+
   Upstream *upstream_;
   std::unique_ptr<DownstreamConnection> dconn_;
+  // The backend connection which the hedged request is sent over.
+  // This is not visible to upstream until it wins the race.
+  std::unique_ptr<DownstreamConnection> hedge_dconn_;
 
   // only used by HTTP/2 upstream
   BlockedLink *blocked_link_;
+  // The concurrency limiter which this request is queued in, or
+  // holds a slot of.
+  std::shared_ptr<ConcurrencyLimiter> concurrency_limiter_;
+  AdmissionLink admission_link_;
+  // The time when this request is queued in |concurrency_limiter_|.
+  ev_tstamp queue_start_time_;
+  // The duration this request waited in |concurrency_limiter_|.
+  ev_tstamp queue_time_;
+  // The single-flight call which this request leads or follows.
+  std::shared_ptr<SingleFlightCall> single_flight_call_;
+  SingleFlightLink single_flight_link_;
+  // Stores the response in response cache if it is not nullptr.
+  std::unique_ptr<CacheWriter> cache_writer_;
+  // Compresses response body if it is not nullptr.
+  std::unique_ptr<ResponseCompressor> response_compressor_;
+  // Bitmap of the rewrite rules which matched this request, allocated
+  // by balloc_.  nullptr if no rule with actions on response header
+  // fields matched.
+  uint8_t *rewrite_matched_;
   // The backend address used to fulfill this request.  These are for
   // logging purpose.
   std::shared_ptr<DownstreamAddrGroup> group_;
@@ -582,6 +755,11 @@ private:
   DownstreamState response_state_;
   // only used by HTTP/2 upstream
   DispatchState dispatch_state_;
+  AdmissionState admission_state_;
+  SingleFlightRole single_flight_role_;
+  // The content-coding which response body is compressed with if the
+  // response is eligible.
+  ContentCoding response_coding_;
   // true if the connection is upgraded (HTTP Upgrade or CONNECT),
   // excluding upgrade to HTTP/2.
   bool upgraded_;
@@ -606,6 +784,9 @@ private:
   bool blocked_request_data_eof_;
   // true if request contains "expect: 100-continue" header field.
   bool expect_100_continue_;
+  // true if the hedged request has been sent, or hedging has been
+  // ruled out for this request.
+  bool hedged_;
 };
 
 } // namespace shrpx
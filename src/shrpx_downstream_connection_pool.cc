@@ -24,43 +24,163 @@
  */
 #include "shrpx_downstream_connection_pool.h"
 #include "shrpx_downstream_connection.h"
+#include "shrpx_http_downstream_connection.h"
+#include "shrpx_log.h"
 
 namespace shrpx {
 
-DownstreamConnectionPool::DownstreamConnectionPool() {}
+namespace {
+// The maximum delay in seconds before connections are made to refill
+// the pool.
+constexpr ev_tstamp REFILL_JITTER = 0.1;
+// The delay in seconds before trying to refill the pool again when
+// the backend is not available.
+constexpr ev_tstamp REFILL_RETRY_INTERVAL = 1.;
+} // namespace
+
+namespace {
+void refill_timeoutcb(struct ev_loop *loop, ev_timer *w, int revents) {
+  auto pool = static_cast<DownstreamConnectionPool *>(w->data);
+
+  pool->refill();
+}
+} // namespace
+
+DownstreamConnectionPool::DownstreamConnectionPool(
+    struct ev_loop *loop, std::mt19937 &gen, size_t min_idle, size_t max_idle,
+    std::function<int(size_t)> refill_func)
+    : refill_func_(std::move(refill_func)),
+      loop_(loop),
+      gen_(gen),
+      min_idle_(min_idle),
+      max_idle_(max_idle),
+      num_hits_(0),
+      num_misses_(0) {
+  ev_timer_init(&refill_timer_, refill_timeoutcb, 0., 0.);
+  refill_timer_.data = this;
+}
 
 DownstreamConnectionPool::~DownstreamConnectionPool() { remove_all(); }
 
 void DownstreamConnectionPool::remove_all() {
-  for (auto dconn : pool_) {
-    delete dconn;
-  }
+  ev_timer_stop(loop_, &refill_timer_);
 
-  pool_.clear();
+  dlist_delete_all(pool_);
+  pool_ = DList<HttpDownstreamConnection>{};
+
+  dlist_delete_all(warming_);
+  warming_ = DList<HttpDownstreamConnection>{};
 }
 
 void DownstreamConnectionPool::add_downstream_connection(
     std::unique_ptr<DownstreamConnection> dconn) {
-  pool_.insert(dconn.release());
+  // Only HttpDownstreamConnection is poolable.
+  pool_.append(static_cast<HttpDownstreamConnection *>(dconn.release()));
+
+  if (max_idle_ && pool_.size() > max_idle_) {
+    auto oldest = pool_.head;
+
+    if (LOG_ENABLED(INFO)) {
+      LOG(INFO) << "Too many idle connections; close the oldest one DCONN:"
+                << oldest;
+    }
+
+    pool_.remove(oldest);
+    delete oldest;
+  }
 }
 
 std::unique_ptr<DownstreamConnection>
 DownstreamConnectionPool::pop_downstream_connection() {
   if (pool_.empty()) {
+    ++num_misses_;
+
+    schedule_refill();
+
     return nullptr;
   }
 
-  auto it = std::begin(pool_);
-  auto dconn = std::unique_ptr<DownstreamConnection>(*it);
-  pool_.erase(it);
+  ++num_hits_;
+
+  auto dconn = pool_.tail;
+  pool_.remove(dconn);
+
+  schedule_refill();
 
-  return dconn;
+  return std::unique_ptr<DownstreamConnection>(dconn);
 }
 
 void DownstreamConnectionPool::remove_downstream_connection(
-    DownstreamConnection *dconn) {
-  pool_.erase(dconn);
+    HttpDownstreamConnection *dconn) {
+  pool_.remove(dconn);
   delete dconn;
+
+  schedule_refill();
+}
+
+void DownstreamConnectionPool::add_warming_connection(
+    std::unique_ptr<HttpDownstreamConnection> dconn) {
+  warming_.append(dconn.release());
+}
+
+void DownstreamConnectionPool::on_warmed(HttpDownstreamConnection *dconn) {
+  warming_.remove(dconn);
+
+  add_downstream_connection(std::unique_ptr<DownstreamConnection>(dconn));
+}
+
+void DownstreamConnectionPool::remove_warming_connection(
+    HttpDownstreamConnection *dconn) {
+  warming_.remove(dconn);
+  delete dconn;
+
+  schedule_refill();
+}
+
+void DownstreamConnectionPool::schedule_refill() {
+  if (!refill_func_ || ev_is_active(&refill_timer_) ||
+      pool_.size() + warming_.size() >= min_idle_) {
+    return;
+  }
+
+  auto dist = std::uniform_real_distribution<>(0., REFILL_JITTER);
+
+  ev_timer_set(&refill_timer_, dist(gen_), 0.);
+  ev_timer_start(loop_, &refill_timer_);
+}
+
+void DownstreamConnectionPool::refill() {
+  auto n = pool_.size() + warming_.size();
+  if (n >= min_idle_) {
+    return;
+  }
+
+  if (refill_func_(min_idle_ - n) == 0) {
+    return;
+  }
+
+  // Removing a connection which failed to connect may have started
+  // timer.
+  ev_timer_stop(loop_, &refill_timer_);
+
+  auto dist = std::uniform_real_distribution<>(0., REFILL_JITTER);
+
+  ev_timer_set(&refill_timer_, REFILL_RETRY_INTERVAL + dist(gen_), 0.);
+  ev_timer_start(loop_, &refill_timer_);
+}
+
+size_t DownstreamConnectionPool::size() const { return pool_.size(); }
+
+size_t DownstreamConnectionPool::get_num_warming() const {
+  return warming_.size();
+}
+
+size_t DownstreamConnectionPool::get_min_idle() const { return min_idle_; }
+
+uint64_t DownstreamConnectionPool::get_num_hits() const { return num_hits_; }
+
+uint64_t DownstreamConnectionPool::get_num_misses() const {
+  return num_misses_;
 }
 
 } // namespace shrpx
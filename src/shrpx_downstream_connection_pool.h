@@ -28,24 +28,80 @@
 #include "shrpx.h"
 
 #include <memory>
-#include <set>
+#include <functional>
+#include <random>
+
+#include <ev.h>
+
+#include "template.h"
+
+using namespace nghttp2;
 
 namespace shrpx {
 
 class DownstreamConnection;
+class HttpDownstreamConnection;
 
+// DownstreamConnectionPool keeps idle HTTP/1 connections to a backend
+// address.  The connection which became idle most recently is reused
+// first.  If |min_idle| > 0, it also keeps at least |min_idle|
+// connections established in advance so that a request does not
+// have to wait for connection establishment.
 class DownstreamConnectionPool {
 public:
-  DownstreamConnectionPool();
+  // |refill_func| is called with the number of connections to add
+  // when the pool has less than |min_idle| connections.  It should
+  // start connecting, and pass each connection to
+  // add_warming_connection().  It returns 0 if it succeeds, or -1 if
+  // the backend is not available now, and the pool tries again later.
+  // If |max_idle| > 0, the oldest idle connection is closed when the
+  // number of idle connections exceeds it.
+  DownstreamConnectionPool(struct ev_loop *loop, std::mt19937 &gen,
+                           size_t min_idle, size_t max_idle,
+                           std::function<int(size_t)> refill_func);
   ~DownstreamConnectionPool();
 
   void add_downstream_connection(std::unique_ptr<DownstreamConnection> dconn);
+  // Returns the most recently pooled connection, or nullptr if the
+  // pool is empty.
   std::unique_ptr<DownstreamConnection> pop_downstream_connection();
-  void remove_downstream_connection(DownstreamConnection *dconn);
+  void remove_downstream_connection(HttpDownstreamConnection *dconn);
+  // Adds |dconn| which is still connecting to the backend.
+  void add_warming_connection(std::unique_ptr<HttpDownstreamConnection> dconn);
+  // Moves |dconn| which has finished connecting into idle connections.
+  void on_warmed(HttpDownstreamConnection *dconn);
+  // Removes |dconn| which failed to connect.
+  void remove_warming_connection(HttpDownstreamConnection *dconn);
   void remove_all();
+  // Starts connecting to the backend if the pool has less than
+  // min_idle connections.  The connection is made after random short
+  // delay so that workers do not connect at the same time.
+  void schedule_refill();
+  // Called when refill timer expires.
+  void refill();
+  // Returns the number of connections in this pool.
+  size_t size() const;
+  // Returns the number of connections which are still connecting.
+  size_t get_num_warming() const;
+  size_t get_min_idle() const;
+  // Returns the number of times a request found an idle connection.
+  uint64_t get_num_hits() const;
+  // Returns the number of times a request found no idle connection.
+  uint64_t get_num_misses() const;
 
 private:
-  std::set<DownstreamConnection *> pool_;
+  // Idle connections, ordered from the oldest to the newest.
+  DList<HttpDownstreamConnection> pool_;
+  // Connections made by refill which are still connecting.
+  DList<HttpDownstreamConnection> warming_;
+  std::function<int(size_t)> refill_func_;
+  ev_timer refill_timer_;
+  struct ev_loop *loop_;
+  std::mt19937 &gen_;
+  size_t min_idle_;
+  size_t max_idle_;
+  uint64_t num_hits_;
+  uint64_t num_misses_;
 };
 
 } // namespace shrpx
@@ -28,14 +28,17 @@
 #include <limits>
 
 #include "shrpx_downstream.h"
+#include "shrpx_metrics.h"
 
 namespace shrpx {
 
 DownstreamQueue::HostEntry::HostEntry(ImmutableString &&key)
     : key(std::move(key)), num_active(0) {}
 
-DownstreamQueue::DownstreamQueue(size_t conn_max_per_host, bool unified_host)
-    : conn_max_per_host_(conn_max_per_host == 0
+DownstreamQueue::DownstreamQueue(size_t conn_max_per_host, bool unified_host,
+                                 WorkerMetrics *metrics)
+    : metrics_(metrics),
+      conn_max_per_host_(conn_max_per_host == 0
                              ? std::numeric_limits<size_t>::max()
                              : conn_max_per_host),
       unified_host_(unified_host) {}
@@ -44,6 +47,11 @@ DownstreamQueue::~DownstreamQueue() {
   dlist_delete_all(downstreams_);
   for (auto &p : host_entries_) {
     auto &ent = p.second;
+    if (metrics_) {
+      for (auto link = ent.blocked.head; link; link = link->dlnext) {
+        metrics_sub(metrics_->downstream_queue_blocked);
+      }
+    }
     dlist_delete_all(ent.blocked);
   }
 }
@@ -98,6 +106,10 @@ void DownstreamQueue::mark_blocked(Downstream *downstream) {
   auto link = new BlockedLink{};
   downstream->attach_blocked_link(link);
   ent.blocked.append(link);
+
+  if (metrics_) {
+    metrics_add(metrics_->downstream_queue_blocked);
+  }
 }
 
 bool DownstreamQueue::can_activate(const StringRef &host) const {
@@ -139,6 +151,10 @@ Downstream *DownstreamQueue::remove_and_get_blocked(Downstream *downstream,
     if (link) {
       ent.blocked.remove(link);
       delete link;
+
+      if (metrics_) {
+        metrics_sub(metrics_->downstream_queue_blocked);
+      }
     }
   }
 
@@ -165,6 +181,10 @@ Downstream *DownstreamQueue::remove_and_get_blocked(Downstream *downstream,
   delete link;
   remove_host_entry_if_empty(ent, host_entries_, host);
 
+  if (metrics_) {
+    metrics_sub(metrics_->downstream_queue_blocked);
+  }
+
   return next_downstream;
 }
 
@@ -39,6 +39,7 @@ using namespace nghttp2;
 namespace shrpx {
 
 class Downstream;
+struct WorkerMetrics;
 
 // Link entry in HostEntry.blocked and downstream because downstream
 // could be deleted in anytime and we'd like to find Downstream in
@@ -70,7 +71,10 @@ public:
   using HostEntryMap = std::map<StringRef, HostEntry>;
 
   // conn_max_per_host == 0 means no limit for downstream connection.
-  DownstreamQueue(size_t conn_max_per_host = 0, bool unified_host = true);
+  // If |metrics| is not nullptr, the number of blocked downstreams is
+  // reflected to it.
+  DownstreamQueue(size_t conn_max_per_host = 0, bool unified_host = true,
+                  WorkerMetrics *metrics = nullptr);
   ~DownstreamQueue();
   // Add |downstream| to this queue.  This is entry point for
   // Downstream object.
@@ -104,6 +108,7 @@ private:
   // connections to the same host.
   HostEntryMap host_entries_;
   DList<Downstream> downstreams_;
+  WorkerMetrics *metrics_;
   // Maximum number of concurrent connections to the same host.
   size_t conn_max_per_host_;
   // true if downstream host is treated as the same.  Used for reverse
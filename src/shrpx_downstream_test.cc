@@ -29,6 +29,8 @@
 #include <CUnit/CUnit.h>
 
 #include "shrpx_downstream.h"
+#include "shrpx_worker.h"
+#include "shrpx_log.h"
 
 namespace shrpx {
 
@@ -223,4 +225,188 @@ void test_downstream_find_affinity_cookie(void) {
   CU_ASSERT(0 == aff);
 }
 
+void test_downstream_request_pipelinable(void) {
+  {
+    Downstream d(nullptr, nullptr, 0);
+    auto &req = d.request();
+    req.method = HTTP_GET;
+
+    CU_ASSERT(d.request_pipelinable());
+
+    req.method = HTTP_HEAD;
+
+    CU_ASSERT(d.request_pipelinable());
+
+    req.method = HTTP_POST;
+
+    CU_ASSERT(!d.request_pipelinable());
+  }
+  {
+    Downstream d(nullptr, nullptr, 0);
+    auto &req = d.request();
+    req.method = HTTP_GET;
+    req.fs.content_length = 3;
+
+    CU_ASSERT(!d.request_pipelinable());
+
+    req.fs.content_length = 0;
+
+    CU_ASSERT(d.request_pipelinable());
+
+    req.connection_close = true;
+
+    CU_ASSERT(!d.request_pipelinable());
+  }
+  {
+    Downstream d(nullptr, nullptr, 0);
+    auto &req = d.request();
+    req.method = HTTP_GET;
+    req.fs.add_header_token(StringRef::from_lit("transfer-encoding"),
+                            StringRef::from_lit("chunked"), false,
+                            http2::HD_TRANSFER_ENCODING);
+
+    CU_ASSERT(!d.request_pipelinable());
+  }
+  {
+    Downstream d(nullptr, nullptr, 0);
+    auto &req = d.request();
+    req.method = HTTP_OPTIONS;
+    req.http_major = 2;
+    req.http_minor = 0;
+
+    CU_ASSERT(d.request_pipelinable());
+
+    req.http2_expect_body = true;
+
+    CU_ASSERT(!d.request_pipelinable());
+  }
+  {
+    Downstream d(nullptr, nullptr, 0);
+    auto &req = d.request();
+    req.method = HTTP_GET;
+    req.upgrade_request = true;
+
+    CU_ASSERT(!d.request_pipelinable());
+  }
+}
+
+namespace {
+size_t count_header(const FieldStore &fs, const StringRef &name) {
+  size_t n = 0;
+  for (auto &kv : fs.headers()) {
+    if (kv.name == name) {
+      ++n;
+    }
+  }
+  return n;
+}
+} // namespace
+
+void test_downstream_start_response_compression(void) {
+  auto group = std::make_shared<DownstreamAddrGroup>();
+  group->shared_addr = std::make_shared<SharedDownstreamAddr>();
+  group->shared_addr->compress = true;
+
+  auto etag = StringRef::from_lit("etag");
+  auto vary = StringRef::from_lit("vary");
+  auto content_encoding = StringRef::from_lit("content-encoding");
+
+  {
+    Downstream d(nullptr, nullptr, 0);
+    d.request().fs.add_header_token(StringRef::from_lit("accept-encoding"),
+                                    StringRef::from_lit("gzip"), false,
+                                    http2::HD_ACCEPT_ENCODING);
+    d.select_response_coding(group);
+
+    auto &resp = d.response();
+    resp.http_status = 200;
+    resp.fs.content_length = 1000;
+    resp.fs.add_header_token(StringRef::from_lit("content-type"),
+                             StringRef::from_lit("text/plain"), false,
+                             http2::HD_CONTENT_TYPE);
+    resp.fs.add_header_token(etag, StringRef::from_lit("\"alpha\""), false,
+                             -1);
+
+    CU_ASSERT(d.start_response_compression());
+    CU_ASSERT("W/\"alpha\"" == resp.fs.header(etag)->value);
+    CU_ASSERT("accept-encoding" == resp.fs.header(vary)->value);
+    CU_ASSERT("gzip" == resp.fs.header(content_encoding)->value);
+  }
+  {
+    // 304 response to the client which accepts the coding carries
+    // the same ETag and Vary as the compressed 200 response.
+    Downstream d(nullptr, nullptr, 0);
+    d.request().fs.add_header_token(StringRef::from_lit("accept-encoding"),
+                                    StringRef::from_lit("gzip"), false,
+                                    http2::HD_ACCEPT_ENCODING);
+    d.select_response_coding(group);
+
+    auto &resp = d.response();
+    resp.http_status = 304;
+    resp.fs.add_header_token(etag, StringRef::from_lit("\"alpha\""), false,
+                             -1);
+
+    CU_ASSERT(!d.start_response_compression());
+    CU_ASSERT(!d.response_compressed());
+    CU_ASSERT("W/\"alpha\"" == resp.fs.header(etag)->value);
+    CU_ASSERT("accept-encoding" == resp.fs.header(vary)->value);
+    CU_ASSERT(nullptr == resp.fs.header(content_encoding));
+  }
+  {
+    // Weak ETag and Vary which already covers accept-encoding are
+    // left intact.
+    Downstream d(nullptr, nullptr, 0);
+    d.request().fs.add_header_token(StringRef::from_lit("accept-encoding"),
+                                    StringRef::from_lit("gzip"), false,
+                                    http2::HD_ACCEPT_ENCODING);
+    d.select_response_coding(group);
+
+    auto &resp = d.response();
+    resp.http_status = 304;
+    resp.fs.add_header_token(etag, StringRef::from_lit("W/\"alpha\""), false,
+                             -1);
+    resp.fs.add_header_token(vary, StringRef::from_lit("Accept-Encoding"),
+                             false, -1);
+
+    CU_ASSERT(!d.start_response_compression());
+    CU_ASSERT("W/\"alpha\"" == resp.fs.header(etag)->value);
+    CU_ASSERT(1 == count_header(resp.fs, vary));
+  }
+  {
+    // 304 response with no-transform is not changed.
+    Downstream d(nullptr, nullptr, 0);
+    d.request().fs.add_header_token(StringRef::from_lit("accept-encoding"),
+                                    StringRef::from_lit("gzip"), false,
+                                    http2::HD_ACCEPT_ENCODING);
+    d.select_response_coding(group);
+
+    auto &resp = d.response();
+    resp.http_status = 304;
+    resp.fs.add_header_token(StringRef::from_lit("cache-control"),
+                             StringRef::from_lit("no-transform"), false,
+                             http2::HD_CACHE_CONTROL);
+    resp.fs.add_header_token(etag, StringRef::from_lit("\"alpha\""), false,
+                             -1);
+
+    CU_ASSERT(!d.start_response_compression());
+    CU_ASSERT("\"alpha\"" == resp.fs.header(etag)->value);
+    CU_ASSERT(nullptr == resp.fs.header(vary));
+  }
+  {
+    // 304 response to the client which does not accept compression
+    // is not changed.
+    Downstream d(nullptr, nullptr, 0);
+    d.select_response_coding(group);
+
+    auto &resp = d.response();
+    resp.http_status = 304;
+    resp.fs.add_header_token(etag, StringRef::from_lit("\"alpha\""), false,
+                             -1);
+
+    CU_ASSERT(!d.start_response_compression());
+    CU_ASSERT("\"alpha\"" == resp.fs.header(etag)->value);
+    CU_ASSERT(nullptr == resp.fs.header(vary));
+  }
+}
+
 } // namespace shrpx
@@ -24,30 +24,33 @@
  */
 #include "shrpx_dual_dns_resolver.h"
 
+#include <algorithm>
+
+#include "shrpx_log.h"
+
 namespace shrpx {
 
+namespace {
+void delaycb(struct ev_loop *loop, ev_timer *w, int revents) {
+  auto resolv = static_cast<DualDNSResolver *>(w->data);
+  resolv->on_delay_timeout();
+}
+} // namespace
+
 DualDNSResolver::DualDNSResolver(struct ev_loop *loop)
-    : resolv4_(loop), resolv6_(loop) {
-  auto cb = [this](DNSResolverStatus, const Address *) {
-    Address result;
-
-    auto status = this->get_status(&result);
-    switch (status) {
-    case DNSResolverStatus::ERROR:
-    case DNSResolverStatus::OK:
-      break;
-    default:
-      return;
-    }
+    : resolv4_(loop), resolv6_(loop), loop_(loop), delay_expired_(false) {
+  ev_timer_init(&delay_timer_, delaycb, DUAL_DNS_RESOLVER_RESOLUTION_DELAY,
+                0.);
+  delay_timer_.data = this;
 
-    auto cb = this->get_complete_cb();
-    cb(status, &result);
-  };
+  auto cb = [this](DNSResolverStatus, const Address *) { on_result(); };
 
   resolv4_.set_complete_cb(cb);
   resolv6_.set_complete_cb(cb);
 }
 
+DualDNSResolver::~DualDNSResolver() { ev_timer_stop(loop_, &delay_timer_); }
+
 int DualDNSResolver::resolve(const StringRef &host) {
   int rv4, rv6;
   rv4 = resolv4_.resolve(host, AF_INET);
@@ -57,19 +60,81 @@ int DualDNSResolver::resolve(const StringRef &host) {
     return -1;
   }
 
+  if (get_status(nullptr) == DNSResolverStatus::RUNNING &&
+      (resolv4_.get_status(nullptr) == DNSResolverStatus::OK ||
+       resolv6_.get_status(nullptr) == DNSResolverStatus::OK)) {
+    ev_timer_start(loop_, &delay_timer_);
+  }
+
   return 0;
 }
 
+void DualDNSResolver::on_result() {
+  if (process_result()) {
+    // this may be deleted here.
+    return;
+  }
+
+  if ((resolv4_.get_status(nullptr) == DNSResolverStatus::OK ||
+       resolv6_.get_status(nullptr) == DNSResolverStatus::OK) &&
+      !ev_is_active(&delay_timer_)) {
+    if (LOG_ENABLED(INFO)) {
+      LOG(INFO) << "Waiting for the records of the other address family";
+    }
+    ev_timer_start(loop_, &delay_timer_);
+  }
+}
+
+void DualDNSResolver::on_delay_timeout() {
+  if (LOG_ENABLED(INFO)) {
+    LOG(INFO) << "Resolution delay expired, proceeding with the records "
+                 "resolved so far";
+  }
+
+  delay_expired_ = true;
+
+  process_result();
+  // this may be deleted here.
+}
+
+bool DualDNSResolver::process_result() {
+  auto status = get_status(nullptr);
+  switch (status) {
+  case DNSResolverStatus::ERROR:
+  case DNSResolverStatus::OK:
+    break;
+  default:
+    return false;
+  }
+
+  ev_timer_stop(loop_, &delay_timer_);
+
+  Address result;
+  get_status(&result);
+
+  auto cb = get_complete_cb();
+  cb(status, &result);
+
+  return true;
+}
+
 CompleteCb DualDNSResolver::get_complete_cb() const { return complete_cb_; }
 
 void DualDNSResolver::set_complete_cb(CompleteCb cb) { complete_cb_ = cb; }
 
 DNSResolverStatus DualDNSResolver::get_status(Address *result) const {
-  auto rv6 = resolv6_.get_status(result);
+  auto rv6 = resolv6_.get_status(nullptr);
+  auto rv4 = resolv4_.get_status(nullptr);
+  if ((rv4 == DNSResolverStatus::RUNNING ||
+       rv6 == DNSResolverStatus::RUNNING) &&
+      !delay_expired_) {
+    return DNSResolverStatus::RUNNING;
+  }
+  rv6 = resolv6_.get_status(result);
   if (rv6 == DNSResolverStatus::OK) {
     return DNSResolverStatus::OK;
   }
-  auto rv4 = resolv4_.get_status(result);
+  rv4 = resolv4_.get_status(result);
   if (rv4 == DNSResolverStatus::OK) {
     return DNSResolverStatus::OK;
   }
@@ -82,4 +147,40 @@ DNSResolverStatus DualDNSResolver::get_status(Address *result) const {
   return DNSResolverStatus::IDLE;
 }
 
+void DualDNSResolver::get_records(std::vector<Address> *addrs,
+                                  int *ttl) const {
+  addrs->clear();
+  *ttl = -1;
+
+  static const std::vector<Address> empty;
+
+  auto &addrs6 = resolv6_.get_status(nullptr) == DNSResolverStatus::OK
+                     ? resolv6_.get_addrs()
+                     : empty;
+  auto &addrs4 = resolv4_.get_status(nullptr) == DNSResolverStatus::OK
+                     ? resolv4_.get_addrs()
+                     : empty;
+
+  addrs->reserve(addrs6.size() + addrs4.size());
+
+  for (size_t i = 0; i < std::max(addrs6.size(), addrs4.size()); ++i) {
+    if (i < addrs6.size()) {
+      addrs->push_back(addrs6[i]);
+    }
+    if (i < addrs4.size()) {
+      addrs->push_back(addrs4[i]);
+    }
+  }
+
+  for (auto r : {&resolv6_, &resolv4_}) {
+    if (r->get_status(nullptr) != DNSResolverStatus::OK) {
+      continue;
+    }
+    auto t = r->get_ttl();
+    if (t != -1) {
+      *ttl = *ttl == -1 ? t : std::min(*ttl, t);
+    }
+  }
+}
+
 } // namespace shrpx
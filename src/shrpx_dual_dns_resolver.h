@@ -27,6 +27,8 @@
 
 #include "shrpx.h"
 
+#include <vector>
+
 #include <ev.h>
 
 #include "shrpx_dns_resolver.h"
@@ -35,27 +37,55 @@ using namespace nghttp2;
 
 namespace shrpx {
 
+// The time to wait for the records of the other address family after
+// the records of one family are resolved (Resolution Delay in RFC
+// 8305).
+constexpr ev_tstamp DUAL_DNS_RESOLVER_RESOLUTION_DELAY = 0.05;
+
 // DualDNSResolver performs name resolution for both A and AAAA
-// records at the same time.  The first successful return (or if we
-// have both successful results, prefer to AAAA) is chosen.  This is
-// wrapper around 2 DNSResolver inside.  resolve(), get_status(), and
-// how CompleteCb is called have the same semantics with DNSResolver.
+// records at the same time.  Once the records of one family are
+// resolved, it waits for the other for
+// DUAL_DNS_RESOLVER_RESOLUTION_DELAY seconds, so that both families
+// are cached and raced.  If we have both successful results, AAAA is
+// preferred.
+// This is wrapper around 2 DNSResolver inside.  resolve(),
+// get_status(), and how CompleteCb is called have the same semantics
+// with DNSResolver.
 class DualDNSResolver {
 public:
   DualDNSResolver(struct ev_loop *loop);
+  ~DualDNSResolver();
 
   // Resolves |host|.  |host| must be NULL-terminated string.
   int resolve(const StringRef &host);
   CompleteCb get_complete_cb() const;
   void set_complete_cb(CompleteCb cb);
   DNSResolverStatus get_status(Address *result) const;
+  // Stores all resolved addresses in |addrs|, alternating between
+  // IPv6 and IPv4 starting with IPv6, and the minimum TTL in |ttl|.
+  // |*ttl| is -1 if it is unknown.
+  void get_records(std::vector<Address> *addrs, int *ttl) const;
+
+  // Called when one of the resolvers finishes.
+  void on_result();
+  // Called when resolution delay expires.
+  void on_delay_timeout();
 
 private:
+  // Calls complete_cb_ if name lookup is done.  Returns true if it
+  // is called.
+  bool process_result();
+
   // For A record
   DNSResolver resolv4_;
   // For AAAA record
   DNSResolver resolv6_;
   CompleteCb complete_cb_;
+  ev_timer delay_timer_;
+  struct ev_loop *loop_;
+  // true if resolution delay has expired, and we no longer wait for
+  // the other address family.
+  bool delay_expired_;
 };
 
 } // namespace shrpx
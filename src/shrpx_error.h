@@ -39,6 +39,9 @@ enum ErrorCode {
   SHRPX_ERR_DCONN_CANCELED = -103,
   SHRPX_ERR_RETRY = -104,
   SHRPX_ERR_TLS_REQUIRED = -105,
+  SHRPX_ERR_QUEUED = -106,
+  SHRPX_ERR_OVERLOADED = -107,
+  SHRPX_ERR_COALESCED = -108,
 };
 
 } // namespace shrpx
@@ -0,0 +1,184 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_happy_eyeballs.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+
+#include "shrpx_connection.h"
+#include "shrpx_log.h"
+#include "util.h"
+
+namespace shrpx {
+
+namespace {
+void timeoutcb(struct ev_loop *loop, ev_timer *w, int revents) {
+  auto he = static_cast<HappyEyeballs *>(w->data);
+  he->on_timeout();
+}
+} // namespace
+
+namespace {
+void writecb(struct ev_loop *loop, ev_io *w, int revents) {
+  auto he = static_cast<HappyEyeballs *>(w->data);
+  he->on_writable();
+}
+} // namespace
+
+HappyEyeballs::HappyEyeballs(Connection *conn, const Address &fallback,
+                             std::function<void(const Address &)> switch_cb)
+    : fallback_(fallback),
+      switch_cb_(std::move(switch_cb)),
+      conn_(conn),
+      loop_(conn->loop),
+      fd_(-1),
+      done_(false) {
+  ev_timer_init(&timer_, timeoutcb, HAPPY_EYEBALLS_CONNECTION_ATTEMPT_DELAY,
+                0.);
+  timer_.data = this;
+
+  ev_io_init(&wev_, writecb, -1, EV_WRITE);
+  wev_.data = this;
+}
+
+HappyEyeballs::~HappyEyeballs() {
+  ev_timer_stop(loop_, &timer_);
+  close_fallback();
+}
+
+void HappyEyeballs::start() { ev_timer_start(loop_, &timer_); }
+
+void HappyEyeballs::on_timeout() {
+  if (LOG_ENABLED(INFO)) {
+    LOG(INFO) << "Connection attempt delay expired; connecting to "
+              << util::to_numeric_addr(&fallback_);
+  }
+
+  connect_fallback();
+}
+
+int HappyEyeballs::connect_fallback() {
+  fd_ = util::create_nonblock_socket(fallback_.su.storage.ss_family);
+  if (fd_ == -1) {
+    auto error = errno;
+    LOG(WARN) << "socket() failed; addr=" << util::to_numeric_addr(&fallback_)
+              << ", errno=" << error;
+
+    done_ = true;
+
+    return -1;
+  }
+
+  if (connect(fd_, &fallback_.su.sa, fallback_.len) != 0 &&
+      errno != EINPROGRESS) {
+    auto error = errno;
+    LOG(WARN) << "connect() failed; addr=" << util::to_numeric_addr(&fallback_)
+              << ", errno=" << error;
+
+    close_fallback();
+    done_ = true;
+
+    return -1;
+  }
+
+  ev_io_set(&wev_, fd_, EV_WRITE);
+  ev_io_start(loop_, &wev_);
+
+  return 0;
+}
+
+void HappyEyeballs::on_writable() {
+  auto sock_error = util::get_socket_error(fd_);
+  if (sock_error != 0) {
+    LOG(WARN) << "Backend connect failed; addr="
+              << util::to_numeric_addr(&fallback_) << ": errno=" << sock_error;
+
+    close_fallback();
+    done_ = true;
+
+    return;
+  }
+
+  if (LOG_ENABLED(INFO)) {
+    LOG(INFO) << "Connected to " << util::to_numeric_addr(&fallback_)
+              << " first";
+  }
+
+  replace_fd();
+}
+
+int HappyEyeballs::on_primary_failure() {
+  if (done_) {
+    return -1;
+  }
+
+  ev_timer_stop(loop_, &timer_);
+
+  if (fd_ == -1 && connect_fallback() != 0) {
+    return -1;
+  }
+
+  if (LOG_ENABLED(INFO)) {
+    LOG(INFO) << "Falling back to " << util::to_numeric_addr(&fallback_);
+  }
+
+  replace_fd();
+
+  return 0;
+}
+
+void HappyEyeballs::replace_fd() {
+  ev_timer_stop(loop_, &timer_);
+  ev_io_stop(loop_, &wev_);
+
+  conn_->rlimit.stopw();
+  conn_->wlimit.stopw();
+
+  close(conn_->fd);
+  conn_->fd = fd_;
+  fd_ = -1;
+  done_ = true;
+
+  ev_io_set(&conn_->rev, conn_->fd, EV_READ);
+  ev_io_set(&conn_->wev, conn_->fd, EV_WRITE);
+
+  conn_->wlimit.startw();
+
+  switch_cb_(fallback_);
+}
+
+void HappyEyeballs::close_fallback() {
+  if (fd_ == -1) {
+    return;
+  }
+
+  ev_io_stop(loop_, &wev_);
+  close(fd_);
+  fd_ = -1;
+}
+
+} // namespace shrpx
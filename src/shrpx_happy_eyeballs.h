@@ -0,0 +1,94 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHRPX_HAPPY_EYEBALLS_H
+#define SHRPX_HAPPY_EYEBALLS_H
+
+#include "shrpx.h"
+
+#include <functional>
+
+#include <ev.h>
+
+#include "network.h"
+
+using namespace nghttp2;
+
+namespace shrpx {
+
+struct Connection;
+
+// The time to wait for the connection to the first address before
+// connecting to the next one (Connection Attempt Delay in RFC 8305).
+constexpr ev_tstamp HAPPY_EYEBALLS_CONNECTION_ATTEMPT_DELAY = 0.25;
+
+// HappyEyeballs races the connection to another address of the
+// backend, preferably of the other address family, with the
+// connection which is being established on |conn|.  If the
+// connection is not established in
+// HAPPY_EYEBALLS_CONNECTION_ATTEMPT_DELAY seconds, or it fails, it
+// starts connecting to |fallback|.  If the connection to |fallback|
+// is established first, it replaces conn->fd, and calls |switch_cb|
+// with |fallback|.  Then the owner of |conn| sees it as connected.
+class HappyEyeballs {
+public:
+  HappyEyeballs(Connection *conn, const Address &fallback,
+                std::function<void(const Address &)> switch_cb);
+  ~HappyEyeballs();
+
+  // Starts connection attempt delay timer.
+  void start();
+  // Called when connection attempt delay expires.
+  void on_timeout();
+  // Called when the connection to fallback address is established or
+  // fails.
+  void on_writable();
+  // Called when the connection on conn->fd fails.  If the connection
+  // to fallback address is available, this function replaces
+  // conn->fd with it, and returns 0.  The caller should wait for the
+  // connection on the new conn->fd.  Otherwise, it returns -1.
+  int on_primary_failure();
+
+private:
+  // Starts connecting to fallback address.  Returns 0 if it succeeds.
+  int connect_fallback();
+  // Replaces conn->fd with fd_.
+  void replace_fd();
+  void close_fallback();
+
+  Address fallback_;
+  std::function<void(const Address &)> switch_cb_;
+  ev_timer timer_;
+  ev_io wev_;
+  Connection *conn_;
+  struct ev_loop *loop_;
+  int fd_;
+  // true if fallback address has been used, either it failed, or it
+  // replaced conn->fd.
+  bool done_;
+};
+
+} // namespace shrpx
+
+#endif // SHRPX_HAPPY_EYEBALLS_H
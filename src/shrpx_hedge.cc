@@ -0,0 +1,100 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_hedge.h"
+
+#include <algorithm>
+
+namespace shrpx {
+
+RetryBudget::RetryBudget() : tokens_(RETRY_BUDGET_CAPACITY), ratio_(0.) {}
+
+void RetryBudget::set_percent(uint32_t percent) { ratio_ = percent / 100.; }
+
+void RetryBudget::deposit() {
+  tokens_ = std::min(tokens_ + ratio_, RETRY_BUDGET_CAPACITY);
+}
+
+bool RetryBudget::withdraw() {
+  if (tokens_ < 1.) {
+    return false;
+  }
+
+  tokens_ -= 1.;
+
+  return true;
+}
+
+double RetryBudget::get_tokens() const { return tokens_; }
+
+RecentLatencyHistogram::RecentLatencyHistogram()
+    : buckets_{}, num_samples_(0) {}
+
+void RecentLatencyHistogram::observe(ev_tstamp latency) {
+  auto us = static_cast<uint64_t>(std::max(latency, 0.) * 1000000.);
+
+  ++buckets_[latency_histogram_bucket_index(us)];
+
+  if (++num_samples_ < RECENT_LATENCY_WINDOW) {
+    return;
+  }
+
+  num_samples_ = 0;
+
+  for (auto &n : buckets_) {
+    n /= 2;
+    num_samples_ += n;
+  }
+}
+
+ev_tstamp RecentLatencyHistogram::get_percentile(uint32_t percentile) const {
+  if (num_samples_ < RECENT_LATENCY_MIN_SAMPLES) {
+    return 0.;
+  }
+
+  auto rank = (static_cast<uint64_t>(num_samples_) * percentile + 99) / 100;
+  uint64_t n = 0;
+  size_t i = 0;
+
+  for (; i < buckets_.size() - 1; ++i) {
+    n += buckets_[i];
+    if (n >= rank) {
+      break;
+    }
+  }
+
+  if (i == buckets_.size() - 1) {
+    // The last bucket has no upper bound.
+    --i;
+  }
+
+  return static_cast<ev_tstamp>(latency_histogram_bucket_upper_bound(i)) /
+         1000000.;
+}
+
+uint32_t RecentLatencyHistogram::get_num_samples() const {
+  return num_samples_;
+}
+
+} // namespace shrpx
@@ -0,0 +1,101 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHRPX_HEDGE_H
+#define SHRPX_HEDGE_H
+
+#include "shrpx.h"
+
+#include <array>
+
+#include <ev.h>
+
+#include "shrpx_metrics.h"
+
+namespace shrpx {
+
+// The ratio of hedged requests to requests in percent, which is used
+// if retry budget is not configured.
+constexpr uint32_t HEDGE_DEFAULT_RETRY_BUDGET = 10;
+
+// The number of tokens which RetryBudget holds at most.  The bucket
+// is full initially, so that a few retries are allowed before any
+// request is made.
+constexpr double RETRY_BUDGET_CAPACITY = 10.;
+
+// RetryBudget is a token bucket which limits the number of retried
+// and hedged requests relative to the number of requests, so that
+// retries do not amplify the load of an overloaded backend.  Each
+// request adds a fraction of a token, and each retry consumes one
+// token.
+class RetryBudget {
+public:
+  RetryBudget();
+
+  // Sets the ratio of retries to requests in percent.
+  void set_percent(uint32_t percent);
+  // Adds tokens for a new request.
+  void deposit();
+  // Consumes one token and returns true if it is available.
+  // Otherwise returns false.
+  bool withdraw();
+  double get_tokens() const;
+
+private:
+  double tokens_;
+  double ratio_;
+};
+
+// The number of samples after which the counts of
+// RecentLatencyHistogram are halved, so that recent samples weigh
+// more than the old ones.
+constexpr uint32_t RECENT_LATENCY_WINDOW = 1024;
+// The minimum number of samples required to estimate a percentile.
+constexpr uint32_t RECENT_LATENCY_MIN_SAMPLES = 20;
+
+// RecentLatencyHistogram records response latencies in the same
+// buckets as LatencyHistogram to estimate the percentile of recent
+// latency.  Unlike LatencyHistogram, it is private to a worker.
+class RecentLatencyHistogram {
+public:
+  RecentLatencyHistogram();
+
+  // Records |latency| in seconds.
+  void observe(ev_tstamp latency);
+  // Returns the estimated |percentile|-th percentile of latency in
+  // seconds.  |percentile| must be in [1, 99], inclusive.  The
+  // estimate is the upper bound of the bucket which contains the
+  // percentile.  This function returns 0 if the number of samples is
+  // less than RECENT_LATENCY_MIN_SAMPLES.
+  ev_tstamp get_percentile(uint32_t percentile) const;
+  uint32_t get_num_samples() const;
+
+private:
+  std::array<uint32_t, LATENCY_HISTOGRAM_NUM_BUCKETS> buckets_;
+  uint32_t num_samples_;
+};
+
+} // namespace shrpx
+
+#endif // SHRPX_HEDGE_H
@@ -0,0 +1,130 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_hedge_test.h"
+
+#include <CUnit/CUnit.h>
+
+#include "shrpx_hedge.h"
+
+namespace shrpx {
+
+void test_shrpx_hedge_retry_budget(void) {
+  RetryBudget budget;
+
+  budget.set_percent(20);
+
+  // The bucket is full initially.
+  for (size_t i = 0; i < 10; ++i) {
+    CU_ASSERT(budget.withdraw());
+  }
+
+  CU_ASSERT(!budget.withdraw());
+
+  // 5 requests earn 1 retry.
+  for (size_t i = 0; i < 4; ++i) {
+    budget.deposit();
+  }
+
+  CU_ASSERT(!budget.withdraw());
+
+  budget.deposit();
+
+  CU_ASSERT(budget.withdraw());
+  CU_ASSERT(!budget.withdraw());
+
+  // Tokens do not exceed the capacity.
+  for (size_t i = 0; i < 1000; ++i) {
+    budget.deposit();
+  }
+
+  CU_ASSERT(RETRY_BUDGET_CAPACITY == budget.get_tokens());
+
+  budget.set_percent(0);
+
+  for (size_t i = 0; i < 10; ++i) {
+    CU_ASSERT(budget.withdraw());
+  }
+
+  budget.deposit();
+
+  CU_ASSERT(!budget.withdraw());
+}
+
+void test_shrpx_hedge_latency_histogram(void) {
+  RecentLatencyHistogram hist;
+
+  for (size_t i = 0; i < RECENT_LATENCY_MIN_SAMPLES - 1; ++i) {
+    hist.observe(0.01);
+  }
+
+  // Not enough samples.
+  CU_ASSERT(0. == hist.get_percentile(50));
+
+  hist.observe(0.01);
+
+  auto p = hist.get_percentile(50);
+
+  CU_ASSERT(p >= 0.01);
+  CU_ASSERT(p < 0.012);
+
+  // 90% of samples take 10ms, and the rest take 1s.
+  for (size_t i = 0; i < 180; ++i) {
+    hist.observe(i % 10 == 0 ? 1. : 0.01);
+  }
+
+  p = hist.get_percentile(50);
+
+  CU_ASSERT(p >= 0.01);
+  CU_ASSERT(p < 0.012);
+
+  p = hist.get_percentile(95);
+
+  CU_ASSERT(p >= 1.);
+  CU_ASSERT(p < 1.2);
+
+  // Latency of 0 falls in the first bucket.
+  RecentLatencyHistogram edge;
+
+  for (size_t i = 0; i < RECENT_LATENCY_MIN_SAMPLES; ++i) {
+    edge.observe(i % 2 ? 0. : 1000.);
+  }
+
+  CU_ASSERT(edge.get_percentile(10) < 1e-5);
+  CU_ASSERT(edge.get_percentile(90) >= 1000.);
+
+  // Old samples are halved as new ones come in.
+  for (size_t i = 0; i < RECENT_LATENCY_WINDOW; ++i) {
+    hist.observe(0.1);
+  }
+
+  CU_ASSERT(hist.get_num_samples() < RECENT_LATENCY_WINDOW);
+
+  p = hist.get_percentile(50);
+
+  CU_ASSERT(p >= 0.1);
+  CU_ASSERT(p < 0.12);
+}
+
+} // namespace shrpx
@@ -43,6 +43,9 @@
 #include "shrpx_http.h"
 #include "shrpx_worker.h"
 #include "shrpx_connect_blocker.h"
+#include "shrpx_load_balancer.h"
+#include "shrpx_outlier_detector.h"
+#include "shrpx_happy_eyeballs.h"
 #include "shrpx_log.h"
 #include "http2.h"
 #include "util.h"
@@ -203,6 +206,8 @@ Http2Session::Http2Session(struct ev_loop *loop, SSL_CTX *ssl_ctx,
       allow_connect_proto_(false) {
   read_ = write_ = &Http2Session::noop;
 
+  conn_.tls_dyn_rec_adaptive = get_config()->tls.dyn_rec.adaptive;
+
   on_read_ = &Http2Session::read_noop;
   on_write_ = &Http2Session::write_noop;
 
@@ -224,11 +229,15 @@ Http2Session::Http2Session(struct ev_loop *loop, SSL_CTX *ssl_ctx,
   ev_prepare_init(&prep_, prepare_cb);
   prep_.data = this;
   ev_prepare_start(loop, &prep_);
+
+  ++addr_->num_http2_session;
 }
 
 Http2Session::~Http2Session() {
   exclude_from_scheduling();
   disconnect(should_hard_fail());
+
+  --addr_->num_http2_session;
 }
 
 int Http2Session::disconnect(bool hard) {
@@ -245,6 +254,8 @@ int Http2Session::disconnect(bool hard) {
     dns_tracker->cancel(dns_query_.get());
   }
 
+  happy_eyeballs_.reset();
+
   conn_.rlimit.stopw();
   conn_.wlimit.stopw();
 
@@ -336,6 +347,25 @@ int Http2Session::resolve_name() {
   }
 }
 
+void Http2Session::start_happy_eyeballs() {
+  if (!addr_->dns) {
+    return;
+  }
+
+  Address fallback;
+  if (!worker_->get_dns_tracker()->get_fallback(StringRef{addr_->host},
+                                                *raddr_, &fallback)) {
+    return;
+  }
+
+  util::set_port(fallback, addr_->port);
+
+  happy_eyeballs_ = std::make_unique<HappyEyeballs>(
+      &conn_, fallback,
+      [this](const Address &addr) { *resolved_addr_ = addr; });
+  happy_eyeballs_->start();
+}
+
 namespace {
 int htp_hdrs_completecb(llhttp_t *htp);
 } // namespace
@@ -462,7 +492,8 @@ int Http2Session::initiate_connection() {
           SSL_set_tlsext_host_name(conn_.tls.ssl, sni_name.c_str());
         }
 
-        auto tls_session = tls::reuse_tls_session(addr_->tls_session_cache);
+        auto tls_session = tls::reuse_tls_session(addr_->tls_session_cache,
+                                                  ev_now(conn_.loop));
         if (tls_session) {
           SSL_set_session(conn_.tls.ssl, tls_session);
           SSL_SESSION_free(tls_session);
@@ -530,6 +561,8 @@ int Http2Session::initiate_connection() {
 
         ev_io_set(&conn_.rev, conn_.fd, EV_READ);
         ev_io_set(&conn_.wev, conn_.fd, EV_WRITE);
+
+        start_happy_eyeballs();
       }
 
       conn_.prepare_client_handshake();
@@ -594,6 +627,8 @@ int Http2Session::initiate_connection() {
 
         ev_io_set(&conn_.rev, conn_.fd, EV_READ);
         ev_io_set(&conn_.wev, conn_.fd, EV_WRITE);
+
+        start_happy_eyeballs();
       }
     }
 
@@ -1108,6 +1143,23 @@ int on_response_headers(Http2Session *http2session, Downstream *downstream,
       http2session->get_downstream_addr_group());
   downstream->set_addr(http2session->get_addr());
 
+  if (!downstream->get_non_final_response()) {
+    auto addr = http2session->get_addr();
+    auto t = ev_now(http2session->get_loop());
+    auto latency = t - downstream->get_backend_attach_time();
+
+    ++addr->num_responses;
+    load_balancer_observe_latency(addr, t, latency);
+    http2session->get_downstream_addr_group()
+        ->shared_addr->latency_histogram.observe(latency);
+    downstream->update_concurrency_limit(latency);
+    outlier_detector_record(http2session->get_downstream_addr_group().get(),
+                            addr,
+                            status_code >= 500 ? OutlierEvent::SERVER_ERROR
+                                               : OutlierEvent::SUCCESS,
+                            t);
+  }
+
   if (LOG_ENABLED(INFO)) {
     std::stringstream ss;
     for (auto &nv : nva) {
@@ -1302,6 +1354,22 @@ int on_frame_recv_callback(nghttp2_session *session, const nghttp2_frame *frame,
       auto downstream = sd->dconn->get_downstream();
       downstream->set_response_rst_stream_error_code(
           frame->rst_stream.error_code);
+
+      switch (frame->rst_stream.error_code) {
+      case NGHTTP2_NO_ERROR:
+      // The stream is retried in the other connection.
+      case NGHTTP2_REFUSED_STREAM:
+        break;
+      default:
+        if (downstream->get_response_state() !=
+            DownstreamState::MSG_COMPLETE) {
+          outlier_detector_record(
+              http2session->get_downstream_addr_group().get(),
+              http2session->get_addr(), OutlierEvent::RESET,
+              ev_now(http2session->get_loop()));
+        }
+      }
+
       call_downstream_readcb(http2session, downstream);
     }
     return 0;
@@ -1963,11 +2031,20 @@ int Http2Session::connected() {
                       << util::to_numeric_addr(raddr_)
                       << ": errno=" << sock_error;
 
+    if (happy_eyeballs_ && happy_eyeballs_->on_primary_failure() == 0) {
+      // Wait for the connection to another address.
+      return 0;
+    }
+
+    happy_eyeballs_.reset();
+
     downstream_failure(addr_, raddr_);
 
     return -1;
   }
 
+  happy_eyeballs_.reset();
+
   if (LOG_ENABLED(INFO)) {
     SSLOG(INFO, this) << "Connection established";
   }
@@ -2085,6 +2162,14 @@ int Http2Session::tls_handshake() {
     SSLOG(INFO, this) << "SSL/TLS handshake completed";
   }
 
+  auto &metrics = worker_->get_metrics();
+
+  if (SSL_session_reused(conn_.tls.ssl)) {
+    metrics_add(metrics.backend_tls_handshakes_resumed);
+  } else {
+    metrics_add(metrics.backend_tls_handshakes_full);
+  }
+
   if (!get_config()->tls.insecure &&
       tls::check_cert(conn_.tls.ssl, addr_, raddr_) != 0) {
     downstream_failure(addr_, raddr_);
@@ -2295,6 +2380,28 @@ int Http2Session::handle_downstream_push_promise_complete(
 
 size_t Http2Session::get_num_dconns() const { return dconns_.size(); }
 
+size_t Http2Session::get_max_concurrent_streams() const {
+  if (!session_) {
+    return 100;
+  }
+
+  return nghttp2_session_get_remote_settings(
+      session_, NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS);
+}
+
+size_t Http2Session::get_num_inflight_bytes() const {
+  auto n = wb_.rleft();
+
+  if (session_) {
+    auto recvlen = nghttp2_session_get_effective_recv_data_length(session_);
+    if (recvlen > 0) {
+      n += recvlen;
+    }
+  }
+
+  return n;
+}
+
 bool Http2Session::max_concurrency_reached(size_t extra) const {
   if (!session_) {
     return dconns_.size() + extra >= 100;
@@ -52,6 +52,7 @@ class Downstream;
 struct DownstreamAddrGroup;
 struct DownstreamAddr;
 struct DNSQuery;
+class HappyEyeballs;
 
 struct StreamData {
   StreamData *dlnext, *dlprev;
@@ -109,6 +110,9 @@ public:
   int disconnect(bool hard = false);
   int initiate_connection();
   int resolve_name();
+  // Starts racing the connection to another resolved address if the
+  // backend address is resolved by DNS.
+  void start_happy_eyeballs();
 
   void add_downstream_connection(Http2DownstreamConnection *dconn);
   void remove_downstream_connection(Http2DownstreamConnection *dconn);
@@ -204,6 +208,16 @@ public:
   // streams.
   size_t get_num_dconns() const;
 
+  // Returns the max concurrent streams limit advertised by server.
+  // If the connection has not been established yet, this function
+  // returns the default value 100.
+  size_t get_max_concurrent_streams() const;
+
+  // Returns the number of bytes which are buffered to be sent to
+  // backend, and the number of DATA bytes which are received from
+  // backend, but have not been consumed by frontend yet.
+  size_t get_num_inflight_bytes() const;
+
   // Adds to group scope http2_avail_freelist.
   void add_to_avail_freelist();
   // Adds to address scope http2_extra_freelist.
@@ -280,6 +294,10 @@ private:
   // Resolved IP address if dns parameter is used
   std::unique_ptr<Address> resolved_addr_;
   std::unique_ptr<DNSQuery> dns_query_;
+  // Races the connection to another resolved address, preferably of
+  // the other address family, while connecting to the resolved
+  // address.
+  std::unique_ptr<HappyEyeballs> happy_eyeballs_;
   Http2SessionState state_;
   ConnectionCheck connection_check_state_;
   FreelistZone freelist_zone_;
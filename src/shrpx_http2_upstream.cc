@@ -37,6 +37,7 @@
 #include "shrpx_http.h"
 #include "shrpx_worker.h"
 #include "shrpx_http2_session.h"
+#include "shrpx_rewrite.h"
 #include "shrpx_log.h"
 #ifdef HAVE_MRUBY
 #  include "shrpx_mruby.h"
@@ -433,6 +434,14 @@ int Http2Upstream::on_request_headers(Downstream *downstream,
   }
 #endif // HAVE_MRUBY
 
+  if (downstream->get_response_state() != DownstreamState::MSG_COMPLETE &&
+      rewrite_request(downstream) != 0) {
+    if (error_reply(downstream, 500) != 0) {
+      return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+    }
+    return 0;
+  }
+
   if (frame->hd.flags & NGHTTP2_FLAG_END_STREAM) {
     downstream->disable_upstream_rtimer();
 
@@ -465,10 +474,24 @@ void Http2Upstream::initiate_downstream(Downstream *downstream) {
   for (;;) {
     auto dconn = handler_->get_downstream_connection(rv, downstream);
     if (!dconn) {
-      if (rv == SHRPX_ERR_TLS_REQUIRED) {
+      switch (rv) {
+      case SHRPX_ERR_TLS_REQUIRED:
         rv = redirect_to_https(downstream);
-      } else {
+        break;
+      case SHRPX_ERR_QUEUED:
+        // on_downstream_admitted() is called when a slot is
+        // available.
+        return;
+      case SHRPX_ERR_COALESCED:
+        // The response to the identical request is delivered by
+        // SingleFlightCall.
+        return;
+      case SHRPX_ERR_OVERLOADED:
+        rv = error_reply(downstream, 503);
+        break;
+      default:
         rv = error_reply(downstream, 502);
+        break;
       }
       if (rv != 0) {
         rst_stream(downstream, NGHTTP2_INTERNAL_ERROR);
@@ -854,7 +877,17 @@ int send_data_callback(nghttp2_session *session, nghttp2_frame *frame,
     downstream->reset_upstream_wtimer();
   }
 
-  if (length > 0 && downstream->resume_read(SHRPX_NO_BUFFER, length) != 0) {
+  auto consumed = length;
+
+  if (downstream->response_compressed()) {
+    // Compressed body does not correspond to the bytes received from
+    // backend.  Consume them once all compressed data buffered so far
+    // are sent.
+    consumed =
+        body->rleft() == 0 ? downstream->response().unconsumed_body_length : 0;
+  }
+
+  if (length > 0 && downstream->resume_read(SHRPX_NO_BUFFER, consumed) != 0) {
     return NGHTTP2_ERR_CALLBACK_FAILURE;
   }
 
@@ -1014,7 +1047,8 @@ size_t downstream_queue_size(Worker *worker) {
 Http2Upstream::Http2Upstream(ClientHandler *handler)
     : wb_(handler->get_worker()->get_mcpool()),
       downstream_queue_(downstream_queue_size(handler->get_worker()),
-                        !get_config()->http2_proxy),
+                        !get_config()->http2_proxy,
+                        &handler->get_worker()->get_metrics()),
       handler_(handler),
       session_(nullptr),
       max_buffer_size_(MAX_BUFFER_SIZE),
@@ -1653,6 +1687,8 @@ int Http2Upstream::on_downstream_header_complete(Downstream *downstream) {
     }
   }
 
+  downstream->share_response_header();
+
   auto config = get_config();
   auto &httpconf = config->http;
 
@@ -1660,10 +1696,17 @@ int Http2Upstream::on_downstream_header_complete(Downstream *downstream) {
     downstream->rewrite_location_response_header(req.scheme);
   }
 
+  if (!downstream->get_non_final_response()) {
+    rewrite_response(downstream);
+  }
+
 #ifdef HAVE_MRUBY
+  // dconn is nullptr if the response is shared by single-flight
+  // leader.  Per-pattern mruby script is not run in this case.
   if (!downstream->get_non_final_response()) {
     auto dconn = downstream->get_downstream_connection();
-    const auto &group = dconn->get_downstream_addr_group();
+    const auto &group = dconn ? dconn->get_downstream_addr_group()
+                              : std::shared_ptr<DownstreamAddrGroup>();
     if (group) {
       const auto &dmruby_ctx = group->shared_addr->mruby_ctx;
 
@@ -1697,6 +1740,8 @@ int Http2Upstream::on_downstream_header_complete(Downstream *downstream) {
   }
 #endif // HAVE_MRUBY
 
+  downstream->start_response_compression();
+
   auto &http2conf = config->http2;
 
   // We need some conditions that must be fulfilled to initiate server
@@ -1872,8 +1917,28 @@ int Http2Upstream::on_downstream_header_complete(Downstream *downstream) {
 int Http2Upstream::on_downstream_body(Downstream *downstream,
                                       const uint8_t *data, size_t len,
                                       bool flush) {
+  downstream->share_response_body(data, len);
+
   auto body = downstream->get_response_buf();
-  body->append(data, len);
+
+  if (downstream->response_compressed()) {
+    if (downstream->compress_response_body(*body, data, len, false) != 0) {
+      return -1;
+    }
+
+    auto &resp = downstream->response();
+
+    // The compressor may keep the input without producing any
+    // output.  Consume it here because send_data_callback is not
+    // called until there is compressed data to send.
+    if (body->rleft() == 0 && resp.unconsumed_body_length &&
+        downstream->resume_read(SHRPX_NO_BUFFER,
+                                resp.unconsumed_body_length) != 0) {
+      return -1;
+    }
+  } else {
+    body->append(data, len);
+  }
 
   if (flush) {
     nghttp2_session_resume_data(session_, downstream->get_stream_id());
@@ -1891,6 +1956,10 @@ int Http2Upstream::on_downstream_body_complete(Downstream *downstream) {
     DLOG(INFO, downstream) << "HTTP response completed";
   }
 
+  if (downstream->share_response_complete() != 0) {
+    return -1;
+  }
+
   auto &resp = downstream->response();
 
   if (!downstream->validate_response_recv_body_length()) {
@@ -1899,6 +1968,12 @@ int Http2Upstream::on_downstream_body_complete(Downstream *downstream) {
     return 0;
   }
 
+  if (downstream->response_compressed() &&
+      downstream->compress_response_body(*downstream->get_response_buf(),
+                                         nullptr, 0, true) != 0) {
+    return -1;
+  }
+
   nghttp2_session_resume_data(session_, downstream->get_stream_id());
   downstream->ensure_upstream_wtimer();
 
@@ -2041,7 +2116,8 @@ void Http2Upstream::on_handler_delete() {
 int Http2Upstream::on_downstream_reset(Downstream *downstream, bool no_retry) {
   int rv;
 
-  if (downstream->get_dispatch_state() != DispatchState::ACTIVE) {
+  if (downstream->get_dispatch_state() != DispatchState::ACTIVE &&
+      downstream->get_single_flight_role() != SingleFlightRole::FOLLOWER) {
     // This is error condition when we failed push_request_headers()
     // in initiate_downstream().  Otherwise, we have
     // DispatchState::ACTIVE state, or we did not set
@@ -2067,6 +2143,9 @@ int Http2Upstream::on_downstream_reset(Downstream *downstream, bool no_retry) {
     return 0;
   }
 
+  // Retry budget is found via the backend connection.
+  no_retry = no_retry || !downstream->acquire_retry_budget();
+
   downstream->pop_downstream_connection();
 
   downstream->add_retry();
@@ -2117,6 +2196,14 @@ fail:
   return 0;
 }
 
+int Http2Upstream::on_downstream_admitted(Downstream *downstream) {
+  initiate_downstream(downstream);
+
+  handler_->signal_write();
+
+  return 0;
+}
+
 int Http2Upstream::prepare_push_promise(Downstream *downstream) {
   int rv;
 
@@ -81,6 +81,7 @@ public:
 
   virtual void on_handler_delete();
   virtual int on_downstream_reset(Downstream *downstream, bool no_retry);
+  virtual int on_downstream_admitted(Downstream *downstream);
   virtual int send_reply(Downstream *downstream, const uint8_t *body,
                          size_t bodylen);
   virtual int initiate_push(Downstream *downstream, const StringRef &uri);
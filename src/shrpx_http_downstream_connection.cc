@@ -24,6 +24,12 @@
  */
 #include "shrpx_http_downstream_connection.h"
 
+#ifdef HAVE_SYS_SOCKET_H
+#  include <sys/socket.h>
+#endif // HAVE_SYS_SOCKET_H
+
+#include <cerrno>
+
 #include "shrpx_client_handler.h"
 #include "shrpx_upstream.h"
 #include "shrpx_downstream.h"
@@ -32,10 +38,14 @@
 #include "shrpx_http.h"
 #include "shrpx_log_config.h"
 #include "shrpx_connect_blocker.h"
+#include "shrpx_load_balancer.h"
+#include "shrpx_outlier_detector.h"
 #include "shrpx_downstream_connection_pool.h"
 #include "shrpx_worker.h"
 #include "shrpx_http2_session.h"
 #include "shrpx_tls.h"
+#include "shrpx_happy_eyeballs.h"
+#include "shrpx_pipelined_downstream_connection.h"
 #include "shrpx_log.h"
 #include "http2.h"
 #include "util.h"
@@ -45,6 +55,15 @@ using namespace nghttp2;
 
 namespace shrpx {
 
+namespace {
+// Returns true if |dconn| carries the hedged request of |downstream|.
+// Such connection is invisible to upstream, and its failure just
+// cancels the hedged request.
+bool is_hedge(Downstream *downstream, HttpDownstreamConnection *dconn) {
+  return downstream->get_hedge_downstream_connection() == dconn;
+}
+} // namespace
+
 namespace {
 void timeoutcb(struct ev_loop *loop, ev_timer *w, int revents) {
   auto conn = static_cast<Connection *>(w->data);
@@ -59,6 +78,12 @@ void timeoutcb(struct ev_loop *loop, ev_timer *w, int revents) {
   }
 
   auto downstream = dconn->get_downstream();
+
+  if (is_hedge(downstream, dconn)) {
+    // This deletes dconn.
+    downstream->cancel_hedge();
+    return;
+  }
   auto upstream = downstream->get_upstream();
   auto handler = upstream->get_client_handler();
   auto &resp = downstream->response();
@@ -66,6 +91,10 @@ void timeoutcb(struct ev_loop *loop, ev_timer *w, int revents) {
   // Do this so that dconn is not pooled
   resp.connection_close = true;
 
+  outlier_detector_record(dconn->get_downstream_addr_group().get(),
+                          dconn->get_addr(), OutlierEvent::TIMEOUT,
+                          ev_now(loop));
+
   if (upstream->downstream_error(dconn, Downstream::EVENT_TIMEOUT) != 0) {
     delete handler;
   }
@@ -82,7 +111,7 @@ void retry_downstream_connection(Downstream *downstream,
 
   downstream->add_retry();
 
-  if (downstream->no_more_retry()) {
+  if (downstream->no_more_retry() || !downstream->acquire_retry_budget()) {
     delete handler;
     return;
   }
@@ -134,6 +163,11 @@ void connect_timeoutcb(struct ev_loop *loop, ev_timer *w, int revents) {
 
   auto downstream = dconn->get_downstream();
 
+  if (is_hedge(downstream, dconn)) {
+    downstream->cancel_hedge();
+    return;
+  }
+
   retry_downstream_connection(downstream, 504);
 }
 } // namespace
@@ -153,6 +187,20 @@ void readcb(struct ev_loop *loop, ev_io *w, int revents) {
   auto upstream = downstream->get_upstream();
   auto handler = upstream->get_client_handler();
 
+  if (is_hedge(downstream, dconn)) {
+    switch (dconn->hedge_read()) {
+    case 0:
+      return;
+    case 1:
+      // dconn becomes the backend connection of downstream.
+      downstream->resolve_hedge(dconn);
+      break;
+    default:
+      downstream->cancel_hedge();
+      return;
+    }
+  }
+
   rv = upstream->downstream_read(dconn);
   if (rv != 0) {
     if (rv == SHRPX_ERR_RETRY) {
@@ -174,6 +222,13 @@ void writecb(struct ev_loop *loop, ev_io *w, int revents) {
   auto upstream = downstream->get_upstream();
   auto handler = upstream->get_client_handler();
 
+  if (is_hedge(downstream, dconn)) {
+    if (dconn->on_write() != 0) {
+      downstream->cancel_hedge();
+    }
+    return;
+  }
+
   rv = upstream->downstream_write(dconn);
   if (rv == SHRPX_ERR_RETRY) {
     backend_retry(downstream);
@@ -192,6 +247,10 @@ void connectcb(struct ev_loop *loop, ev_io *w, int revents) {
   auto dconn = static_cast<HttpDownstreamConnection *>(conn->data);
   auto downstream = dconn->get_downstream();
   if (dconn->connected() != 0) {
+    if (is_hedge(downstream, dconn)) {
+      downstream->cancel_hedge();
+      return;
+    }
     backend_retry(downstream);
     return;
   }
@@ -202,7 +261,9 @@ void connectcb(struct ev_loop *loop, ev_io *w, int revents) {
 HttpDownstreamConnection::HttpDownstreamConnection(
     const std::shared_ptr<DownstreamAddrGroup> &group, DownstreamAddr *addr,
     struct ev_loop *loop, Worker *worker)
-    : conn_(loop, -1, nullptr, worker->get_mcpool(),
+    : dlnext(nullptr),
+      dlprev(nullptr),
+      conn_(loop, -1, nullptr, worker->get_mcpool(),
             group->shared_addr->timeout.write, group->shared_addr->timeout.read,
             {}, {}, connectcb, readcb, connect_timeoutcb, this,
             get_config()->tls.dyn_rec.warmup_threshold,
@@ -219,7 +280,12 @@ HttpDownstreamConnection::HttpDownstreamConnection(
       response_htp_{0},
       first_write_done_(false),
       reusable_(true),
-      request_header_written_(false) {}
+      request_header_written_(false),
+      splice_(false),
+      in_pipeline_freelist_(false),
+      retry_on_close_(false) {
+  conn_.tls_dyn_rec_adaptive = get_config()->tls.dyn_rec.adaptive;
+}
 
 HttpDownstreamConnection::~HttpDownstreamConnection() {
   if (LOG_ENABLED(INFO)) {
@@ -230,6 +296,12 @@ HttpDownstreamConnection::~HttpDownstreamConnection() {
     auto dns_tracker = worker_->get_dns_tracker();
     dns_tracker->cancel(dns_query_.get());
   }
+
+  if (in_pipeline_freelist_) {
+    addr_->http1_pipeline_freelist.remove(this);
+  }
+
+  fail_pipeline();
 }
 
 int HttpDownstreamConnection::attach_downstream(Downstream *downstream) {
@@ -323,6 +395,10 @@ int HttpDownstreamConnection::initiate_connection() {
               if (rv != 0) {
                 // This callback destroys |this|.
                 auto downstream = this->downstream_;
+                if (is_hedge(downstream, this)) {
+                  downstream->cancel_hedge();
+                  return;
+                }
                 backend_retry(downstream);
               }
             });
@@ -395,6 +471,18 @@ int HttpDownstreamConnection::initiate_connection() {
 
     raddr_ = raddr;
 
+    if (addr_->dns) {
+      Address fallback;
+      if (worker_->get_dns_tracker()->get_fallback(StringRef{addr_->host},
+                                                   *raddr, &fallback)) {
+        util::set_port(fallback, addr_->port);
+        happy_eyeballs_ = std::make_unique<HappyEyeballs>(
+            &conn_, fallback,
+            [this](const Address &addr) { *resolved_addr_ = addr; });
+        happy_eyeballs_->start();
+      }
+    }
+
     if (addr_->tls) {
       assert(ssl_ctx_);
 
@@ -414,7 +502,8 @@ int HttpDownstreamConnection::initiate_connection() {
         SSL_set_tlsext_host_name(conn_.tls.ssl, sni_name.c_str());
       }
 
-      auto session = tls::reuse_tls_session(addr_->tls_session_cache);
+      auto session = tls::reuse_tls_session(addr_->tls_session_cache,
+                                            ev_now(conn_.loop));
       if (session) {
         SSL_set_session(conn_.tls.ssl, session);
         SSL_SESSION_free(session);
@@ -445,6 +534,11 @@ int HttpDownstreamConnection::initiate_connection() {
     on_write_ = &HttpDownstreamConnection::write_first;
     first_write_done_ = false;
     request_header_written_ = false;
+    // Backend may close a reused connection at any time.  With
+    // pipelining, this happens often because the connection is reused
+    // right after the response which the backend closes after.
+    retry_on_close_ =
+        addr_->pipeline_depth > 1 && downstream_->request_pipelinable();
   }
 
   llhttp_init(&response_htp_, HTTP_RESPONSE, &htp_hooks);
@@ -453,24 +547,17 @@ int HttpDownstreamConnection::initiate_connection() {
   return 0;
 }
 
-int HttpDownstreamConnection::push_request_headers() {
-  if (request_header_written_) {
-    signal_write();
-    return 0;
-  }
-
+void HttpDownstreamConnection::write_request_headers(Downstream *downstream) {
   const auto &downstream_hostport = addr_->hostport;
-  const auto &req = downstream_->request();
+  const auto &req = downstream->request();
 
-  auto &balloc = downstream_->get_block_allocator();
+  auto &balloc = downstream->get_block_allocator();
 
   auto connect_method = req.regular_connect_method();
 
   auto config = get_config();
   auto &httpconf = config->http;
 
-  request_header_written_ = true;
-
   // For HTTP/1.0 request, there is no authority in request.  In that
   // case, we use backend server's host nonetheless.
   auto authority = StringRef(downstream_hostport);
@@ -481,9 +568,9 @@ int HttpDownstreamConnection::push_request_headers() {
     authority = req.authority;
   }
 
-  downstream_->set_request_downstream_host(authority);
+  downstream->set_request_downstream_host(authority);
 
-  auto buf = downstream_->get_request_buf();
+  auto buf = downstream->get_request_buf();
 
   // Assume that method and request path do not contain \r\n.
   auto meth = http2::to_method_string(
@@ -525,7 +612,7 @@ int HttpDownstreamConnection::push_request_headers() {
 
   http2::build_http1_headers_from_headers(buf, req.fs.headers(), build_flags);
 
-  auto cookie = downstream_->assemble_request_cookie();
+  auto cookie = downstream->assemble_request_cookie();
   if (!cookie.empty()) {
     buf->append("Cookie: ");
     buf->append(cookie);
@@ -536,7 +623,7 @@ int HttpDownstreamConnection::push_request_headers() {
   // request body is expected.
   if (req.method != HTTP_CONNECT && req.http2_expect_body &&
       req.fs.content_length == -1) {
-    downstream_->set_chunked_request(true);
+    downstream->set_chunked_request(true);
     buf->append("Transfer-Encoding: chunked\r\n");
   }
 
@@ -549,7 +636,7 @@ int HttpDownstreamConnection::push_request_headers() {
       auto p = base64::encode(std::begin(nonce), std::end(nonce), iov.base);
       *p = '\0';
       auto key = StringRef{iov.base, p};
-      downstream_->set_ws_key(key);
+      downstream->set_ws_key(key);
 
       buf->append("Sec-Websocket-Key: ");
       buf->append(key);
@@ -575,7 +662,7 @@ int HttpDownstreamConnection::push_request_headers() {
     buf->append("Connection: close\r\n");
   }
 
-  auto upstream = downstream_->get_upstream();
+  auto upstream = downstream->get_upstream();
   auto handler = upstream->get_client_handler();
 
 #if OPENSSL_1_1_1_API
@@ -627,7 +714,7 @@ int HttpDownstreamConnection::push_request_headers() {
       buf->append((*xff).value);
       buf->append(", ");
     }
-    buf->append(client_handler_->get_ipaddr());
+    buf->append(handler->get_ipaddr());
     buf->append("\r\n");
   } else if (xff) {
     buf->append("X-Forwarded-For: ");
@@ -692,9 +779,22 @@ int HttpDownstreamConnection::push_request_headers() {
       nhdrs = http::colorizeHeaders(nhdrs.c_str());
     }
     DCLOG(INFO, this) << "HTTP request headers. stream_id="
-                      << downstream_->get_stream_id() << "\n"
+                      << downstream->get_stream_id() << "\n"
                       << nhdrs;
   }
+}
+
+int HttpDownstreamConnection::push_request_headers() {
+  if (request_header_written_) {
+    signal_write();
+    return 0;
+  }
+
+  const auto &req = downstream_->request();
+
+  request_header_written_ = true;
+
+  write_request_headers(downstream_);
 
   // Don't call signal_write() if we anticipate request body.  We call
   // signal_write() when we received request body chunk, and it
@@ -816,6 +916,12 @@ namespace {
 void idle_readcb(struct ev_loop *loop, ev_io *w, int revents) {
   auto conn = static_cast<Connection *>(w->data);
   auto dconn = static_cast<HttpDownstreamConnection *>(conn->data);
+
+  // TLSv1.3 server may send NewSessionTicket after handshake.
+  if (dconn->idle_read() == 0) {
+    return;
+  }
+
   if (LOG_ENABLED(INFO)) {
     DCLOG(INFO, dconn) << "Idle connection EOF";
   }
@@ -834,6 +940,14 @@ void idle_timeoutcb(struct ev_loop *loop, ev_timer *w, int revents) {
     return;
   }
 
+  auto &dconn_pool = dconn->get_addr()->dconn_pool;
+
+  // Keep the connections which the pool should have in advance.
+  if (dconn_pool->size() <= dconn_pool->get_min_idle()) {
+    conn->again_rt();
+    return;
+  }
+
   if (LOG_ENABLED(INFO)) {
     DCLOG(INFO, dconn) << "Idle connection timeout";
   }
@@ -843,12 +957,173 @@ void idle_timeoutcb(struct ev_loop *loop, ev_timer *w, int revents) {
 }
 } // namespace
 
+namespace {
+void remove_warming_from_pool(HttpDownstreamConnection *dconn) {
+  auto addr = dconn->get_addr();
+  auto &dconn_pool = addr->dconn_pool;
+  dconn_pool->remove_warming_connection(dconn);
+}
+} // namespace
+
+namespace {
+void warm_timeoutcb(struct ev_loop *loop, ev_timer *w, int revents) {
+  auto conn = static_cast<Connection *>(w->data);
+  auto dconn = static_cast<HttpDownstreamConnection *>(conn->data);
+
+  if (w == &conn->rt && !conn->expired_rt()) {
+    return;
+  }
+
+  auto raddr = dconn->get_raddr();
+
+  DCLOG(WARN, dconn) << "Pre-connect time out; addr="
+                     << util::to_numeric_addr(raddr);
+
+  downstream_failure(dconn->get_addr(), raddr);
+
+  remove_warming_from_pool(dconn);
+  // dconn was deleted
+}
+} // namespace
+
+namespace {
+void warm_handshakecb(struct ev_loop *loop, ev_io *w, int revents) {
+  auto conn = static_cast<Connection *>(w->data);
+  auto dconn = static_cast<HttpDownstreamConnection *>(conn->data);
+
+  // Both on_read() and on_write() perform TLS handshake here.  When
+  // it completes, dconn is moved to the pool.
+  if (dconn->on_write() != 0) {
+    remove_warming_from_pool(dconn);
+    // dconn was deleted
+  }
+}
+} // namespace
+
+namespace {
+void warm_connectcb(struct ev_loop *loop, ev_io *w, int revents) {
+  auto conn = static_cast<Connection *>(w->data);
+  auto dconn = static_cast<HttpDownstreamConnection *>(conn->data);
+
+  if (dconn->connected() != 0) {
+    remove_warming_from_pool(dconn);
+    // dconn was deleted
+    return;
+  }
+
+  if (!conn->tls.ssl) {
+    dconn->on_warmed();
+    return;
+  }
+
+  ev_set_cb(&conn->rev, warm_handshakecb);
+  ev_set_cb(&conn->wev, warm_handshakecb);
+
+  warm_handshakecb(loop, w, revents);
+}
+} // namespace
+
+int HttpDownstreamConnection::preconnect() {
+  // DNS query needs Downstream to continue connecting.
+  assert(!addr_->dns);
+
+  if (initiate_connection() != 0) {
+    return -1;
+  }
+
+  ev_set_cb(&conn_.wev, warm_connectcb);
+  ev_set_cb(&conn_.rt, warm_timeoutcb);
+  ev_set_cb(&conn_.wt, warm_timeoutcb);
+
+  return 0;
+}
+
+void HttpDownstreamConnection::on_warmed() {
+  if (LOG_ENABLED(INFO)) {
+    DCLOG(INFO, this) << "Pre-connected to backend";
+  }
+
+  ev_set_cb(&conn_.wev, writecb);
+
+  detach_downstream(nullptr);
+
+  addr_->dconn_pool->on_warmed(this);
+}
+
+int HttpDownstreamConnection::idle_read() {
+  std::array<uint8_t, 16_k> buf;
+
+  auto nread = conn_.tls.ssl ? conn_.read_tls(buf.data(), buf.size())
+                             : conn_.read_clear(buf.data(), buf.size());
+
+  // Server must not send anything without request.
+  if (nread != 0) {
+    return -1;
+  }
+
+  return 0;
+}
+
+int HttpDownstreamConnection::hedge_read() {
+  if (conn_.tls.ssl) {
+    if (!SSL_is_init_finished(conn_.tls.ssl)) {
+      return on_read() == 0 ? 0 : -1;
+    }
+
+    ERR_clear_error();
+
+    // Look ahead so that post-handshake messages are not mistaken
+    // for response.
+    uint8_t b;
+    auto rv = SSL_peek(conn_.tls.ssl, &b, 1);
+    if (rv > 0) {
+      return 1;
+    }
+
+    switch (SSL_get_error(conn_.tls.ssl, rv)) {
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+      return 0;
+    default:
+      return -1;
+    }
+  }
+
+  uint8_t b;
+  ssize_t nread;
+  while ((nread = recv(conn_.fd, &b, 1, MSG_PEEK)) == -1 && errno == EINTR)
+    ;
+
+  if (nread > 0) {
+    return 1;
+  }
+
+  if (nread == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    return 0;
+  }
+
+  return -1;
+}
+
 void HttpDownstreamConnection::detach_downstream(Downstream *downstream) {
   if (LOG_ENABLED(INFO)) {
     DCLOG(INFO, this) << "Detaching from DOWNSTREAM:" << downstream;
   }
   downstream_ = nullptr;
 
+  if (!pipeline_.empty()) {
+    promote_pipelined_request();
+    return;
+  }
+
+  if (!pipeline_input_.empty()) {
+    // The response to the pipelined request which was canceled.
+    pipeline_input_.clear();
+    reusable_ = false;
+  }
+
+  update_pipeline_freelist();
+
   ev_set_cb(&conn_.rev, idle_readcb);
   ioctrl_.force_resume_read();
 
@@ -866,6 +1141,159 @@ void HttpDownstreamConnection::detach_downstream(Downstream *downstream) {
   ev_timer_stop(conn_.loop, &conn_.wt);
 }
 
+void HttpDownstreamConnection::promote_pipelined_request() {
+  auto dconn = pipeline_.head;
+  pipeline_.remove(dconn);
+  dconn->on_carrier_detached(false);
+
+  downstream_ = dconn->get_downstream();
+  client_handler_ = downstream_->get_upstream()->get_client_handler();
+
+  if (LOG_ENABLED(INFO)) {
+    DCLOG(INFO, this) << "Carry pipelined DOWNSTREAM:" << downstream_;
+  }
+
+  // The request header fields have been written to the request buffer
+  // of downstream_.
+  request_header_written_ = true;
+  retry_on_close_ = true;
+
+  llhttp_init(&response_htp_, HTTP_RESPONSE, &htp_hooks);
+  response_htp_.data = downstream_;
+
+  // The response might have been received already.
+  ioctrl_.force_resume_read();
+  ev_feed_event(conn_.loop, &conn_.rev, EV_READ);
+
+  if (downstream_->get_request_buf()->rleft()) {
+    signal_write();
+  }
+
+  update_pipeline_freelist();
+}
+
+void HttpDownstreamConnection::add_pipelined_request(
+    PipelinedDownstreamConnection *dconn) {
+  if (LOG_ENABLED(INFO)) {
+    DCLOG(INFO, this) << "Pipeline request of DOWNSTREAM:"
+                      << dconn->get_downstream();
+  }
+
+  pipeline_.append(dconn);
+
+  update_pipeline_freelist();
+}
+
+void HttpDownstreamConnection::remove_pipelined_request(
+    PipelinedDownstreamConnection *dconn) {
+  if (dconn->get_write_started()) {
+    // The response to the request is going to arrive before the
+    // responses to the requests after it.  This connection cannot
+    // deliver them, and is closed after the requests before it are
+    // done.
+    for (auto p = dconn->dlnext; p;) {
+      auto next = p->dlnext;
+      pipeline_.remove(p);
+      p->on_carrier_detached(true);
+      p = next;
+    }
+
+    reusable_ = false;
+  }
+
+  pipeline_.remove(dconn);
+
+  update_pipeline_freelist();
+}
+
+int HttpDownstreamConnection::push_pipelined_request_headers(
+    Downstream *downstream) {
+  write_request_headers(downstream);
+
+  signal_write();
+
+  return 0;
+}
+
+DefaultMemchunks *HttpDownstreamConnection::get_request_output() {
+  auto buf = downstream_->get_request_buf();
+  if (buf->rleft()) {
+    return buf;
+  }
+
+  for (auto dconn = pipeline_.head; dconn; dconn = dconn->dlnext) {
+    auto downstream = dconn->get_downstream();
+    if (downstream->get_request_header_sent()) {
+      continue;
+    }
+
+    auto output = downstream->get_request_buf();
+    if (output->rleft()) {
+      dconn->set_write_started();
+      return output;
+    }
+
+    if (!dconn->get_write_started()) {
+      // Request header fields have not been pushed yet.
+      return output;
+    }
+
+    downstream->set_request_header_sent(true);
+  }
+
+  return buf;
+}
+
+int HttpDownstreamConnection::process_pipeline_input() {
+  auto input = std::move(pipeline_input_);
+  pipeline_input_.clear();
+
+  // The input might contain the next response after the current one.
+  auto rv = process_input(input.data(), input.size());
+  if (rv != 0) {
+    return rv;
+  }
+
+  if (!pipeline_input_.empty() || !ev_is_active(&conn_.rev)) {
+    return 0;
+  }
+
+  return on_read_(*this);
+}
+
+void HttpDownstreamConnection::fail_pipeline() {
+  for (auto dconn = pipeline_.head; dconn;) {
+    auto next = dconn->dlnext;
+    pipeline_.remove(dconn);
+    dconn->on_carrier_detached(true);
+    dconn = next;
+  }
+}
+
+void HttpDownstreamConnection::update_pipeline_freelist() {
+  auto available =
+      addr_->pipeline_depth > 1 && downstream_ && reusable_ &&
+      !group_->retired && first_write_done_ &&
+      downstream_->get_request_header_sent() &&
+      downstream_->request_pipelinable() &&
+      !downstream_->response().connection_close &&
+      pipeline_.size() + 1 < addr_->pipeline_depth;
+
+  if (available == in_pipeline_freelist_) {
+    return;
+  }
+
+  auto &freelist = addr_->http1_pipeline_freelist;
+
+  if (available) {
+    freelist.append(this);
+  } else {
+    freelist.remove(this);
+  }
+
+  in_pipeline_freelist_ = available;
+}
+
 void HttpDownstreamConnection::pause_read(IOCtrlReason reason) {
   ioctrl_.pause_read(reason);
 }
@@ -926,6 +1354,23 @@ int htp_hdrs_completecb(llhttp_t *htp) {
   downstream->set_downstream_addr_group(dconn->get_downstream_addr_group());
   downstream->set_addr(dconn->get_addr());
 
+  if (!downstream->get_non_final_response()) {
+    auto addr = dconn->get_addr();
+    auto t = ev_now(handler->get_loop());
+    auto latency = t - downstream->get_backend_attach_time();
+
+    ++addr->num_responses;
+    load_balancer_observe_latency(addr, t, latency);
+    dconn->get_downstream_addr_group()->shared_addr->latency_histogram.observe(
+        latency);
+    downstream->update_concurrency_limit(latency);
+    outlier_detector_record(dconn->get_downstream_addr_group().get(), addr,
+                            resp.http_status >= 500
+                                ? OutlierEvent::SERVER_ERROR
+                                : OutlierEvent::SUCCESS,
+                            t);
+  }
+
   // Server MUST NOT send Transfer-Encoding with a status code 1xx or
   // 204.  Also server MUST NOT send Transfer-Encoding with a status
   // code 2xx to a CONNECT request.  Same holds true with
@@ -1154,7 +1599,14 @@ int htp_msg_completecb(llhttp_t *htp) {
   // server. This callback is not called if the connection is
   // tunneled.
   downstream->pause_read(SHRPX_MSG_BLOCK);
-  return downstream->get_upstream()->on_downstream_body_complete(downstream);
+  if (downstream->get_upstream()->on_downstream_body_complete(downstream) !=
+      0) {
+    return -1;
+  }
+
+  // Stop parsing here.  The data after this response, if any, is the
+  // response to the pipelined request.
+  return HPE_PAUSED;
 }
 } // namespace
 
@@ -1198,6 +1650,8 @@ int HttpDownstreamConnection::write_first() {
                           req.unconsumed_body_length);
   }
 
+  update_pipeline_freelist();
+
   return 0;
 }
 
@@ -1225,6 +1679,51 @@ int HttpDownstreamConnection::read_clear() {
     if (!ev_is_active(&conn_.rev)) {
       return 0;
     }
+
+    if (splice_) {
+      return read_splice();
+    }
+  }
+}
+
+int HttpDownstreamConnection::read_splice() {
+  conn_.last_read = ev_now(conn_.loop);
+
+  auto upstream = downstream_->get_upstream();
+  auto &resp = downstream_->response();
+
+  for (;;) {
+    auto nread = upstream->on_downstream_body_splice(
+        downstream_, conn_, resp.fs.content_length - resp.recv_body_length);
+    if (nread < 0) {
+      return nread;
+    }
+
+    if (nread == 0) {
+      if (!upstream->response_empty()) {
+        // The pipe might be full.  Resume reading after upstream
+        // drains it.
+        downstream_->pause_read(SHRPX_NO_BUFFER);
+      }
+
+      return 0;
+    }
+
+    resp.recv_body_length += nread;
+
+    if (resp.recv_body_length < resp.fs.content_length) {
+      continue;
+    }
+
+    splice_ = false;
+    on_read_ = &HttpDownstreamConnection::read_clear;
+
+    // Same as htp_msg_completecb.  response_htp_ is initialized
+    // again when the next request is attached.
+    downstream_->set_response_state(DownstreamState::MSG_COMPLETE);
+    downstream_->pause_read(SHRPX_MSG_BLOCK);
+
+    return upstream->on_downstream_body_complete(downstream_);
   }
 }
 
@@ -1232,11 +1731,15 @@ int HttpDownstreamConnection::write_clear() {
   conn_.last_read = ev_now(conn_.loop);
 
   auto upstream = downstream_->get_upstream();
-  auto input = downstream_->get_request_buf();
 
   std::array<struct iovec, MAX_WR_IOVCNT> iov;
 
-  while (input->rleft() > 0) {
+  for (;;) {
+    auto input = get_request_output();
+    if (input->rleft() == 0) {
+      break;
+    }
+
     auto iovcnt = input->riovec(iov.data(), iov.size());
 
     auto nwrite = conn_.writev_clear(iov.data(), iovcnt);
@@ -1255,6 +1758,8 @@ int HttpDownstreamConnection::write_clear() {
       ev_feed_event(conn_.loop, &conn_.rev, EV_READ);
       on_write_ = &HttpDownstreamConnection::noop;
       reusable_ = false;
+      fail_pipeline();
+      update_pipeline_freelist();
       break;
     }
 
@@ -1264,7 +1769,7 @@ int HttpDownstreamConnection::write_clear() {
   conn_.wlimit.stopw();
   ev_timer_stop(conn_.loop, &conn_.wt);
 
-  if (input->rleft() == 0) {
+  if (downstream_->get_request_buf()->rleft() == 0) {
     auto &req = downstream_->request();
 
     upstream->resume_read(SHRPX_NO_BUFFER, downstream_,
@@ -1294,6 +1799,14 @@ int HttpDownstreamConnection::tls_handshake() {
     DCLOG(INFO, this) << "SSL/TLS handshake completed";
   }
 
+  auto &metrics = worker_->get_metrics();
+
+  if (SSL_session_reused(conn_.tls.ssl)) {
+    metrics_add(metrics.backend_tls_handshakes_resumed);
+  } else {
+    metrics_add(metrics.backend_tls_handshakes_full);
+  }
+
   if (!get_config()->tls.insecure &&
       tls::check_cert(conn_.tls.ssl, addr_, raddr_) != 0) {
     downstream_failure(addr_, raddr_);
@@ -1315,6 +1828,12 @@ int HttpDownstreamConnection::tls_handshake() {
 
   // TODO Check negotiated ALPN
 
+  if (!downstream_) {
+    // This connection was made by preconnect().
+    on_warmed();
+    return 0;
+  }
+
   return on_write();
 }
 
@@ -1353,11 +1872,15 @@ int HttpDownstreamConnection::write_tls() {
   ERR_clear_error();
 
   auto upstream = downstream_->get_upstream();
-  auto input = downstream_->get_request_buf();
 
   struct iovec iov;
 
-  while (input->rleft() > 0) {
+  for (;;) {
+    auto input = get_request_output();
+    if (input->rleft() == 0) {
+      break;
+    }
+
     auto iovcnt = input->riovec(&iov, 1);
     if (iovcnt != 1) {
       assert(0);
@@ -1379,6 +1902,8 @@ int HttpDownstreamConnection::write_tls() {
       ev_feed_event(conn_.loop, &conn_.rev, EV_READ);
       on_write_ = &HttpDownstreamConnection::noop;
       reusable_ = false;
+      fail_pipeline();
+      update_pipeline_freelist();
       break;
     }
 
@@ -1388,7 +1913,7 @@ int HttpDownstreamConnection::write_tls() {
   conn_.wlimit.stopw();
   ev_timer_stop(conn_.loop, &conn_.wt);
 
-  if (input->rleft() == 0) {
+  if (downstream_->get_request_buf()->rleft() == 0) {
     auto &req = downstream_->request();
 
     upstream->resume_read(SHRPX_NO_BUFFER, downstream_,
@@ -1402,6 +1927,11 @@ int HttpDownstreamConnection::process_input(const uint8_t *data,
                                             size_t datalen) {
   int rv;
 
+  if (downstream_->hedge_pending()) {
+    // Response has arrived before the hedged one.
+    downstream_->resolve_hedge(this);
+  }
+
   if (downstream_->get_upgraded()) {
     // For upgraded connection, just pass data to the upstream.
     rv = downstream_->get_upstream()->on_downstream_body(downstream_, data,
@@ -1427,6 +1957,28 @@ int HttpDownstreamConnection::process_input(const uint8_t *data,
                                     llhttp_get_error_pos(&response_htp_)) -
                                 data);
 
+  if (htperr == HPE_PAUSED &&
+      downstream_->get_response_state() == DownstreamState::MSG_COMPLETE) {
+    if (nproc == datalen) {
+      return 0;
+    }
+
+    if (pipeline_.empty()) {
+      if (LOG_ENABLED(INFO)) {
+        DCLOG(INFO, this) << "Unexpected data after response";
+      }
+
+      return SHRPX_ERR_DCONN_CANCELED;
+    }
+
+    // The response to the pipelined request.  It is processed after
+    // the request becomes current.
+    pipeline_input_.insert(std::end(pipeline_input_), data + nproc,
+                           data + datalen);
+
+    return 0;
+  }
+
   if (htperr != HPE_OK &&
       (!downstream_->get_upgraded() || htperr != HPE_PAUSED_UPGRADE)) {
     // Handling early return (in other words, response was hijacked by
@@ -1461,6 +2013,16 @@ int HttpDownstreamConnection::process_input(const uint8_t *data,
     return 0;
   }
 
+  if (downstream_->get_response_state() == DownstreamState::HEADER_COMPLETE &&
+      start_splice()) {
+    if (LOG_ENABLED(INFO)) {
+      DCLOG(INFO, this) << "Splice the rest of response body";
+    }
+
+    splice_ = true;
+    on_read_ = &HttpDownstreamConnection::read_splice;
+  }
+
   if (downstream_->response_buf_full()) {
     downstream_->pause_read(SHRPX_NO_BUFFER);
     return 0;
@@ -1469,6 +2031,24 @@ int HttpDownstreamConnection::process_input(const uint8_t *data,
   return 0;
 }
 
+bool HttpDownstreamConnection::start_splice() {
+  if (conn_.tls.ssl || !get_config()->http.http1_splice ||
+      downstream_->get_upgraded() || downstream_->response_body_shared() ||
+      downstream_->response_compressed()) {
+    return false;
+  }
+
+  auto &resp = downstream_->response();
+
+  if (resp.fs.content_length <= 0 ||
+      resp.recv_body_length >= resp.fs.content_length) {
+    return false;
+  }
+
+  return downstream_->get_upstream()->start_downstream_body_splice(
+      downstream_);
+}
+
 int HttpDownstreamConnection::connected() {
   auto &connect_blocker = addr_->connect_blocker;
 
@@ -1480,11 +2060,20 @@ int HttpDownstreamConnection::connected() {
                       << util::to_numeric_addr(raddr_)
                       << ": errno=" << sock_error;
 
+    if (happy_eyeballs_ && happy_eyeballs_->on_primary_failure() == 0) {
+      // Wait for the connection to another address.
+      return 0;
+    }
+
+    happy_eyeballs_.reset();
+
     downstream_failure(addr_, raddr_);
 
     return -1;
   }
 
+  happy_eyeballs_.reset();
+
   if (LOG_ENABLED(INFO)) {
     DCLOG(INFO, this) << "Connected to downstream host";
   }
@@ -1518,7 +2107,40 @@ int HttpDownstreamConnection::connected() {
   return 0;
 }
 
-int HttpDownstreamConnection::on_read() { return on_read_(*this); }
+int HttpDownstreamConnection::on_read() {
+  auto rv =
+      pipeline_input_.empty() ? on_read_(*this) : process_pipeline_input();
+
+  if ((rv == SHRPX_ERR_EOF || rv == SHRPX_ERR_NETWORK) && retry_on_close_ &&
+      downstream_->get_response_state() == DownstreamState::INITIAL) {
+    // Backend closed the connection before responding to the
+    // pipelined request or the request sent over a reused connection.
+    // The connection might be reset because the request was left
+    // unread.  The request is idempotent, and retried as if it was not
+    // sent.
+    downstream_->set_request_header_sent(false);
+    return SHRPX_ERR_EOF;
+  }
+
+  switch (rv) {
+  case SHRPX_ERR_EOF:
+    // EOF before the request is sent is the race with backend closing
+    // idle connection, and the request is retried.
+    if (!downstream_->get_request_header_sent() ||
+        downstream_->get_response_state() != DownstreamState::INITIAL) {
+      break;
+    }
+    // fall through
+  case SHRPX_ERR_NETWORK:
+    if (downstream_->get_response_state() != DownstreamState::MSG_COMPLETE) {
+      outlier_detector_record(group_.get(), addr_, OutlierEvent::RESET,
+                              ev_now(conn_.loop));
+    }
+    break;
+  }
+
+  return rv;
+}
 
 int HttpDownstreamConnection::on_write() { return on_write_(*this); }
 
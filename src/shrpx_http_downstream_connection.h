@@ -27,11 +27,14 @@
 
 #include "shrpx.h"
 
+#include <vector>
+
 #include "llhttp.h"
 
 #include "shrpx_downstream_connection.h"
 #include "shrpx_io_control.h"
 #include "shrpx_connection.h"
+#include "template.h"
 
 namespace shrpx {
 
@@ -40,6 +43,8 @@ class Worker;
 struct DownstreamAddrGroup;
 struct DownstreamAddr;
 struct DNSQuery;
+class HappyEyeballs;
+class PipelinedDownstreamConnection;
 
 class HttpDownstreamConnection : public DownstreamConnection {
 public:
@@ -71,14 +76,32 @@ public:
   virtual DownstreamAddr *get_addr() const;
 
   int initiate_connection();
+  // Starts connecting to the backend without request.  The connection
+  // is added to the connection pool of the address when it is
+  // established.  This function returns 0 if it succeeds, or -1.
+  int preconnect();
+  // Called when the connection made by preconnect() is established.
+  void on_warmed();
+  // Reads data from idle connection.  This function returns 0 if the
+  // connection is still usable, or -1.
+  int idle_read();
+  // Called when this connection, which carries a hedged request, is
+  // readable.  It returns 1 if response has arrived, 0 if nothing has
+  // arrived yet, or -1 if the connection failed.
+  int hedge_read();
 
   int write_first();
   int read_clear();
   int write_clear();
+  // Moves the rest of response body to upstream with splice(2).
+  int read_splice();
   int read_tls();
   int write_tls();
 
   int process_input(const uint8_t *data, size_t datalen);
+  // Returns true if the rest of response body can be moved by
+  // read_splice().
+  bool start_splice();
   int tls_handshake();
 
   int connected();
@@ -92,6 +115,22 @@ public:
 
   int process_blocked_request_buf();
 
+  // Queues the request of |dconn| after the requests which this
+  // object carries.
+  void add_pipelined_request(PipelinedDownstreamConnection *dconn);
+  // Removes |dconn| from the queue.  If the request of |dconn| has
+  // been written, the requests after it are retried, and this object
+  // is not reused.
+  void remove_pipelined_request(PipelinedDownstreamConnection *dconn);
+  // Writes the request header fields of pipelined |downstream| to its
+  // request buffer.
+  int push_pipelined_request_headers(Downstream *downstream);
+
+  // dlnext and dlprev link this object either in the connection pool,
+  // or in http1_pipeline_freelist of addr_.  The former happens only
+  // when this object has no request.
+  HttpDownstreamConnection *dlnext, *dlprev;
+
 private:
   Connection conn_;
   std::function<int(HttpDownstreamConnection &)> on_read_, on_write_,
@@ -109,6 +148,10 @@ private:
   // Resolved IP address if dns parameter is used
   std::unique_ptr<Address> resolved_addr_;
   std::unique_ptr<DNSQuery> dns_query_;
+  // Races the connection to another resolved address, preferably of
+  // the other address family, while connecting to the resolved
+  // address.
+  std::unique_ptr<HappyEyeballs> happy_eyeballs_;
   IOControl ioctrl_;
   llhttp_t response_htp_;
   // true if first write succeeded.
@@ -117,6 +160,40 @@ private:
   bool reusable_;
   // true if request header is written to request buffer.
   bool request_header_written_;
+  // true if response body is moved by read_splice().
+  bool splice_;
+  // true if this object is in http1_pipeline_freelist of addr_.
+  bool in_pipeline_freelist_;
+  // true if the request of downstream_ is retried when backend closes
+  // the connection before sending response.  This is the case if the
+  // request was pipelined, or it is pipelinable and sent over a reused
+  // connection to pipelining backend.
+  bool retry_on_close_;
+
+  // Writes request header fields of |downstream| to its request
+  // buffer.
+  void write_request_headers(Downstream *downstream);
+  // Returns the request buffer to write next.  Pipelined requests are
+  // written after the request of downstream_.
+  DefaultMemchunks *get_request_output();
+  // Processes the data which follows the previous response in
+  // pipeline_input_.
+  int process_pipeline_input();
+  // Makes the first pipelined request current after the response to
+  // downstream_ completed.
+  void promote_pipelined_request();
+  // Retries all pipelined requests with another connection.
+  void fail_pipeline();
+  // Adds or removes this object in http1_pipeline_freelist of addr_
+  // depending on whether it can take more pipelined requests.
+  void update_pipeline_freelist();
+
+  // Pipelined requests which are sent after the request of
+  // downstream_, in the order of response.
+  DList<PipelinedDownstreamConnection> pipeline_;
+  // The data received after the response to downstream_, which is
+  // the part of the responses to the pipelined requests.
+  std::vector<uint8_t> pipeline_input_;
 };
 
 } // namespace shrpx
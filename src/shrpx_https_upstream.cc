@@ -24,6 +24,13 @@
  */
 #include "shrpx_https_upstream.h"
 
+#ifdef HAVE_UNISTD_H
+#  include <unistd.h>
+#endif // HAVE_UNISTD_H
+#ifdef HAVE_FCNTL_H
+#  include <fcntl.h>
+#endif // HAVE_FCNTL_H
+
 #include <cassert>
 #include <set>
 #include <sstream>
@@ -37,6 +44,7 @@
 #include "shrpx_log_config.h"
 #include "shrpx_worker.h"
 #include "shrpx_http2_session.h"
+#include "shrpx_rewrite.h"
 #include "shrpx_log.h"
 #ifdef HAVE_MRUBY
 #  include "shrpx_mruby.h"
@@ -80,12 +88,14 @@ HttpsUpstream::HttpsUpstream(ClientHandler *handler)
     : handler_(handler),
       current_header_length_(0),
       ioctrl_(handler->get_rlimit()),
-      num_requests_(0) {
+      num_requests_(0),
+      splice_pipe_{-1, -1},
+      splice_pipe_len_(0) {
   llhttp_init(&htp_, HTTP_REQUEST, &htp_hooks);
   htp_.data = this;
 }
 
-HttpsUpstream::~HttpsUpstream() {}
+HttpsUpstream::~HttpsUpstream() { close_splice_pipe(); }
 
 void HttpsUpstream::reset_current_header_length() {
   current_header_length_ = 0;
@@ -445,6 +455,12 @@ int htp_hdrs_completecb(llhttp_t *htp) {
   }
 #endif // HAVE_MRUBY
 
+  if (downstream->get_response_state() != DownstreamState::MSG_COMPLETE &&
+      rewrite_request(downstream) != 0) {
+    downstream->response().http_status = 500;
+    return -1;
+  }
+
   // mruby hook may change method value
 
   if (req.no_authority && config->http2_proxy &&
@@ -457,63 +473,7 @@ int htp_hdrs_completecb(llhttp_t *htp) {
     return 0;
   }
 
-  DownstreamConnection *dconn_ptr;
-
-  for (;;) {
-    auto dconn = handler->get_downstream_connection(rv, downstream);
-
-    if (!dconn) {
-      if (rv == SHRPX_ERR_TLS_REQUIRED) {
-        upstream->redirect_to_https(downstream);
-      }
-      downstream->set_request_state(DownstreamState::CONNECT_FAIL);
-      return -1;
-    }
-
-#ifdef HAVE_MRUBY
-    dconn_ptr = dconn.get();
-#endif // HAVE_MRUBY
-    if (downstream->attach_downstream_connection(std::move(dconn)) == 0) {
-      break;
-    }
-  }
-
-#ifdef HAVE_MRUBY
-  const auto &group = dconn_ptr->get_downstream_addr_group();
-  if (group) {
-    const auto &dmruby_ctx = group->shared_addr->mruby_ctx;
-
-    if (dmruby_ctx->run_on_request_proc(downstream) != 0) {
-      resp.http_status = 500;
-      return -1;
-    }
-
-    if (downstream->get_response_state() == DownstreamState::MSG_COMPLETE) {
-      return 0;
-    }
-  }
-#endif // HAVE_MRUBY
-
-  rv = downstream->push_request_headers();
-
-  if (rv != 0) {
-    return -1;
-  }
-
-  if (faddr->alt_mode != UpstreamAltMode::NONE) {
-    // Normally, we forward expect: 100-continue to backend server,
-    // and let them decide whether responds with 100 Continue or not.
-    // For alternative mode, we have no backend, so just send 100
-    // Continue here to make the client happy.
-    if (downstream->get_expect_100_continue()) {
-      auto output = downstream->get_response_buf();
-      constexpr auto res = StringRef::from_lit("HTTP/1.1 100 Continue\r\n\r\n");
-      output->append(res);
-      handler->signal_write();
-    }
-  }
-
-  return 0;
+  return upstream->initiate_downstream(downstream);
 }
 } // namespace
 
@@ -721,6 +681,16 @@ int HttpsUpstream::on_write() {
     return 0;
   }
 
+  if (splice_pipe_len_) {
+    if (write_splice_pipe() != 0) {
+      return -1;
+    }
+
+    if (splice_pipe_len_) {
+      return 0;
+    }
+  }
+
   // We need to postpone detachment until all data are sent so that
   // we can notify nghttp2 library all data consumed.
   if (downstream->get_response_state() == DownstreamState::MSG_COMPLETE) {
@@ -1041,6 +1011,12 @@ void HttpsUpstream::delete_downstream() {
   }
 
   downstream_.reset();
+
+  if (splice_pipe_len_) {
+    // The response was not completely sent.  Do not let the rest of
+    // it leak into the next response.
+    close_splice_pipe();
+  }
 }
 
 Downstream *HttpsUpstream::get_downstream() const { return downstream_.get(); }
@@ -1076,16 +1052,24 @@ int HttpsUpstream::on_downstream_header_complete(Downstream *downstream) {
   auto dconn = downstream->get_downstream_connection();
   // dconn might be nullptr if this is non-final response from mruby.
 
+  downstream->share_response_header();
+
   if (downstream->get_non_final_response() &&
       !downstream->supports_non_final_response()) {
     resp.fs.clear_headers();
     return 0;
   }
 
+  if (!downstream->get_non_final_response()) {
+    rewrite_response(downstream);
+  }
+
 #ifdef HAVE_MRUBY
+  // dconn is nullptr if the response is shared by single-flight
+  // leader.  Per-pattern mruby script is not run in this case.
   if (!downstream->get_non_final_response()) {
-    assert(dconn);
-    const auto &group = dconn->get_downstream_addr_group();
+    const auto &group = dconn ? dconn->get_downstream_addr_group()
+                              : std::shared_ptr<DownstreamAddrGroup>();
     if (group) {
       const auto &dmruby_ctx = group->shared_addr->mruby_ctx;
 
@@ -1113,6 +1097,19 @@ int HttpsUpstream::on_downstream_header_complete(Downstream *downstream) {
   }
 #endif // HAVE_MRUBY
 
+  if (downstream->start_response_compression()) {
+    if (http2::legacy_http1(req.http_major, req.http_minor)) {
+      // The end of compressed body is signaled by closing connection.
+      resp.connection_close = true;
+      downstream->set_chunked_response(false);
+    } else {
+      resp.fs.add_header_token(StringRef::from_lit("transfer-encoding"),
+                               StringRef::from_lit("chunked"), false,
+                               http2::HD_TRANSFER_ENCODING);
+      downstream->set_chunked_response(true);
+    }
+  }
+
   auto connect_method = req.method == HTTP_CONNECT;
 
   auto buf = downstream->get_response_buf();
@@ -1295,13 +1292,56 @@ int HttpsUpstream::on_downstream_header_complete(Downstream *downstream) {
   return 0;
 }
 
+namespace {
+// Moves compressed response body in |buf| to |output| without
+// copying, framing it as a chunk if |chunked| is true.  This function
+// returns the number of bytes of compressed body moved.
+size_t write_compressed_body(DefaultMemchunks *output, DefaultMemchunks &buf,
+                             bool chunked) {
+  auto n = buf.rleft();
+  if (n == 0) {
+    return 0;
+  }
+
+  if (chunked) {
+    output->append(util::utox(n));
+    output->append("\r\n");
+  }
+
+  buf.remove(*output);
+
+  if (chunked) {
+    output->append("\r\n");
+  }
+
+  return n;
+}
+} // namespace
+
 int HttpsUpstream::on_downstream_body(Downstream *downstream,
                                       const uint8_t *data, size_t len,
                                       bool flush) {
   if (len == 0) {
     return 0;
   }
+
+  downstream->share_response_body(data, len);
+
   auto output = downstream->get_response_buf();
+
+  if (downstream->response_compressed()) {
+    DefaultMemchunks buf(output->pool);
+
+    if (downstream->compress_response_body(buf, data, len, false) != 0) {
+      return -1;
+    }
+
+    downstream->response_sent_body_length += write_compressed_body(
+        output, buf, downstream->get_chunked_response());
+
+    return 0;
+  }
+
   if (downstream->get_chunked_response()) {
     output->append(util::utox(len));
     output->append("\r\n");
@@ -1320,8 +1360,24 @@ int HttpsUpstream::on_downstream_body_complete(Downstream *downstream) {
   const auto &req = downstream->request();
   auto &resp = downstream->response();
 
+  if (downstream->share_response_complete() != 0) {
+    return -1;
+  }
+
+  auto output = downstream->get_response_buf();
+
+  if (downstream->response_compressed()) {
+    DefaultMemchunks buf(output->pool);
+
+    if (downstream->compress_response_body(buf, nullptr, 0, true) != 0) {
+      return -1;
+    }
+
+    downstream->response_sent_body_length += write_compressed_body(
+        output, buf, downstream->get_chunked_response());
+  }
+
   if (downstream->get_chunked_response()) {
-    auto output = downstream->get_response_buf();
     const auto &trailers = resp.fs.trailers();
     if (trailers.empty()) {
       output->append("0\r\n\r\n");
@@ -1349,6 +1405,189 @@ int HttpsUpstream::on_downstream_body_complete(Downstream *downstream) {
   return 0;
 }
 
+bool HttpsUpstream::start_downstream_body_splice(Downstream *downstream) {
+#ifdef HAVE_SPLICE
+  if (!get_config()->http.http1_splice) {
+    return false;
+  }
+
+  auto conn = handler_->get_connection();
+
+  if (conn->tls.ssl || downstream->get_chunked_response()) {
+    return false;
+  }
+
+  if (splice_pipe_[0] != -1) {
+    return true;
+  }
+
+  if (pipe2(splice_pipe_.data(), O_NONBLOCK | O_CLOEXEC) != 0) {
+    auto error = errno;
+    ULOG(WARN, this) << "pipe2() failed: errno=" << error;
+    splice_pipe_ = {-1, -1};
+    return false;
+  }
+
+#  ifdef F_SETPIPE_SZ
+  auto worker = handler_->get_worker();
+  auto &downstreamconf = *worker->get_downstream_config();
+
+  // This may fail if the size exceeds the system limit.  The default
+  // size is used in that case.
+  fcntl(splice_pipe_[1], F_SETPIPE_SZ,
+        static_cast<int>(downstreamconf.response_buffer_size));
+#  endif // F_SETPIPE_SZ
+
+  return true;
+#else  // !HAVE_SPLICE
+  return false;
+#endif // !HAVE_SPLICE
+}
+
+ssize_t HttpsUpstream::on_downstream_body_splice(Downstream *downstream,
+                                                 Connection &conn,
+                                                 size_t len) {
+#ifdef HAVE_SPLICE
+  auto nread = conn.splice_read_clear(splice_pipe_[1], len);
+  if (nread <= 0) {
+    return nread;
+  }
+
+  splice_pipe_len_ += nread;
+  downstream->response_sent_body_length += nread;
+
+  return nread;
+#else  // !HAVE_SPLICE
+  return -1;
+#endif // !HAVE_SPLICE
+}
+
+int HttpsUpstream::write_splice_pipe() {
+#ifdef HAVE_SPLICE
+  auto conn = handler_->get_connection();
+
+  while (splice_pipe_len_) {
+    auto nwrite = conn->splice_write_clear(splice_pipe_[0], splice_pipe_len_);
+    if (nwrite < 0) {
+      return -1;
+    }
+
+    if (nwrite == 0) {
+      return 0;
+    }
+
+    splice_pipe_len_ -= nwrite;
+  }
+
+  return 0;
+#else  // !HAVE_SPLICE
+  return -1;
+#endif // !HAVE_SPLICE
+}
+
+void HttpsUpstream::close_splice_pipe() {
+  if (splice_pipe_[0] == -1) {
+    return;
+  }
+
+  close(splice_pipe_[0]);
+  close(splice_pipe_[1]);
+
+  splice_pipe_ = {-1, -1};
+  splice_pipe_len_ = 0;
+}
+
+int HttpsUpstream::initiate_downstream(Downstream *downstream) {
+  int rv;
+  auto faddr = handler_->get_upstream_addr();
+  auto &resp = downstream->response();
+
+  DownstreamConnection *dconn_ptr;
+
+  for (;;) {
+    auto dconn = handler_->get_downstream_connection(rv, downstream);
+
+    if (!dconn) {
+      switch (rv) {
+      case SHRPX_ERR_TLS_REQUIRED:
+        redirect_to_https(downstream);
+        break;
+      case SHRPX_ERR_QUEUED:
+        // The request body is buffered until a slot is available.
+        return 0;
+      case SHRPX_ERR_COALESCED:
+        // The response to the identical request is delivered by
+        // SingleFlightCall.
+        return 0;
+      case SHRPX_ERR_OVERLOADED:
+        resp.http_status = 503;
+        break;
+      }
+      downstream->set_request_state(DownstreamState::CONNECT_FAIL);
+      return -1;
+    }
+
+#ifdef HAVE_MRUBY
+    dconn_ptr = dconn.get();
+#endif // HAVE_MRUBY
+    if (downstream->attach_downstream_connection(std::move(dconn)) == 0) {
+      break;
+    }
+  }
+
+#ifdef HAVE_MRUBY
+  const auto &group = dconn_ptr->get_downstream_addr_group();
+  if (group) {
+    const auto &dmruby_ctx = group->shared_addr->mruby_ctx;
+
+    if (dmruby_ctx->run_on_request_proc(downstream) != 0) {
+      resp.http_status = 500;
+      return -1;
+    }
+
+    if (downstream->get_response_state() == DownstreamState::MSG_COMPLETE) {
+      return 0;
+    }
+  }
+#endif // HAVE_MRUBY
+
+  rv = downstream->push_request_headers();
+
+  if (rv != 0) {
+    return -1;
+  }
+
+  if (faddr->alt_mode != UpstreamAltMode::NONE) {
+    // Normally, we forward expect: 100-continue to backend server,
+    // and let them decide whether responds with 100 Continue or not.
+    // For alternative mode, we have no backend, so just send 100
+    // Continue here to make the client happy.
+    if (downstream->get_expect_100_continue()) {
+      auto output = downstream->get_response_buf();
+      constexpr auto res = StringRef::from_lit("HTTP/1.1 100 Continue\r\n\r\n");
+      output->append(res);
+      handler_->signal_write();
+    }
+  }
+
+  return 0;
+}
+
+int HttpsUpstream::on_downstream_admitted(Downstream *downstream) {
+  assert(downstream == downstream_.get());
+
+  if (initiate_downstream(downstream) == 0) {
+    return 0;
+  }
+
+  auto status_code = downstream->response().http_status;
+  if (status_code == 0) {
+    status_code = 502;
+  }
+
+  return on_downstream_abort_request(downstream, status_code);
+}
+
 int HttpsUpstream::on_downstream_abort_request(Downstream *downstream,
                                                unsigned int status_code) {
   error_reply(status_code);
@@ -1425,6 +1664,10 @@ int HttpsUpstream::on_downstream_reset(Downstream *downstream, bool no_retry) {
 
   assert(downstream == downstream_.get());
 
+  // Retry budget is found via the backend connection.
+  no_retry = no_retry || !downstream_->request_submission_ready() ||
+             !downstream_->acquire_retry_budget();
+
   downstream_->pop_downstream_connection();
 
   if (!downstream_->request_submission_ready()) {
@@ -1516,7 +1759,7 @@ bool HttpsUpstream::response_empty() const {
 
   auto buf = downstream_->get_response_buf();
 
-  return buf->rleft() == 0;
+  return buf->rleft() == 0 && splice_pipe_len_ == 0;
 }
 
 Downstream *
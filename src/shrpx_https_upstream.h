@@ -28,6 +28,7 @@
 #include "shrpx.h"
 
 #include <cinttypes>
+#include <array>
 #include <memory>
 
 #include "llhttp.h"
@@ -73,9 +74,13 @@ public:
   virtual int on_downstream_body(Downstream *downstream, const uint8_t *data,
                                  size_t len, bool flush);
   virtual int on_downstream_body_complete(Downstream *downstream);
+  virtual bool start_downstream_body_splice(Downstream *downstream);
+  virtual ssize_t on_downstream_body_splice(Downstream *downstream,
+                                            Connection &conn, size_t len);
 
   virtual void on_handler_delete();
   virtual int on_downstream_reset(Downstream *downstream, bool no_retry);
+  virtual int on_downstream_admitted(Downstream *downstream);
   virtual int send_reply(Downstream *downstream, const uint8_t *body,
                          size_t bodylen);
   virtual int initiate_push(Downstream *downstream, const StringRef &uri);
@@ -94,10 +99,18 @@ public:
   void reset_current_header_length();
   void log_response_headers(DefaultMemchunks *buf) const;
   int redirect_to_https(Downstream *downstream);
+  // Sends request of |downstream| to backend.  Returns 0 if it
+  // succeeds, or it waits for a slot of ConcurrencyLimiter.
+  int initiate_downstream(Downstream *downstream);
 
   // Called when new request has started.
   void on_start_request();
 
+  // Writes response body in splice_pipe_ to the client connection.
+  // It returns 0 if it succeeds, or -1.
+  int write_splice_pipe();
+  void close_splice_pipe();
+
 private:
   ClientHandler *handler_;
   llhttp_t htp_;
@@ -106,6 +119,12 @@ private:
   IOControl ioctrl_;
   // The number of requests seen so far.
   size_t num_requests_;
+  // The pipe which response body moved from backend with splice(2)
+  // goes through.  It is created when it is first used, and reused
+  // for the subsequent requests.
+  std::array<int, 2> splice_pipe_;
+  // The number of bytes in splice_pipe_.
+  size_t splice_pipe_len_;
 };
 
 } // namespace shrpx
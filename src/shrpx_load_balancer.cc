@@ -0,0 +1,320 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_load_balancer.h"
+
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+#include <array>
+
+#include "shrpx_worker.h"
+#include "shrpx_connect_blocker.h"
+#include "shrpx_log.h"
+#include "util.h"
+
+namespace shrpx {
+
+namespace {
+// The latency in seconds assumed for each outstanding request to an
+// address which has not responded yet.  It is large enough that such
+// address gets at most one request until its latency is known.
+constexpr double UNKNOWN_LATENCY_PENALTY = 1e6;
+} // namespace
+
+double load_balancer_get_latency(const DownstreamAddr *addr, ev_tstamp now) {
+  if (addr->latency_ewma == 0.) {
+    return 0.;
+  }
+
+  auto td = std::max(now - addr->latency_ewma_stamp, 0.);
+
+  return addr->latency_ewma * exp(-td / LOAD_BALANCER_LATENCY_DECAY);
+}
+
+void load_balancer_observe_latency(DownstreamAddr *addr, ev_tstamp now,
+                                   ev_tstamp rtt) {
+  rtt = std::max(rtt, 0.);
+
+  if (addr->latency_ewma == 0. || rtt > addr->latency_ewma) {
+    addr->latency_ewma = rtt;
+  } else {
+    auto td = std::max(now - addr->latency_ewma_stamp, 0.);
+    auto w = exp(-td / LOAD_BALANCER_LATENCY_DECAY);
+    addr->latency_ewma = addr->latency_ewma * w + rtt * (1. - w);
+  }
+
+  addr->latency_ewma_stamp = now;
+}
+
+double load_balancer_get_cost(const DownstreamAddr *addr,
+                              LoadBalancing balance, ev_tstamp now) {
+  switch (balance) {
+  case LoadBalancing::LEAST_REQUEST:
+    return static_cast<double>(addr->num_inflight + 1) / addr->weight;
+  case LoadBalancing::PEAK_EWMA:
+  case LoadBalancing::P2C: {
+    auto latency = load_balancer_get_latency(addr, now);
+    if (latency == 0.) {
+      return addr->num_inflight * UNKNOWN_LATENCY_PENALTY / addr->weight;
+    }
+    return latency * (addr->num_inflight + 1) / addr->weight;
+  }
+  default:
+    assert(0);
+    abort();
+  }
+}
+
+namespace {
+// Scans all addresses in |shared_addr|, and returns the one with the
+// lowest cost.  The scan starts at shared_addr->next_addr so that
+// ties are broken in round robin fashion.
+DownstreamAddr *select_least_cost(SharedDownstreamAddr *shared_addr,
+                                  LoadBalancing balance, ev_tstamp now) {
+  auto &addrs = shared_addr->addrs;
+  auto n = addrs.size();
+
+  DownstreamAddr *best = nullptr;
+  size_t best_idx = 0;
+  auto best_cost = std::numeric_limits<double>::infinity();
+
+  for (size_t i = 0; i < n; ++i) {
+    auto idx = (shared_addr->next_addr + i) % n;
+    auto addr = &addrs[idx];
+
+    if (addr->connect_blocker->blocked()) {
+      continue;
+    }
+
+    auto cost = load_balancer_get_cost(addr, balance, now);
+    if (best == nullptr || cost < best_cost) {
+      best = addr;
+      best_idx = idx;
+      best_cost = cost;
+    }
+  }
+
+  if (best) {
+    shared_addr->next_addr = (best_idx + 1) % n;
+  }
+
+  return best;
+}
+} // namespace
+
+DownstreamAddr *load_balancer_select(SharedDownstreamAddr *shared_addr,
+                                     std::mt19937 &gen, ev_tstamp now) {
+  auto balance = shared_addr->balance;
+  auto &addrs = shared_addr->addrs;
+
+  assert(balance != LoadBalancing::ROUND_ROBIN);
+
+  if (balance != LoadBalancing::P2C || addrs.size() < 2) {
+    return select_least_cost(shared_addr, balance, now);
+  }
+
+  auto n = addrs.size();
+  auto i = std::uniform_int_distribution<size_t>(0, n - 1)(gen);
+  auto j = std::uniform_int_distribution<size_t>(0, n - 2)(gen);
+  if (j >= i) {
+    ++j;
+  }
+
+  auto a = &addrs[i];
+  auto b = &addrs[j];
+
+  // If one of them is blocked, fall back to the full scan so that a
+  // working address is found whenever there is one.
+  if (a->connect_blocker->blocked() || b->connect_blocker->blocked()) {
+    return select_least_cost(shared_addr, balance, now);
+  }
+
+  if (load_balancer_get_cost(b, balance, now) <
+      load_balancer_get_cost(a, balance, now)) {
+    return b;
+  }
+
+  return a;
+}
+
+namespace {
+// Prime numbers used as the size of affinity table.  The smallest one
+// which is at least AFFINITY_TABLE_ENTRIES_PER_ADDR times the number
+// of addresses is chosen.
+constexpr uint32_t AFFINITY_TABLE_SIZES[] = {
+    251, 509, 1021, 2039, 4093, 8191, 16381, 32749, 65521,
+};
+constexpr size_t AFFINITY_TABLE_ENTRIES_PER_ADDR = 100;
+} // namespace
+
+namespace {
+// Permutation of affinity table slots for a backend address, as
+// described in Maglev paper.  The n-th preferred slot is (offset + n
+// * skip) % table size.
+struct AffinityPermutation {
+  uint32_t idx;
+  uint32_t offset;
+  uint32_t skip;
+  uint32_t next;
+  uint64_t hash;
+};
+} // namespace
+
+int load_balancer_build_affinity_table(std::vector<uint32_t> &table,
+                                       const std::vector<StringRef> &keys) {
+  int rv;
+
+  table.clear();
+
+  if (keys.empty()) {
+    return 0;
+  }
+
+  auto m = *(std::end(AFFINITY_TABLE_SIZES) - 1);
+  for (auto n : AFFINITY_TABLE_SIZES) {
+    if (n >= keys.size() * AFFINITY_TABLE_ENTRIES_PER_ADDR) {
+      m = n;
+      break;
+    }
+  }
+
+  std::vector<AffinityPermutation> perms;
+  perms.reserve(keys.size());
+
+  std::array<uint8_t, 32> buf;
+
+  for (size_t i = 0; i < keys.size(); ++i) {
+    rv = util::sha256(buf.data(), keys[i]);
+    if (rv != 0) {
+      return -1;
+    }
+
+    uint64_t h = 0;
+    for (size_t j = 0; j < 8; ++j) {
+      h = (h << 8) | buf[j];
+    }
+
+    perms.push_back(AffinityPermutation{
+        static_cast<uint32_t>(i), static_cast<uint32_t>((h >> 32) % m),
+        static_cast<uint32_t>((h & 0xffffffffu) % (m - 1) + 1), 0, h});
+  }
+
+  // Fill the table in the order of the hash of keys, rather than the
+  // order of configuration.
+  std::sort(std::begin(perms), std::end(perms),
+            [](const AffinityPermutation &lhs, const AffinityPermutation &rhs) {
+              return lhs.hash < rhs.hash ||
+                     (lhs.hash == rhs.hash && lhs.idx < rhs.idx);
+            });
+
+  constexpr auto empty = std::numeric_limits<uint32_t>::max();
+
+  table.assign(m, empty);
+
+  size_t filled = 0;
+
+  for (;;) {
+    for (auto &p : perms) {
+      uint32_t c;
+
+      // m is prime, so that the permutation visits all slots.
+      do {
+        c = (p.offset + static_cast<uint64_t>(p.next) * p.skip) % m;
+        ++p.next;
+      } while (table[c] != empty);
+
+      table[c] = p.idx;
+
+      if (++filled == m) {
+        return 0;
+      }
+    }
+  }
+}
+
+namespace {
+// Derives a new hash from |hash| for the |n|-th retry.  This is the
+// finalizer of MurmurHash3.
+uint32_t rehash_affinity(uint32_t hash, uint32_t n) {
+  auto h = hash ^ (n * 0x9e3779b9u);
+
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+
+  return h;
+}
+} // namespace
+
+DownstreamAddr *load_balancer_select_affinity(SharedDownstreamAddr *shared_addr,
+                                              uint32_t hash) {
+  auto &table = shared_addr->affinity_table;
+  auto &addrs = shared_addr->addrs;
+
+  assert(!table.empty());
+
+  auto idx = table[hash % table.size()];
+  auto addr = &addrs[idx];
+
+  if (!addr->connect_blocker->blocked()) {
+    return addr;
+  }
+
+  // The same sequence of hashes is tried for the same |hash|, so that
+  // a key sticks to the same fallback address.
+  auto max_retry = static_cast<uint32_t>(addrs.size() * 2);
+
+  for (uint32_t n = 1; n <= max_retry; ++n) {
+    addr = &addrs[table[rehash_affinity(hash, n) % table.size()]];
+    if (!addr->connect_blocker->blocked()) {
+      return addr;
+    }
+  }
+
+  for (size_t i = 1; i < addrs.size(); ++i) {
+    addr = &addrs[(idx + i) % addrs.size()];
+    if (!addr->connect_blocker->blocked()) {
+      return addr;
+    }
+  }
+
+  return nullptr;
+}
+
+bool load_balancer_need_http2_session(size_t nsessions, size_t target,
+                                      size_t nstreams, size_t max_streams) {
+  if (nsessions < target) {
+    return true;
+  }
+
+  // Open a new session when the least loaded session becomes 3/4
+  // full.
+  return nstreams + 1 > max_streams - max_streams / 4;
+}
+
+} // namespace shrpx
@@ -0,0 +1,97 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHRPX_LOAD_BALANCER_H
+#define SHRPX_LOAD_BALANCER_H
+
+#include "shrpx.h"
+
+#include <random>
+#include <vector>
+
+#include <ev.h>
+
+#include "shrpx_config.h"
+
+namespace shrpx {
+
+struct DownstreamAddr;
+struct SharedDownstreamAddr;
+
+// The time constant of peak EWMA latency in seconds.
+constexpr ev_tstamp LOAD_BALANCER_LATENCY_DECAY = 10.;
+
+// Returns the peak EWMA latency of |addr| in seconds at |now|.  The
+// value decays toward 0 as time passes without new sample.
+double load_balancer_get_latency(const DownstreamAddr *addr, ev_tstamp now);
+
+// Records the response latency |rtt| of |addr| observed at |now|.  A
+// sample larger than the current average replaces it immediately.
+void load_balancer_observe_latency(DownstreamAddr *addr, ev_tstamp now,
+                                   ev_tstamp rtt);
+
+// Returns the cost of forwarding a request to |addr| at |now| under
+// load balancing method |balance|.  Lower is better.
+double load_balancer_get_cost(const DownstreamAddr *addr,
+                              LoadBalancing balance, ev_tstamp now);
+
+// Selects an address from |shared_addr| using its load balancing
+// method, which must not be LoadBalancing::ROUND_ROBIN.  Addresses
+// which are blocked are skipped.  This function returns nullptr if
+// all addresses are blocked.
+DownstreamAddr *load_balancer_select(SharedDownstreamAddr *shared_addr,
+                                     std::mt19937 &gen, ev_tstamp now);
+
+// Builds Maglev lookup table for session affinity into |table|.
+// |keys| contains the identity of each backend address, and the index
+// of a key is stored in |table|.  Each address gets almost the same
+// number of entries, and adding or removing an address changes only
+// the entries of that address, and a few more.  The result does not
+// depend on the order of |keys|.  This function returns 0 if it
+// succeeds, or -1.
+int load_balancer_build_affinity_table(std::vector<uint32_t> &table,
+                                       const std::vector<StringRef> &keys);
+
+// Selects an address from |shared_addr| for session affinity hash
+// |hash| using its affinity table.  If the address is blocked, the
+// table is looked up again with the hashes derived from |hash|, so
+// that the keys of an unavailable address are spread over the other
+// addresses.  This function returns nullptr if all addresses are
+// blocked.
+DownstreamAddr *load_balancer_select_affinity(SharedDownstreamAddr *shared_addr,
+                                              uint32_t hash);
+
+// Returns true if a new HTTP/2 session should be opened to a backend
+// address which currently has |nsessions| sessions, and streams are
+// spread over |target| sessions.  |nstreams| is the number of streams
+// in the least loaded session which can accept a new stream, and
+// |max_streams| is its concurrency limit.  A new session is opened
+// before the limit is reached so that it is ready when the existing
+// sessions become full.
+bool load_balancer_need_http2_session(size_t nsessions, size_t target,
+                                      size_t nstreams, size_t max_streams);
+
+} // namespace shrpx
+
+#endif // SHRPX_LOAD_BALANCER_H
@@ -0,0 +1,295 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_load_balancer_test.h"
+
+#include <cmath>
+#include <algorithm>
+#include <limits>
+
+#include <CUnit/CUnit.h>
+
+#include "shrpx_load_balancer.h"
+#include "shrpx_worker.h"
+#include "shrpx_log.h"
+#include "util.h"
+
+namespace shrpx {
+
+void test_shrpx_load_balancer_latency(void) {
+  DownstreamAddr addr{};
+
+  CU_ASSERT(0. == load_balancer_get_latency(&addr, 100.));
+
+  // The first sample is taken as is.
+  load_balancer_observe_latency(&addr, 100., 0.2);
+
+  CU_ASSERT(0.2 == load_balancer_get_latency(&addr, 100.));
+
+  // A larger sample replaces the average immediately.
+  load_balancer_observe_latency(&addr, 100., 1.);
+
+  CU_ASSERT(1. == load_balancer_get_latency(&addr, 100.));
+
+  // A smaller sample is averaged with the weight of the elapsed time.
+  load_balancer_observe_latency(&addr, 100. + LOAD_BALANCER_LATENCY_DECAY,
+                                0.1);
+
+  auto w = exp(-1.);
+  auto expected = w + 0.1 * (1. - w);
+
+  CU_ASSERT(fabs(expected - load_balancer_get_latency(
+                                &addr, 100. + LOAD_BALANCER_LATENCY_DECAY)) <
+            1e-9);
+
+  // Without new sample, the average decays toward 0.
+  CU_ASSERT(fabs(expected * w -
+                 load_balancer_get_latency(
+                     &addr, 100. + 2 * LOAD_BALANCER_LATENCY_DECAY)) < 1e-9);
+}
+
+void test_shrpx_load_balancer_select(void) {
+  std::mt19937 gen(0);
+  auto loop = EV_DEFAULT;
+  SharedDownstreamAddr shared_addr;
+
+  shared_addr.addrs.resize(3);
+  for (auto &addr : shared_addr.addrs) {
+    addr.connect_blocker =
+        std::make_unique<ConnectBlocker>(gen, loop, nullptr, nullptr, nullptr);
+    addr.weight = 1;
+  }
+
+  auto &addrs = shared_addr.addrs;
+
+  // least-request picks the address with the fewest outstanding
+  // requests, weighted.
+  shared_addr.balance = LoadBalancing::LEAST_REQUEST;
+
+  addrs[0].num_inflight = 2;
+  addrs[1].num_inflight = 1;
+  addrs[2].num_inflight = 3;
+
+  CU_ASSERT(&addrs[1] == load_balancer_select(&shared_addr, gen, 0.));
+
+  addrs[2].weight = 4;
+
+  CU_ASSERT(&addrs[2] == load_balancer_select(&shared_addr, gen, 0.));
+
+  addrs[2].weight = 1;
+
+  // Ties are broken in round robin fashion.
+  for (auto &addr : addrs) {
+    addr.num_inflight = 0;
+  }
+
+  auto a = load_balancer_select(&shared_addr, gen, 0.);
+  auto b = load_balancer_select(&shared_addr, gen, 0.);
+  auto c = load_balancer_select(&shared_addr, gen, 0.);
+
+  CU_ASSERT(a != b);
+  CU_ASSERT(b != c);
+  CU_ASSERT(a != c);
+
+  // peak-ewma prefers an address without outstanding request whose
+  // latency is not known yet, and then the fastest one.
+  shared_addr.balance = LoadBalancing::PEAK_EWMA;
+
+  load_balancer_observe_latency(&addrs[0], 0., 0.5);
+  load_balancer_observe_latency(&addrs[2], 0., 0.1);
+
+  CU_ASSERT(&addrs[1] == load_balancer_select(&shared_addr, gen, 0.));
+
+  addrs[1].num_inflight = 1;
+
+  CU_ASSERT(&addrs[2] == load_balancer_select(&shared_addr, gen, 0.));
+
+  // 0.1 * 6 > 0.5 * 1
+  addrs[2].num_inflight = 5;
+
+  CU_ASSERT(&addrs[0] == load_balancer_select(&shared_addr, gen, 0.));
+
+  // Blocked address is never selected.
+  addrs[0].connect_blocker->offline();
+
+  CU_ASSERT(&addrs[2] == load_balancer_select(&shared_addr, gen, 0.));
+
+  // p2c never selects the worse of 2 choices, which is addrs[1] here.
+  shared_addr.balance = LoadBalancing::P2C;
+
+  for (size_t i = 0; i < 100; ++i) {
+    auto addr = load_balancer_select(&shared_addr, gen, 0.);
+    CU_ASSERT(&addrs[2] == addr);
+  }
+
+  addrs[2].connect_blocker->offline();
+
+  CU_ASSERT(&addrs[1] == load_balancer_select(&shared_addr, gen, 0.));
+
+  addrs[1].connect_blocker->offline();
+
+  CU_ASSERT(nullptr == load_balancer_select(&shared_addr, gen, 0.));
+}
+
+void test_shrpx_load_balancer_affinity_table(void) {
+  std::vector<std::string> names;
+  for (size_t i = 0; i < 10; ++i) {
+    names.push_back("127.0.0.1:" + util::utos(3000 + i));
+  }
+
+  std::vector<StringRef> keys;
+  for (auto &name : names) {
+    keys.emplace_back(name);
+  }
+
+  std::vector<uint32_t> table;
+
+  CU_ASSERT(0 == load_balancer_build_affinity_table(table, keys));
+  CU_ASSERT(1021 == table.size());
+
+  // Each address gets almost the same number of entries.
+  std::vector<size_t> counts(keys.size());
+  for (auto idx : table) {
+    ++counts[idx];
+  }
+
+  auto minmax = std::minmax_element(std::begin(counts), std::end(counts));
+
+  CU_ASSERT(*minmax.second - *minmax.first <= 1);
+
+  // The order of keys does not matter.
+  std::vector<StringRef> rkeys(keys.rbegin(), keys.rend());
+  std::vector<uint32_t> rtable;
+
+  CU_ASSERT(0 == load_balancer_build_affinity_table(rtable, rkeys));
+  CU_ASSERT(table.size() == rtable.size());
+
+  size_t diff = 0;
+  for (size_t i = 0; i < table.size(); ++i) {
+    if (keys[table[i]] != rkeys[rtable[i]]) {
+      ++diff;
+    }
+  }
+
+  CU_ASSERT(0 == diff);
+
+  // Removing an address moves mostly only the entries of that
+  // address.
+  std::vector<StringRef> skeys(std::begin(keys), std::end(keys) - 1);
+  std::vector<uint32_t> stable;
+
+  CU_ASSERT(0 == load_balancer_build_affinity_table(stable, skeys));
+  CU_ASSERT(table.size() == stable.size());
+
+  diff = 0;
+  for (size_t i = 0; i < table.size(); ++i) {
+    if (table[i] != keys.size() - 1 && keys[table[i]] != skeys[stable[i]]) {
+      ++diff;
+    }
+  }
+
+  CU_ASSERT(diff < table.size() / 20);
+
+  CU_ASSERT(0 == load_balancer_build_affinity_table(table, {}));
+  CU_ASSERT(table.empty());
+}
+
+void test_shrpx_load_balancer_select_affinity(void) {
+  std::mt19937 gen(0);
+  auto loop = EV_DEFAULT;
+  SharedDownstreamAddr shared_addr;
+
+  shared_addr.addrs.resize(4);
+  for (auto &addr : shared_addr.addrs) {
+    addr.connect_blocker =
+        std::make_unique<ConnectBlocker>(gen, loop, nullptr, nullptr, nullptr);
+  }
+
+  auto &addrs = shared_addr.addrs;
+
+  CU_ASSERT(0 == load_balancer_build_affinity_table(
+                     shared_addr.affinity_table,
+                     {StringRef::from_lit("a"), StringRef::from_lit("b"),
+                      StringRef::from_lit("c"), StringRef::from_lit("d")}));
+
+  auto &table = shared_addr.affinity_table;
+
+  for (uint32_t hash = 0; hash < 100; ++hash) {
+    CU_ASSERT(&addrs[table[hash % table.size()]] ==
+              load_balancer_select_affinity(&shared_addr, hash));
+  }
+
+  // The keys of a blocked address are spread over the others, and
+  // the other keys stay.
+  addrs[0].connect_blocker->offline();
+
+  std::vector<size_t> counts(addrs.size());
+
+  for (uint32_t hash = 0; hash < table.size() * 10; ++hash) {
+    auto addr = load_balancer_select_affinity(&shared_addr, hash);
+    auto idx = table[hash % table.size()];
+
+    CU_ASSERT(&addrs[0] != addr);
+
+    if (idx != 0) {
+      CU_ASSERT(&addrs[idx] == addr);
+      continue;
+    }
+
+    CU_ASSERT(addr == load_balancer_select_affinity(&shared_addr, hash));
+
+    ++counts[addr - addrs.data()];
+  }
+
+  CU_ASSERT(counts[1] > 0);
+  CU_ASSERT(counts[2] > 0);
+  CU_ASSERT(counts[3] > 0);
+
+  for (auto &addr : addrs) {
+    addr.connect_blocker->offline();
+  }
+
+  CU_ASSERT(nullptr == load_balancer_select_affinity(&shared_addr, 0));
+}
+
+void test_shrpx_load_balancer_need_http2_session(void) {
+  // Sessions are opened until the target is reached.
+  CU_ASSERT(load_balancer_need_http2_session(0, 1, 0, 100));
+  CU_ASSERT(load_balancer_need_http2_session(1, 4, 0, 100));
+  CU_ASSERT(load_balancer_need_http2_session(3, 4, 0, 100));
+  CU_ASSERT(!load_balancer_need_http2_session(4, 4, 0, 100));
+
+  // A new session is opened when the least loaded one becomes 3/4
+  // full.
+  CU_ASSERT(!load_balancer_need_http2_session(1, 1, 74, 100));
+  CU_ASSERT(load_balancer_need_http2_session(1, 1, 75, 100));
+  CU_ASSERT(load_balancer_need_http2_session(2, 1, 99, 100));
+  CU_ASSERT(!load_balancer_need_http2_session(1, 1, 0, 1));
+
+  // Server does not limit concurrency.
+  CU_ASSERT(!load_balancer_need_http2_session(
+      1, 1, 1000000, std::numeric_limits<uint32_t>::max()));
+}
+
+} // namespace shrpx
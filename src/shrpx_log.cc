@@ -50,6 +50,7 @@
 #include "shrpx_config.h"
 #include "shrpx_downstream.h"
 #include "shrpx_worker.h"
+#include "shrpx_accesslog_writer.h"
 #include "util.h"
 #include "template.h"
 
@@ -573,13 +574,811 @@ StringRef construct_absolute_request_uri(BlockAllocator &balloc,
 }
 } // namespace
 
+namespace {
+// copy_json_escape copies |src| to |d_first| escaping it as JSON
+// string.  The characters which ESCAPE_TBL marks are escaped as
+// "\uNNNN".  '"' and '\' are escaped with a backslash.  Bytes
+// outside ASCII are treated as if they were Latin-1, because we do
+// not validate UTF-8 sequence here.
+template <typename OutputIterator>
+std::pair<OutputIterator, OutputIterator>
+copy_json_escape(const StringRef &src, OutputIterator d_first,
+                 OutputIterator d_last) {
+  auto safe_first = std::begin(src);
+  for (auto p = std::begin(src); p != std::end(src) && d_first != d_last;
+       ++p) {
+    unsigned char c = *p;
+    if (!ESCAPE_TBL[c]) {
+      continue;
+    }
+
+    auto n =
+        std::min(std::distance(d_first, d_last), std::distance(safe_first, p));
+    d_first = std::copy_n(safe_first, n, d_first);
+
+    if (c == '"' || c == '\\') {
+      if (std::distance(d_first, d_last) < 2) {
+        return std::make_pair(d_first, d_last);
+      }
+      *d_first++ = '\\';
+      *d_first++ = c;
+    } else {
+      if (std::distance(d_first, d_last) < 6) {
+        return std::make_pair(d_first, d_last);
+      }
+      *d_first++ = '\\';
+      *d_first++ = 'u';
+      *d_first++ = '0';
+      *d_first++ = '0';
+      *d_first++ = LOWER_XDIGITS[c >> 4];
+      *d_first++ = LOWER_XDIGITS[c & 0xf];
+    }
+    safe_first = p + 1;
+  }
+
+  auto n = std::min(std::distance(d_first, d_last),
+                    std::distance(safe_first, std::end(src)));
+  return std::make_pair(std::copy_n(safe_first, n, d_first), d_last);
+}
+} // namespace
+
+// LogOutput is the buffer which a log record is written into.
+struct LogOutput {
+  char *p;
+  char *last;
+};
+
+// LogRecord contains the values shared by log fragments in a single
+// access log record.
+struct LogRecord {
+  const LogSpec &lgsp;
+  Downstream *downstream;
+  const Request &req;
+  const Response &resp;
+  BlockAllocator &balloc;
+  const DownstreamAddr *downstream_addr;
+  StringRef method;
+  StringRef path;
+  StringRef path_without_query;
+};
+
+// The following structs define how a value of log fragment is
+// encoded.  Each of them has the following functions:
+//
+// begin_record and end_record are called before and after all
+// fragments are written respectively.
+//
+// literal writes LogFragmentType::LITERAL.
+//
+// escaped writes a value which may contain any byte.  verbatim
+// writes a value which is not escaped in text format for historical
+// reason, but may contain any byte.  safe writes a value which
+// consists of printable ASCII characters except for '"' and '\', and
+// needs no escaping.  number writes a numeric value.  none writes
+// the value which is not available.
+namespace {
+struct TextLogEncoding {
+  static void begin_record(LogOutput &out) {}
+  static void end_record(LogOutput &out, char *first) {}
+  static void literal(LogOutput &out, const LogFragment &lf) {
+    std::tie(out.p, out.last) = copy(lf.value, out.p, out.last);
+  }
+  static void escaped(LogOutput &out, const LogFragment &lf,
+                      const StringRef &s) {
+    std::tie(out.p, out.last) = copy_escape(s, out.p, out.last);
+  }
+  static void verbatim(LogOutput &out, const LogFragment &lf,
+                       const StringRef &s) {
+    std::tie(out.p, out.last) = copy(s, out.p, out.last);
+  }
+  static void safe(LogOutput &out, const LogFragment &lf, const StringRef &s) {
+    std::tie(out.p, out.last) = copy(s, out.p, out.last);
+  }
+  static void number(LogOutput &out, const LogFragment &lf,
+                     const StringRef &s) {
+    std::tie(out.p, out.last) = copy(s, out.p, out.last);
+  }
+  static void none(LogOutput &out, const LogFragment &lf) {
+    std::tie(out.p, out.last) = copy('-', out.p, out.last);
+  }
+};
+} // namespace
+
+namespace {
+// JSONLogEncoding writes a record as a single JSON object.  Each
+// variable becomes a member whose name is the variable name.
+// lf.key contains the member name (and a preceding ',' if
+// necessary) followed by ':'.
+struct JSONLogEncoding {
+  static void begin_record(LogOutput &out) {
+    std::tie(out.p, out.last) = copy('{', out.p, out.last);
+    // Reserve 1 byte for the closing '}'.
+    --out.last;
+  }
+  static void end_record(LogOutput &out, char *first) { *out.p++ = '}'; }
+  static void literal(LogOutput &out, const LogFragment &lf) {}
+  static void escaped(LogOutput &out, const LogFragment &lf,
+                      const StringRef &s) {
+    std::tie(out.p, out.last) = copy(lf.key, out.p, out.last);
+    std::tie(out.p, out.last) = copy('"', out.p, out.last);
+    std::tie(out.p, out.last) = copy_json_escape(s, out.p, out.last);
+    std::tie(out.p, out.last) = copy('"', out.p, out.last);
+  }
+  static void verbatim(LogOutput &out, const LogFragment &lf,
+                       const StringRef &s) {
+    escaped(out, lf, s);
+  }
+  static void safe(LogOutput &out, const LogFragment &lf, const StringRef &s) {
+    std::tie(out.p, out.last) = copy(lf.key, out.p, out.last);
+    std::tie(out.p, out.last) = copy('"', out.p, out.last);
+    std::tie(out.p, out.last) = copy(s, out.p, out.last);
+    std::tie(out.p, out.last) = copy('"', out.p, out.last);
+  }
+  static void number(LogOutput &out, const LogFragment &lf,
+                     const StringRef &s) {
+    std::tie(out.p, out.last) = copy(lf.key, out.p, out.last);
+    std::tie(out.p, out.last) = copy(s, out.p, out.last);
+  }
+  static void none(LogOutput &out, const LogFragment &lf) {
+    std::tie(out.p, out.last) = copy(lf.key, out.p, out.last);
+    std::tie(out.p, out.last) = copy_l("null", out.p, out.last);
+  }
+};
+} // namespace
+
+namespace {
+// BinaryLogEncoding writes a record in the following format.  All
+// integers are in network byte order.
+//
+//   record = length(4) version(1) *field
+//   field  = key value_type(1) value_length(2) value
+//
+// length is the length of the record excluding length itself.
+// version is ACCESSLOG_BINARY_VERSION.  key is lf.key, which is
+// field id(1) (the numeric value of LogFragmentType), followed by
+// name length(1) and name for LogFragmentType::HTTP.  value_type is
+// one of BinaryLogValueType.  A field is never split, but its value
+// may be truncated if a record does not fit in a buffer.
+enum BinaryLogValueType : uint8_t {
+  BINARY_LOG_VALUE_NONE,
+  BINARY_LOG_VALUE_STRING,
+  BINARY_LOG_VALUE_NUMBER,
+};
+
+struct BinaryLogEncoding {
+  static void begin_record(LogOutput &out) {
+    // The record length is filled in end_record.
+    out.p += 4;
+    *out.p++ = ACCESSLOG_BINARY_VERSION;
+  }
+  static void end_record(LogOutput &out, char *first) {
+    uint32_t n = out.p - first - 4;
+    *first++ = (n >> 24) & 0xff;
+    *first++ = (n >> 16) & 0xff;
+    *first++ = (n >> 8) & 0xff;
+    *first++ = n & 0xff;
+  }
+  static void literal(LogOutput &out, const LogFragment &lf) {}
+  static void escaped(LogOutput &out, const LogFragment &lf,
+                      const StringRef &s) {
+    field(out, lf, BINARY_LOG_VALUE_STRING, s);
+  }
+  static void verbatim(LogOutput &out, const LogFragment &lf,
+                       const StringRef &s) {
+    field(out, lf, BINARY_LOG_VALUE_STRING, s);
+  }
+  static void safe(LogOutput &out, const LogFragment &lf, const StringRef &s) {
+    field(out, lf, BINARY_LOG_VALUE_STRING, s);
+  }
+  static void number(LogOutput &out, const LogFragment &lf,
+                     const StringRef &s) {
+    field(out, lf, BINARY_LOG_VALUE_NUMBER, s);
+  }
+  static void none(LogOutput &out, const LogFragment &lf) {
+    field(out, lf, BINARY_LOG_VALUE_NONE, StringRef{});
+  }
+  static void field(LogOutput &out, const LogFragment &lf, uint8_t type,
+                    const StringRef &s) {
+    auto left = static_cast<size_t>(out.last - out.p);
+    if (left < lf.key.size() + 3) {
+      // Stop writing any further fields.
+      out.last = out.p;
+      return;
+    }
+
+    out.p = std::copy(std::begin(lf.key), std::end(lf.key), out.p);
+    *out.p++ = type;
+
+    left -= lf.key.size() + 3;
+
+    auto n = std::min(std::min(left, s.size()),
+                      static_cast<size_t>(std::numeric_limits<uint16_t>::max()));
+    *out.p++ = (n >> 8) & 0xff;
+    *out.p++ = n & 0xff;
+    out.p = std::copy_n(std::begin(s), n, out.p);
+  }
+};
+} // namespace
+
+namespace {
+template <typename Enc, typename T>
+void write_uint(LogOutput &out, const LogFragment &lf, T n) {
+  std::array<char, NGHTTP2_MAX_UINT64_DIGITS> buf;
+  auto p = util::utos(std::begin(buf), n);
+  Enc::number(out, lf, StringRef{std::begin(buf), p});
+}
+} // namespace
+
+namespace {
+// Writes HTTP version of request in |rec| to |p|, and returns the
+// one beyond the last byte written.  The buffer must have at least
+// str_size("HTTP/x.y") bytes.
+char *copy_http_version(char *p, const LogRecord &rec) {
+  p = util::copy_lit(p, "HTTP/");
+  p = util::utos(p, rec.req.http_major);
+  if (rec.req.http_major < 2) {
+    *p++ = '.';
+    p = util::utos(p, rec.req.http_minor);
+  }
+  return p;
+}
+} // namespace
+
+namespace {
+template <typename Enc>
+void write_literal(LogOutput &out, const LogFragment &lf,
+                   const LogRecord &rec) {
+  Enc::literal(out, lf);
+}
+} // namespace
+
+namespace {
+template <typename Enc>
+void write_remote_addr(LogOutput &out, const LogFragment &lf,
+                       const LogRecord &rec) {
+  Enc::verbatim(out, lf, rec.lgsp.remote_addr);
+}
+} // namespace
+
+namespace {
+template <typename Enc>
+void write_time_local(LogOutput &out, const LogFragment &lf,
+                      const LogRecord &rec) {
+  Enc::safe(out, lf, rec.req.tstamp->time_local);
+}
+} // namespace
+
+namespace {
+template <typename Enc>
+void write_time_iso8601(LogOutput &out, const LogFragment &lf,
+                        const LogRecord &rec) {
+  Enc::safe(out, lf, rec.req.tstamp->time_iso8601);
+}
+} // namespace
+
+namespace {
+template <typename Enc>
+void write_request(LogOutput &out, const LogFragment &lf,
+                   const LogRecord &rec) {
+  auto iov =
+      make_byte_ref(rec.balloc, rec.method.size() + 1 + rec.path.size() +
+                                    str_size(" HTTP/") +
+                                    NGHTTP2_MAX_UINT64_DIGITS * 2 + 1);
+  auto p = reinterpret_cast<char *>(iov.base);
+  p = std::copy(std::begin(rec.method), std::end(rec.method), p);
+  *p++ = ' ';
+  p = std::copy(std::begin(rec.path), std::end(rec.path), p);
+  *p++ = ' ';
+  p = copy_http_version(p, rec);
+
+  // Only path might contain the characters which need escaping.
+  Enc::escaped(out, lf, StringRef{reinterpret_cast<char *>(iov.base), p});
+}
+} // namespace
+
+namespace {
+template <typename Enc>
+void write_method(LogOutput &out, const LogFragment &lf,
+                  const LogRecord &rec) {
+  Enc::safe(out, lf, rec.method);
+}
+} // namespace
+
+namespace {
+template <typename Enc>
+void write_path(LogOutput &out, const LogFragment &lf, const LogRecord &rec) {
+  Enc::escaped(out, lf, rec.path);
+}
+} // namespace
+
+namespace {
+template <typename Enc>
+void write_path_without_query(LogOutput &out, const LogFragment &lf,
+                              const LogRecord &rec) {
+  Enc::escaped(out, lf, rec.path_without_query);
+}
+} // namespace
+
+namespace {
+template <typename Enc>
+void write_protocol_version(LogOutput &out, const LogFragment &lf,
+                            const LogRecord &rec) {
+  std::array<char, str_size("HTTP/") + NGHTTP2_MAX_UINT64_DIGITS * 2 + 1> buf;
+  auto p = copy_http_version(buf.data(), rec);
+  Enc::safe(out, lf, StringRef{buf.data(), p});
+}
+} // namespace
+
+namespace {
+template <typename Enc>
+void write_status(LogOutput &out, const LogFragment &lf,
+                  const LogRecord &rec) {
+  write_uint<Enc>(out, lf, rec.resp.http_status);
+}
+} // namespace
+
+namespace {
+template <typename Enc>
+void write_body_bytes_sent(LogOutput &out, const LogFragment &lf,
+                           const LogRecord &rec) {
+  write_uint<Enc>(out, lf, rec.downstream->response_sent_body_length);
+}
+} // namespace
+
+namespace {
+template <typename Enc>
+void write_http(LogOutput &out, const LogFragment &lf, const LogRecord &rec) {
+  auto hd = rec.req.fs.header(lf.value);
+  if (!hd) {
+    Enc::none(out, lf);
+    return;
+  }
+
+  Enc::escaped(out, lf, (*hd).value);
+}
+} // namespace
+
+namespace {
+template <typename Enc>
+void write_authority(LogOutput &out, const LogFragment &lf,
+                     const LogRecord &rec) {
+  if (rec.req.authority.empty()) {
+    Enc::none(out, lf);
+    return;
+  }
+
+  Enc::verbatim(out, lf, rec.req.authority);
+}
+} // namespace
+
+namespace {
+template <typename Enc>
+void write_remote_port(LogOutput &out, const LogFragment &lf,
+                       const LogRecord &rec) {
+  Enc::safe(out, lf, rec.lgsp.remote_port);
+}
+} // namespace
+
+namespace {
+template <typename Enc>
+void write_server_port(LogOutput &out, const LogFragment &lf,
+                       const LogRecord &rec) {
+  write_uint<Enc>(out, lf, rec.lgsp.server_port);
+}
+} // namespace
+
+namespace {
+// Writes |t| milliseconds in seconds with millisecond resolution.
+template <typename Enc>
+void write_msec(LogOutput &out, const LogFragment &lf, uint64_t t) {
+  std::array<char, NGHTTP2_MAX_UINT64_DIGITS + str_size(".000")> buf;
+  auto p = util::utos(buf.data(), t / 1000);
+  *p++ = '.';
+  auto frac = t % 1000;
+  *p++ = '0' + frac / 100;
+  *p++ = '0' + frac / 10 % 10;
+  *p++ = '0' + frac % 10;
+
+  Enc::number(out, lf, StringRef{buf.data(), p});
+}
+} // namespace
+
+namespace {
+template <typename Enc>
+void write_request_time(LogOutput &out, const LogFragment &lf,
+                        const LogRecord &rec) {
+  auto t = std::chrono::duration_cast<std::chrono::milliseconds>(
+               rec.lgsp.request_end_time -
+               rec.downstream->get_request_start_time())
+               .count();
+
+  write_msec<Enc>(out, lf, t);
+}
+} // namespace
+
+namespace {
+template <typename Enc>
+void write_pid(LogOutput &out, const LogFragment &lf, const LogRecord &rec) {
+  write_uint<Enc>(out, lf, rec.lgsp.pid);
+}
+} // namespace
+
+namespace {
+template <typename Enc>
+void write_alpn(LogOutput &out, const LogFragment &lf, const LogRecord &rec) {
+  Enc::escaped(out, lf, rec.lgsp.alpn);
+}
+} // namespace
+
+namespace {
+template <typename Enc>
+void write_tls_cipher(LogOutput &out, const LogFragment &lf,
+                      const LogRecord &rec) {
+  if (!rec.lgsp.ssl) {
+    Enc::none(out, lf);
+    return;
+  }
+
+  Enc::safe(out, lf, StringRef{SSL_get_cipher_name(rec.lgsp.ssl)});
+}
+} // namespace
+
+namespace {
+template <typename Enc>
+void write_tls_protocol(LogOutput &out, const LogFragment &lf,
+                        const LogRecord &rec) {
+  if (!rec.lgsp.ssl) {
+    Enc::none(out, lf);
+    return;
+  }
+
+  Enc::safe(out, lf, StringRef{nghttp2::tls::get_tls_protocol(rec.lgsp.ssl)});
+}
+} // namespace
+
+namespace {
+template <typename Enc>
+void write_tls_session_id(LogOutput &out, const LogFragment &lf,
+                          const LogRecord &rec) {
+  auto session = rec.lgsp.ssl ? SSL_get_session(rec.lgsp.ssl) : nullptr;
+  if (!session) {
+    Enc::none(out, lf);
+    return;
+  }
+
+  unsigned int session_id_length = 0;
+  auto session_id = SSL_SESSION_get_id(session, &session_id_length);
+  if (session_id_length == 0) {
+    Enc::none(out, lf);
+    return;
+  }
+
+  std::array<char, SSL_MAX_SSL_SESSION_ID_LENGTH * 2> buf;
+  auto p = std::begin(buf);
+  std::tie(p, std::ignore) = copy_hex_low(session_id, session_id_length, p,
+                                          std::end(buf));
+
+  Enc::safe(out, lf, StringRef{std::begin(buf), p});
+}
+} // namespace
+
+namespace {
+template <typename Enc>
+void write_tls_session_reused(LogOutput &out, const LogFragment &lf,
+                              const LogRecord &rec) {
+  if (!rec.lgsp.ssl) {
+    Enc::none(out, lf);
+    return;
+  }
+
+  Enc::safe(out, lf,
+            SSL_session_reused(rec.lgsp.ssl) ? StringRef::from_lit("r")
+                                             : StringRef::from_lit("."));
+}
+} // namespace
+
+namespace {
+template <typename Enc>
+void write_tls_sni(LogOutput &out, const LogFragment &lf,
+                   const LogRecord &rec) {
+  if (rec.lgsp.sni.empty()) {
+    Enc::none(out, lf);
+    return;
+  }
+
+  Enc::escaped(out, lf, rec.lgsp.sni);
+}
+} // namespace
+
+namespace {
+template <typename Enc>
+void write_tls_client_fingerprint(LogOutput &out, const LogFragment &lf,
+                                  const LogRecord &rec) {
+  if (!rec.lgsp.ssl) {
+    Enc::none(out, lf);
+    return;
+  }
+
+  auto x = SSL_get_peer_certificate(rec.lgsp.ssl);
+  if (!x) {
+    Enc::none(out, lf);
+    return;
+  }
+
+  std::array<uint8_t, 32> md;
+  auto len = tls::get_x509_fingerprint(
+      md.data(), md.size(), x,
+      lf.type == LogFragmentType::TLS_CLIENT_FINGERPRINT_SHA256 ? EVP_sha256()
+                                                                : EVP_sha1());
+  X509_free(x);
+  if (len <= 0) {
+    Enc::none(out, lf);
+    return;
+  }
+
+  std::array<char, 64> buf;
+  auto p = std::begin(buf);
+  std::tie(p, std::ignore) = copy_hex_low(md.data(), len, p, std::end(buf));
+
+  Enc::safe(out, lf, StringRef{std::begin(buf), p});
+}
+} // namespace
+
+namespace {
+template <typename Enc>
+void write_tls_client_name(LogOutput &out, const LogFragment &lf,
+                           const LogRecord &rec) {
+  if (!rec.lgsp.ssl) {
+    Enc::none(out, lf);
+    return;
+  }
+
+  auto x = SSL_get_peer_certificate(rec.lgsp.ssl);
+  if (!x) {
+    Enc::none(out, lf);
+    return;
+  }
+
+  auto name = lf.type == LogFragmentType::TLS_CLIENT_ISSUER_NAME
+                  ? tls::get_x509_issuer_name(rec.balloc, x)
+                  : tls::get_x509_subject_name(rec.balloc, x);
+  X509_free(x);
+  if (name.empty()) {
+    Enc::none(out, lf);
+    return;
+  }
+
+  Enc::verbatim(out, lf, name);
+}
+} // namespace
+
+namespace {
+template <typename Enc>
+void write_tls_client_serial(LogOutput &out, const LogFragment &lf,
+                             const LogRecord &rec) {
+  if (!rec.lgsp.ssl) {
+    Enc::none(out, lf);
+    return;
+  }
+
+  auto x = SSL_get_peer_certificate(rec.lgsp.ssl);
+  if (!x) {
+    Enc::none(out, lf);
+    return;
+  }
+
+  auto sn = tls::get_x509_serial(rec.balloc, x);
+  X509_free(x);
+  if (sn.empty()) {
+    Enc::none(out, lf);
+    return;
+  }
+
+  Enc::safe(out, lf, sn);
+}
+} // namespace
+
+namespace {
+template <typename Enc>
+void write_backend_host(LogOutput &out, const LogFragment &lf,
+                        const LogRecord &rec) {
+  if (!rec.downstream_addr) {
+    Enc::none(out, lf);
+    return;
+  }
+
+  Enc::verbatim(out, lf, rec.downstream_addr->host);
+}
+} // namespace
+
+namespace {
+template <typename Enc>
+void write_backend_port(LogOutput &out, const LogFragment &lf,
+                        const LogRecord &rec) {
+  if (!rec.downstream_addr) {
+    Enc::none(out, lf);
+    return;
+  }
+
+  write_uint<Enc>(out, lf, rec.downstream_addr->port);
+}
+} // namespace
+
+namespace {
+template <typename Enc>
+void write_backend_queue_time(LogOutput &out, const LogFragment &lf,
+                              const LogRecord &rec) {
+  write_msec<Enc>(
+      out, lf,
+      static_cast<uint64_t>(rec.downstream->get_queue_time() * 1000));
+}
+} // namespace
+
+namespace {
+template <typename Enc>
+void write_none(LogOutput &out, const LogFragment &lf, const LogRecord &rec) {}
+} // namespace
+
+namespace {
+template <typename Enc>
+LogFragmentWriter get_log_fragment_writer(LogFragmentType type) {
+  switch (type) {
+  case LogFragmentType::LITERAL:
+    return write_literal<Enc>;
+  case LogFragmentType::REMOTE_ADDR:
+    return write_remote_addr<Enc>;
+  case LogFragmentType::TIME_LOCAL:
+    return write_time_local<Enc>;
+  case LogFragmentType::TIME_ISO8601:
+    return write_time_iso8601<Enc>;
+  case LogFragmentType::REQUEST:
+    return write_request<Enc>;
+  case LogFragmentType::METHOD:
+    return write_method<Enc>;
+  case LogFragmentType::PATH:
+    return write_path<Enc>;
+  case LogFragmentType::PATH_WITHOUT_QUERY:
+    return write_path_without_query<Enc>;
+  case LogFragmentType::PROTOCOL_VERSION:
+    return write_protocol_version<Enc>;
+  case LogFragmentType::STATUS:
+    return write_status<Enc>;
+  case LogFragmentType::BODY_BYTES_SENT:
+    return write_body_bytes_sent<Enc>;
+  case LogFragmentType::HTTP:
+    return write_http<Enc>;
+  case LogFragmentType::AUTHORITY:
+    return write_authority<Enc>;
+  case LogFragmentType::REMOTE_PORT:
+    return write_remote_port<Enc>;
+  case LogFragmentType::SERVER_PORT:
+    return write_server_port<Enc>;
+  case LogFragmentType::REQUEST_TIME:
+    return write_request_time<Enc>;
+  case LogFragmentType::PID:
+    return write_pid<Enc>;
+  case LogFragmentType::ALPN:
+    return write_alpn<Enc>;
+  case LogFragmentType::TLS_CIPHER:
+    return write_tls_cipher<Enc>;
+  case LogFragmentType::TLS_PROTOCOL:
+    return write_tls_protocol<Enc>;
+  case LogFragmentType::TLS_SESSION_ID:
+    return write_tls_session_id<Enc>;
+  case LogFragmentType::TLS_SESSION_REUSED:
+    return write_tls_session_reused<Enc>;
+  case LogFragmentType::TLS_SNI:
+    return write_tls_sni<Enc>;
+  case LogFragmentType::TLS_CLIENT_FINGERPRINT_SHA1:
+  case LogFragmentType::TLS_CLIENT_FINGERPRINT_SHA256:
+    return write_tls_client_fingerprint<Enc>;
+  case LogFragmentType::TLS_CLIENT_ISSUER_NAME:
+  case LogFragmentType::TLS_CLIENT_SUBJECT_NAME:
+    return write_tls_client_name<Enc>;
+  case LogFragmentType::TLS_CLIENT_SERIAL:
+    return write_tls_client_serial<Enc>;
+  case LogFragmentType::BACKEND_HOST:
+    return write_backend_host<Enc>;
+  case LogFragmentType::BACKEND_PORT:
+    return write_backend_port<Enc>;
+  case LogFragmentType::BACKEND_QUEUE_TIME:
+    return write_backend_queue_time<Enc>;
+  default:
+    return write_none<Enc>;
+  }
+}
+} // namespace
+
+namespace {
+// Returns the key of |lf| for |encoding|.  |first| is true if |lf| is
+// the first field in a record.
+StringRef make_log_fragment_key(BlockAllocator &balloc, const LogFragment &lf,
+                                AccessLogEncoding encoding, bool first) {
+  switch (encoding) {
+  case AccessLogEncoding::JSON: {
+    auto iov = make_byte_ref(balloc, lf.name.size() + str_size(",\"\":") + 1);
+    auto p = iov.base;
+    if (!first) {
+      *p++ = ',';
+    }
+    *p++ = '"';
+    p = std::copy(std::begin(lf.name), std::end(lf.name), p);
+    *p++ = '"';
+    *p++ = ':';
+    *p = '\0';
+
+    return StringRef{iov.base, p};
+  }
+  case AccessLogEncoding::BINARY: {
+    auto namelen = std::min(lf.value.size(), static_cast<size_t>(255));
+    auto iov = make_byte_ref(balloc, 2 + namelen + 1);
+    auto p = iov.base;
+    *p++ = static_cast<uint8_t>(lf.type);
+    if (lf.type == LogFragmentType::HTTP) {
+      *p++ = namelen;
+      p = std::copy_n(std::begin(lf.value), namelen, p);
+    }
+    *p = '\0';
+
+    return StringRef{iov.base, p};
+  }
+  default:
+    return StringRef{};
+  }
+}
+} // namespace
+
+void compile_log_format(BlockAllocator &balloc, std::vector<LogFragment> &lfv,
+                        AccessLogEncoding encoding) {
+  auto first = true;
+
+  for (auto &lf : lfv) {
+    switch (encoding) {
+    case AccessLogEncoding::TEXT:
+      lf.write = get_log_fragment_writer<TextLogEncoding>(lf.type);
+      break;
+    case AccessLogEncoding::JSON:
+      lf.write = get_log_fragment_writer<JSONLogEncoding>(lf.type);
+      break;
+    case AccessLogEncoding::BINARY:
+      lf.write = get_log_fragment_writer<BinaryLogEncoding>(lf.type);
+      break;
+    }
+
+    if (lf.type == LogFragmentType::LITERAL) {
+      continue;
+    }
+
+    lf.key = make_log_fragment_key(balloc, lf, encoding, first);
+
+    first = false;
+  }
+}
+
+namespace {
+template <typename Enc>
+void write_log_record(LogOutput &out, const std::vector<LogFragment> &lfv,
+                      const LogRecord &rec) {
+  auto first = out.p;
+
+  Enc::begin_record(out);
+
+  for (auto &lf : lfv) {
+    lf.write(out, lf, rec);
+  }
+
+  Enc::end_record(out, first);
+}
+} // namespace
+
 void upstream_accesslog(const std::vector<LogFragment> &lfv,
                         const LogSpec &lgsp) {
   auto config = get_config();
   auto lgconf = log_config();
   auto &accessconf = get_config()->logging.access;
 
-  if (lgconf->accesslog_fd == -1 && !accessconf.syslog) {
+  if (!lgconf->accesslog_ring && lgconf->accesslog_fd == -1 &&
+      !accessconf.syslog) {
     return;
   }
 
@@ -588,11 +1387,8 @@ void upstream_accesslog(const std::vector<LogFragment> &lfv,
   auto downstream = lgsp.downstream;
 
   const auto &req = downstream->request();
-  const auto &resp = downstream->response();
-  const auto &tstamp = req.tstamp;
   auto &balloc = downstream->get_block_allocator();
 
-  auto downstream_addr = downstream->get_addr();
   auto method = req.method == -1 ? StringRef::from_lit("<unknown>")
                                  : http2::to_method_string(req.method);
   auto path = req.method == HTTP_CONNECT
@@ -609,246 +1405,55 @@ void upstream_accesslog(const std::vector<LogFragment> &lfv,
           : StringRef{std::begin(path),
                       std::find(std::begin(path), std::end(path), '?')};
 
-  auto p = std::begin(buf);
-  auto last = std::end(buf) - 2;
-
-  for (auto &lf : lfv) {
-    switch (lf.type) {
-    case LogFragmentType::LITERAL:
-      std::tie(p, last) = copy(lf.value, p, last);
-      break;
-    case LogFragmentType::REMOTE_ADDR:
-      std::tie(p, last) = copy(lgsp.remote_addr, p, last);
-      break;
-    case LogFragmentType::TIME_LOCAL:
-      std::tie(p, last) = copy(tstamp->time_local, p, last);
-      break;
-    case LogFragmentType::TIME_ISO8601:
-      std::tie(p, last) = copy(tstamp->time_iso8601, p, last);
-      break;
-    case LogFragmentType::REQUEST:
-      std::tie(p, last) = copy(method, p, last);
-      std::tie(p, last) = copy(' ', p, last);
-      std::tie(p, last) = copy_escape(path, p, last);
-      std::tie(p, last) = copy_l(" HTTP/", p, last);
-      std::tie(p, last) = copy(req.http_major, p, last);
-      if (req.http_major < 2) {
-        std::tie(p, last) = copy('.', p, last);
-        std::tie(p, last) = copy(req.http_minor, p, last);
-      }
-      break;
-    case LogFragmentType::METHOD:
-      std::tie(p, last) = copy(method, p, last);
-      break;
-    case LogFragmentType::PATH:
-      std::tie(p, last) = copy_escape(path, p, last);
-      break;
-    case LogFragmentType::PATH_WITHOUT_QUERY:
-      std::tie(p, last) = copy_escape(path_without_query, p, last);
-      break;
-    case LogFragmentType::PROTOCOL_VERSION:
-      std::tie(p, last) = copy_l("HTTP/", p, last);
-      std::tie(p, last) = copy(req.http_major, p, last);
-      if (req.http_major < 2) {
-        std::tie(p, last) = copy('.', p, last);
-        std::tie(p, last) = copy(req.http_minor, p, last);
-      }
-      break;
-    case LogFragmentType::STATUS:
-      std::tie(p, last) = copy(resp.http_status, p, last);
-      break;
-    case LogFragmentType::BODY_BYTES_SENT:
-      std::tie(p, last) = copy(downstream->response_sent_body_length, p, last);
-      break;
-    case LogFragmentType::HTTP: {
-      auto hd = req.fs.header(lf.value);
-      if (hd) {
-        std::tie(p, last) = copy_escape((*hd).value, p, last);
-        break;
-      }
+  auto rec = LogRecord{
+      lgsp,
+      downstream,
+      req,
+      downstream->response(),
+      balloc,
+      downstream->get_addr(),
+      method,
+      path,
+      path_without_query,
+  };
+
+  auto out = LogOutput{std::begin(buf), std::end(buf) - 2};
+
+  switch (accessconf.encoding) {
+  case AccessLogEncoding::TEXT:
+    write_log_record<TextLogEncoding>(out, lfv, rec);
+    break;
+  case AccessLogEncoding::JSON:
+    write_log_record<JSONLogEncoding>(out, lfv, rec);
+    break;
+  case AccessLogEncoding::BINARY:
+    write_log_record<BinaryLogEncoding>(out, lfv, rec);
+    break;
+  }
 
-      std::tie(p, last) = copy('-', p, last);
+  auto p = out.p;
 
-      break;
-    }
-    case LogFragmentType::AUTHORITY:
-      if (!req.authority.empty()) {
-        std::tie(p, last) = copy(req.authority, p, last);
-        break;
-      }
+  if (accessconf.encoding != AccessLogEncoding::BINARY) {
+    if (accessconf.syslog && !lgconf->accesslog_ring) {
+      *p = '\0';
 
-      std::tie(p, last) = copy('-', p, last);
+      syslog(LOG_INFO, "%s", buf.data());
 
-      break;
-    case LogFragmentType::REMOTE_PORT:
-      std::tie(p, last) = copy(lgsp.remote_port, p, last);
-      break;
-    case LogFragmentType::SERVER_PORT:
-      std::tie(p, last) = copy(lgsp.server_port, p, last);
-      break;
-    case LogFragmentType::REQUEST_TIME: {
-      auto t = std::chrono::duration_cast<std::chrono::milliseconds>(
-                   lgsp.request_end_time - downstream->get_request_start_time())
-                   .count();
-      std::tie(p, last) = copy(t / 1000, p, last);
-      std::tie(p, last) = copy('.', p, last);
-      auto frac = t % 1000;
-      if (frac < 100) {
-        auto n = frac < 10 ? 2 : 1;
-        std::tie(p, last) = copy("000", n, p, last);
-      }
-      std::tie(p, last) = copy(frac, p, last);
-      break;
-    }
-    case LogFragmentType::PID:
-      std::tie(p, last) = copy(lgsp.pid, p, last);
-      break;
-    case LogFragmentType::ALPN:
-      std::tie(p, last) = copy_escape(lgsp.alpn, p, last);
-      break;
-    case LogFragmentType::TLS_CIPHER:
-      if (!lgsp.ssl) {
-        std::tie(p, last) = copy('-', p, last);
-        break;
-      }
-      std::tie(p, last) = copy(SSL_get_cipher_name(lgsp.ssl), p, last);
-      break;
-    case LogFragmentType::TLS_PROTOCOL:
-      if (!lgsp.ssl) {
-        std::tie(p, last) = copy('-', p, last);
-        break;
-      }
-      std::tie(p, last) =
-          copy(nghttp2::tls::get_tls_protocol(lgsp.ssl), p, last);
-      break;
-    case LogFragmentType::TLS_SESSION_ID: {
-      auto session = SSL_get_session(lgsp.ssl);
-      if (!session) {
-        std::tie(p, last) = copy('-', p, last);
-        break;
-      }
-      unsigned int session_id_length = 0;
-      auto session_id = SSL_SESSION_get_id(session, &session_id_length);
-      if (session_id_length == 0) {
-        std::tie(p, last) = copy('-', p, last);
-        break;
-      }
-      std::tie(p, last) = copy_hex_low(session_id, session_id_length, p, last);
-      break;
-    }
-    case LogFragmentType::TLS_SESSION_REUSED:
-      if (!lgsp.ssl) {
-        std::tie(p, last) = copy('-', p, last);
-        break;
-      }
-      std::tie(p, last) =
-          copy(SSL_session_reused(lgsp.ssl) ? 'r' : '.', p, last);
-      break;
-    case LogFragmentType::TLS_SNI:
-      if (lgsp.sni.empty()) {
-        std::tie(p, last) = copy('-', p, last);
-        break;
-      }
-      std::tie(p, last) = copy_escape(lgsp.sni, p, last);
-      break;
-    case LogFragmentType::TLS_CLIENT_FINGERPRINT_SHA1:
-    case LogFragmentType::TLS_CLIENT_FINGERPRINT_SHA256: {
-      if (!lgsp.ssl) {
-        std::tie(p, last) = copy('-', p, last);
-        break;
-      }
-      auto x = SSL_get_peer_certificate(lgsp.ssl);
-      if (!x) {
-        std::tie(p, last) = copy('-', p, last);
-        break;
-      }
-      std::array<uint8_t, 32> buf;
-      auto len = tls::get_x509_fingerprint(
-          buf.data(), buf.size(), x,
-          lf.type == LogFragmentType::TLS_CLIENT_FINGERPRINT_SHA256
-              ? EVP_sha256()
-              : EVP_sha1());
-      X509_free(x);
-      if (len <= 0) {
-        std::tie(p, last) = copy('-', p, last);
-        break;
-      }
-      std::tie(p, last) = copy_hex_low(buf.data(), len, p, last);
-      break;
-    }
-    case LogFragmentType::TLS_CLIENT_ISSUER_NAME:
-    case LogFragmentType::TLS_CLIENT_SUBJECT_NAME: {
-      if (!lgsp.ssl) {
-        std::tie(p, last) = copy('-', p, last);
-        break;
-      }
-      auto x = SSL_get_peer_certificate(lgsp.ssl);
-      if (!x) {
-        std::tie(p, last) = copy('-', p, last);
-        break;
-      }
-      auto name = lf.type == LogFragmentType::TLS_CLIENT_ISSUER_NAME
-                      ? tls::get_x509_issuer_name(balloc, x)
-                      : tls::get_x509_subject_name(balloc, x);
-      X509_free(x);
-      if (name.empty()) {
-        std::tie(p, last) = copy('-', p, last);
-        break;
-      }
-      std::tie(p, last) = copy(name, p, last);
-      break;
-    }
-    case LogFragmentType::TLS_CLIENT_SERIAL: {
-      if (!lgsp.ssl) {
-        std::tie(p, last) = copy('-', p, last);
-        break;
-      }
-      auto x = SSL_get_peer_certificate(lgsp.ssl);
-      if (!x) {
-        std::tie(p, last) = copy('-', p, last);
-        break;
-      }
-      auto sn = tls::get_x509_serial(balloc, x);
-      X509_free(x);
-      if (sn.empty()) {
-        std::tie(p, last) = copy('-', p, last);
-        break;
-      }
-      std::tie(p, last) = copy(sn, p, last);
-      break;
-    }
-    case LogFragmentType::BACKEND_HOST:
-      if (!downstream_addr) {
-        std::tie(p, last) = copy('-', p, last);
-        break;
-      }
-      std::tie(p, last) = copy(downstream_addr->host, p, last);
-      break;
-    case LogFragmentType::BACKEND_PORT:
-      if (!downstream_addr) {
-        std::tie(p, last) = copy('-', p, last);
-        break;
-      }
-      std::tie(p, last) = copy(downstream_addr->port, p, last);
-      break;
-    case LogFragmentType::NONE:
-      break;
-    default:
-      break;
+      return;
     }
+
+    *p++ = '\n';
   }
 
-  *p = '\0';
+  auto nwrite = std::distance(std::begin(buf), p);
 
-  if (accessconf.syslog) {
-    syslog(LOG_INFO, "%s", buf.data());
+  if (lgconf->accesslog_ring) {
+    lgconf->accesslog_ring->push(reinterpret_cast<uint8_t *>(buf.data()),
+                                 nwrite);
 
     return;
   }
 
-  *p++ = '\n';
-
-  auto nwrite = std::distance(std::begin(buf), p);
   while (write(lgconf->accesslog_fd, buf.data(), nwrite) == -1 &&
          errno == EINTR)
     ;
@@ -863,7 +1468,10 @@ int reopen_log_files(const LoggingConfig &loggingconf) {
   auto &accessconf = loggingconf.access;
   auto &errorconf = loggingconf.error;
 
-  if (!accessconf.syslog && !accessconf.file.empty()) {
+  // Access log file is opened by AccessLogWriter if asynchronous
+  // access log is enabled.
+  if (!accessconf.syslog && !accessconf.file.empty() &&
+      !lgconf->accesslog_ring) {
     new_accesslog_fd = open_log_file(accessconf.file.c_str());
 
     if (new_accesslog_fd == -1) {
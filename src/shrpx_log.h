@@ -217,6 +217,8 @@ void dec(Log &log);
 #define TTY_HTTP_HD (log_config()->errorlog_tty ? "\033[1;34m" : "")
 #define TTY_RST (log_config()->errorlog_tty ? "\033[0m" : "")
 
+// The numeric value of LogFragmentType is used as field id in binary
+// access log format.  Add new types to the end.
 enum class LogFragmentType {
   NONE,
   LITERAL,
@@ -253,13 +255,40 @@ enum class LogFragmentType {
   PATH,
   PATH_WITHOUT_QUERY,
   PROTOCOL_VERSION,
+  BACKEND_QUEUE_TIME,
 };
 
+// The version of binary access log format.  Increment this when
+// the format changes in incompatible way.
+constexpr uint8_t ACCESSLOG_BINARY_VERSION = 1;
+
+struct LogFragment;
+struct LogOutput;
+struct LogRecord;
+
+// LogFragmentWriter writes the value of |lf| to |out|.
+using LogFragmentWriter = void (*)(LogOutput &out, const LogFragment &lf,
+                                   const LogRecord &rec);
+
 struct LogFragment {
-  LogFragment(LogFragmentType type, StringRef value = StringRef::from_lit(""))
-      : type(type), value(std::move(value)) {}
+  LogFragment(LogFragmentType type, StringRef value = StringRef::from_lit(""),
+              StringRef name = StringRef::from_lit(""))
+      : type(type),
+        value(std::move(value)),
+        name(std::move(name)),
+        write(nullptr) {}
   LogFragmentType type;
   StringRef value;
+  // The name of variable without leading '$' (e.g., remote_addr).
+  // This is empty if type == LogFragmentType::LITERAL.
+  StringRef name;
+  // The prefix written before the value of this fragment, which is
+  // specific to AccessLogEncoding.  This is set by
+  // compile_log_format.
+  StringRef key;
+  // The function to write this fragment, which is set by
+  // compile_log_format.
+  LogFragmentWriter write;
 };
 
 struct LogSpec {
@@ -274,6 +303,11 @@ struct LogSpec {
   pid_t pid;
 };
 
+// Prepares |lfv| to write access log in |encoding|.  This function
+// must be called before |lfv| is passed to upstream_accesslog.
+void compile_log_format(BlockAllocator &balloc, std::vector<LogFragment> &lfv,
+                        AccessLogEncoding encoding);
+
 void upstream_accesslog(const std::vector<LogFragment> &lf,
                         const LogSpec &lgsp);
 
@@ -47,6 +47,7 @@ LogConfig::LogConfig()
       pid(getpid()),
       accesslog_fd(-1),
       errorlog_fd(-1),
+      accesslog_ring(nullptr),
       errorlog_tty(false) {
   auto tid = std::this_thread::get_id();
   auto tid_hash =
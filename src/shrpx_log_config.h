@@ -37,6 +37,8 @@ using namespace nghttp2;
 
 namespace shrpx {
 
+class AccessLogRing;
+
 struct Timestamp {
   Timestamp(const std::chrono::system_clock::time_point &tp);
 
@@ -55,6 +57,9 @@ struct LogConfig {
   pid_t pid;
   int accesslog_fd;
   int errorlog_fd;
+  // If non-null, access log records are queued to this buffer, and
+  // written by AccessLogWriter instead of this thread.
+  AccessLogRing *accesslog_ring;
   // true if errorlog_fd is referring to a terminal.
   bool errorlog_tty;
 
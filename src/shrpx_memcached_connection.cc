@@ -107,7 +107,7 @@ MemcachedConnection::MemcachedConnection(const Address *addr,
       do_write_(&MemcachedConnection::noop),
       sni_name_(sni_name),
       connect_blocker_(
-          gen, loop, [] {}, [] {}),
+          gen, loop, [] {}, [] {}, nullptr),
       parse_state_{},
       addr_(addr),
       ssl_ctx_(ssl_ctx),
@@ -186,7 +186,8 @@ int MemcachedConnection::initiate_connection() {
       SSL_set_tlsext_host_name(conn_.tls.ssl, sni_name_.c_str());
     }
 
-    auto session = tls::reuse_tls_session(tls_session_cache_);
+    auto session = tls::reuse_tls_session(tls_session_cache_,
+                                          ev_now(conn_.loop));
     if (session) {
       SSL_set_session(conn_.tls.ssl, session);
       SSL_SESSION_free(session);
@@ -0,0 +1,801 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_metrics.h"
+
+#include <cmath>
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <tuple>
+#include <unordered_set>
+
+#include "shrpx_worker.h"
+#include "shrpx_connection_handler.h"
+#include "shrpx_log.h"
+#include "shrpx_load_balancer.h"
+#include "shrpx_cache.h"
+#include "shrpx_tls_session_store.h"
+#include "util.h"
+
+namespace shrpx {
+
+namespace {
+// Returns floor(log2(v)).  |v| must be greater than 0.
+size_t log2_floor(uint64_t v) {
+  size_t n = 0;
+  for (size_t s = 32; s; s >>= 1) {
+    if (v >> s) {
+      v >>= s;
+      n += s;
+    }
+  }
+  return n;
+}
+} // namespace
+
+size_t latency_histogram_bucket_index(uint64_t v) {
+  if (v < LATENCY_HISTOGRAM_SUB_BUCKETS) {
+    return v;
+  }
+
+  auto m = log2_floor(v);
+  if (m >= LATENCY_HISTOGRAM_MAX_MAGNITUDE) {
+    return LATENCY_HISTOGRAM_NUM_BUCKETS - 1;
+  }
+
+  auto k = m - LATENCY_HISTOGRAM_SUB_BUCKET_BITS;
+  auto sub = (v >> k) & (LATENCY_HISTOGRAM_SUB_BUCKETS - 1);
+
+  return (k + 1) * LATENCY_HISTOGRAM_SUB_BUCKETS + sub;
+}
+
+namespace {
+uint64_t latency_histogram_bucket_lower_bound(size_t idx) {
+  if (idx < LATENCY_HISTOGRAM_SUB_BUCKETS) {
+    return idx;
+  }
+
+  auto k = idx / LATENCY_HISTOGRAM_SUB_BUCKETS - 1;
+  auto sub = idx % LATENCY_HISTOGRAM_SUB_BUCKETS;
+
+  return static_cast<uint64_t>(LATENCY_HISTOGRAM_SUB_BUCKETS + sub) << k;
+}
+} // namespace
+
+uint64_t latency_histogram_bucket_upper_bound(size_t idx) {
+  if (idx == LATENCY_HISTOGRAM_NUM_BUCKETS - 1) {
+    return std::numeric_limits<uint64_t>::max();
+  }
+  return latency_histogram_bucket_lower_bound(idx + 1);
+}
+
+LatencyHistogram::LatencyHistogram() : sum(0) {
+  for (auto &b : buckets) {
+    b.store(0, std::memory_order_relaxed);
+  }
+}
+
+void LatencyHistogram::record(uint64_t v) {
+  metrics_add(buckets[latency_histogram_bucket_index(v)]);
+  metrics_add(sum, v);
+}
+
+void LatencyHistogramSnapshot::merge(const LatencyHistogram &h) {
+  for (size_t i = 0; i < buckets.size(); ++i) {
+    buckets[i] += h.buckets[i].load(std::memory_order_relaxed);
+  }
+  sum += h.sum.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogramSnapshot::count() const {
+  uint64_t n = 0;
+  for (auto b : buckets) {
+    n += b;
+  }
+  return n;
+}
+
+uint64_t LatencyHistogramSnapshot::quantile(double q) const {
+  auto total = count();
+  if (total == 0) {
+    return 0;
+  }
+
+  auto rank = std::max(static_cast<uint64_t>(1),
+                       static_cast<uint64_t>(std::ceil(q * total)));
+
+  uint64_t n = 0;
+  for (size_t i = 0; i < buckets.size(); ++i) {
+    n += buckets[i];
+    if (n < rank) {
+      continue;
+    }
+
+    auto lo = latency_histogram_bucket_lower_bound(i);
+    if (i == buckets.size() - 1) {
+      return lo;
+    }
+
+    // Use the middle of bucket as an estimate.
+    return lo + (latency_histogram_bucket_upper_bound(i) - lo) / 2;
+  }
+
+  return latency_histogram_bucket_lower_bound(buckets.size() - 1);
+}
+
+WorkerMetrics::WorkerMetrics()
+    : connections_accepted(0),
+      tls_handshakes_full(0),
+      tls_handshakes_resumed(0),
+      tls_handshakes_failed(0),
+      backend_tls_handshakes_full(0),
+      backend_tls_handshakes_resumed(0),
+      downstream_queue_blocked(0),
+      snapshot{} {
+  for (auto &c : requests) {
+    c.store(0, std::memory_order_relaxed);
+  }
+}
+
+void metrics_record_request(WorkerMetrics &m, unsigned int status,
+                            uint64_t duration_us) {
+  auto cls = status / 100;
+  if (cls >= METRICS_NUM_STATUS_CLASSES) {
+    cls = 0;
+  }
+
+  metrics_add(m.requests[cls]);
+  m.request_duration.record(duration_us);
+}
+
+void metrics_update_snapshot(Worker *worker) {
+  auto &m = worker->get_metrics();
+  auto mcpool = worker->get_mcpool();
+  auto now = ev_now(worker->get_loop());
+
+  std::vector<BackendMetricsSnapshot> backends;
+  std::unordered_set<SharedDownstreamAddr *> seen;
+
+  for (auto &group : worker->get_downstream_addr_groups()) {
+    auto shared_addr = group->shared_addr.get();
+    if (!seen.insert(shared_addr).second) {
+      continue;
+    }
+
+    for (auto &addr : shared_addr->addrs) {
+      backends.push_back(BackendMetricsSnapshot{
+          std::string{std::begin(addr.hostport), std::end(addr.hostport)},
+          addr.proto == Proto::HTTP2 ? StringRef::from_lit("h2")
+                                     : StringRef::from_lit("h1"),
+          addr.dconn_pool->size(),
+          addr.num_dconn,
+          addr.num_responses,
+          addr.num_inflight,
+          static_cast<uint64_t>(load_balancer_get_latency(&addr, now) *
+                                1000000.),
+          addr.dconn_pool->get_num_hits(),
+          addr.dconn_pool->get_num_misses(),
+          addr.outlier_detector.ejected(now),
+          addr.outlier_detector.get_num_ejections(),
+      });
+    }
+  }
+
+  std::lock_guard<std::mutex> g(m.snapshot_mu);
+
+  auto &snapshot = m.snapshot;
+
+  snapshot.backends = std::move(backends);
+  snapshot.mcpool_allocated = mcpool->poolsize;
+  snapshot.mcpool_free = mcpool->freelistsize;
+  snapshot.mcpool_peak = mcpool->peak_poolsize;
+  snapshot.mcpool_released = mcpool->releasedsize;
+  snapshot.num_connections = worker->get_worker_stat()->num_connections;
+}
+
+namespace {
+// Appends |us| microseconds to |out| in seconds.
+void append_seconds(std::string &out, uint64_t us) {
+  out += util::utos(us / 1000000);
+
+  auto frac = us % 1000000;
+  if (frac == 0) {
+    return;
+  }
+
+  std::array<char, 7> buf;
+  auto p = std::end(buf);
+  for (size_t i = 0; i < 6; ++i) {
+    *--p = '0' + frac % 10;
+    frac /= 10;
+  }
+
+  auto last = std::end(buf);
+  for (; *(last - 1) == '0'; --last)
+    ;
+
+  out += '.';
+  out.append(p, last);
+}
+} // namespace
+
+namespace {
+// Appends |s| to |out| as a label value.
+void append_label_value(std::string &out, const StringRef &s) {
+  for (auto c : s) {
+    switch (c) {
+    case '\\':
+      out += "\\\\";
+      break;
+    case '"':
+      out += "\\\"";
+      break;
+    case '\n':
+      out += "\\n";
+      break;
+    default:
+      out += c;
+    }
+  }
+}
+} // namespace
+
+namespace {
+void append_header(std::string &out, const StringRef &name,
+                   const StringRef &help, const StringRef &type) {
+  out += "# HELP ";
+  out.append(std::begin(name), std::end(name));
+  out += ' ';
+  out.append(std::begin(help), std::end(help));
+  out += "\n# TYPE ";
+  out.append(std::begin(name), std::end(name));
+  out += ' ';
+  out.append(std::begin(type), std::end(type));
+  out += '\n';
+}
+} // namespace
+
+namespace {
+void append_metric(std::string &out, const StringRef &name, uint64_t n) {
+  out.append(std::begin(name), std::end(name));
+  out += ' ';
+  out += util::utos(n);
+  out += '\n';
+}
+} // namespace
+
+namespace {
+// Appends the metric |name| of the TLS session cache for |side|.  If
+// |result| is not empty, it is added as "result" label.
+void append_tls_session_cache_metric(std::string &out, const StringRef &name,
+                                     const StringRef &side,
+                                     const StringRef &result, uint64_t n) {
+  out.append(std::begin(name), std::end(name));
+  out += "{side=\"";
+  out.append(std::begin(side), std::end(side));
+  if (!result.empty()) {
+    out += "\",result=\"";
+    out.append(std::begin(result), std::end(result));
+  }
+  out += "\"} ";
+  out += util::utos(n);
+  out += '\n';
+}
+} // namespace
+
+namespace {
+// The upper bounds of histogram buckets exported, in log2 of
+// microseconds.  They range from 128us to about 33.5s.
+constexpr size_t EXPORT_BUCKET_MIN_MAGNITUDE = 7;
+constexpr size_t EXPORT_BUCKET_MAX_MAGNITUDE = 25;
+} // namespace
+
+namespace {
+// Appends |h| as a histogram metric |name| in seconds.
+void append_histogram(std::string &out, const StringRef &name,
+                      const StringRef &help,
+                      const LatencyHistogramSnapshot &h) {
+  append_header(out, name, help, StringRef::from_lit("histogram"));
+
+  auto total = h.count();
+
+  uint64_t n = 0;
+  size_t i = 0;
+  for (auto mag = EXPORT_BUCKET_MIN_MAGNITUDE;
+       mag <= EXPORT_BUCKET_MAX_MAGNITUDE; ++mag) {
+    auto bound = static_cast<uint64_t>(1) << mag;
+    for (; latency_histogram_bucket_upper_bound(i) <= bound; ++i) {
+      n += h.buckets[i];
+    }
+
+    out.append(std::begin(name), std::end(name));
+    out += "_bucket{le=\"";
+    append_seconds(out, bound);
+    out += "\"} ";
+    out += util::utos(n);
+    out += '\n';
+  }
+
+  out.append(std::begin(name), std::end(name));
+  out += "_bucket{le=\"+Inf\"} ";
+  out += util::utos(total);
+  out += '\n';
+  out.append(std::begin(name), std::end(name));
+  out += "_sum ";
+  append_seconds(out, h.sum);
+  out += '\n';
+  out.append(std::begin(name), std::end(name));
+  out += "_count ";
+  out += util::utos(total);
+  out += '\n';
+}
+} // namespace
+
+namespace {
+struct BackendKey {
+  bool operator<(const BackendKey &other) const {
+    return std::tie(hostport, proto) < std::tie(other.hostport, other.proto);
+  }
+
+  std::string hostport;
+  StringRef proto;
+};
+} // namespace
+
+std::string format_metrics(ConnectionHandler *conn_handler) {
+  std::vector<Worker *> workers;
+
+  auto single_worker = conn_handler->get_single_worker();
+  if (single_worker) {
+    workers.push_back(single_worker);
+  } else {
+    for (auto &worker : conn_handler->get_workers()) {
+      workers.push_back(worker.get());
+    }
+  }
+
+  std::array<uint64_t, METRICS_NUM_STATUS_CLASSES> requests{};
+  LatencyHistogramSnapshot duration{};
+  LatencyHistogramSnapshot tls_handshake_duration{};
+  LatencyHistogramSnapshot private_key_op_duration{};
+  LatencyHistogramSnapshot mruby_on_req_duration{};
+  LatencyHistogramSnapshot mruby_on_resp_duration{};
+  uint64_t connections_accepted = 0;
+  uint64_t tls_handshakes_full = 0;
+  uint64_t tls_handshakes_resumed = 0;
+  uint64_t tls_handshakes_failed = 0;
+  uint64_t backend_tls_handshakes_full = 0;
+  uint64_t backend_tls_handshakes_resumed = 0;
+  uint64_t downstream_queue_blocked = 0;
+  std::vector<WorkerMetricsSnapshot> mcpools;
+  uint64_t num_connections = 0;
+  std::map<BackendKey, BackendMetricsSnapshot> backends;
+
+  for (auto worker : workers) {
+    auto &m = worker->get_metrics();
+
+    for (size_t i = 0; i < requests.size(); ++i) {
+      requests[i] += m.requests[i].load(std::memory_order_relaxed);
+    }
+
+    duration.merge(m.request_duration);
+    tls_handshake_duration.merge(m.tls_handshake_duration);
+    private_key_op_duration.merge(m.private_key_op_duration);
+    mruby_on_req_duration.merge(m.mruby_on_req_duration);
+    mruby_on_resp_duration.merge(m.mruby_on_resp_duration);
+
+    connections_accepted +=
+        m.connections_accepted.load(std::memory_order_relaxed);
+    tls_handshakes_full +=
+        m.tls_handshakes_full.load(std::memory_order_relaxed);
+    tls_handshakes_resumed +=
+        m.tls_handshakes_resumed.load(std::memory_order_relaxed);
+    tls_handshakes_failed +=
+        m.tls_handshakes_failed.load(std::memory_order_relaxed);
+    backend_tls_handshakes_full +=
+        m.backend_tls_handshakes_full.load(std::memory_order_relaxed);
+    backend_tls_handshakes_resumed +=
+        m.backend_tls_handshakes_resumed.load(std::memory_order_relaxed);
+    downstream_queue_blocked +=
+        m.downstream_queue_blocked.load(std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> g(m.snapshot_mu);
+
+    auto &snapshot = m.snapshot;
+
+    mcpools.emplace_back();
+    auto &mcpool = mcpools.back();
+    mcpool.mcpool_allocated = snapshot.mcpool_allocated;
+    mcpool.mcpool_free = snapshot.mcpool_free;
+    mcpool.mcpool_peak = snapshot.mcpool_peak;
+    mcpool.mcpool_released = snapshot.mcpool_released;
+    num_connections += snapshot.num_connections;
+
+    for (auto &b : snapshot.backends) {
+      auto &ent = backends[BackendKey{b.hostport, b.proto}];
+      ent.num_idle_conns += b.num_idle_conns;
+      ent.num_streams += b.num_streams;
+      ent.num_responses += b.num_responses;
+      ent.num_inflight += b.num_inflight;
+      ent.pool_hits += b.pool_hits;
+      ent.pool_misses += b.pool_misses;
+      ent.num_ejected += b.num_ejected;
+      ent.num_ejections += b.num_ejections;
+      // Each worker measures latency on its own.  Report the worst.
+      ent.latency_us = std::max(ent.latency_us, b.latency_us);
+    }
+  }
+
+  std::string out;
+
+  append_header(out, StringRef::from_lit("nghttpx_requests_total"),
+                StringRef::from_lit("The number of requests completed."),
+                StringRef::from_lit("counter"));
+  for (size_t i = 0; i < requests.size(); ++i) {
+    out += "nghttpx_requests_total{code=\"";
+    if (i == 0) {
+      out += "other";
+    } else {
+      out += static_cast<char>('0' + i);
+      out += "xx";
+    }
+    out += "\"} ";
+    out += util::utos(requests[i]);
+    out += '\n';
+  }
+
+  append_histogram(out, StringRef::from_lit("nghttpx_request_duration_seconds"),
+                   StringRef::from_lit("The time taken to complete requests."),
+                   duration);
+
+  append_header(
+      out, StringRef::from_lit("nghttpx_request_duration_quantile_seconds"),
+      StringRef::from_lit(
+          "The estimated quantiles of the time taken to complete requests."),
+      StringRef::from_lit("gauge"));
+  for (auto &q : {std::make_pair(0.5, "0.5"), std::make_pair(0.9, "0.9"),
+                  std::make_pair(0.99, "0.99"),
+                  std::make_pair(0.999, "0.999")}) {
+    out += "nghttpx_request_duration_quantile_seconds{quantile=\"";
+    out += q.second;
+    out += "\"} ";
+    append_seconds(out, duration.quantile(q.first));
+    out += '\n';
+  }
+
+  append_header(out, StringRef::from_lit("nghttpx_connections_accepted_total"),
+                StringRef::from_lit("The number of client connections "
+                                    "accepted."),
+                StringRef::from_lit("counter"));
+  append_metric(out, StringRef::from_lit("nghttpx_connections_accepted_total"),
+                connections_accepted);
+
+  append_header(out, StringRef::from_lit("nghttpx_connections_active"),
+                StringRef::from_lit("The number of client connections."),
+                StringRef::from_lit("gauge"));
+  append_metric(out, StringRef::from_lit("nghttpx_connections_active"),
+                num_connections);
+
+  append_header(out, StringRef::from_lit("nghttpx_tls_handshakes_total"),
+                StringRef::from_lit("The number of TLS handshakes with "
+                                    "clients."),
+                StringRef::from_lit("counter"));
+  append_metric(
+      out, StringRef::from_lit("nghttpx_tls_handshakes_total{result=\"full\"}"),
+      tls_handshakes_full);
+  append_metric(
+      out,
+      StringRef::from_lit("nghttpx_tls_handshakes_total{result=\"resumed\"}"),
+      tls_handshakes_resumed);
+  append_metric(
+      out,
+      StringRef::from_lit("nghttpx_tls_handshakes_total{result=\"failed\"}"),
+      tls_handshakes_failed);
+
+  append_histogram(
+      out, StringRef::from_lit("nghttpx_tls_handshake_duration_seconds"),
+      StringRef::from_lit("The time from accepting a connection to the "
+                          "completion of TLS handshake."),
+      tls_handshake_duration);
+
+  append_histogram(
+      out, StringRef::from_lit("nghttpx_tls_private_key_op_duration_seconds"),
+      StringRef::from_lit("The time taken by private key operations "
+                          "offloaded to signing threads."),
+      private_key_op_duration);
+
+  append_histogram(
+      out, StringRef::from_lit("nghttpx_mruby_on_req_duration_seconds"),
+      StringRef::from_lit("The time taken to run mruby request phase hooks."),
+      mruby_on_req_duration);
+
+  append_histogram(
+      out, StringRef::from_lit("nghttpx_mruby_on_resp_duration_seconds"),
+      StringRef::from_lit("The time taken to run mruby response phase hooks."),
+      mruby_on_resp_duration);
+
+  append_header(out,
+                StringRef::from_lit("nghttpx_backend_tls_handshakes_total"),
+                StringRef::from_lit("The number of TLS handshakes with "
+                                    "backends which completed."),
+                StringRef::from_lit("counter"));
+  append_metric(out,
+                StringRef::from_lit(
+                    "nghttpx_backend_tls_handshakes_total{result=\"full\"}"),
+                backend_tls_handshakes_full);
+  append_metric(
+      out,
+      StringRef::from_lit(
+          "nghttpx_backend_tls_handshakes_total{result=\"resumed\"}"),
+      backend_tls_handshakes_resumed);
+
+  append_header(out, StringRef::from_lit("nghttpx_downstream_queue_blocked"),
+                StringRef::from_lit("The number of requests waiting for "
+                                    "backend connection limit."),
+                StringRef::from_lit("gauge"));
+  append_metric(out, StringRef::from_lit("nghttpx_downstream_queue_blocked"),
+                downstream_queue_blocked);
+
+  auto cache = conn_handler->get_response_cache();
+
+  append_header(out, StringRef::from_lit("nghttpx_cache_lookups_total"),
+                StringRef::from_lit("The number of requests looked up in "
+                                    "response cache."),
+                StringRef::from_lit("counter"));
+  append_metric(
+      out, StringRef::from_lit("nghttpx_cache_lookups_total{result=\"hit\"}"),
+      cache->get_num_lookups(CacheLookupResult::HIT));
+  append_metric(
+      out,
+      StringRef::from_lit("nghttpx_cache_lookups_total{result=\"stale\"}"),
+      cache->get_num_lookups(CacheLookupResult::STALE));
+  append_metric(
+      out, StringRef::from_lit("nghttpx_cache_lookups_total{result=\"miss\"}"),
+      cache->get_num_lookups(CacheLookupResult::MISS));
+
+  append_header(out, StringRef::from_lit("nghttpx_cache_not_modified_total"),
+                StringRef::from_lit("The number of stale responses which "
+                                    "backend validated with 304."),
+                StringRef::from_lit("counter"));
+  append_metric(out, StringRef::from_lit("nghttpx_cache_not_modified_total"),
+                cache->get_num_not_modified());
+
+  append_header(out, StringRef::from_lit("nghttpx_cache_stores_total"),
+                StringRef::from_lit("The number of responses stored in "
+                                    "response cache."),
+                StringRef::from_lit("counter"));
+  append_metric(out, StringRef::from_lit("nghttpx_cache_stores_total"),
+                cache->get_num_stores());
+
+  append_header(out, StringRef::from_lit("nghttpx_cache_evictions_total"),
+                StringRef::from_lit("The number of URIs evicted from "
+                                    "response cache."),
+                StringRef::from_lit("counter"));
+  append_metric(out, StringRef::from_lit("nghttpx_cache_evictions_total"),
+                cache->get_num_evictions());
+
+  append_header(out, StringRef::from_lit("nghttpx_cache_bytes"),
+                StringRef::from_lit("The number of bytes used by response "
+                                    "cache."),
+                StringRef::from_lit("gauge"));
+  append_metric(out, StringRef::from_lit("nghttpx_cache_bytes"),
+                cache->get_size());
+
+  append_header(out, StringRef::from_lit("nghttpx_cache_entries"),
+                StringRef::from_lit("The number of URIs stored in response "
+                                    "cache."),
+                StringRef::from_lit("gauge"));
+  append_metric(out, StringRef::from_lit("nghttpx_cache_entries"),
+                cache->get_num_entries());
+
+  struct {
+    StringRef side;
+    TLSSessionStore *store;
+  } tls_session_stores[] = {
+      {StringRef::from_lit("frontend"),
+       conn_handler->get_frontend_tls_session_store()},
+      {StringRef::from_lit("backend"),
+       conn_handler->get_backend_tls_session_store()},
+  };
+
+  append_header(
+      out, StringRef::from_lit("nghttpx_tls_session_cache_lookups_total"),
+      StringRef::from_lit("The number of lookups of TLS session in the "
+                          "session cache shared by workers."),
+      StringRef::from_lit("counter"));
+  for (auto &ts : tls_session_stores) {
+    append_tls_session_cache_metric(
+        out, StringRef::from_lit("nghttpx_tls_session_cache_lookups_total"),
+        ts.side, StringRef::from_lit("hit"), ts.store->get_num_hits());
+    append_tls_session_cache_metric(
+        out, StringRef::from_lit("nghttpx_tls_session_cache_lookups_total"),
+        ts.side, StringRef::from_lit("miss"), ts.store->get_num_misses());
+  }
+
+  append_header(
+      out, StringRef::from_lit("nghttpx_tls_session_cache_stores_total"),
+      StringRef::from_lit("The number of TLS sessions stored in the session "
+                          "cache shared by workers."),
+      StringRef::from_lit("counter"));
+  for (auto &ts : tls_session_stores) {
+    append_tls_session_cache_metric(
+        out, StringRef::from_lit("nghttpx_tls_session_cache_stores_total"),
+        ts.side, StringRef{}, ts.store->get_num_stores());
+  }
+
+  append_header(
+      out, StringRef::from_lit("nghttpx_tls_session_cache_evictions_total"),
+      StringRef::from_lit("The number of TLS sessions evicted from the "
+                          "session cache shared by workers."),
+      StringRef::from_lit("counter"));
+  for (auto &ts : tls_session_stores) {
+    append_tls_session_cache_metric(
+        out, StringRef::from_lit("nghttpx_tls_session_cache_evictions_total"),
+        ts.side, StringRef{}, ts.store->get_num_evictions());
+  }
+
+  append_header(out, StringRef::from_lit("nghttpx_tls_session_cache_entries"),
+                StringRef::from_lit("The number of TLS sessions in the "
+                                    "session cache shared by workers."),
+                StringRef::from_lit("gauge"));
+  for (auto &ts : tls_session_stores) {
+    append_tls_session_cache_metric(
+        out, StringRef::from_lit("nghttpx_tls_session_cache_entries"), ts.side,
+        StringRef{}, ts.store->get_num_entries());
+  }
+
+  // Buffer pools are reported per worker because a worker which has
+  // handled a burst of traffic may keep much more memory than others.
+  struct {
+    StringRef name;
+    StringRef help;
+    StringRef type;
+    uint64_t (*get)(const WorkerMetricsSnapshot &);
+  } mcpool_metrics[] = {
+      {StringRef::from_lit("nghttpx_memchunk_pool_bytes"),
+       StringRef::from_lit("The number of bytes allocated by buffer pool."),
+       StringRef::from_lit("gauge"),
+       [](const WorkerMetricsSnapshot &m) {
+         return static_cast<uint64_t>(m.mcpool_allocated);
+       }},
+      {StringRef::from_lit("nghttpx_memchunk_pool_free_bytes"),
+       StringRef::from_lit("The number of bytes of unused buffers kept in "
+                           "buffer pool."),
+       StringRef::from_lit("gauge"),
+       [](const WorkerMetricsSnapshot &m) {
+         return static_cast<uint64_t>(m.mcpool_free);
+       }},
+      {StringRef::from_lit("nghttpx_memchunk_pool_peak_bytes"),
+       StringRef::from_lit("The maximum number of bytes allocated by "
+                           "buffer pool."),
+       StringRef::from_lit("gauge"),
+       [](const WorkerMetricsSnapshot &m) {
+         return static_cast<uint64_t>(m.mcpool_peak);
+       }},
+      {StringRef::from_lit("nghttpx_memchunk_pool_released_bytes_total"),
+       StringRef::from_lit("The number of bytes released by buffer pool."),
+       StringRef::from_lit("counter"),
+       [](const WorkerMetricsSnapshot &m) { return m.mcpool_released; }},
+  };
+
+  for (auto &mm : mcpool_metrics) {
+    append_header(out, mm.name, mm.help, mm.type);
+    for (size_t i = 0; i < mcpools.size(); ++i) {
+      out.append(std::begin(mm.name), std::end(mm.name));
+      out += "{worker=\"";
+      out += util::utos(i);
+      out += "\"} ";
+      out += util::utos(mm.get(mcpools[i]));
+      out += '\n';
+    }
+  }
+
+  if (backends.empty()) {
+    return out;
+  }
+
+  struct {
+    StringRef name;
+    StringRef help;
+    StringRef type;
+    uint64_t (*get)(const BackendMetricsSnapshot &);
+  } backend_metrics[] = {
+      {StringRef::from_lit("nghttpx_backend_responses_total"),
+       StringRef::from_lit("The number of responses received from backend."),
+       StringRef::from_lit("counter"),
+       [](const BackendMetricsSnapshot &b) { return b.num_responses; }},
+      {StringRef::from_lit("nghttpx_backend_idle_connections"),
+       StringRef::from_lit("The number of idle connections in backend "
+                           "connection pool."),
+       StringRef::from_lit("gauge"),
+       [](const BackendMetricsSnapshot &b) {
+         return static_cast<uint64_t>(b.num_idle_conns);
+       }},
+      {StringRef::from_lit("nghttpx_backend_http2_streams"),
+       StringRef::from_lit("The number of HTTP/2 streams open to backend."),
+       StringRef::from_lit("gauge"),
+       [](const BackendMetricsSnapshot &b) {
+         return static_cast<uint64_t>(b.num_streams);
+       }},
+      {StringRef::from_lit("nghttpx_backend_requests_inflight"),
+       StringRef::from_lit("The number of requests outstanding to backend."),
+       StringRef::from_lit("gauge"),
+       [](const BackendMetricsSnapshot &b) {
+         return static_cast<uint64_t>(b.num_inflight);
+       }},
+      {StringRef::from_lit("nghttpx_backend_connection_pool_hits_total"),
+       StringRef::from_lit("The number of requests which reused an idle "
+                           "connection in backend connection pool."),
+       StringRef::from_lit("counter"),
+       [](const BackendMetricsSnapshot &b) { return b.pool_hits; }},
+      {StringRef::from_lit("nghttpx_backend_connection_pool_misses_total"),
+       StringRef::from_lit("The number of requests which found no idle "
+                           "connection in backend connection pool."),
+       StringRef::from_lit("counter"),
+       [](const BackendMetricsSnapshot &b) { return b.pool_misses; }},
+      {StringRef::from_lit("nghttpx_backend_ejected"),
+       StringRef::from_lit("The number of workers which eject backend as an "
+                           "outlier."),
+       StringRef::from_lit("gauge"),
+       [](const BackendMetricsSnapshot &b) { return b.num_ejected; }},
+      {StringRef::from_lit("nghttpx_backend_ejections_total"),
+       StringRef::from_lit("The number of times backend was ejected as an "
+                           "outlier."),
+       StringRef::from_lit("counter"),
+       [](const BackendMetricsSnapshot &b) { return b.num_ejections; }},
+  };
+
+  for (auto &bm : backend_metrics) {
+    append_header(out, bm.name, bm.help, bm.type);
+    for (auto &kv : backends) {
+      out.append(std::begin(bm.name), std::end(bm.name));
+      out += "{backend=\"";
+      append_label_value(out, StringRef{kv.first.hostport});
+      out += "\",proto=\"";
+      out.append(std::begin(kv.first.proto), std::end(kv.first.proto));
+      out += "\"} ";
+      out += util::utos(bm.get(kv.second));
+      out += '\n';
+    }
+  }
+
+  append_header(
+      out, StringRef::from_lit("nghttpx_backend_latency_ewma_seconds"),
+      StringRef::from_lit("The peak EWMA of backend response latency."),
+      StringRef::from_lit("gauge"));
+  for (auto &kv : backends) {
+    out += "nghttpx_backend_latency_ewma_seconds{backend=\"";
+    append_label_value(out, StringRef{kv.first.hostport});
+    out += "\",proto=\"";
+    out.append(std::begin(kv.first.proto), std::end(kv.first.proto));
+    out += "\"} ";
+    append_seconds(out, kv.second.latency_us);
+    out += '\n';
+  }
+
+  return out;
+}
+
+} // namespace shrpx
@@ -0,0 +1,210 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHRPX_METRICS_H
+#define SHRPX_METRICS_H
+
+#include "shrpx.h"
+
+#include <atomic>
+#include <array>
+#include <vector>
+#include <string>
+#include <mutex>
+
+#include "template.h"
+
+using namespace nghttp2;
+
+namespace shrpx {
+
+class Worker;
+class ConnectionHandler;
+
+// The number of sub-buckets per power of 2 in LatencyHistogram, in
+// log2.  With 3, the relative error of a recorded value is at most
+// 12.5%.
+constexpr size_t LATENCY_HISTOGRAM_SUB_BUCKET_BITS = 3;
+constexpr size_t LATENCY_HISTOGRAM_SUB_BUCKETS =
+    1 << LATENCY_HISTOGRAM_SUB_BUCKET_BITS;
+// Values in [2**LATENCY_HISTOGRAM_MAX_MAGNITUDE, inf) are all
+// recorded in the last bucket.
+constexpr size_t LATENCY_HISTOGRAM_MAX_MAGNITUDE = 32;
+constexpr size_t LATENCY_HISTOGRAM_NUM_BUCKETS =
+    (LATENCY_HISTOGRAM_MAX_MAGNITUDE - LATENCY_HISTOGRAM_SUB_BUCKET_BITS + 1) *
+    LATENCY_HISTOGRAM_SUB_BUCKETS;
+
+// Returns the index of bucket in LatencyHistogram which |v| falls
+// in.
+size_t latency_histogram_bucket_index(uint64_t v);
+// Returns the exclusive upper bound of values recorded in the bucket
+// at |idx|.
+uint64_t latency_histogram_bucket_upper_bound(size_t idx);
+
+// Increments |c| by |n|.  |c| must be written only by the thread
+// which owns it.  Because there is only one writer, we do not need
+// atomic read-modify-write operation.  The other threads only read
+// the value with std::memory_order_relaxed.
+inline void metrics_add(std::atomic<uint64_t> &c, uint64_t n = 1) {
+  c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+// Decrements |c| by |n|.  The same restriction of metrics_add()
+// applies.
+inline void metrics_sub(std::atomic<uint64_t> &c, uint64_t n = 1) {
+  c.store(c.load(std::memory_order_relaxed) - n, std::memory_order_relaxed);
+}
+
+// LatencyHistogram is a histogram of latency in microseconds, which
+// has a fixed number of logarithmic buckets in the similar fashion of
+// HdrHistogram.  It is written by a single thread.
+struct LatencyHistogram {
+  LatencyHistogram();
+
+  // Records |v|.
+  void record(uint64_t v);
+
+  std::array<std::atomic<uint64_t>, LATENCY_HISTOGRAM_NUM_BUCKETS> buckets;
+  // The sum of all recorded values.
+  std::atomic<uint64_t> sum;
+};
+
+// LatencyHistogramSnapshot is a merged, plain copy of
+// LatencyHistogram.
+struct LatencyHistogramSnapshot {
+  // Adds the current values of |h| to this object.
+  void merge(const LatencyHistogram &h);
+  // Returns the total number of recorded values.
+  uint64_t count() const;
+  // Returns the estimated value at |q| quantile where 0 <= q <= 1.
+  // It returns 0 if there is no recorded value.
+  uint64_t quantile(double q) const;
+
+  std::array<uint64_t, LATENCY_HISTOGRAM_NUM_BUCKETS> buckets;
+  uint64_t sum;
+};
+
+// BackendMetricsSnapshot is the usage of a backend address observed
+// by a worker.
+struct BackendMetricsSnapshot {
+  // host:port of backend, or UNIX domain socket path.
+  std::string hostport;
+  // The application protocol, either "h1" or "h2".
+  StringRef proto;
+  // The number of idle connections kept in connection pool.
+  size_t num_idle_conns;
+  // The number of HTTP/2 streams currently open.
+  size_t num_streams;
+  // The number of responses received from this backend.
+  uint64_t num_responses;
+  // The number of requests outstanding to this backend.
+  size_t num_inflight;
+  // The peak EWMA of response latency in microseconds.
+  uint64_t latency_us;
+  // The number of times a request found an idle connection in
+  // connection pool.
+  uint64_t pool_hits;
+  // The number of times a request found no idle connection in
+  // connection pool.
+  uint64_t pool_misses;
+  // The number of workers which currently eject this backend as an
+  // outlier.  It is either 0 or 1 for a single worker.
+  uint64_t num_ejected;
+  // The number of times this backend was ejected as an outlier.
+  uint64_t num_ejections;
+};
+
+// WorkerMetricsSnapshot contains values which cannot be read from
+// the other threads directly.  Worker periodically copies them to
+// WorkerMetrics.
+struct WorkerMetricsSnapshot {
+  std::vector<BackendMetricsSnapshot> backends;
+  // The number of bytes allocated by the memchunk pool.
+  size_t mcpool_allocated;
+  // The number of bytes in the free list of memchunk pool.
+  size_t mcpool_free;
+  // The maximum number of bytes allocated by the memchunk pool.
+  size_t mcpool_peak;
+  // The total number of bytes released by the memchunk pool.
+  uint64_t mcpool_released;
+  // The number of client connections.
+  size_t num_connections;
+};
+
+// The classes of response status code.  The index is the status code
+// divided by 100, and 0 is used for the rest.
+constexpr size_t METRICS_NUM_STATUS_CLASSES = 6;
+
+// WorkerMetrics is a set of counters owned by a worker.  Each counter
+// is written only by the worker thread, so that updating them costs
+// no more than updating plain integers.  They are read by the thread
+// which serves metrics API.
+struct WorkerMetrics {
+  WorkerMetrics();
+
+  // The number of requests completed, per status code class.
+  std::array<std::atomic<uint64_t>, METRICS_NUM_STATUS_CLASSES> requests;
+  // The time from the beginning of a request to the end of response.
+  LatencyHistogram request_duration;
+  std::atomic<uint64_t> connections_accepted;
+  std::atomic<uint64_t> tls_handshakes_full;
+  std::atomic<uint64_t> tls_handshakes_resumed;
+  std::atomic<uint64_t> tls_handshakes_failed;
+  // The time from accepting a connection to the completion of TLS
+  // handshake.
+  LatencyHistogram tls_handshake_duration;
+  // The time taken by private key operations offloaded to
+  // PrivateKeyPool, including the time waiting for a thread.
+  LatencyHistogram private_key_op_duration;
+  // The time taken to run mruby request and response phase hooks.
+  LatencyHistogram mruby_on_req_duration;
+  LatencyHistogram mruby_on_resp_duration;
+  // TLS handshakes with backend which completed.
+  std::atomic<uint64_t> backend_tls_handshakes_full;
+  std::atomic<uint64_t> backend_tls_handshakes_resumed;
+  // The number of requests blocked in DownstreamQueue.
+  std::atomic<uint64_t> downstream_queue_blocked;
+
+  // Protects snapshot.
+  std::mutex snapshot_mu;
+  WorkerMetricsSnapshot snapshot;
+};
+
+// Records the completion of request with the response status code
+// |status| and its duration |duration_us| in microseconds.
+void metrics_record_request(WorkerMetrics &m, unsigned int status,
+                            uint64_t duration_us);
+
+// Copies the values which are only safely read by |worker| to its
+// snapshot.  This function must be called from the thread which runs
+// |worker|.
+void metrics_update_snapshot(Worker *worker);
+
+// Returns the metrics of all workers owned by |conn_handler| in
+// Prometheus text exposition format.
+std::string format_metrics(ConnectionHandler *conn_handler);
+
+} // namespace shrpx
+
+#endif // SHRPX_METRICS_H
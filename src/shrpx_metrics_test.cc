@@ -0,0 +1,89 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_metrics_test.h"
+
+#include <CUnit/CUnit.h>
+
+#include "shrpx_metrics.h"
+
+namespace shrpx {
+
+void test_shrpx_metrics_latency_histogram_bucket(void) {
+  CU_ASSERT(0 == latency_histogram_bucket_index(0));
+  CU_ASSERT(7 == latency_histogram_bucket_index(7));
+  CU_ASSERT(8 == latency_histogram_bucket_index(8));
+  CU_ASSERT(15 == latency_histogram_bucket_index(15));
+  CU_ASSERT(16 == latency_histogram_bucket_index(16));
+  CU_ASSERT(16 == latency_histogram_bucket_index(17));
+  CU_ASSERT(17 == latency_histogram_bucket_index(18));
+  CU_ASSERT(23 == latency_histogram_bucket_index(31));
+  CU_ASSERT(24 == latency_histogram_bucket_index(32));
+  CU_ASSERT(LATENCY_HISTOGRAM_NUM_BUCKETS - 1 ==
+            latency_histogram_bucket_index((1ULL << 32) - 1));
+  CU_ASSERT(LATENCY_HISTOGRAM_NUM_BUCKETS - 1 ==
+            latency_histogram_bucket_index(1ULL << 40));
+
+  CU_ASSERT(1 == latency_histogram_bucket_upper_bound(0));
+  CU_ASSERT(16 == latency_histogram_bucket_upper_bound(15));
+  CU_ASSERT(18 == latency_histogram_bucket_upper_bound(16));
+  CU_ASSERT(32 == latency_histogram_bucket_upper_bound(23));
+
+  // Every value must be less than the upper bound of its bucket, and
+  // not less than the upper bound of the previous bucket.
+  for (uint64_t v = 1; v < (1ULL << 31); v = v * 3 + 1) {
+    auto idx = latency_histogram_bucket_index(v);
+    CU_ASSERT(v < latency_histogram_bucket_upper_bound(idx));
+    CU_ASSERT(v >= latency_histogram_bucket_upper_bound(idx - 1));
+  }
+}
+
+void test_shrpx_metrics_latency_histogram_quantile(void) {
+  LatencyHistogram h;
+  LatencyHistogramSnapshot s{};
+
+  s.merge(h);
+
+  CU_ASSERT(0 == s.count());
+  CU_ASSERT(0 == s.quantile(0.5));
+
+  for (uint64_t v = 1; v <= 100; ++v) {
+    h.record(v * 1000);
+  }
+
+  s = LatencyHistogramSnapshot{};
+  s.merge(h);
+
+  CU_ASSERT(100 == s.count());
+  CU_ASSERT(5050000 == s.sum);
+
+  // The relative error must be within the width of sub-bucket.
+  auto p50 = s.quantile(0.5);
+  CU_ASSERT(p50 >= 50000 * 7 / 8 && p50 <= 50000 * 9 / 8);
+  auto p99 = s.quantile(0.99);
+  CU_ASSERT(p99 >= 99000 * 7 / 8 && p99 <= 99000 * 9 / 8);
+  CU_ASSERT(s.quantile(0.5) <= s.quantile(0.9));
+}
+
+} // namespace shrpx
@@ -24,13 +24,24 @@
  */
 #include "shrpx_mruby.h"
 
+#include <array>
+#include <chrono>
+#include <vector>
+
 #include <mruby/compile.h>
 #include <mruby/string.h>
+#include <mruby/irep.h>
+#include <mruby/dump.h>
+#include <mruby/variable.h>
 
 #include "shrpx_downstream.h"
+#include "shrpx_upstream.h"
+#include "shrpx_client_handler.h"
+#include "shrpx_worker.h"
 #include "shrpx_config.h"
 #include "shrpx_mruby_module.h"
 #include "shrpx_downstream_connection.h"
+#include "shrpx_metrics.h"
 #include "shrpx_log.h"
 
 namespace shrpx {
@@ -38,7 +49,22 @@ namespace shrpx {
 namespace mruby {
 
 MRubyContext::MRubyContext(mrb_state *mrb, mrb_value app, mrb_value env)
-    : mrb_(mrb), app_(std::move(app)), env_(std::move(env)) {}
+    : mrb_(mrb),
+      app_(std::move(app)),
+      env_(std::move(env)),
+      on_req_sym_(0),
+      on_resp_sym_(0),
+      has_on_req_(false),
+      has_on_resp_(false) {
+  if (!mrb_) {
+    return;
+  }
+
+  on_req_sym_ = mrb_intern_lit(mrb_, "on_req");
+  on_resp_sym_ = mrb_intern_lit(mrb_, "on_resp");
+  has_on_req_ = mrb_respond_to(mrb_, app_, on_req_sym_);
+  has_on_resp_ = mrb_respond_to(mrb_, app_, on_resp_sym_);
+}
 
 MRubyContext::~MRubyContext() {
   if (mrb_) {
@@ -51,35 +77,51 @@ int MRubyContext::run_app(Downstream *downstream, int phase) {
     return 0;
   }
 
-  MRubyAssocData data{downstream, phase};
-
-  mrb_->ud = &data;
-
-  int rv = 0;
-  auto ai = mrb_gc_arena_save(mrb_);
-  auto ai_d = defer([ai, this]() { mrb_gc_arena_restore(mrb_, ai); });
-
-  const char *method;
+  mrb_sym method;
   switch (phase) {
   case PHASE_REQUEST:
-    if (!mrb_respond_to(mrb_, app_, mrb_intern_lit(mrb_, "on_req"))) {
+    if (!has_on_req_) {
       return 0;
     }
-    method = "on_req";
+    method = on_req_sym_;
     break;
   case PHASE_RESPONSE:
-    if (!mrb_respond_to(mrb_, app_, mrb_intern_lit(mrb_, "on_resp"))) {
+    if (!has_on_resp_) {
       return 0;
     }
-    method = "on_resp";
+    method = on_resp_sym_;
     break;
   default:
     assert(0);
   }
 
-  auto res = mrb_funcall(mrb_, app_, method, 1, env_);
+  MRubyAssocData data{downstream, phase};
+
+  mrb_->ud = &data;
+
+  int rv = 0;
+  auto ai = mrb_gc_arena_save(mrb_);
+  auto ai_d = defer([ai, this]() { mrb_gc_arena_restore(mrb_, ai); });
+
+  auto t = std::chrono::steady_clock::now();
+
+  auto res = mrb_funcall_argv(mrb_, app_, method, 1, &env_);
   (void)res;
 
+  auto duration_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                         std::chrono::steady_clock::now() - t)
+                         .count();
+
+  auto &metrics = downstream->get_upstream()
+                      ->get_client_handler()
+                      ->get_worker()
+                      ->get_metrics();
+  if (phase == PHASE_REQUEST) {
+    metrics.mruby_on_req_duration.record(duration_us);
+  } else {
+    metrics.mruby_on_resp_duration.record(duration_us);
+  }
+
   if (mrb_->exc) {
     // If response has been committed, ignore error
     if (downstream->get_response_state() != DownstreamState::MSG_COMPLETE) {
@@ -110,7 +152,8 @@ void MRubyContext::delete_downstream(Downstream *downstream) {
   if (!mrb_) {
     return;
   }
-  delete_downstream_from_module(mrb_, downstream);
+  // Env#ctx stores the object for |downstream| in env_.
+  mrb_iv_remove(mrb_, env_, intern_ptr(mrb_, downstream));
 }
 
 namespace {
@@ -133,6 +176,54 @@ mrb_value instantiate_app(mrb_state *mrb, RProc *proc) {
 }
 } // namespace
 
+namespace {
+// Returns true if |infile| starts with the magic of mruby bytecode.
+// The file position is rewound to the beginning.
+bool is_bytecode(FILE *infile) {
+  std::array<char, 4> magic;
+  auto nread = fread(magic.data(), 1, magic.size(), infile);
+  rewind(infile);
+
+  return nread == magic.size() &&
+         StringRef{magic.data(), magic.size()} == StringRef::from_lit("RITE");
+}
+} // namespace
+
+namespace {
+// Loads mruby bytecode generated by mrbc from |infile|.  Since the
+// code is compiled ahead of time, this avoids parsing the script in
+// each thread on startup and configuration reload.
+RProc *load_bytecode(mrb_state *mrb, FILE *infile) {
+  std::vector<uint8_t> buf;
+  std::array<uint8_t, 4_k> chunk;
+
+  for (;;) {
+    auto nread = fread(chunk.data(), 1, chunk.size(), infile);
+    buf.insert(std::end(buf), std::begin(chunk), std::begin(chunk) + nread);
+    if (nread < chunk.size()) {
+      break;
+    }
+  }
+
+  if (ferror(infile)) {
+    LOG(ERROR) << "Could not read mruby bytecode";
+    return nullptr;
+  }
+
+  // mrb_read_irep copies the data which it needs.
+  auto irep = mrb_read_irep(mrb, buf.data());
+  if (irep == nullptr) {
+    LOG(ERROR) << "mrb_read_irep failed";
+    return nullptr;
+  }
+
+  auto proc = mrb_proc_new(mrb, irep);
+  mrb_irep_decref(mrb, irep);
+
+  return proc;
+}
+} // namespace
+
 // Based on
 // https://github.com/h2o/h2o/blob/master/lib/handler/mruby.c.  It is
 // very hard to write these kind of code because mruby has almost no
@@ -150,6 +241,10 @@ RProc *compile(mrb_state *mrb, const StringRef &filename) {
   }
   auto infile_d = defer(fclose, infile);
 
+  if (is_bytecode(infile)) {
+    return load_bytecode(mrb, infile);
+  }
+
   auto mrbc = mrbc_context_new(mrb);
   if (mrbc == nullptr) {
     LOG(ERROR) << "mrb_context_new failed";
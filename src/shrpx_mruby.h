@@ -58,6 +58,13 @@ private:
   mrb_state *mrb_;
   mrb_value app_;
   mrb_value env_;
+  // The symbols of hook methods.  They are interned once, rather than
+  // for each call.
+  mrb_sym on_req_sym_;
+  mrb_sym on_resp_sym_;
+  // true if app object defines the hook method.
+  bool has_on_req_;
+  bool has_on_resp_;
 };
 
 enum {
@@ -71,6 +78,8 @@ struct MRubyAssocData {
   int phase;
 };
 
+// Compiles mruby script |filename|.  If |filename| contains mruby
+// bytecode generated by mrbc, it is loaded without compilation.
 RProc *compile(mrb_state *mrb, const StringRef &filename);
 
 std::unique_ptr<MRubyContext> create_mruby_context(const StringRef &filename);
@@ -35,6 +35,7 @@
 #include "shrpx_mruby_module_env.h"
 #include "shrpx_mruby_module_request.h"
 #include "shrpx_mruby_module_response.h"
+#include "util.h"
 
 namespace shrpx {
 
@@ -59,17 +60,6 @@ mrb_value create_env(mrb_state *mrb) {
 }
 } // namespace
 
-void delete_downstream_from_module(mrb_state *mrb, Downstream *downstream) {
-  auto module = mrb_module_get(mrb, "Nghttpx");
-  auto env = mrb_obj_iv_get(mrb, reinterpret_cast<RObject *>(module),
-                            mrb_intern_lit(mrb, "env"));
-  if (mrb_nil_p(env)) {
-    return;
-  }
-
-  mrb_iv_remove(mrb, env, intern_ptr(mrb, downstream));
-}
-
 mrb_value init_module(mrb_state *mrb) {
   auto module = mrb_define_module(mrb, "Nghttpx");
 
@@ -108,6 +98,29 @@ mrb_value create_headers_hash(mrb_state *mrb, const HeaderRefs &headers) {
   return hash;
 }
 
+mrb_value create_header_values(mrb_state *mrb, const HeaderRefs &headers,
+                               const StringRef &name) {
+  auto ary = mrb_nil_value();
+
+  for (auto &hd : headers) {
+    if (!util::strieq(name, hd.name)) {
+      continue;
+    }
+
+    if (mrb_nil_p(ary)) {
+      ary = mrb_ary_new(mrb);
+    }
+
+    auto ai = mrb_gc_arena_save(mrb);
+
+    mrb_ary_push(mrb, ary, mrb_str_new(mrb, hd.value.c_str(), hd.value.size()));
+
+    mrb_gc_arena_restore(mrb, ai);
+  }
+
+  return ary;
+}
+
 } // namespace mruby
 
 } // namespace shrpx
@@ -41,10 +41,14 @@ namespace mruby {
 
 mrb_value init_module(mrb_state *mrb);
 
-void delete_downstream_from_module(mrb_state *mrb, Downstream *downstream);
-
 mrb_value create_headers_hash(mrb_state *mrb, const HeaderRefs &headers);
 
+// Returns Ruby array containing the values of header fields named
+// |name| in |headers|, or nil if there is no such header field.
+// Unlike create_headers_hash(), it only copies the values requested.
+mrb_value create_header_values(mrb_state *mrb, const HeaderRefs &headers,
+                               const StringRef &name);
+
 } // namespace mruby
 
 } // namespace shrpx
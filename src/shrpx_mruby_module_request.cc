@@ -209,6 +209,21 @@ mrb_value request_get_headers(mrb_state *mrb, mrb_value self) {
 }
 } // namespace
 
+namespace {
+mrb_value request_get_header(mrb_state *mrb, mrb_value self) {
+  auto data = static_cast<MRubyAssocData *>(mrb->ud);
+  auto downstream = data->downstream;
+  const auto &req = downstream->request();
+
+  const char *name;
+  mrb_int namelen;
+  mrb_get_args(mrb, "s", &name, &namelen);
+
+  return create_header_values(mrb, req.fs.headers(),
+                              StringRef{name, static_cast<size_t>(namelen)});
+}
+} // namespace
+
 namespace {
 mrb_value request_mod_header(mrb_state *mrb, mrb_value self, bool repl) {
   auto data = static_cast<MRubyAssocData *>(mrb->ud);
@@ -353,6 +368,8 @@ void init_request_class(mrb_state *mrb, RClass *module) {
                     MRB_ARGS_REQ(1));
   mrb_define_method(mrb, request_class, "headers", request_get_headers,
                     MRB_ARGS_NONE());
+  mrb_define_method(mrb, request_class, "header", request_get_header,
+                    MRB_ARGS_REQ(1));
   mrb_define_method(mrb, request_class, "add_header", request_add_header,
                     MRB_ARGS_REQ(2));
   mrb_define_method(mrb, request_class, "set_header", request_set_header,
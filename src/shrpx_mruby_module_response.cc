@@ -103,6 +103,21 @@ mrb_value response_get_headers(mrb_state *mrb, mrb_value self) {
 }
 } // namespace
 
+namespace {
+mrb_value response_get_header(mrb_state *mrb, mrb_value self) {
+  auto data = static_cast<MRubyAssocData *>(mrb->ud);
+  auto downstream = data->downstream;
+  const auto &resp = downstream->response();
+
+  const char *name;
+  mrb_int namelen;
+  mrb_get_args(mrb, "s", &name, &namelen);
+
+  return create_header_values(mrb, resp.fs.headers(),
+                              StringRef{name, static_cast<size_t>(namelen)});
+}
+} // namespace
+
 namespace {
 mrb_value response_mod_header(mrb_state *mrb, mrb_value self, bool repl) {
   auto data = static_cast<MRubyAssocData *>(mrb->ud);
@@ -381,6 +396,8 @@ void init_response_class(mrb_state *mrb, RClass *module) {
                     MRB_ARGS_REQ(1));
   mrb_define_method(mrb, response_class, "headers", response_get_headers,
                     MRB_ARGS_NONE());
+  mrb_define_method(mrb, response_class, "header", response_get_header,
+                    MRB_ARGS_REQ(1));
   mrb_define_method(mrb, response_class, "add_header", response_add_header,
                     MRB_ARGS_REQ(2));
   mrb_define_method(mrb, response_class, "set_header", response_set_header,
@@ -0,0 +1,195 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_outlier_detector.h"
+
+#include <cmath>
+#include <algorithm>
+
+#include "shrpx_worker.h"
+#include "shrpx_connect_blocker.h"
+#include "shrpx_log.h"
+#include "util.h"
+
+namespace shrpx {
+
+OutlierDetector::OutlierDetector()
+    : buckets_{},
+      num_requests_(0),
+      num_failures_(0),
+      epoch_(0),
+      ejected_until_(0.),
+      multiplier_(0),
+      num_ejections_(0) {}
+
+void OutlierDetector::rotate(ev_tstamp now, ev_tstamp window) {
+  auto epoch = static_cast<int64_t>(
+      std::floor(now * OUTLIER_DETECTOR_NUM_BUCKETS / window));
+
+  if (epoch <= epoch_) {
+    return;
+  }
+
+  if (epoch - epoch_ >= static_cast<int64_t>(OUTLIER_DETECTOR_NUM_BUCKETS)) {
+    buckets_ = {};
+    num_requests_ = 0;
+    num_failures_ = 0;
+  } else {
+    for (auto e = epoch_ + 1; e <= epoch; ++e) {
+      auto &b = buckets_[e % OUTLIER_DETECTOR_NUM_BUCKETS];
+
+      num_requests_ -= b.requests;
+      num_failures_ -= b.failures;
+
+      b = {};
+    }
+  }
+
+  epoch_ = epoch;
+}
+
+void OutlierDetector::record(OutlierEvent ev, ev_tstamp now,
+                             ev_tstamp window) {
+  rotate(now, window);
+
+  auto &b = buckets_[epoch_ % OUTLIER_DETECTOR_NUM_BUCKETS];
+
+  ++b.requests;
+  ++num_requests_;
+
+  if (ev != OutlierEvent::SUCCESS) {
+    ++b.failures;
+    ++num_failures_;
+  }
+}
+
+bool OutlierDetector::is_outlier(
+    const OutlierDetectionConfig &outlierconf) const {
+  if (outlierconf.failure_rate == 0 || num_requests_ == 0 ||
+      num_requests_ < outlierconf.min_requests) {
+    return false;
+  }
+
+  return num_failures_ * 100 >= num_requests_ * outlierconf.failure_rate;
+}
+
+ev_tstamp OutlierDetector::eject(ev_tstamp now,
+                                 const OutlierDetectionConfig &outlierconf) {
+  auto max_ejection_time = std::max(outlierconf.base_ejection_time,
+                                    outlierconf.max_ejection_time);
+
+  // The address has stayed in load balancing long enough.  Start
+  // over with the shortest ejection.
+  if (now - ejected_until_ >= max_ejection_time) {
+    multiplier_ = 0;
+  }
+
+  ++multiplier_;
+  ++num_ejections_;
+
+  auto d = std::min(outlierconf.base_ejection_time * multiplier_,
+                    max_ejection_time);
+
+  ejected_until_ = now + d;
+
+  buckets_ = {};
+  num_requests_ = 0;
+  num_failures_ = 0;
+
+  return d;
+}
+
+bool OutlierDetector::ejected(ev_tstamp now) const {
+  return now < ejected_until_;
+}
+
+uint64_t OutlierDetector::get_num_requests() const { return num_requests_; }
+
+uint64_t OutlierDetector::get_num_failures() const { return num_failures_; }
+
+uint64_t OutlierDetector::get_num_ejections() const { return num_ejections_; }
+
+size_t outlier_detector_max_ejections(size_t naddrs, uint32_t percent) {
+  if (naddrs < 2) {
+    return 0;
+  }
+
+  auto n = std::max(naddrs * percent / 100, static_cast<size_t>(1));
+
+  return std::min(n, naddrs - 1);
+}
+
+void outlier_detector_record(DownstreamAddrGroup *group, DownstreamAddr *addr,
+                             OutlierEvent ev, ev_tstamp now) {
+  auto &outlierconf = get_config()->conn.downstream->outlier;
+
+  if (outlierconf.failure_rate == 0) {
+    return;
+  }
+
+  auto &od = addr->outlier_detector;
+
+  // Responses to the requests which were sent before ejection may
+  // still arrive.  They do not tell anything new.
+  if (od.ejected(now)) {
+    return;
+  }
+
+  od.record(ev, now, outlierconf.window);
+
+  if (ev == OutlierEvent::SUCCESS || !od.is_outlier(outlierconf)) {
+    return;
+  }
+
+  // The address is already out of load balancing.
+  if (addr->connect_blocker->blocked()) {
+    return;
+  }
+
+  auto &addrs = group->shared_addr->addrs;
+
+  auto nejected = static_cast<size_t>(
+      std::count_if(std::begin(addrs), std::end(addrs),
+                    [now](const DownstreamAddr &a) {
+                      return a.outlier_detector.ejected(now);
+                    }));
+
+  if (nejected >= outlier_detector_max_ejections(
+                      addrs.size(), outlierconf.max_ejection_percent)) {
+    return;
+  }
+
+  auto nfailures = od.get_num_failures();
+  auto nrequests = od.get_num_requests();
+
+  auto d = od.eject(now, outlierconf);
+
+  addr->connect_blocker->eject(d);
+
+  LOG(WARN) << "Eject backend " << addr->hostport << " for "
+            << util::duration_str(d) << ": " << nfailures << " out of "
+            << nrequests << " requests failed";
+}
+
+} // namespace shrpx
@@ -0,0 +1,121 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHRPX_OUTLIER_DETECTOR_H
+#define SHRPX_OUTLIER_DETECTOR_H
+
+#include "shrpx.h"
+
+#include <array>
+
+#include <ev.h>
+
+#include "shrpx_config.h"
+
+namespace shrpx {
+
+struct DownstreamAddr;
+struct DownstreamAddrGroup;
+
+// The outcome of a request to a backend address.
+enum class OutlierEvent {
+  SUCCESS,
+  // Backend responded with 5xx status code.
+  SERVER_ERROR,
+  // Backend reset stream or connection before response completed.
+  RESET,
+  // Backend did not respond in time.
+  TIMEOUT,
+};
+
+// The number of buckets in the sliding window of OutlierDetector.
+constexpr size_t OUTLIER_DETECTOR_NUM_BUCKETS = 10;
+
+// OutlierDetector counts the outcome of requests to a backend address
+// in a sliding window, and keeps the ejection state of the address.
+// The window is divided into OUTLIER_DETECTOR_NUM_BUCKETS buckets,
+// and the oldest bucket is discarded as time goes by.  It is private
+// to a worker.
+class OutlierDetector {
+public:
+  OutlierDetector();
+
+  // Records the outcome |ev| of a request at |now|.  |window| is the
+  // length of sliding window.
+  void record(OutlierEvent ev, ev_tstamp now, ev_tstamp window);
+  // Returns true if the failure rate in the window reaches the
+  // threshold in |outlierconf|.
+  bool is_outlier(const OutlierDetectionConfig &outlierconf) const;
+  // Ejects the address at |now|, and returns the duration of
+  // ejection.  The counts in the window are cleared.
+  ev_tstamp eject(ev_tstamp now, const OutlierDetectionConfig &outlierconf);
+  // Returns true if the address is ejected at |now|.
+  bool ejected(ev_tstamp now) const;
+  // Returns the number of requests in the window as of the last call
+  // of record().
+  uint64_t get_num_requests() const;
+  // Returns the number of failed requests in the window as of the
+  // last call of record().
+  uint64_t get_num_failures() const;
+  // Returns the number of times the address was ejected.
+  uint64_t get_num_ejections() const;
+
+private:
+  // Discards the buckets which fall outside the window at |now|.
+  void rotate(ev_tstamp now, ev_tstamp window);
+
+  struct Bucket {
+    uint32_t requests;
+    uint32_t failures;
+  };
+
+  std::array<Bucket, OUTLIER_DETECTOR_NUM_BUCKETS> buckets_;
+  // The sum of requests and failures in |buckets_|.
+  uint64_t num_requests_;
+  uint64_t num_failures_;
+  // The serial number of the latest bucket, which is the time
+  // divided by the width of bucket.
+  int64_t epoch_;
+  // The time until which the address is ejected.
+  ev_tstamp ejected_until_;
+  // The number of consecutive ejections, which multiplies the
+  // ejection time.
+  size_t multiplier_;
+  uint64_t num_ejections_;
+};
+
+// Returns the maximum number of ejected addresses in a group which
+// has |naddrs| addresses, where |percent| is the maximum ratio of
+// ejected addresses.
+size_t outlier_detector_max_ejections(size_t naddrs, uint32_t percent);
+
+// Records the outcome |ev| of a request to |addr| in |group|, and
+// ejects |addr| from load balancing if it becomes an outlier.  This
+// function does nothing if outlier detection is disabled.
+void outlier_detector_record(DownstreamAddrGroup *group, DownstreamAddr *addr,
+                             OutlierEvent ev, ev_tstamp now);
+
+} // namespace shrpx
+
+#endif // SHRPX_OUTLIER_DETECTOR_H
@@ -0,0 +1,132 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_outlier_detector_test.h"
+
+#include <CUnit/CUnit.h>
+
+#include "shrpx_outlier_detector.h"
+#include "shrpx_log.h"
+
+namespace shrpx {
+
+void test_shrpx_outlier_detector(void) {
+  OutlierDetector od;
+  OutlierDetectionConfig outlierconf{};
+
+  outlierconf.window = 10.;
+  outlierconf.base_ejection_time = 30.;
+  outlierconf.max_ejection_time = 100.;
+  outlierconf.min_requests = 10;
+  outlierconf.failure_rate = 50;
+
+  auto now = 1000.;
+
+  for (size_t i = 0; i < 5; ++i) {
+    od.record(OutlierEvent::SUCCESS, now, outlierconf.window);
+    od.record(OutlierEvent::SERVER_ERROR, now, outlierconf.window);
+  }
+
+  CU_ASSERT(10 == od.get_num_requests());
+  CU_ASSERT(5 == od.get_num_failures());
+  CU_ASSERT(od.is_outlier(outlierconf));
+
+  outlierconf.min_requests = 11;
+
+  CU_ASSERT(!od.is_outlier(outlierconf));
+
+  outlierconf.min_requests = 10;
+
+  // The buckets older than the window are discarded.
+  now += 5.;
+
+  od.record(OutlierEvent::SUCCESS, now, outlierconf.window);
+
+  CU_ASSERT(11 == od.get_num_requests());
+  CU_ASSERT(5 == od.get_num_failures());
+  CU_ASSERT(!od.is_outlier(outlierconf));
+
+  now += 5.;
+
+  od.record(OutlierEvent::RESET, now, outlierconf.window);
+
+  CU_ASSERT(2 == od.get_num_requests());
+  CU_ASSERT(1 == od.get_num_failures());
+
+  now += 100.;
+
+  od.record(OutlierEvent::TIMEOUT, now, outlierconf.window);
+
+  CU_ASSERT(1 == od.get_num_requests());
+  CU_ASSERT(1 == od.get_num_failures());
+
+  // Ejection time grows with consecutive ejections up to the
+  // maximum.
+  CU_ASSERT(!od.ejected(now));
+  CU_ASSERT(30. == od.eject(now, outlierconf));
+  CU_ASSERT(od.ejected(now));
+  CU_ASSERT(!od.ejected(now + 30.));
+  CU_ASSERT(0 == od.get_num_requests());
+  CU_ASSERT(0 == od.get_num_failures());
+
+  now += 40.;
+
+  CU_ASSERT(60. == od.eject(now, outlierconf));
+
+  now += 70.;
+
+  CU_ASSERT(90. == od.eject(now, outlierconf));
+
+  now += 100.;
+
+  CU_ASSERT(100. == od.eject(now, outlierconf));
+
+  // The address stayed in load balancing for the maximum ejection
+  // time.
+  now += 200.;
+
+  CU_ASSERT(30. == od.eject(now, outlierconf));
+  CU_ASSERT(5 == od.get_num_ejections());
+
+  outlierconf.failure_rate = 0;
+
+  for (size_t i = 0; i < 20; ++i) {
+    od.record(OutlierEvent::SERVER_ERROR, now, outlierconf.window);
+  }
+
+  CU_ASSERT(!od.is_outlier(outlierconf));
+}
+
+void test_shrpx_outlier_detector_max_ejections(void) {
+  CU_ASSERT(0 == outlier_detector_max_ejections(0, 10));
+  CU_ASSERT(0 == outlier_detector_max_ejections(1, 100));
+  CU_ASSERT(1 == outlier_detector_max_ejections(2, 10));
+  CU_ASSERT(1 == outlier_detector_max_ejections(2, 100));
+  CU_ASSERT(1 == outlier_detector_max_ejections(10, 0));
+  CU_ASSERT(1 == outlier_detector_max_ejections(10, 10));
+  CU_ASSERT(5 == outlier_detector_max_ejections(10, 50));
+  CU_ASSERT(9 == outlier_detector_max_ejections(10, 100));
+}
+
+} // namespace shrpx
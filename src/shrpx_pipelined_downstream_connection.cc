@@ -0,0 +1,176 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_pipelined_downstream_connection.h"
+
+#include "shrpx_http_downstream_connection.h"
+#include "shrpx_upstream.h"
+#include "shrpx_downstream.h"
+#include "shrpx_client_handler.h"
+#include "shrpx_log.h"
+
+namespace shrpx {
+
+namespace {
+void retrycb(struct ev_loop *loop, ev_timer *w, int revents) {
+  auto dconn = static_cast<PipelinedDownstreamConnection *>(w->data);
+
+  dconn->retry();
+}
+} // namespace
+
+PipelinedDownstreamConnection::PipelinedDownstreamConnection(
+    HttpDownstreamConnection *carrier, struct ev_loop *loop)
+    : dlnext(nullptr),
+      dlprev(nullptr),
+      group_(carrier->get_downstream_addr_group()),
+      addr_(carrier->get_addr()),
+      carrier_(carrier),
+      loop_(loop),
+      write_started_(false) {
+  ev_timer_init(&retry_timer_, retrycb, 0., 0.);
+  retry_timer_.data = this;
+}
+
+PipelinedDownstreamConnection::~PipelinedDownstreamConnection() {
+  if (LOG_ENABLED(INFO)) {
+    DCLOG(INFO, this) << "Deleted";
+  }
+
+  ev_timer_stop(loop_, &retry_timer_);
+
+  if (carrier_) {
+    carrier_->remove_pipelined_request(this);
+  }
+}
+
+int PipelinedDownstreamConnection::attach_downstream(Downstream *downstream) {
+  if (LOG_ENABLED(INFO)) {
+    DCLOG(INFO, this) << "Attaching to DOWNSTREAM:" << downstream;
+  }
+
+  downstream_ = downstream;
+
+  carrier_->add_pipelined_request(this);
+
+  return 0;
+}
+
+void PipelinedDownstreamConnection::detach_downstream(Downstream *downstream) {
+  if (LOG_ENABLED(INFO)) {
+    DCLOG(INFO, this) << "Detaching from DOWNSTREAM:" << downstream;
+  }
+
+  if (carrier_) {
+    carrier_->remove_pipelined_request(this);
+    carrier_ = nullptr;
+  }
+
+  downstream_ = nullptr;
+}
+
+int PipelinedDownstreamConnection::push_request_headers() {
+  if (!carrier_) {
+    // The request is going to be retried.
+    return 0;
+  }
+
+  return carrier_->push_pipelined_request_headers(downstream_);
+}
+
+int PipelinedDownstreamConnection::push_upload_data_chunk(const uint8_t *data,
+                                                          size_t datalen) {
+  // Pipelined request has no request body.
+  return -1;
+}
+
+int PipelinedDownstreamConnection::end_upload_data() { return 0; }
+
+void PipelinedDownstreamConnection::pause_read(IOCtrlReason reason) {}
+
+int PipelinedDownstreamConnection::resume_read(IOCtrlReason reason,
+                                               size_t consumed) {
+  return 0;
+}
+
+void PipelinedDownstreamConnection::force_resume_read() {}
+
+int PipelinedDownstreamConnection::on_read() { return 0; }
+
+int PipelinedDownstreamConnection::on_write() { return 0; }
+
+void PipelinedDownstreamConnection::on_upstream_change(Upstream *upstream) {}
+
+bool PipelinedDownstreamConnection::poolable() const { return false; }
+
+const std::shared_ptr<DownstreamAddrGroup> &
+PipelinedDownstreamConnection::get_downstream_addr_group() const {
+  return group_;
+}
+
+DownstreamAddr *PipelinedDownstreamConnection::get_addr() const {
+  return addr_;
+}
+
+void PipelinedDownstreamConnection::on_carrier_detached(bool retry) {
+  carrier_ = nullptr;
+
+  if (!retry) {
+    return;
+  }
+
+  if (LOG_ENABLED(INFO)) {
+    DCLOG(INFO, this) << "Pipelined request is retried";
+  }
+
+  // Retry in the next event loop iteration because the carrier might
+  // be deleted in the middle of upstream processing.
+  ev_timer_start(loop_, &retry_timer_);
+}
+
+void PipelinedDownstreamConnection::retry() {
+  auto downstream = downstream_;
+  auto upstream = downstream->get_upstream();
+  auto handler = upstream->get_client_handler();
+
+  // The request is idempotent, and has no request body.  It is safe to
+  // send it again even if the backend has received it.
+  downstream->set_request_header_sent(false);
+  downstream->get_request_buf()->reset();
+
+  // This deletes this object.
+  if (upstream->on_downstream_reset(downstream, false) != 0) {
+    delete handler;
+  }
+}
+
+bool PipelinedDownstreamConnection::get_write_started() const {
+  return write_started_;
+}
+
+void PipelinedDownstreamConnection::set_write_started() {
+  write_started_ = true;
+}
+
+} // namespace shrpx
@@ -0,0 +1,100 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHRPX_PIPELINED_DOWNSTREAM_CONNECTION_H
+#define SHRPX_PIPELINED_DOWNSTREAM_CONNECTION_H
+
+#include "shrpx.h"
+
+#include <memory>
+
+#include <ev.h>
+
+#include "shrpx_downstream_connection.h"
+
+namespace shrpx {
+
+class HttpDownstreamConnection;
+
+// PipelinedDownstreamConnection is the backend connection of the
+// request which is pipelined on HttpDownstreamConnection carrying
+// other requests.  The request is written after the requests ahead
+// of it.  When the response to the last of them completes,
+// HttpDownstreamConnection replaces this object.  If
+// HttpDownstreamConnection fails before that, the request is retried
+// with another connection.
+class PipelinedDownstreamConnection : public DownstreamConnection {
+public:
+  PipelinedDownstreamConnection(HttpDownstreamConnection *carrier,
+                                struct ev_loop *loop);
+  virtual ~PipelinedDownstreamConnection();
+  virtual int attach_downstream(Downstream *downstream);
+  virtual void detach_downstream(Downstream *downstream);
+
+  virtual int push_request_headers();
+  virtual int push_upload_data_chunk(const uint8_t *data, size_t datalen);
+  virtual int end_upload_data();
+
+  virtual void pause_read(IOCtrlReason reason);
+  virtual int resume_read(IOCtrlReason reason, size_t consumed);
+  virtual void force_resume_read();
+
+  virtual int on_read();
+  virtual int on_write();
+
+  virtual void on_upstream_change(Upstream *upstream);
+
+  virtual bool poolable() const;
+
+  virtual const std::shared_ptr<DownstreamAddrGroup> &
+  get_downstream_addr_group() const;
+  virtual DownstreamAddr *get_addr() const;
+
+  // Called when the carrier leaves this object.  If |retry| is true,
+  // the request is retried with another connection asynchronously.
+  void on_carrier_detached(bool retry);
+  // Retries the request with another connection.  This function
+  // deletes this object.
+  void retry();
+
+  bool get_write_started() const;
+  void set_write_started();
+
+  PipelinedDownstreamConnection *dlnext, *dlprev;
+
+private:
+  std::shared_ptr<DownstreamAddrGroup> group_;
+  DownstreamAddr *addr_;
+  // The connection which carries the request.  nullptr if the
+  // connection has left.
+  HttpDownstreamConnection *carrier_;
+  ev_timer retry_timer_;
+  struct ev_loop *loop_;
+  // true if the carrier started to write the request.
+  bool write_started_;
+};
+
+} // namespace shrpx
+
+#endif // SHRPX_PIPELINED_DOWNSTREAM_CONNECTION_H
@@ -0,0 +1,468 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_private_key_pool.h"
+
+#include <algorithm>
+
+#include <openssl/err.h>
+#include <openssl/evp.h>
+
+#include "shrpx_connection.h"
+#include "shrpx_metrics.h"
+#include "shrpx_log.h"
+#include "ssl_compat.h"
+
+// Private key operations are offloaded by running TLS handshakes in
+// OpenSSL async jobs, and pausing the job while a signing thread
+// performs the operation.  BoringSSL and LibreSSL do not have async
+// jobs.
+#if OPENSSL_1_1_API && !defined(OPENSSL_IS_BORINGSSL) &&                      \
+    !defined(OPENSSL_NO_ASYNC)
+#  define SHRPX_PRIVATE_KEY_OFFLOAD 1
+#  include <openssl/async.h>
+#endif // OPENSSL_1_1_API && !defined(OPENSSL_IS_BORINGSSL) &&
+       // !defined(OPENSSL_NO_ASYNC)
+
+namespace shrpx {
+
+PrivateKeyOp::PrivateKeyOp()
+    : type(PrivateKeyOpType::RSA_PRIVATE_ENCRYPT),
+      rsa(nullptr),
+      ec_key(nullptr),
+      padding(0),
+      rv(-1),
+      conn(nullptr),
+      duration_us(0),
+      canceled(false),
+      done(false) {}
+
+PrivateKeyOp::~PrivateKeyOp() {
+  if (rsa) {
+    RSA_free(rsa);
+  }
+  if (ec_key) {
+    EC_KEY_free(ec_key);
+  }
+}
+
+void PrivateKeyOp::run() {
+#ifdef SHRPX_PRIVATE_KEY_OFFLOAD
+  switch (type) {
+  case PrivateKeyOpType::RSA_PRIVATE_ENCRYPT:
+    out.resize(RSA_size(rsa));
+    rv = RSA_meth_get_priv_enc(RSA_PKCS1_OpenSSL())(
+        in.size(), in.data(), out.data(), rsa, padding);
+    break;
+  case PrivateKeyOpType::RSA_PRIVATE_DECRYPT:
+    out.resize(RSA_size(rsa));
+    rv = RSA_meth_get_priv_dec(RSA_PKCS1_OpenSSL())(
+        in.size(), in.data(), out.data(), rsa, padding);
+    break;
+  case PrivateKeyOpType::ECDSA_SIGN: {
+    int (*sign)(int, const unsigned char *, int, unsigned char *,
+                unsigned int *, const BIGNUM *, const BIGNUM *, EC_KEY *);
+    EC_KEY_METHOD_get_sign(EC_KEY_OpenSSL(), &sign, nullptr, nullptr);
+
+    out.resize(ECDSA_size(ec_key));
+    unsigned int siglen;
+    if (sign(0, in.data(), in.size(), out.data(), &siglen, nullptr, nullptr,
+             ec_key) != 1) {
+      rv = -1;
+      break;
+    }
+    out.resize(siglen);
+    rv = siglen;
+    break;
+  }
+  }
+
+  if (rv < 0) {
+    ERR_clear_error();
+  }
+#endif // SHRPX_PRIVATE_KEY_OFFLOAD
+}
+
+PrivateKeyPool::PrivateKeyPool(size_t num_threads) : stopped_(false) {
+  threads_.reserve(num_threads);
+
+  for (size_t i = 0; i < num_threads; ++i) {
+    threads_.emplace_back([this] { run(); });
+  }
+}
+
+PrivateKeyPool::~PrivateKeyPool() {
+  {
+    std::lock_guard<std::mutex> g(mu_);
+    stopped_ = true;
+  }
+
+  cv_.notify_all();
+
+  for (auto &t : threads_) {
+    t.join();
+  }
+}
+
+void PrivateKeyPool::submit(std::shared_ptr<PrivateKeyOp> op) {
+  op->queued_time = std::chrono::steady_clock::now();
+
+  {
+    std::lock_guard<std::mutex> g(mu_);
+    ops_.push_back(std::move(op));
+  }
+
+  cv_.notify_one();
+}
+
+size_t PrivateKeyPool::get_num_queued() {
+  std::lock_guard<std::mutex> g(mu_);
+  return ops_.size();
+}
+
+void PrivateKeyPool::run() {
+  for (;;) {
+    std::shared_ptr<PrivateKeyOp> op;
+
+    {
+      std::unique_lock<std::mutex> g(mu_);
+      cv_.wait(g, [this] { return stopped_ || !ops_.empty(); });
+
+      if (stopped_) {
+        return;
+      }
+
+      op = std::move(ops_.front());
+      ops_.pop_front();
+    }
+
+    // The connection might have been closed while the operation is
+    // queued.
+    if (!op->canceled.load(std::memory_order_relaxed)) {
+      op->run();
+    }
+
+    op->duration_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                          std::chrono::steady_clock::now() - op->queued_time)
+                          .count();
+
+    auto queue = op->queue;
+    queue->on_complete(std::move(op));
+  }
+}
+
+namespace {
+void private_key_op_queuecb(struct ev_loop *loop, ev_async *w, int revents) {
+  auto queue = static_cast<PrivateKeyOpQueue *>(w->data);
+
+  queue->process();
+}
+} // namespace
+
+PrivateKeyOpQueue::PrivateKeyOpQueue(struct ev_loop *loop,
+                                     PrivateKeyPool *pool,
+                                     WorkerMetrics *metrics)
+    : loop_(loop), pool_(pool), metrics_(metrics), closed_(false) {
+  ev_async_init(&ev_, private_key_op_queuecb);
+  ev_.data = this;
+  ev_async_start(loop_, &ev_);
+}
+
+PrivateKeyOpQueue::~PrivateKeyOpQueue() { close(); }
+
+void PrivateKeyOpQueue::submit(std::shared_ptr<PrivateKeyOp> op) {
+  op->queue = shared_from_this();
+  pool_->submit(std::move(op));
+}
+
+void PrivateKeyOpQueue::on_complete(std::shared_ptr<PrivateKeyOp> op) {
+  std::lock_guard<std::mutex> g(mu_);
+
+  if (closed_) {
+    return;
+  }
+
+  completed_.push_back(std::move(op));
+
+  ev_async_send(loop_, &ev_);
+}
+
+void PrivateKeyOpQueue::process() {
+  std::vector<std::shared_ptr<PrivateKeyOp>> ops;
+
+  {
+    std::lock_guard<std::mutex> g(mu_);
+    ops.swap(completed_);
+  }
+
+  for (auto &op : ops) {
+    // op->queue refers to this object.
+    op->queue.reset();
+
+    if (op->canceled.load(std::memory_order_relaxed)) {
+      continue;
+    }
+
+    metrics_->private_key_op_duration.record(op->duration_us);
+
+    op->done = true;
+
+    // Resume the handshake.  The job which waits for op continues in
+    // the next SSL_do_handshake().
+    auto conn = op->conn;
+    conn->tls.handshake_state = TLSHandshakeState::NORMAL;
+
+    conn->rlimit.startw();
+    ev_timer_again(conn->loop, &conn->rt);
+
+    conn->wlimit.startw();
+    ev_timer_again(conn->loop, &conn->wt);
+  }
+}
+
+void PrivateKeyOpQueue::close() {
+  std::vector<std::shared_ptr<PrivateKeyOp>> ops;
+
+  {
+    std::lock_guard<std::mutex> g(mu_);
+
+    if (closed_) {
+      return;
+    }
+
+    closed_ = true;
+    ops.swap(completed_);
+  }
+
+  for (auto &op : ops) {
+    op->queue.reset();
+  }
+
+  ev_async_stop(loop_, &ev_);
+}
+
+namespace {
+// The connection whose TLS handshake runs on the current thread.
+thread_local Connection *handshake_conn;
+} // namespace
+
+void private_key_offload_begin(Connection *conn) { handshake_conn = conn; }
+
+void private_key_offload_end() { handshake_conn = nullptr; }
+
+#ifdef SHRPX_PRIVATE_KEY_OFFLOAD
+namespace {
+// Performs |op|.  If the TLS handshake of the current connection runs
+// in an async job, |op| is performed by PrivateKeyPool while the job
+// is paused.  Otherwise, it is performed on the current thread.  It
+// returns false if the connection has been closed before |op|
+// completes.
+bool run_private_key_op(const std::shared_ptr<PrivateKeyOp> &op) {
+  auto conn = handshake_conn;
+  if (!conn || !conn->tls.private_key_op_queue || !ASYNC_get_current_job()) {
+    op->run();
+    return true;
+  }
+
+  op->conn = conn;
+  conn->tls.private_key_op = op;
+  conn->tls.private_key_op_queue->submit(op);
+
+  while (!op->done) {
+    if (op->canceled.load(std::memory_order_relaxed) || !ASYNC_pause_job()) {
+      return false;
+    }
+  }
+
+  conn->tls.private_key_op.reset();
+
+  return true;
+}
+} // namespace
+
+namespace {
+int rsa_private_op(PrivateKeyOpType type, int flen, const unsigned char *from,
+                   unsigned char *to, RSA *rsa, int padding) {
+  auto op = std::make_shared<PrivateKeyOp>();
+  op->type = type;
+  RSA_up_ref(rsa);
+  op->rsa = rsa;
+  op->in.assign(from, from + flen);
+  op->padding = padding;
+
+  if (!run_private_key_op(op) || op->rv < 0) {
+    return -1;
+  }
+
+  std::copy_n(std::begin(op->out), op->rv, to);
+
+  return op->rv;
+}
+} // namespace
+
+namespace {
+int rsa_priv_enc(int flen, const unsigned char *from, unsigned char *to,
+                 RSA *rsa, int padding) {
+  return rsa_private_op(PrivateKeyOpType::RSA_PRIVATE_ENCRYPT, flen, from, to,
+                        rsa, padding);
+}
+} // namespace
+
+namespace {
+int rsa_priv_dec(int flen, const unsigned char *from, unsigned char *to,
+                 RSA *rsa, int padding) {
+  return rsa_private_op(PrivateKeyOpType::RSA_PRIVATE_DECRYPT, flen, from, to,
+                        rsa, padding);
+}
+} // namespace
+
+namespace {
+int ecdsa_sign(int type, const unsigned char *dgst, int dlen,
+               unsigned char *sig, unsigned int *siglen, const BIGNUM *kinv,
+               const BIGNUM *r, EC_KEY *eckey) {
+  if (kinv || r) {
+    int (*sign)(int, const unsigned char *, int, unsigned char *,
+                unsigned int *, const BIGNUM *, const BIGNUM *, EC_KEY *);
+    EC_KEY_METHOD_get_sign(EC_KEY_OpenSSL(), &sign, nullptr, nullptr);
+
+    return sign(type, dgst, dlen, sig, siglen, kinv, r, eckey);
+  }
+
+  auto op = std::make_shared<PrivateKeyOp>();
+  op->type = PrivateKeyOpType::ECDSA_SIGN;
+  EC_KEY_up_ref(eckey);
+  op->ec_key = eckey;
+  op->in.assign(dgst, dgst + dlen);
+
+  if (!run_private_key_op(op) || op->rv < 0) {
+    return 0;
+  }
+
+  std::copy(std::begin(op->out), std::end(op->out), sig);
+  *siglen = op->out.size();
+
+  return 1;
+}
+} // namespace
+
+namespace {
+RSA_METHOD *get_rsa_method() {
+  static auto meth = [] {
+    auto meth = RSA_meth_dup(RSA_PKCS1_OpenSSL());
+    RSA_meth_set1_name(meth, "nghttpx private key offload");
+    RSA_meth_set_priv_enc(meth, rsa_priv_enc);
+    RSA_meth_set_priv_dec(meth, rsa_priv_dec);
+    return meth;
+  }();
+
+  return meth;
+}
+} // namespace
+
+namespace {
+EC_KEY_METHOD *get_ec_key_method() {
+  static auto meth = [] {
+    auto meth = EC_KEY_METHOD_new(EC_KEY_OpenSSL());
+
+    int (*sign_setup)(EC_KEY *, BN_CTX *, BIGNUM **, BIGNUM **);
+    ECDSA_SIG *(*sign_sig)(const unsigned char *, int, const BIGNUM *,
+                           const BIGNUM *, EC_KEY *);
+    EC_KEY_METHOD_get_sign(EC_KEY_OpenSSL(), nullptr, &sign_setup, &sign_sig);
+    EC_KEY_METHOD_set_sign(meth, ecdsa_sign, sign_setup, sign_sig);
+
+    return meth;
+  }();
+
+  return meth;
+}
+} // namespace
+#endif // SHRPX_PRIVATE_KEY_OFFLOAD
+
+bool private_key_offload_supported() {
+#ifdef SHRPX_PRIVATE_KEY_OFFLOAD
+  return ASYNC_is_capable();
+#else  // !SHRPX_PRIVATE_KEY_OFFLOAD
+  return false;
+#endif // !SHRPX_PRIVATE_KEY_OFFLOAD
+}
+
+EVP_PKEY *private_key_offload_wrap(EVP_PKEY *pkey) {
+#ifdef SHRPX_PRIVATE_KEY_OFFLOAD
+  switch (EVP_PKEY_base_id(pkey)) {
+  case EVP_PKEY_RSA: {
+    auto rsa = EVP_PKEY_get1_RSA(pkey);
+    if (!rsa) {
+      return nullptr;
+    }
+
+    // Do not modify the key shared with |pkey|.
+    auto dup = RSAPrivateKey_dup(rsa);
+    RSA_free(rsa);
+    if (!dup) {
+      return nullptr;
+    }
+
+    auto new_pkey = EVP_PKEY_new();
+    if (!new_pkey) {
+      RSA_free(dup);
+      return nullptr;
+    }
+
+    RSA_set_method(dup, get_rsa_method());
+    EVP_PKEY_assign_RSA(new_pkey, dup);
+
+    return new_pkey;
+  }
+  case EVP_PKEY_EC: {
+    auto ec_key = EVP_PKEY_get1_EC_KEY(pkey);
+    if (!ec_key) {
+      return nullptr;
+    }
+
+    auto dup = EC_KEY_dup(ec_key);
+    EC_KEY_free(ec_key);
+    if (!dup) {
+      return nullptr;
+    }
+
+    auto new_pkey = EVP_PKEY_new();
+    if (!new_pkey) {
+      EC_KEY_free(dup);
+      return nullptr;
+    }
+
+    EC_KEY_set_method(dup, get_ec_key_method());
+    EVP_PKEY_assign_EC_KEY(new_pkey, dup);
+
+    return new_pkey;
+  }
+  default:
+    return nullptr;
+  }
+#else  // !SHRPX_PRIVATE_KEY_OFFLOAD
+  return nullptr;
+#endif // !SHRPX_PRIVATE_KEY_OFFLOAD
+}
+
+} // namespace shrpx
@@ -0,0 +1,167 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHRPX_PRIVATE_KEY_POOL_H
+#define SHRPX_PRIVATE_KEY_POOL_H
+
+#include "shrpx.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <ev.h>
+
+#include <openssl/ssl.h>
+#include <openssl/rsa.h>
+#include <openssl/ec.h>
+
+namespace shrpx {
+
+struct Connection;
+class PrivateKeyOpQueue;
+struct WorkerMetrics;
+
+enum class PrivateKeyOpType {
+  RSA_PRIVATE_ENCRYPT,
+  RSA_PRIVATE_DECRYPT,
+  ECDSA_SIGN,
+};
+
+// PrivateKeyOp is a private key operation which a TLS handshake
+// offloads to PrivateKeyPool.  The input and the result are owned by
+// this object, so that a signing thread never touches the
+// connection.
+struct PrivateKeyOp {
+  PrivateKeyOp();
+  ~PrivateKeyOp();
+
+  // Performs the operation.  This function is called by a signing
+  // thread.
+  void run();
+
+  PrivateKeyOpType type;
+  // The key.  One of them is not nullptr, and a reference is held.
+  RSA *rsa;
+  EC_KEY *ec_key;
+  std::vector<uint8_t> in;
+  // The RSA padding mode.
+  int padding;
+  // The result of the operation.  It is valid if rv >= 0.
+  std::vector<uint8_t> out;
+  int rv;
+  // The queue of the worker which submitted this operation.
+  std::shared_ptr<PrivateKeyOpQueue> queue;
+  // The connection which waits for this operation.  It is only
+  // accessed by the worker thread.
+  Connection *conn;
+  // The time taken to complete this operation, including the time
+  // spent in the queue of PrivateKeyPool, in microseconds.
+  uint64_t duration_us;
+  std::chrono::steady_clock::time_point queued_time;
+  // true if the connection gave up this operation.
+  std::atomic<bool> canceled;
+  // true if the worker has received the result.  It is only accessed
+  // by the worker thread.
+  bool done;
+};
+
+// PrivateKeyPool is a pool of threads which perform private key
+// operations for TLS handshakes, so that a burst of full handshakes
+// does not stall the other connections handled by workers.  It is
+// shared by all workers.
+class PrivateKeyPool {
+public:
+  PrivateKeyPool(size_t num_threads);
+  ~PrivateKeyPool();
+
+  void submit(std::shared_ptr<PrivateKeyOp> op);
+
+  // Returns the number of operations waiting for a thread.
+  size_t get_num_queued();
+
+private:
+  void run();
+
+  std::mutex mu_;
+  std::condition_variable cv_;
+  std::deque<std::shared_ptr<PrivateKeyOp>> ops_;
+  std::vector<std::thread> threads_;
+  bool stopped_;
+};
+
+// PrivateKeyOpQueue receives the operations completed by
+// PrivateKeyPool for a worker, and resumes the handshakes waiting for
+// them in the worker thread.
+class PrivateKeyOpQueue
+    : public std::enable_shared_from_this<PrivateKeyOpQueue> {
+public:
+  PrivateKeyOpQueue(struct ev_loop *loop, PrivateKeyPool *pool,
+                    WorkerMetrics *metrics);
+  ~PrivateKeyOpQueue();
+
+  // Submits |op| to PrivateKeyPool.
+  void submit(std::shared_ptr<PrivateKeyOp> op);
+  // Called by a signing thread when |op| completes.
+  void on_complete(std::shared_ptr<PrivateKeyOp> op);
+  // Resumes the handshakes whose operations have completed.
+  void process();
+  // Stops receiving operations.  It must be called before the worker
+  // is destroyed, because this object may outlive it.
+  void close();
+
+private:
+  std::mutex mu_;
+  std::vector<std::shared_ptr<PrivateKeyOp>> completed_;
+  ev_async ev_;
+  struct ev_loop *loop_;
+  PrivateKeyPool *pool_;
+  WorkerMetrics *metrics_;
+  bool closed_;
+};
+
+// Returns true if private key operations can be offloaded with the
+// linked TLS library.
+bool private_key_offload_supported();
+
+// Returns a copy of |pkey| whose private key operations are offloaded
+// to PrivateKeyPool when they are performed in the handshake of a
+// connection passed to private_key_offload_begin().  It returns
+// nullptr if the type of |pkey| is not supported.  The caller should
+// free the returned object using EVP_PKEY_free().
+EVP_PKEY *private_key_offload_wrap(EVP_PKEY *pkey);
+
+// Tells that the TLS handshake of |conn| runs on the current thread
+// until private_key_offload_end() is called.
+void private_key_offload_begin(Connection *conn);
+void private_key_offload_end();
+
+} // namespace shrpx
+
+#endif // SHRPX_PRIVATE_KEY_POOL_H
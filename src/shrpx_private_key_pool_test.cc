@@ -0,0 +1,406 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_private_key_pool_test.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <CUnit/CUnit.h>
+
+#include <openssl/evp.h>
+#include <openssl/bn.h>
+#include <openssl/x509.h>
+#ifdef SSL_MODE_ASYNC
+#  include <openssl/async.h>
+#endif // SSL_MODE_ASYNC
+
+#include "shrpx_private_key_pool.h"
+#include "shrpx_connection.h"
+#include "shrpx_config.h"
+#include "shrpx_metrics.h"
+#include "shrpx_error.h"
+#include "shrpx_log.h"
+#include "util.h"
+
+namespace shrpx {
+
+namespace {
+constexpr uint8_t sign_data[] = "private key operation";
+} // namespace
+
+namespace {
+// Signs |sign_data| using |pkey|, and stores the signature in |sig|.
+// It returns true if it succeeds.
+bool sign(std::vector<uint8_t> &sig, EVP_PKEY *pkey) {
+  auto ctx = EVP_MD_CTX_new();
+
+  size_t siglen;
+  auto rv =
+      EVP_DigestSignInit(ctx, nullptr, EVP_sha256(), nullptr, pkey) == 1 &&
+      EVP_DigestSign(ctx, nullptr, &siglen, sign_data, sizeof(sign_data)) ==
+          1;
+
+  if (rv) {
+    sig.resize(siglen);
+    rv = EVP_DigestSign(ctx, sig.data(), &siglen, sign_data,
+                        sizeof(sign_data)) == 1;
+    sig.resize(siglen);
+  }
+
+  EVP_MD_CTX_free(ctx);
+
+  return rv;
+}
+} // namespace
+
+namespace {
+// Returns true if |sig| is the valid signature of |sign_data| by
+// |pkey|.
+bool verify(const std::vector<uint8_t> &sig, EVP_PKEY *pkey) {
+  auto ctx = EVP_MD_CTX_new();
+
+  auto rv =
+      EVP_DigestVerifyInit(ctx, nullptr, EVP_sha256(), nullptr, pkey) == 1 &&
+      EVP_DigestVerify(ctx, sig.data(), sig.size(), sign_data,
+                       sizeof(sign_data)) == 1;
+
+  EVP_MD_CTX_free(ctx);
+
+  return rv;
+}
+} // namespace
+
+namespace {
+EVP_PKEY *generate_rsa_key() {
+  auto rsa = RSA_new();
+  auto e = BN_new();
+
+  BN_set_word(e, RSA_F4);
+  CU_ASSERT(1 == RSA_generate_key_ex(rsa, 2048, e, nullptr));
+
+  BN_free(e);
+
+  auto pkey = EVP_PKEY_new();
+  EVP_PKEY_assign_RSA(pkey, rsa);
+
+  return pkey;
+}
+} // namespace
+
+namespace {
+EVP_PKEY *generate_ec_key() {
+  auto ec_key = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
+
+  CU_ASSERT(1 == EC_KEY_generate_key(ec_key));
+
+  auto pkey = EVP_PKEY_new();
+  EVP_PKEY_assign_EC_KEY(pkey, ec_key);
+
+  return pkey;
+}
+} // namespace
+
+namespace {
+// Checks that the private key operations of |pkey| wrapped by
+// private_key_offload_wrap() still work outside of a handshake, in
+// which they are performed synchronously.
+void check_sync(EVP_PKEY *pkey) {
+  auto offload_pkey = private_key_offload_wrap(pkey);
+
+  if (private_key_offload_supported()) {
+    CU_ASSERT_FATAL(nullptr != offload_pkey);
+  }
+
+  if (!offload_pkey) {
+    return;
+  }
+
+  std::vector<uint8_t> sig;
+
+  CU_ASSERT(sign(sig, offload_pkey));
+  CU_ASSERT(verify(sig, pkey));
+
+  EVP_PKEY_free(offload_pkey);
+}
+} // namespace
+
+void test_shrpx_private_key_pool_rsa(void) {
+  auto pkey = generate_rsa_key();
+
+  check_sync(pkey);
+
+  EVP_PKEY_free(pkey);
+}
+
+void test_shrpx_private_key_pool_ecdsa(void) {
+  auto pkey = generate_ec_key();
+
+  check_sync(pkey);
+
+  EVP_PKEY_free(pkey);
+}
+
+#ifdef SSL_MODE_ASYNC
+namespace {
+void noop_iocb(struct ev_loop *loop, ev_io *w, int revents) {}
+} // namespace
+
+namespace {
+void noop_timeoutcb(struct ev_loop *loop, ev_timer *w, int revents) {}
+} // namespace
+
+namespace {
+struct SignJobArg {
+  EVP_PKEY *pkey;
+  std::vector<uint8_t> *sig;
+};
+} // namespace
+
+namespace {
+int sign_job(void *arg) {
+  auto job_arg = static_cast<SignJobArg *>(arg);
+
+  return sign(*job_arg->sig, job_arg->pkey);
+}
+} // namespace
+
+namespace {
+// Signs using |pkey| wrapped by private_key_offload_wrap() in an
+// async job, as if it is done in the handshake of a connection.  The
+// operation must be performed by PrivateKeyPool, and the job is
+// resumed by PrivateKeyOpQueue through the event loop.
+void check_async(EVP_PKEY *pkey) {
+  auto offload_pkey = private_key_offload_wrap(pkey);
+
+  CU_ASSERT_FATAL(nullptr != offload_pkey);
+
+  auto loop = EV_DEFAULT;
+  PrivateKeyPool pool(2);
+  WorkerMetrics metrics;
+  auto queue = std::make_shared<PrivateKeyOpQueue>(loop, &pool, &metrics);
+  MemchunkPool mcpool;
+
+  int fds[2];
+
+  CU_ASSERT_FATAL(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+  {
+    Connection conn(loop, fds[0], nullptr, &mcpool, 30., 30.,
+                    RateLimitConfig{}, RateLimitConfig{}, noop_iocb,
+                    noop_iocb, noop_timeoutcb, nullptr, 0, 0., Proto::HTTP1);
+    conn.tls.private_key_op_queue = queue.get();
+
+    std::vector<uint8_t> sig;
+    SignJobArg arg{offload_pkey, &sig};
+    ASYNC_JOB *job = nullptr;
+    auto waitctx = ASYNC_WAIT_CTX_new();
+    size_t npauses = 0;
+    int ret = 0;
+
+    for (;;) {
+      private_key_offload_begin(&conn);
+      auto rv =
+          ASYNC_start_job(&job, waitctx, &ret, sign_job, &arg, sizeof(arg));
+      private_key_offload_end();
+
+      if (rv != ASYNC_PAUSE) {
+        CU_ASSERT(ASYNC_FINISH == rv);
+        break;
+      }
+
+      ++npauses;
+
+      // The job waits for the operation submitted to PrivateKeyPool.
+      CU_ASSERT(nullptr != conn.tls.private_key_op);
+
+      ev_run(loop, EVRUN_ONCE);
+    }
+
+    ASYNC_WAIT_CTX_free(waitctx);
+
+    CU_ASSERT(1 == ret);
+    CU_ASSERT(npauses > 0);
+    CU_ASSERT(nullptr == conn.tls.private_key_op);
+    CU_ASSERT(verify(sig, pkey));
+
+    LatencyHistogramSnapshot snapshot{};
+    snapshot.merge(metrics.private_key_op_duration);
+
+    CU_ASSERT(snapshot.count() > 0);
+  }
+
+  close(fds[1]);
+
+  queue->close();
+
+  EVP_PKEY_free(offload_pkey);
+}
+} // namespace
+#endif // SSL_MODE_ASYNC
+
+void test_shrpx_private_key_pool_async(void) {
+#ifdef SSL_MODE_ASYNC
+  if (!private_key_offload_supported()) {
+    return;
+  }
+
+  auto rsa_pkey = generate_rsa_key();
+
+  check_async(rsa_pkey);
+
+  EVP_PKEY_free(rsa_pkey);
+
+  auto ec_pkey = generate_ec_key();
+
+  check_async(ec_pkey);
+
+  EVP_PKEY_free(ec_pkey);
+#endif // SSL_MODE_ASYNC
+}
+
+#ifdef SSL_MODE_ASYNC
+namespace {
+// Creates self-signed certificate for |pkey|.
+X509 *create_cert(EVP_PKEY *pkey) {
+  auto cert = X509_new();
+
+  X509_set_version(cert, 2);
+  ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+  X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+  X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+  X509_set_pubkey(cert, pkey);
+
+  auto name = X509_get_subject_name(cert);
+  X509_NAME_add_entry_by_txt(
+      name, "CN", MBSTRING_ASC,
+      reinterpret_cast<const unsigned char *>("localhost"), -1, -1, 0);
+  X509_set_issuer_name(cert, name);
+
+  CU_ASSERT(0 < X509_sign(cert, pkey, EVP_sha256()));
+
+  return cert;
+}
+} // namespace
+#endif // SSL_MODE_ASYNC
+
+void test_shrpx_private_key_pool_cancel(void) {
+#ifdef SSL_MODE_ASYNC
+  if (!private_key_offload_supported()) {
+    return;
+  }
+
+  // Connection::set_ssl() needs this.
+  auto &tlsconf = mod_config()->tls;
+  if (!tlsconf.bio_method) {
+    tlsconf.bio_method = create_bio_method();
+  }
+
+  auto pkey = generate_ec_key();
+  auto offload_pkey = private_key_offload_wrap(pkey);
+
+  CU_ASSERT_FATAL(nullptr != offload_pkey);
+
+  auto cert = create_cert(pkey);
+
+  auto server_ssl_ctx = SSL_CTX_new(TLS_server_method());
+  CU_ASSERT(1 == SSL_CTX_use_certificate(server_ssl_ctx, cert));
+  CU_ASSERT(1 == SSL_CTX_use_PrivateKey(server_ssl_ctx, offload_pkey));
+  SSL_CTX_set_mode(server_ssl_ctx, SSL_MODE_ASYNC);
+
+  auto client_ssl_ctx = SSL_CTX_new(TLS_client_method());
+
+  auto loop = EV_DEFAULT;
+  PrivateKeyPool pool(1);
+  WorkerMetrics metrics;
+  auto queue = std::make_shared<PrivateKeyOpQueue>(loop, &pool, &metrics);
+  MemchunkPool mcpool;
+
+  int fds[2];
+
+  CU_ASSERT_FATAL(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+  util::make_socket_nonblocking(fds[0]);
+  util::make_socket_nonblocking(fds[1]);
+
+  auto client_ssl = SSL_new(client_ssl_ctx);
+  SSL_set_fd(client_ssl, fds[1]);
+  SSL_set_connect_state(client_ssl);
+
+  std::shared_ptr<PrivateKeyOp> op;
+
+  {
+    Connection conn(loop, fds[0], SSL_new(server_ssl_ctx), &mcpool, 30., 30.,
+                    RateLimitConfig{}, RateLimitConfig{}, noop_iocb,
+                    noop_iocb, noop_timeoutcb, nullptr, 0, 0., Proto::HTTP1);
+    conn.tls.private_key_op_queue = queue.get();
+    conn.prepare_server_handshake();
+    conn.rlimit.startw();
+
+    for (size_t i = 0; i < 10 && !conn.tls.private_key_op; ++i) {
+      SSL_do_handshake(client_ssl);
+
+      CU_ASSERT(SHRPX_ERR_INPROGRESS == conn.tls_handshake());
+    }
+
+    // The handshake is paused for signing CertificateVerify.
+    CU_ASSERT_FATAL(nullptr != conn.tls.private_key_op);
+    CU_ASSERT(TLSHandshakeState::WAIT_FOR_PRIVATE_KEY_OP ==
+              conn.tls.handshake_state);
+
+    op = conn.tls.private_key_op;
+
+    conn.disconnect();
+
+    CU_ASSERT(op->canceled.load());
+    CU_ASSERT(nullptr == conn.tls.private_key_op);
+    CU_ASSERT(nullptr == conn.tls.ssl);
+  }
+
+  // PrivateKeyOpQueue must not touch the connection which has gone.
+  while (op->queue) {
+    ev_run(loop, EVRUN_ONCE);
+  }
+
+  CU_ASSERT(!op->done);
+
+  LatencyHistogramSnapshot snapshot{};
+  snapshot.merge(metrics.private_key_op_duration);
+
+  CU_ASSERT(0 == snapshot.count());
+
+  SSL_free(client_ssl);
+  close(fds[1]);
+
+  queue->close();
+
+  SSL_CTX_free(client_ssl_ctx);
+  SSL_CTX_free(server_ssl_ctx);
+  X509_free(cert);
+  EVP_PKEY_free(offload_pkey);
+  EVP_PKEY_free(pkey);
+#endif // SSL_MODE_ASYNC
+}
+
+} // namespace shrpx
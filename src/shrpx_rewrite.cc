@@ -0,0 +1,483 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_rewrite.h"
+
+#include <algorithm>
+
+#include "shrpx_downstream.h"
+#include "shrpx_upstream.h"
+#include "shrpx_config.h"
+#include "shrpx_log.h"
+#include "util.h"
+
+namespace shrpx {
+
+namespace {
+StringRef make_lower_string_ref(BlockAllocator &balloc, const StringRef &src) {
+  auto iov = make_byte_ref(balloc, src.size() + 1);
+  auto p = iov.base;
+  p = std::copy(std::begin(src), std::end(src), p);
+  util::inp_strlower(iov.base, p);
+  *p = '\0';
+
+  return StringRef{iov.base, p};
+}
+} // namespace
+
+namespace {
+// Parses header field name |src| for the condition or action of
+// --rewrite-rule.
+StringRef parse_header_name(BlockAllocator &balloc, const StringRef &src) {
+  auto name = make_lower_string_ref(balloc, src);
+  if (!nghttp2_check_header_name(name.byte(), name.size())) {
+    return StringRef{};
+  }
+
+  return name;
+}
+} // namespace
+
+namespace {
+// Returns true if header field |token| must not be changed by
+// --rewrite-rule, because it determines the message framing.
+bool is_framing_header(int32_t token) {
+  switch (token) {
+  case http2::HD_CONNECTION:
+  case http2::HD_CONTENT_LENGTH:
+  case http2::HD_TRANSFER_ENCODING:
+    return true;
+  default:
+    return false;
+  }
+}
+} // namespace
+
+namespace {
+// Parses the header field action |op| in |value|, and appends it to
+// |actions|.
+int parse_header_action(std::vector<RewriteHeaderAction> &actions,
+                        BlockAllocator &balloc, RewriteHeaderOp op,
+                        const StringRef &value) {
+  RewriteHeaderAction action{};
+  action.op = op;
+
+  if (op == RewriteHeaderOp::REMOVE) {
+    action.name = parse_header_name(balloc, value);
+    if (action.name.empty()) {
+      LOG(ERROR) << "rewrite-rule: invalid header field name: " << value;
+      return -1;
+    }
+  } else {
+    auto nv = parse_header(balloc, value);
+    if (nv.name.empty()) {
+      LOG(ERROR) << "rewrite-rule: invalid header field: " << value;
+      return -1;
+    }
+
+    action.name = nv.name;
+    action.value = nv.value;
+  }
+
+  action.token = http2::lookup_token(action.name);
+
+  if (is_framing_header(action.token)) {
+    LOG(ERROR) << "rewrite-rule: " << action.name
+               << " header field cannot be changed";
+    return -1;
+  }
+
+  actions.push_back(std::move(action));
+
+  return 0;
+}
+} // namespace
+
+namespace {
+// Returns true if |path| can be used in path condition, or
+// rewrite-path action.
+bool check_path(const StringRef &path) {
+  return !path.empty() && path[0] == '/' &&
+         std::find(std::begin(path), std::end(path), '?') == std::end(path);
+}
+} // namespace
+
+int parse_rewrite_rule(RewriteRule &rule, BlockAllocator &balloc,
+                       const StringRef &src) {
+  rule = RewriteRule{};
+  rule.method = -1;
+  rule.reply = RewriteReply::NONE;
+
+  auto status_given = false;
+
+  auto first = std::begin(src);
+  for (;;) {
+    auto end = std::find(first, std::end(src), ';');
+    auto param = StringRef{first, end};
+    auto eq = std::find(std::begin(param), std::end(param), '=');
+    auto key = StringRef{std::begin(param), eq};
+    auto value = eq == std::end(param) ? StringRef{}
+                                       : StringRef{eq + 1, std::end(param)};
+
+    if (util::strieq_l("method", key)) {
+      rule.method = http2::lookup_method_token(value);
+      if (rule.method == -1) {
+        LOG(ERROR) << "rewrite-rule: unknown method: " << value;
+        return -1;
+      }
+    } else if (util::strieq_l("host", key)) {
+      if (value.empty()) {
+        LOG(ERROR) << "rewrite-rule: host must not be empty";
+        return -1;
+      }
+      rule.host = make_lower_string_ref(balloc, value);
+    } else if (util::strieq_l("path", key)) {
+      if (!check_path(value)) {
+        LOG(ERROR) << "rewrite-rule: path must start with '/', and must not "
+                      "contain query: "
+                   << value;
+        return -1;
+      }
+      rule.path = make_string_ref(balloc, value);
+    } else if (util::strieq_l("header", key)) {
+      RewriteHeaderMatch m{};
+
+      if (std::find(std::begin(value), std::end(value), ':') ==
+          std::end(value)) {
+        m.name = parse_header_name(balloc, value);
+      } else {
+        auto nv = parse_header(balloc, value);
+        m.name = nv.name;
+        m.value = nv.value;
+        m.has_value = true;
+      }
+
+      if (m.name.empty()) {
+        LOG(ERROR) << "rewrite-rule: invalid header field: " << value;
+        return -1;
+      }
+
+      m.token = http2::lookup_token(m.name);
+
+      rule.headers.push_back(std::move(m));
+    } else if (util::strieq_l("set-request-header", key)) {
+      if (parse_header_action(rule.request_headers, balloc,
+                              RewriteHeaderOp::SET, value) != 0) {
+        return -1;
+      }
+    } else if (util::strieq_l("add-request-header", key)) {
+      if (parse_header_action(rule.request_headers, balloc,
+                              RewriteHeaderOp::ADD, value) != 0) {
+        return -1;
+      }
+    } else if (util::strieq_l("remove-request-header", key)) {
+      if (parse_header_action(rule.request_headers, balloc,
+                              RewriteHeaderOp::REMOVE, value) != 0) {
+        return -1;
+      }
+    } else if (util::strieq_l("set-response-header", key)) {
+      if (parse_header_action(rule.response_headers, balloc,
+                              RewriteHeaderOp::SET, value) != 0) {
+        return -1;
+      }
+    } else if (util::strieq_l("add-response-header", key)) {
+      if (parse_header_action(rule.response_headers, balloc,
+                              RewriteHeaderOp::ADD, value) != 0) {
+        return -1;
+      }
+    } else if (util::strieq_l("remove-response-header", key)) {
+      if (parse_header_action(rule.response_headers, balloc,
+                              RewriteHeaderOp::REMOVE, value) != 0) {
+        return -1;
+      }
+    } else if (util::strieq_l("rewrite-path", key)) {
+      if (!check_path(value)) {
+        LOG(ERROR) << "rewrite-rule: rewrite-path must start with '/', and "
+                      "must not contain query: "
+                   << value;
+        return -1;
+      }
+      rule.rewrite_path = make_string_ref(balloc, value);
+    } else if (util::strieq_l("redirect", key)) {
+      if (rule.reply != RewriteReply::NONE) {
+        LOG(ERROR) << "rewrite-rule: redirect and return are mutually "
+                      "exclusive";
+        return -1;
+      }
+      if (value.empty() ||
+          !nghttp2_check_header_value(value.byte(), value.size())) {
+        LOG(ERROR) << "rewrite-rule: invalid redirect URI: " << value;
+        return -1;
+      }
+      rule.reply = RewriteReply::REDIRECT;
+      rule.location = make_string_ref(balloc, value);
+    } else if (util::strieq_l("return", key)) {
+      if (rule.reply != RewriteReply::NONE) {
+        LOG(ERROR) << "rewrite-rule: redirect and return are mutually "
+                      "exclusive";
+        return -1;
+      }
+      rule.reply = RewriteReply::RETURN;
+    } else if (util::strieq_l("status", key)) {
+      auto n = util::parse_uint(value);
+      if (n < 200 || n > 599) {
+        LOG(ERROR) << "rewrite-rule: status must be in the range [200, 599]: "
+                   << value;
+        return -1;
+      }
+      rule.status = n;
+      status_given = true;
+    } else if (!param.empty()) {
+      LOG(ERROR) << "rewrite-rule: unknown parameter: " << param;
+      return -1;
+    }
+
+    if (end == std::end(src)) {
+      break;
+    }
+
+    first = end + 1;
+  }
+
+  switch (rule.reply) {
+  case RewriteReply::NONE:
+    if (status_given) {
+      LOG(ERROR) << "rewrite-rule: status requires redirect or return";
+      return -1;
+    }
+
+    if (rule.request_headers.empty() && rule.response_headers.empty() &&
+        rule.rewrite_path.empty()) {
+      LOG(ERROR) << "rewrite-rule: no action is specified";
+      return -1;
+    }
+
+    break;
+  case RewriteReply::REDIRECT:
+    if (!status_given) {
+      rule.status = 308;
+    }
+
+    switch (rule.status) {
+    case 301:
+    case 302:
+    case 303:
+    case 307:
+    case 308:
+      break;
+    default:
+      LOG(ERROR) << "rewrite-rule: redirect status must be one of 301, 302, "
+                    "303, 307, and 308";
+      return -1;
+    }
+
+    break;
+  case RewriteReply::RETURN:
+    if (!status_given) {
+      rule.status = 200;
+    }
+
+    break;
+  }
+
+  return 0;
+}
+
+namespace {
+bool match_host(const StringRef &pattern, const StringRef &host) {
+  if (util::starts_with(pattern, StringRef::from_lit("*."))) {
+    // The wildcard does not match empty label.
+    return host.size() > pattern.size() - 1 &&
+           util::iends_with(host, StringRef{std::begin(pattern) + 1,
+                                            std::end(pattern)});
+  }
+
+  return util::strieq(pattern, host);
+}
+} // namespace
+
+namespace {
+bool match_path(const StringRef &pattern, const StringRef &path) {
+  auto query = std::find(std::begin(path), std::end(path), '?');
+  auto p = StringRef{std::begin(path), query};
+
+  if (pattern[pattern.size() - 1] == '/') {
+    return util::starts_with(p, pattern);
+  }
+
+  return pattern == p;
+}
+} // namespace
+
+namespace {
+bool match_header(const RewriteHeaderMatch &m, const HeaderRefs &headers) {
+  for (auto &kv : headers) {
+    if (m.token == -1 ? kv.name != m.name : kv.token != m.token) {
+      continue;
+    }
+
+    if (!m.has_value || kv.value == m.value) {
+      return true;
+    }
+  }
+
+  return false;
+}
+} // namespace
+
+bool rewrite_rule_match(const RewriteRule &rule, const Request &req) {
+  if (rule.method != -1 && rule.method != req.method) {
+    return false;
+  }
+
+  if (!rule.host.empty() &&
+      !match_host(rule.host, util::extract_host(req.authority))) {
+    return false;
+  }
+
+  if (!rule.path.empty() && !match_path(rule.path, req.path)) {
+    return false;
+  }
+
+  for (auto &m : rule.headers) {
+    if (!match_header(m, req.fs.headers())) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+namespace {
+void apply_header_actions(FieldStore &fs,
+                          const std::vector<RewriteHeaderAction> &actions) {
+  for (auto &a : actions) {
+    if (a.op != RewriteHeaderOp::ADD) {
+      auto &headers = fs.headers();
+      headers.erase(std::remove_if(std::begin(headers), std::end(headers),
+                                   [&a](const HeaderRefs::value_type &kv) {
+                                     return kv.name == a.name;
+                                   }),
+                    std::end(headers));
+    }
+
+    if (a.op != RewriteHeaderOp::REMOVE) {
+      fs.add_header_token(a.name, a.value, false, a.token);
+    }
+  }
+}
+} // namespace
+
+void rewrite_apply_request(const RewriteRule &rule, Request &req,
+                           BlockAllocator &balloc) {
+  apply_header_actions(req.fs, rule.request_headers);
+
+  if (rule.rewrite_path.empty() || req.path.empty() || req.path[0] != '/') {
+    return;
+  }
+
+  auto query = std::find(std::begin(req.path), std::end(req.path), '?');
+  auto rest = StringRef{};
+
+  if (!rule.path.empty() && rule.path[rule.path.size() - 1] == '/') {
+    // The request path starts with rule.path.
+    rest = StringRef{std::begin(req.path) + rule.path.size(), query};
+  }
+
+  req.path = concat_string_ref(balloc, rule.rewrite_path, rest,
+                               StringRef{query, std::end(req.path)});
+}
+
+void rewrite_apply_response(const RewriteRule &rule, Response &resp) {
+  apply_header_actions(resp.fs, rule.response_headers);
+}
+
+int rewrite_request(Downstream *downstream) {
+  const auto &rules = get_config()->http.rewrite_rules;
+
+  if (rules.empty()) {
+    return 0;
+  }
+
+  auto &req = downstream->request();
+  auto &balloc = downstream->get_block_allocator();
+
+  for (size_t i = 0; i < rules.size(); ++i) {
+    auto &rule = rules[i];
+
+    if (!rewrite_rule_match(rule, req)) {
+      continue;
+    }
+
+    if (LOG_ENABLED(INFO)) {
+      DLOG(INFO, downstream) << "Rewrite rule #" << i << " matched";
+    }
+
+    if (!rule.response_headers.empty()) {
+      downstream->set_rewrite_rule_matched(i);
+    }
+
+    rewrite_apply_request(rule, req, balloc);
+
+    if (rule.reply == RewriteReply::NONE) {
+      continue;
+    }
+
+    auto &resp = downstream->response();
+
+    resp.http_status = rule.status;
+
+    if (rule.reply == RewriteReply::REDIRECT) {
+      resp.fs.add_header_token(StringRef::from_lit("location"), rule.location,
+                               false, http2::HD_LOCATION);
+    }
+
+    if (rule.status != 204 && rule.status != 304) {
+      resp.fs.add_header_token(StringRef::from_lit("content-length"),
+                               StringRef::from_lit("0"), false,
+                               http2::HD_CONTENT_LENGTH);
+    }
+
+    rewrite_response(downstream);
+
+    auto upstream = downstream->get_upstream();
+
+    return upstream->send_reply(downstream, nullptr, 0);
+  }
+
+  return 0;
+}
+
+void rewrite_response(Downstream *downstream) {
+  const auto &rules = get_config()->http.rewrite_rules;
+  auto &resp = downstream->response();
+
+  for (size_t i = 0; i < rules.size(); ++i) {
+    if (downstream->get_rewrite_rule_matched(i)) {
+      rewrite_apply_response(rules[i], resp);
+    }
+  }
+}
+
+} // namespace shrpx
@@ -0,0 +1,145 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHRPX_REWRITE_H
+#define SHRPX_REWRITE_H
+
+#include "shrpx.h"
+
+#include <vector>
+
+#include "http2.h"
+#include "template.h"
+#include "allocator.h"
+
+using namespace nghttp2;
+
+namespace shrpx {
+
+class Downstream;
+struct Request;
+struct Response;
+
+enum class RewriteHeaderOp {
+  // Replaces the existing header fields with the same name.
+  SET,
+  ADD,
+  REMOVE,
+};
+
+struct RewriteHeaderAction {
+  RewriteHeaderOp op;
+  // Lowercased header field name.
+  StringRef name;
+  // Empty if |op| is RewriteHeaderOp::REMOVE.
+  StringRef value;
+  int32_t token;
+};
+
+struct RewriteHeaderMatch {
+  // Lowercased header field name.
+  StringRef name;
+  // The value which header field must have.  If |has_value| is
+  // false, the header field only has to be present.
+  StringRef value;
+  int32_t token;
+  bool has_value;
+};
+
+enum class RewriteReply {
+  // The request is forwarded to backend.
+  NONE,
+  // Responds with redirect to |location|.
+  REDIRECT,
+  // Responds with |status| and empty body.
+  RETURN,
+};
+
+// RewriteRule is a rule given by --rewrite-rule.  The conditions and
+// actions are parsed and interned on startup, so that evaluating them
+// does not require anything but comparisons.  The strings are
+// allocated by the allocator of Config, and they are used in header
+// fields as they are.
+struct RewriteRule {
+  // Conditions.  The rule matches a request if all of them are
+  // satisfied.
+
+  // HTTP method token, or -1 if any method matches.
+  int method;
+  // Lowercased host.  If it starts with "*.", it matches the
+  // subdomains.  Empty if any host matches.
+  StringRef host;
+  // Request path without query.  If it ends with "/", it matches the
+  // paths which start with it.  Empty if any path matches.
+  StringRef path;
+  std::vector<RewriteHeaderMatch> headers;
+
+  // Actions.
+
+  std::vector<RewriteHeaderAction> request_headers;
+  std::vector<RewriteHeaderAction> response_headers;
+  // If nonempty, the path of the matched request is rewritten to
+  // this value.  If |path| is a prefix, only the matched part is
+  // replaced.  Query is preserved.
+  StringRef rewrite_path;
+  // The value of location header field if |reply| is
+  // RewriteReply::REDIRECT.
+  StringRef location;
+  RewriteReply reply;
+  // The status code of the response if |reply| is not
+  // RewriteReply::NONE.
+  unsigned int status;
+};
+
+// Parses |src| as the value of --rewrite-rule, and stores it in
+// |rule|.  The strings are allocated by |balloc|.  This function
+// returns 0 if it succeeds, or -1.
+int parse_rewrite_rule(RewriteRule &rule, BlockAllocator &balloc,
+                       const StringRef &src);
+
+// Returns true if |req| satisfies the conditions of |rule|.
+bool rewrite_rule_match(const RewriteRule &rule, const Request &req);
+
+// Applies the actions of |rule| on request header fields and path to
+// |req|.  The new path is allocated by |balloc|.
+void rewrite_apply_request(const RewriteRule &rule, Request &req,
+                           BlockAllocator &balloc);
+
+// Applies the actions of |rule| on response header fields to |resp|.
+void rewrite_apply_response(const RewriteRule &rule, Response &resp);
+
+// Evaluates the rules given by --rewrite-rule against the request of
+// |downstream|, and applies the actions of the rules which match.  If
+// a rule responds to the request, the response is sent, and the
+// remaining rules are not evaluated.  This function returns 0 if it
+// succeeds, or -1.
+int rewrite_request(Downstream *downstream);
+
+// Applies the actions on response header fields of the rules which
+// matched the request of |downstream| to its response.
+void rewrite_response(Downstream *downstream);
+
+} // namespace shrpx
+
+#endif // SHRPX_REWRITE_H
@@ -0,0 +1,233 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_rewrite_test.h"
+
+#include <CUnit/CUnit.h>
+
+#include "shrpx_rewrite.h"
+#include "shrpx_downstream.h"
+#include "shrpx_log.h"
+
+namespace shrpx {
+
+namespace {
+void add_header(HeaderRefs &headers, const StringRef &name,
+                const StringRef &value) {
+  headers.emplace_back(name, value, false,
+                       http2::lookup_token(name.byte(), name.size()));
+}
+} // namespace
+
+void test_shrpx_rewrite_parse_rewrite_rule(void) {
+  BlockAllocator balloc(4096, 4096);
+
+  {
+    RewriteRule rule;
+
+    CU_ASSERT(0 == parse_rewrite_rule(
+                       rule, balloc,
+                       StringRef::from_lit(
+                           "method=GET;host=*.Example.com;path=/api/;"
+                           "header=X-Debug;header=accept-language: en;"
+                           "set-request-header=X-App: new;"
+                           "remove-response-header=server;"
+                           "rewrite-path=/v2/")));
+
+    CU_ASSERT(HTTP_GET == rule.method);
+    CU_ASSERT("*.example.com" == rule.host);
+    CU_ASSERT("/api/" == rule.path);
+    CU_ASSERT(2 == rule.headers.size());
+    CU_ASSERT("x-debug" == rule.headers[0].name);
+    CU_ASSERT(!rule.headers[0].has_value);
+    CU_ASSERT("accept-language" == rule.headers[1].name);
+    CU_ASSERT("en" == rule.headers[1].value);
+    CU_ASSERT(http2::HD_ACCEPT_LANGUAGE == rule.headers[1].token);
+    CU_ASSERT(rule.headers[1].has_value);
+    CU_ASSERT(1 == rule.request_headers.size());
+    CU_ASSERT(RewriteHeaderOp::SET == rule.request_headers[0].op);
+    CU_ASSERT("x-app" == rule.request_headers[0].name);
+    CU_ASSERT("new" == rule.request_headers[0].value);
+    CU_ASSERT(1 == rule.response_headers.size());
+    CU_ASSERT(RewriteHeaderOp::REMOVE == rule.response_headers[0].op);
+    CU_ASSERT(http2::HD_SERVER == rule.response_headers[0].token);
+    CU_ASSERT("/v2/" == rule.rewrite_path);
+    CU_ASSERT(RewriteReply::NONE == rule.reply);
+  }
+
+  {
+    RewriteRule rule;
+
+    CU_ASSERT(0 == parse_rewrite_rule(
+                       rule, balloc,
+                       StringRef::from_lit("path=/old;redirect=/new")));
+    CU_ASSERT(RewriteReply::REDIRECT == rule.reply);
+    CU_ASSERT("/new" == rule.location);
+    CU_ASSERT(308 == rule.status);
+  }
+
+  {
+    RewriteRule rule;
+
+    CU_ASSERT(0 == parse_rewrite_rule(
+                       rule, balloc,
+                       StringRef::from_lit("path=/healthz;return;status=204")));
+    CU_ASSERT(RewriteReply::RETURN == rule.reply);
+    CU_ASSERT(204 == rule.status);
+  }
+
+  {
+    RewriteRule rule;
+
+    // No action
+    CU_ASSERT(-1 ==
+              parse_rewrite_rule(rule, balloc, StringRef::from_lit("path=/")));
+    // Unknown parameter
+    CU_ASSERT(-1 == parse_rewrite_rule(rule, balloc,
+                                       StringRef::from_lit("foo=bar;return")));
+    // Unknown method
+    CU_ASSERT(-1 == parse_rewrite_rule(rule, balloc,
+                                       StringRef::from_lit(
+                                           "method=FOO;return")));
+    // Path must not contain query
+    CU_ASSERT(-1 == parse_rewrite_rule(rule, balloc,
+                                       StringRef::from_lit("path=/?a;return")));
+    // Framing header fields cannot be changed
+    CU_ASSERT(-1 == parse_rewrite_rule(
+                        rule, balloc,
+                        StringRef::from_lit("remove-request-header=content-"
+                                            "length")));
+    // Bad redirect status
+    CU_ASSERT(-1 == parse_rewrite_rule(
+                        rule, balloc,
+                        StringRef::from_lit("redirect=/;status=200")));
+    // status without reply
+    CU_ASSERT(-1 == parse_rewrite_rule(
+                        rule, balloc,
+                        StringRef::from_lit("rewrite-path=/;status=200")));
+    // redirect and return
+    CU_ASSERT(-1 == parse_rewrite_rule(rule, balloc,
+                                       StringRef::from_lit(
+                                           "redirect=/;return")));
+  }
+}
+
+void test_shrpx_rewrite_rule_match(void) {
+  BlockAllocator balloc(4096, 4096);
+  RewriteRule rule;
+
+  CU_ASSERT(0 == parse_rewrite_rule(
+                     rule, balloc,
+                     StringRef::from_lit("method=GET;host=*.example.com;"
+                                         "path=/api/;header=x-debug:1;"
+                                         "return")));
+
+  Request req(balloc);
+  req.method = HTTP_GET;
+  req.authority = StringRef::from_lit("www.Example.com:8443");
+  req.path = StringRef::from_lit("/api/users?id=1");
+  add_header(req.fs.headers(), StringRef::from_lit("x-debug"),
+             StringRef::from_lit("1"));
+
+  CU_ASSERT(rewrite_rule_match(rule, req));
+
+  req.method = HTTP_POST;
+
+  CU_ASSERT(!rewrite_rule_match(rule, req));
+
+  req.method = HTTP_GET;
+  req.authority = StringRef::from_lit("example.com");
+
+  CU_ASSERT(!rewrite_rule_match(rule, req));
+
+  req.authority = StringRef::from_lit("www.example.com");
+  req.path = StringRef::from_lit("/apis?/api/");
+
+  CU_ASSERT(!rewrite_rule_match(rule, req));
+
+  req.path = StringRef::from_lit("/api/");
+  req.fs.headers()[0].value = StringRef::from_lit("0");
+
+  CU_ASSERT(!rewrite_rule_match(rule, req));
+
+  CU_ASSERT(0 == parse_rewrite_rule(
+                     rule, balloc, StringRef::from_lit("path=/api;return")));
+
+  // Path without trailing slash is matched exactly.
+  CU_ASSERT(!rewrite_rule_match(rule, req));
+
+  req.path = StringRef::from_lit("/api?x=y");
+
+  CU_ASSERT(rewrite_rule_match(rule, req));
+}
+
+void test_shrpx_rewrite_apply_request(void) {
+  BlockAllocator balloc(4096, 4096);
+  RewriteRule rule;
+
+  CU_ASSERT(0 == parse_rewrite_rule(
+                     rule, balloc,
+                     StringRef::from_lit("path=/old/;rewrite-path=/new/v1/;"
+                                         "set-request-header=x-a:1;"
+                                         "add-request-header=x-b:2;"
+                                         "remove-request-header=x-c")));
+
+  Request req(balloc);
+  req.method = HTTP_GET;
+  req.path = StringRef::from_lit("/old/index.html?q=1");
+  add_header(req.fs.headers(), StringRef::from_lit("x-a"),
+             StringRef::from_lit("0"));
+  add_header(req.fs.headers(), StringRef::from_lit("x-b"),
+             StringRef::from_lit("0"));
+  add_header(req.fs.headers(), StringRef::from_lit("x-c"),
+             StringRef::from_lit("0"));
+  add_header(req.fs.headers(), StringRef::from_lit("x-a"),
+             StringRef::from_lit("0"));
+
+  CU_ASSERT(rewrite_rule_match(rule, req));
+
+  rewrite_apply_request(rule, req, balloc);
+
+  CU_ASSERT("/new/v1/index.html?q=1" == req.path);
+
+  auto &headers = req.fs.headers();
+
+  CU_ASSERT(3 == headers.size());
+  CU_ASSERT("x-b" == headers[0].name);
+  CU_ASSERT("0" == headers[0].value);
+  CU_ASSERT("x-a" == headers[1].name);
+  CU_ASSERT("1" == headers[1].value);
+  CU_ASSERT("x-b" == headers[2].name);
+  CU_ASSERT("2" == headers[2].value);
+
+  // Without path condition, the whole path is replaced.
+  CU_ASSERT(0 == parse_rewrite_rule(
+                     rule, balloc, StringRef::from_lit("rewrite-path=/a")));
+
+  rewrite_apply_request(rule, req, balloc);
+
+  CU_ASSERT("/a?q=1" == req.path);
+}
+
+} // namespace shrpx
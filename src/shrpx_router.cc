@@ -31,10 +31,21 @@
 
 namespace shrpx {
 
-RNode::RNode() : s(nullptr), len(0), index(-1), wildcard_index(-1) {}
+RNode::RNode()
+    : s(nullptr),
+      len(0),
+      index(-1),
+      wildcard_index(-1),
+      first_next(0),
+      num_next(0) {}
 
 RNode::RNode(const char *s, size_t len, ssize_t index, ssize_t wildcard_index)
-    : s(s), len(len), index(index), wildcard_index(wildcard_index) {}
+    : s(s),
+      len(len),
+      index(index),
+      wildcard_index(wildcard_index),
+      first_next(0),
+      num_next(0) {}
 
 Router::Router() : balloc_(1024, 1024), root_{} {}
 
@@ -72,6 +83,11 @@ void Router::add_node(RNode *node, const char *pattern, size_t patlen,
 }
 
 size_t Router::add_route(const StringRef &pattern, size_t idx, bool wildcard) {
+  // Compiled nodes no longer reflect the tree.
+  cnodes_.clear();
+  clabels_.clear();
+  cstrs_.clear();
+
   ssize_t index = -1, wildcard_index = -1;
   if (wildcard) {
     wildcard_index = idx;
@@ -159,8 +175,10 @@ size_t Router::add_route(const StringRef &pattern, size_t idx, bool wildcard) {
 }
 
 namespace {
+template <typename FindNext>
 const RNode *match_complete(size_t *offset, const RNode *node,
-                            const char *first, const char *last) {
+                            const char *first, const char *last,
+                            const FindNext &find_next) {
   *offset = 0;
 
   if (first == last) {
@@ -170,7 +188,7 @@ const RNode *match_complete(size_t *offset, const RNode *node,
   auto p = first;
 
   for (;;) {
-    auto next_node = find_next_node(node, *p);
+    auto next_node = find_next(node, *p);
     if (next_node == nullptr) {
       return nullptr;
     }
@@ -191,8 +209,10 @@ const RNode *match_complete(size_t *offset, const RNode *node,
 } // namespace
 
 namespace {
+template <typename FindNext>
 const RNode *match_partial(bool *pattern_is_wildcard, const RNode *node,
-                           size_t offset, const char *first, const char *last) {
+                           size_t offset, const char *first, const char *last,
+                           const FindNext &find_next) {
   *pattern_is_wildcard = false;
 
   if (first == last) {
@@ -221,7 +241,7 @@ const RNode *match_partial(bool *pattern_is_wildcard, const RNode *node,
         }
 
         // The last '/' handling, see below.
-        node = find_next_node(node, '/');
+        node = find_next(node, '/');
         if (node != nullptr && node->index != -1 && node->len == 1) {
           return node;
         }
@@ -250,7 +270,7 @@ const RNode *match_partial(bool *pattern_is_wildcard, const RNode *node,
   }
 
   for (;;) {
-    auto next_node = find_next_node(node, *p);
+    auto next_node = find_next(node, *p);
     if (next_node == nullptr) {
       return found_node;
     }
@@ -273,7 +293,7 @@ const RNode *match_partial(bool *pattern_is_wildcard, const RNode *node,
         }
 
         // The last '/' handling, see below.
-        node = find_next_node(node, '/');
+        node = find_next(node, '/');
         if (node != nullptr && node->index != -1 && node->len == 1) {
           *pattern_is_wildcard = false;
           return node;
@@ -311,19 +331,48 @@ const RNode *match_partial(bool *pattern_is_wildcard, const RNode *node,
 }
 } // namespace
 
+const RNode *Router::get_root() const {
+  if (cnodes_.empty()) {
+    return &root_;
+  }
+
+  return &cnodes_[0];
+}
+
+const RNode *Router::next_node(const RNode *node, char c) const {
+  if (cnodes_.empty()) {
+    return find_next_node(node, c);
+  }
+
+  if (node->num_next == 0) {
+    return nullptr;
+  }
+
+  auto labels = clabels_.data() + node->first_next;
+  auto p = static_cast<const char *>(memchr(labels, c, node->num_next));
+  if (p == nullptr) {
+    return nullptr;
+  }
+
+  return &cnodes_[node->first_next + (p - labels)];
+}
+
 ssize_t Router::match(const StringRef &host, const StringRef &path) const {
   const RNode *node;
   size_t offset;
 
-  node = match_complete(&offset, &root_, std::begin(host), std::end(host));
+  auto next = [this](const RNode *node, char c) { return next_node(node, c); };
+  auto root = get_root();
+
+  node = match_complete(&offset, root, std::begin(host), std::end(host), next);
   if (node == nullptr) {
     return -1;
   }
 
   bool pattern_is_wildcard;
   node = match_partial(&pattern_is_wildcard, node, offset, std::begin(path),
-                       std::end(path));
-  if (node == nullptr || node == &root_) {
+                       std::end(path), next);
+  if (node == nullptr || node == root) {
     return -1;
   }
 
@@ -334,7 +383,9 @@ ssize_t Router::match(const StringRef &s) const {
   const RNode *node;
   size_t offset;
 
-  node = match_complete(&offset, &root_, std::begin(s), std::end(s));
+  node = match_complete(
+      &offset, get_root(), std::begin(s), std::end(s),
+      [this](const RNode *node, char c) { return next_node(node, c); });
   if (node == nullptr) {
     return -1;
   }
@@ -347,8 +398,9 @@ ssize_t Router::match(const StringRef &s) const {
 }
 
 namespace {
+template <typename FindNext>
 const RNode *match_prefix(size_t *nread, const RNode *node, const char *first,
-                          const char *last) {
+                          const char *last, const FindNext &find_next) {
   if (first == last) {
     return nullptr;
   }
@@ -356,7 +408,7 @@ const RNode *match_prefix(size_t *nread, const RNode *node, const char *first,
   auto p = first;
 
   for (;;) {
-    auto next_node = find_next_node(node, *p);
+    auto next_node = find_next(node, *p);
     if (next_node == nullptr) {
       return nullptr;
     }
@@ -391,11 +443,12 @@ const RNode *match_prefix(size_t *nread, const RNode *node, const char *first,
 ssize_t Router::match_prefix(size_t *nread, const RNode **last_node,
                              const StringRef &s) const {
   if (*last_node == nullptr) {
-    *last_node = &root_;
+    *last_node = get_root();
   }
 
-  auto node =
-      ::shrpx::match_prefix(nread, *last_node, std::begin(s), std::end(s));
+  auto node = ::shrpx::match_prefix(
+      nread, *last_node, std::begin(s), std::end(s),
+      [this](const RNode *node, char c) { return next_node(node, c); });
   if (node == nullptr) {
     return -1;
   }
@@ -415,6 +468,51 @@ void dump_node(const RNode *node, int depth) {
 }
 } // namespace
 
+void Router::compile() {
+  cnodes_.clear();
+  clabels_.clear();
+  cstrs_.clear();
+
+  // Lay out nodes in breadth first order, so that the next nodes of a
+  // node are contiguous.
+  std::vector<const RNode *> order;
+  size_t strlen = 0;
+
+  order.push_back(&root_);
+
+  for (size_t i = 0; i < order.size(); ++i) {
+    auto node = order[i];
+    strlen += node->len;
+    for (auto &nd : node->next) {
+      order.push_back(nd.get());
+    }
+  }
+
+  cnodes_.reserve(order.size());
+  clabels_.reserve(order.size());
+  cstrs_.reserve(strlen);
+
+  size_t first_next = 1;
+
+  for (auto node : order) {
+    auto s = cstrs_.data() + cstrs_.size();
+    cstrs_.insert(std::end(cstrs_), node->s, node->s + node->len);
+
+    cnodes_.emplace_back(node->len ? s : nullptr, node->len, node->index,
+                         node->wildcard_index);
+
+    auto &cnode = cnodes_.back();
+    cnode.first_next = first_next;
+    cnode.num_next = node->next.size();
+
+    first_next += node->next.size();
+
+    clabels_.push_back(node->len ? node->s[0] : '\0');
+  }
+}
+
+bool Router::compiled() const { return !cnodes_.empty(); }
+
 void Router::dump() const { dump_node(&root_, 0); }
 
 } // namespace shrpx
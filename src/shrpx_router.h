@@ -44,7 +44,7 @@ struct RNode {
   RNode &operator=(RNode &&) = default;
   RNode &operator=(const RNode &) = delete;
 
-  // Next RNode, sorted by s[0].
+  // Next RNode, sorted by s[0].  This is empty in compiled node.
   std::vector<std::unique_ptr<RNode>> next;
   // Stores pointer to the string this node represents.  Not
   // NULL-terminated.
@@ -58,6 +58,11 @@ struct RNode {
   // and it still has suffix to match.  Note that we don't store
   // duplicated pattern.
   ssize_t wildcard_index;
+  // The following fields are only used by compiled node.  The next
+  // nodes are stored contiguously in Router starting at first_next,
+  // sorted by s[0].
+  uint32_t first_next;
+  uint32_t num_next;
 };
 
 class Router {
@@ -96,13 +101,34 @@ public:
   void add_node(RNode *node, const char *pattern, size_t patlen, ssize_t index,
                 ssize_t wildcard_index);
 
+  // Compiles Patricia tree into a flat array of nodes in breadth
+  // first order, so that a lookup touches a few contiguous memory
+  // regions instead of chasing pointers.  The first characters of
+  // the next nodes are also stored contiguously, and searched with
+  // memchr.  Matching uses the compiled form until add_route() is
+  // called again.  Call this function after all routes are added.
+  void compile();
+  bool compiled() const;
+
   void dump() const;
 
 private:
+  const RNode *get_root() const;
+  // Returns the next node of |node| which starts with |c|, or
+  // nullptr.
+  const RNode *next_node(const RNode *node, char c) const;
+
   BlockAllocator balloc_;
   // The root node of Patricia tree.  This is special node and its s
   // field is nulptr, and len field is 0.
   RNode root_;
+  // Compiled nodes.  The first node is the root.  Empty if Router
+  // is not compiled.
+  std::vector<RNode> cnodes_;
+  // cnodes_[i].s[0] for each i.
+  std::vector<char> clabels_;
+  // The strings which compiled nodes refer to.
+  std::vector<char> cstrs_;
 };
 
 } // namespace shrpx
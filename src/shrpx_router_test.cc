@@ -24,6 +24,8 @@
  */
 #include "shrpx_router_test.h"
 
+#include <random>
+
 #include <CUnit/CUnit.h>
 
 #include "shrpx_router.h"
@@ -181,4 +183,89 @@ void test_shrpx_router_match_prefix(void) {
   CU_ASSERT(6 == nread);
 }
 
+namespace {
+std::string random_segment(std::mt19937 &gen) {
+  static constexpr char chars[] = "abc/.";
+  std::uniform_int_distribution<size_t> len_dist(1, 6);
+  std::uniform_int_distribution<size_t> char_dist(0, sizeof(chars) - 2);
+
+  std::string s;
+  auto len = len_dist(gen);
+  for (size_t i = 0; i < len; ++i) {
+    s += chars[char_dist(gen)];
+  }
+  return s;
+}
+} // namespace
+
+void test_shrpx_router_compile(void) {
+  std::mt19937 gen(1000000007);
+
+  Router router, compiled;
+  std::vector<std::string> hosts, paths;
+
+  for (size_t i = 0; i < 100; ++i) {
+    hosts.push_back(random_segment(gen));
+    paths.push_back('/' + random_segment(gen));
+  }
+  hosts.push_back("");
+
+  std::uniform_int_distribution<size_t> host_dist(0, hosts.size() - 1);
+  std::uniform_int_distribution<size_t> path_dist(0, paths.size() - 1);
+
+  for (size_t i = 0; i < 500; ++i) {
+    auto pattern = hosts[host_dist(gen)] + paths[path_dist(gen)];
+    auto wildcard = i % 3 == 0;
+
+    CU_ASSERT(router.add_route(StringRef{pattern}, i, wildcard) ==
+              compiled.add_route(StringRef{pattern}, i, wildcard));
+  }
+
+  CU_ASSERT(!compiled.compiled());
+
+  compiled.compile();
+
+  CU_ASSERT(compiled.compiled());
+
+  for (size_t i = 0; i < 10000; ++i) {
+    auto host = hosts[host_dist(gen)];
+    auto path = paths[path_dist(gen)] + random_segment(gen);
+    path.resize(std::uniform_int_distribution<size_t>(1, path.size())(gen));
+
+    CU_ASSERT(router.match(StringRef{host}, StringRef{path}) ==
+              compiled.match(StringRef{host}, StringRef{path}));
+
+    auto s = host + path;
+
+    CU_ASSERT(router.match(StringRef{s}) == compiled.match(StringRef{s}));
+
+    const RNode *node = nullptr, *cnode = nullptr;
+    auto rest = StringRef{s}, crest = StringRef{s};
+
+    for (;;) {
+      size_t nread = 0, cnread = 0;
+      auto idx = router.match_prefix(&nread, &node, rest);
+      auto cidx = compiled.match_prefix(&cnread, &cnode, crest);
+
+      CU_ASSERT(idx == cidx);
+
+      if (idx == -1 || cidx == -1) {
+        break;
+      }
+
+      CU_ASSERT(nread == cnread);
+
+      rest = StringRef{std::begin(rest) + nread, std::end(rest)};
+      crest = StringRef{std::begin(crest) + cnread, std::end(crest)};
+    }
+  }
+
+  // Adding a route drops compiled nodes.
+  compiled.add_route(StringRef::from_lit("zzz/"), 1000);
+
+  CU_ASSERT(!compiled.compiled());
+  CU_ASSERT(1000 == compiled.match(StringRef::from_lit("zzz"),
+                                   StringRef::from_lit("/")));
+}
+
 } // namespace shrpx
@@ -0,0 +1,687 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_single_flight.h"
+
+#include <cassert>
+#include <algorithm>
+
+#include "shrpx_downstream.h"
+#include "shrpx_upstream.h"
+#include "shrpx_client_handler.h"
+#include "shrpx_worker.h"
+#include "shrpx_cache.h"
+#include "shrpx_log.h"
+#include "util.h"
+
+namespace shrpx {
+
+SingleFlight::SingleFlight(const StringRef &key_headers) {
+  if (key_headers.empty()) {
+    return;
+  }
+
+  for (auto &name : util::split_str(key_headers, ':')) {
+    if (name.empty()) {
+      continue;
+    }
+    key_headers_.emplace_back(std::begin(name), std::end(name));
+  }
+}
+
+namespace {
+// Returns |s| without leading and trailing white spaces.
+StringRef trim(const StringRef &s) {
+  auto first = std::begin(s);
+  auto last = std::end(s);
+
+  for (; first != last && (*first == ' ' || *first == '\t'); ++first)
+    ;
+  for (; first != last && (*(last - 1) == ' ' || *(last - 1) == '\t'); --last)
+    ;
+
+  return StringRef{first, last};
+}
+} // namespace
+
+bool SingleFlight::key_header(const StringRef &name) const {
+  return std::any_of(std::begin(key_headers_), std::end(key_headers_),
+                     [&name](const std::string &h) {
+                       return util::strieq(StringRef{h}, name);
+                     });
+}
+
+std::string SingleFlight::create_key(const Request &req) const {
+  if (req.method != HTTP_GET || req.upgrade_request ||
+      req.http2_upgrade_seen || req.connect_proto != ConnectProto::NONE) {
+    return "";
+  }
+
+  // Request which has a body is not identical to the others.
+  if (req.http_major == 2) {
+    if (req.http2_expect_body) {
+      return "";
+    }
+  } else if (req.fs.content_length > 0 ||
+             req.fs.header(http2::HD_TRANSFER_ENCODING)) {
+    return "";
+  }
+
+  // The response to conditional or range request is specific to the
+  // request, e.g., 304 or 206.
+  if (cache_request_conditional(req) ||
+      req.fs.header(StringRef::from_lit("range"))) {
+    return "";
+  }
+
+  for (auto &kv : req.fs.headers()) {
+    // The response to these requests may be specific to the user.
+    if (util::streq_l("authorization", kv.name) ||
+        (kv.token == http2::HD_COOKIE && !key_header(kv.name))) {
+      return "";
+    }
+  }
+
+  std::string key;
+
+  key += req.scheme;
+  key += "://";
+  key += req.authority;
+  key += req.path;
+
+  for (auto &name : key_headers_) {
+    key += '\n';
+
+    // Header field may appear more than once, e.g., cookie crumbs in
+    // HTTP/2.  Include all of them.
+    auto first = true;
+    for (auto &kv : req.fs.headers()) {
+      if (kv.name != StringRef{name}) {
+        continue;
+      }
+
+      if (!first) {
+        key += '\0';
+      }
+      first = false;
+
+      key += kv.value;
+    }
+  }
+
+  return key;
+}
+
+bool SingleFlight::response_shareable(const HeaderRefs &headers) const {
+  for (auto &kv : headers) {
+    if (util::streq_l("set-cookie", kv.name)) {
+      return false;
+    }
+
+    if (kv.token == http2::HD_CACHE_CONTROL &&
+        (util::strifind(kv.value, StringRef::from_lit("private")) ||
+         util::strifind(kv.value, StringRef::from_lit("no-store")))) {
+      return false;
+    }
+
+    // The followers only agree with the leader on the header fields
+    // in the key.
+    if (util::streq_l("vary", kv.name)) {
+      for (auto &name : util::split_str(kv.value, ',')) {
+        name = trim(name);
+        if (name.empty()) {
+          continue;
+        }
+        if (name == StringRef::from_lit("*") || !key_header(name)) {
+          return false;
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+SingleFlightCall *SingleFlight::find(const StringRef &key) const {
+  auto it = calls_.find(key);
+  if (it == std::end(calls_)) {
+    return nullptr;
+  }
+
+  return (*it).second;
+}
+
+void SingleFlight::add(SingleFlightCall *call) {
+  calls_.emplace(call->get_key(), call);
+}
+
+void SingleFlight::remove(SingleFlightCall *call) {
+  calls_.erase(call->get_key());
+}
+
+size_t SingleFlight::get_num_calls() const { return calls_.size(); }
+
+namespace {
+void processcb(struct ev_loop *loop, ev_timer *w, int revents) {
+  auto call = static_cast<SingleFlightCall *>(w->data);
+  call->process();
+}
+} // namespace
+
+SingleFlightCall::SingleFlightCall(struct ev_loop *loop, MemchunkPool *mcpool,
+                                   std::shared_ptr<SingleFlight> single_flight,
+                                   std::string key)
+    : key_(std::move(key)),
+      single_flight_(std::move(single_flight)),
+      balloc_(1024, 1024),
+      body_(mcpool),
+      addr_(nullptr),
+      loop_(loop),
+      content_length_(-1),
+      body_offset_(0),
+      http_status_(0),
+      error_status_(0),
+      http_major_(1),
+      http_minor_(1),
+      state_(SingleFlightState::PENDING),
+      headers_only_(false),
+      bypass_(false),
+      registered_(false) {
+  ev_timer_init(&timer_, processcb, 0., 0.);
+  timer_.data = this;
+
+  if (single_flight_) {
+    single_flight_->add(this);
+    registered_ = true;
+  }
+}
+
+SingleFlightCall::~SingleFlightCall() {
+  ev_timer_stop(loop_, &timer_);
+
+  unregister();
+
+  // Downstream holds a reference to this object while it follows
+  // this call.
+  assert(followers_.empty());
+}
+
+void SingleFlightCall::add_follower(SingleFlightLink *link) {
+  assert(state_ == SingleFlightState::PENDING);
+
+  link->offset = 0;
+  link->header_sent = false;
+
+  followers_.append(link);
+}
+
+void SingleFlightCall::remove_follower(SingleFlightLink *link) {
+  followers_.remove(link);
+
+  drain_body();
+}
+
+void SingleFlightCall::on_header(Downstream *downstream) {
+  if (state_ != SingleFlightState::PENDING) {
+    return;
+  }
+
+  // The requests which arrive after this point do not get the whole
+  // response from the beginning.
+  unregister();
+
+  const auto &resp = downstream->response();
+
+  if (followers_.empty()) {
+    fail(0, false);
+    return;
+  }
+
+  if (!single_flight_ ||
+      !single_flight_->response_shareable(resp.fs.headers())) {
+    if (LOG_ENABLED(INFO)) {
+      DLOG(INFO, downstream) << "Single-flight response cannot be shared";
+    }
+
+    fail(0, true);
+    return;
+  }
+
+  http_status_ = resp.http_status;
+  http_major_ = resp.http_major;
+  http_minor_ = resp.http_minor;
+  headers_only_ = resp.headers_only;
+  content_length_ = resp.fs.content_length;
+  group_ = downstream->get_downstream_addr_group();
+  addr_ = downstream->get_addr();
+
+  headers_.reserve(resp.fs.headers().size());
+
+  for (auto &kv : resp.fs.headers()) {
+    // Message framing is decided for each follower.
+    if (kv.token == http2::HD_TRANSFER_ENCODING) {
+      continue;
+    }
+
+    headers_.emplace_back(make_string_ref(balloc_, kv.name),
+                          make_string_ref(balloc_, kv.value), kv.no_index,
+                          kv.token);
+  }
+
+  state_ = SingleFlightState::HEADER_COMPLETE;
+
+  signal();
+}
+
+void SingleFlightCall::on_body(const uint8_t *data, size_t len) {
+  if (state_ != SingleFlightState::HEADER_COMPLETE || len == 0 ||
+      followers_.empty()) {
+    body_offset_ += len;
+    return;
+  }
+
+  body_.append(data, len);
+
+  signal();
+}
+
+void SingleFlightCall::on_body_complete(Downstream *downstream) {
+  if (state_ != SingleFlightState::HEADER_COMPLETE) {
+    return;
+  }
+
+  const auto &resp = downstream->response();
+
+  for (auto &kv : resp.fs.trailers()) {
+    trailers_.emplace_back(make_string_ref(balloc_, kv.name),
+                           make_string_ref(balloc_, kv.value), kv.no_index,
+                           kv.token);
+  }
+
+  state_ = SingleFlightState::MSG_COMPLETE;
+
+  signal();
+}
+
+void SingleFlightCall::on_leader_detached(Downstream *downstream) {
+  switch (state_) {
+  case SingleFlightState::PENDING: {
+    const auto &resp = downstream->response();
+
+    // If leader got error response from us, followers would get the
+    // same one.  Otherwise, leader was canceled by client, and one of
+    // followers takes over.
+    if (downstream->get_response_state() == DownstreamState::MSG_COMPLETE &&
+        resp.http_status >= 500) {
+      fail(resp.http_status, false);
+    } else {
+      fail(0, false);
+    }
+
+    return;
+  }
+  case SingleFlightState::HEADER_COMPLETE:
+    fail(0, false);
+    return;
+  default:
+    return;
+  }
+}
+
+namespace {
+// Returns true if the header field |name| is sent in 304 response.
+// See RFC 7232, section 4.1.
+bool not_modified_header(const StringRef &name) {
+  return util::streq_l("cache-control", name) ||
+         util::streq_l("content-location", name) ||
+         util::streq_l("date", name) || util::streq_l("etag", name) ||
+         util::streq_l("expires", name) || util::streq_l("vary", name);
+}
+} // namespace
+
+void SingleFlightCall::load_cache_entry(
+    const CacheEntry &entry, std::shared_ptr<DownstreamAddrGroup> group,
+    bool not_modified, bool send_body, ev_tstamp now) {
+  assert(state_ == SingleFlightState::PENDING);
+
+  unregister();
+
+  group_ = std::move(group);
+
+  headers_.reserve(entry.headers.size() + 2);
+
+  for (auto &kv : entry.headers) {
+    if (not_modified && !not_modified_header(kv.name)) {
+      continue;
+    }
+
+    headers_.emplace_back(make_string_ref(balloc_, kv.name),
+                          make_string_ref(balloc_, kv.value), kv.no_index,
+                          kv.token);
+  }
+
+  headers_.emplace_back(
+      StringRef::from_lit("age"),
+      util::make_string_ref_uint(balloc_,
+                                 static_cast<uint64_t>(entry.age(now))),
+      false, -1);
+
+  if (not_modified) {
+    http_status_ = 304;
+    headers_only_ = true;
+  } else {
+    auto body_length = entry.body ? entry.body->length : 0;
+
+    http_status_ = entry.http_status;
+    content_length_ = body_length;
+
+    headers_.emplace_back(StringRef::from_lit("content-length"),
+                          util::make_string_ref_uint(balloc_, body_length),
+                          false, http2::HD_CONTENT_LENGTH);
+
+    if (send_body && body_length) {
+      cache_body_ = entry.body;
+    } else {
+      headers_only_ = true;
+    }
+  }
+
+  state_ = SingleFlightState::MSG_COMPLETE;
+
+  signal();
+}
+
+void SingleFlightCall::fail(unsigned int status_code, bool bypass) {
+  unregister();
+
+  state_ = SingleFlightState::FAILURE;
+  error_status_ = status_code;
+  bypass_ = bypass;
+
+  if (!followers_.empty()) {
+    signal();
+  }
+}
+
+void SingleFlightCall::unregister() {
+  if (!registered_) {
+    return;
+  }
+
+  single_flight_->remove(this);
+  registered_ = false;
+}
+
+void SingleFlightCall::signal() {
+  if (ev_is_active(&timer_)) {
+    return;
+  }
+
+  ev_timer_set(&timer_, 0., 0.);
+  ev_timer_start(loop_, &timer_);
+}
+
+void SingleFlightCall::process() {
+  // Deleting ClientHandler may drop the last reference to this
+  // object.
+  auto self = shared_from_this();
+
+  for (auto link = followers_.head; link;) {
+    auto next = link->dlnext;
+    auto handler = link->downstream->get_upstream()->get_client_handler();
+
+    if (deliver(link) != 0) {
+      // This may delete the other followers which share the same
+      // client connection.
+      delete handler;
+
+      link = followers_.head;
+
+      continue;
+    }
+
+    handler->signal_write();
+
+    link = next;
+  }
+
+  drain_body();
+}
+
+int SingleFlightCall::deliver(SingleFlightLink *link) {
+  auto downstream = link->downstream;
+  auto upstream = downstream->get_upstream();
+
+  switch (state_) {
+  case SingleFlightState::PENDING:
+    return 0;
+  case SingleFlightState::FAILURE:
+    if (link->header_sent) {
+      return reset_follower(link);
+    }
+
+    followers_.remove(link);
+
+    if (error_status_) {
+      downstream->leave_single_flight(false);
+
+      return upstream->on_downstream_abort_request(downstream, error_status_);
+    }
+
+    if (LOG_ENABLED(INFO)) {
+      DLOG(INFO, downstream) << "Single-flight leader failed, retry request";
+    }
+
+    downstream->leave_single_flight(bypass_);
+
+    return upstream->on_downstream_admitted(downstream);
+  default:
+    break;
+  }
+
+  if (!link->header_sent && send_header(link) != 0) {
+    return reset_follower(link);
+  }
+
+  if (send_body(link) != 0) {
+    return reset_follower(link);
+  }
+
+  if (state_ == SingleFlightState::MSG_COMPLETE &&
+      link->offset == get_body_length()) {
+    return send_body_complete(link);
+  }
+
+  return 0;
+}
+
+int SingleFlightCall::send_header(SingleFlightLink *link) {
+  auto downstream = link->downstream;
+  auto upstream = downstream->get_upstream();
+  const auto &req = downstream->request();
+  auto &resp = downstream->response();
+  auto &balloc = downstream->get_block_allocator();
+
+  link->header_sent = true;
+
+  downstream->set_downstream_addr_group(group_);
+  downstream->set_addr(addr_);
+
+  resp.http_status = http_status_;
+  resp.http_major = http_major_;
+  resp.http_minor = http_minor_;
+  resp.headers_only = headers_only_;
+
+  for (auto &kv : headers_) {
+    resp.fs.add_header_token(make_string_ref(balloc, kv.name),
+                             make_string_ref(balloc, kv.value), kv.no_index,
+                             kv.token);
+  }
+
+  resp.fs.content_length = content_length_;
+
+  if (resp.fs.content_length == -1 && downstream->expect_response_body()) {
+    if (req.http_major <= 0 || (req.http_major == 1 && req.http_minor == 0)) {
+      resp.connection_close = true;
+    } else {
+      resp.fs.add_header_token(StringRef::from_lit("transfer-encoding"),
+                               StringRef::from_lit("chunked"), false,
+                               http2::HD_TRANSFER_ENCODING);
+      downstream->set_chunked_response(true);
+    }
+  }
+
+  downstream->set_response_state(DownstreamState::HEADER_COMPLETE);
+
+  if (LOG_ENABLED(INFO)) {
+    DLOG(INFO, downstream) << "Single-flight response header delivered";
+  }
+
+  return upstream->on_downstream_header_complete(downstream);
+}
+
+int SingleFlightCall::send_body(SingleFlightLink *link) {
+  auto downstream = link->downstream;
+  auto upstream = downstream->get_upstream();
+  auto &resp = downstream->response();
+  auto buf = downstream->get_response_buf();
+  auto worker = upstream->get_client_handler()->get_worker();
+  auto &downstreamconf = *worker->get_downstream_config();
+
+  if (cache_body_) {
+    auto &body = *cache_body_;
+
+    while (link->offset < body.length &&
+           buf->rleft() < downstreamconf.response_buffer_size) {
+      auto &chunk = body.chunks[link->offset / CACHE_BODY_CHUNK_SIZE];
+      auto offset = link->offset % CACHE_BODY_CHUNK_SIZE;
+      auto len = std::min(CACHE_BODY_CHUNK_SIZE - offset,
+                          body.length - link->offset);
+
+      resp.recv_body_length += len;
+
+      if (upstream->on_downstream_body(downstream, chunk.get() + offset, len,
+                                       true) != 0) {
+        return -1;
+      }
+
+      link->offset += len;
+    }
+
+    return 0;
+  }
+
+  assert(link->offset >= body_offset_);
+
+  auto offset = link->offset - body_offset_;
+  auto m = body_.head;
+
+  for (; m && offset >= m->len(); m = m->next) {
+    offset -= m->len();
+  }
+
+  // Stop if the client cannot keep up.  Downstream::resume_read()
+  // signals us when the buffer is drained.
+  for (; m && buf->rleft() < downstreamconf.response_buffer_size;
+       m = m->next, offset = 0) {
+    auto len = m->len() - offset;
+    if (len == 0) {
+      continue;
+    }
+
+    resp.recv_body_length += len;
+
+    if (upstream->on_downstream_body(downstream, m->pos + offset, len, true) !=
+        0) {
+      return -1;
+    }
+
+    link->offset += len;
+  }
+
+  return 0;
+}
+
+int SingleFlightCall::send_body_complete(SingleFlightLink *link) {
+  auto downstream = link->downstream;
+  auto upstream = downstream->get_upstream();
+  auto &resp = downstream->response();
+  auto &balloc = downstream->get_block_allocator();
+
+  for (auto &kv : trailers_) {
+    resp.fs.add_trailer_token(make_string_ref(balloc, kv.name),
+                              make_string_ref(balloc, kv.value), kv.no_index,
+                              kv.token);
+  }
+
+  downstream->set_response_state(DownstreamState::MSG_COMPLETE);
+
+  followers_.remove(link);
+  downstream->leave_single_flight(false);
+
+  return upstream->on_downstream_body_complete(downstream);
+}
+
+int SingleFlightCall::reset_follower(SingleFlightLink *link) {
+  auto downstream = link->downstream;
+  auto upstream = downstream->get_upstream();
+
+  followers_.remove(link);
+
+  // Http2Upstream looks at the role to reset the stream.
+  auto rv = upstream->on_downstream_reset(downstream, true);
+
+  downstream->leave_single_flight(false);
+
+  return rv;
+}
+
+void SingleFlightCall::drain_body() {
+  if (body_.rleft() == 0) {
+    return;
+  }
+
+  auto offset = body_offset_ + body_.rleft();
+  for (auto link = followers_.head; link; link = link->dlnext) {
+    offset = std::min(offset, link->offset);
+  }
+
+  body_offset_ += body_.drain(offset - body_offset_);
+}
+
+size_t SingleFlightCall::get_body_length() const {
+  if (cache_body_) {
+    return cache_body_->length;
+  }
+
+  return body_offset_ + body_.rleft();
+}
+
+StringRef SingleFlightCall::get_key() const { return StringRef{key_}; }
+
+SingleFlightState SingleFlightCall::get_state() const { return state_; }
+
+size_t SingleFlightCall::get_num_followers() const { return followers_.size(); }
+
+} // namespace shrpx
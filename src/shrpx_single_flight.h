@@ -0,0 +1,211 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHRPX_SINGLE_FLIGHT_H
+#define SHRPX_SINGLE_FLIGHT_H
+
+#include "shrpx.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include <ev.h>
+
+#include "http2.h"
+#include "memchunk.h"
+#include "allocator.h"
+#include "template.h"
+
+using namespace nghttp2;
+
+namespace shrpx {
+
+class Downstream;
+struct Request;
+struct DownstreamAddrGroup;
+struct DownstreamAddr;
+class SingleFlightCall;
+struct CacheEntry;
+struct CacheBody;
+
+// SingleFlight is a table of the requests in flight to a backend
+// group, which other identical requests can wait for instead of
+// sending their own request.  It is private to a worker, so each
+// worker sends its own request; backend receives up to as many
+// identical requests as there are workers.
+class SingleFlight {
+public:
+  // |key_headers| is a list of request header field names separated
+  // by ':'.  Their values are included in the key in addition to
+  // scheme, authority, and path.
+  SingleFlight(const StringRef &key_headers);
+
+  // Returns the key of |req|.  It returns empty string if |req| is
+  // not eligible for coalescing.  The request which has
+  // Authorization, or Cookie which is not part of the key, is not
+  // eligible because its response may be specific to the user.
+  std::string create_key(const Request &req) const;
+  // Returns true if the response which has header fields |headers|
+  // can be delivered to the clients other than the one which
+  // requested it.  The response must not vary on the request header
+  // fields which are not part of the key.
+  bool response_shareable(const HeaderRefs &headers) const;
+  // Returns the call which is in flight for |key|, or nullptr.
+  SingleFlightCall *find(const StringRef &key) const;
+  void add(SingleFlightCall *call);
+  void remove(SingleFlightCall *call);
+
+  size_t get_num_calls() const;
+
+private:
+  // Returns true if the request header field |name| is part of the
+  // key.
+  bool key_header(const StringRef &name) const;
+
+  std::vector<std::string> key_headers_;
+  std::unordered_map<StringRef, SingleFlightCall *> calls_;
+};
+
+// Link entry in the follower list of SingleFlightCall.  Downstream
+// owns this object.
+struct SingleFlightLink {
+  Downstream *downstream;
+  // The number of response body bytes delivered to |downstream|.
+  size_t offset;
+  // true if response header fields have been delivered to
+  // |downstream|.
+  bool header_sent;
+  SingleFlightLink *dlnext, *dlprev;
+};
+
+enum class SingleFlightState {
+  // Waiting for response header fields from leader.
+  PENDING,
+  HEADER_COMPLETE,
+  MSG_COMPLETE,
+  // Leader failed, or its response cannot be shared.
+  FAILURE,
+};
+
+// SingleFlightCall is a request forwarded to backend by a leader
+// Downstream, and the followers waiting for its response.  The
+// response which the leader receives is buffered, and followers get
+// it asynchronously at their own pace.  Followers can join the call
+// until the leader receives response header fields.  A response
+// served from cache is delivered as a call which is already complete.
+class SingleFlightCall
+    : public std::enable_shared_from_this<SingleFlightCall> {
+public:
+  SingleFlightCall(struct ev_loop *loop, MemchunkPool *mcpool,
+                   std::shared_ptr<SingleFlight> single_flight,
+                   std::string key);
+  ~SingleFlightCall();
+
+  void add_follower(SingleFlightLink *link);
+  void remove_follower(SingleFlightLink *link);
+
+  // The following functions are called when leader |downstream|
+  // receives response.
+  void on_header(Downstream *downstream);
+  void on_body(const uint8_t *data, size_t len);
+  void on_body_complete(Downstream *downstream);
+  // Called when leader |downstream| is deleted.
+  void on_leader_detached(Downstream *downstream);
+
+  // Completes this call with the stored response |entry| for the
+  // request routed to |group|.  If |not_modified| is true, 304
+  // response is delivered instead.  If |send_body| is false,
+  // response body is not delivered.  |now| is the current time.
+  void load_cache_entry(const CacheEntry &entry,
+                        std::shared_ptr<DownstreamAddrGroup> group,
+                        bool not_modified, bool send_body, ev_tstamp now);
+
+  // Delivers the response received so far to followers.
+  void process();
+  // Schedules process() to be called.
+  void signal();
+
+  StringRef get_key() const;
+  SingleFlightState get_state() const;
+  size_t get_num_followers() const;
+
+private:
+  // Makes all followers leave this call.  If |status_code| is
+  // nonzero, followers which have not got response header fields
+  // get the error response of the status code.  Otherwise, they
+  // retry the request.  If |bypass| is true, they do not coalesce
+  // the request again.
+  void fail(unsigned int status_code, bool bypass);
+  // Removes this call from SingleFlight, so that new request does not
+  // join.
+  void unregister();
+  // Delivers the response to follower |link|.  This function returns
+  // 0 if it succeeds, or -1 if the client connection must be closed.
+  int deliver(SingleFlightLink *link);
+  int send_header(SingleFlightLink *link);
+  int send_body(SingleFlightLink *link);
+  int send_body_complete(SingleFlightLink *link);
+  // Resets the stream of follower |link| after response header fields
+  // have been sent.
+  int reset_follower(SingleFlightLink *link);
+  // Drops the part of response body which all followers have got.
+  void drain_body();
+  // Returns the length of response body received so far.
+  size_t get_body_length() const;
+
+  std::string key_;
+  std::shared_ptr<SingleFlight> single_flight_;
+  DList<SingleFlightLink> followers_;
+  BlockAllocator balloc_;
+  // Copy of the response of leader.
+  HeaderRefs headers_;
+  HeaderRefs trailers_;
+  DefaultMemchunks body_;
+  // The response body if the response is served from cache.
+  std::shared_ptr<const CacheBody> cache_body_;
+  // The backend which leader got response from.
+  std::shared_ptr<DownstreamAddrGroup> group_;
+  const DownstreamAddr *addr_;
+  ev_timer timer_;
+  struct ev_loop *loop_;
+  int64_t content_length_;
+  // The number of bytes drained from the head of body_.
+  size_t body_offset_;
+  unsigned int http_status_;
+  // The status code of error response for followers if leader fails.
+  unsigned int error_status_;
+  int http_major_, http_minor_;
+  SingleFlightState state_;
+  bool headers_only_;
+  // true if followers must not coalesce the retried request.
+  bool bypass_;
+  // true if this call is in single_flight_.
+  bool registered_;
+};
+
+} // namespace shrpx
+
+#endif // SHRPX_SINGLE_FLIGHT_H
@@ -0,0 +1,236 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_single_flight_test.h"
+
+#include <CUnit/CUnit.h>
+
+#include "shrpx_single_flight.h"
+#include "shrpx_downstream.h"
+#include "shrpx_log.h"
+
+namespace shrpx {
+
+namespace {
+void add_header(HeaderRefs &headers, const StringRef &name,
+                const StringRef &value) {
+  headers.emplace_back(name, value, false,
+                       http2::lookup_token(name.byte(), name.size()));
+}
+} // namespace
+
+void test_shrpx_single_flight_create_key(void) {
+  BlockAllocator balloc(4096, 4096);
+
+  {
+    SingleFlight sf(StringRef{});
+    Request req(balloc);
+
+    req.method = HTTP_GET;
+    req.scheme = StringRef::from_lit("https");
+    req.authority = StringRef::from_lit("example.com");
+    req.path = StringRef::from_lit("/alpha?bravo");
+
+    CU_ASSERT("https://example.com/alpha?bravo" == sf.create_key(req));
+
+    // Requests which may have body are not coalesced.
+    req.fs.content_length = 10;
+
+    CU_ASSERT(sf.create_key(req).empty());
+
+    req.fs.content_length = -1;
+    req.http_major = 2;
+    req.http2_expect_body = true;
+
+    CU_ASSERT(sf.create_key(req).empty());
+
+    req.http2_expect_body = false;
+    req.method = HTTP_HEAD;
+
+    CU_ASSERT(sf.create_key(req).empty());
+
+    req.method = HTTP_GET;
+    req.upgrade_request = true;
+
+    CU_ASSERT(sf.create_key(req).empty());
+  }
+
+  // Requests which may get the response specific to the user are not
+  // coalesced.
+  {
+    SingleFlight sf(StringRef::from_lit("accept-encoding"));
+    Request req(balloc);
+
+    req.method = HTTP_GET;
+    req.scheme = StringRef::from_lit("https");
+    req.authority = StringRef::from_lit("example.com");
+    req.path = StringRef::from_lit("/");
+    req.fs.add_header_token(StringRef::from_lit("authorization"),
+                            StringRef::from_lit("Basic Zm9vOmJhcg=="), false,
+                            -1);
+
+    CU_ASSERT(sf.create_key(req).empty());
+
+    Request req2(balloc);
+
+    req2.method = HTTP_GET;
+    req2.scheme = StringRef::from_lit("https");
+    req2.authority = StringRef::from_lit("example.com");
+    req2.path = StringRef::from_lit("/");
+    req2.fs.add_header_token(StringRef::from_lit("cookie"),
+                             StringRef::from_lit("session=alpha"), false,
+                             http2::HD_COOKIE);
+
+    CU_ASSERT(sf.create_key(req2).empty());
+  }
+
+  // Cookie is allowed if it is part of the key.  All cookie crumbs
+  // are included.
+  {
+    SingleFlight sf(StringRef::from_lit("cookie"));
+    Request req(balloc);
+
+    req.method = HTTP_GET;
+    req.scheme = StringRef::from_lit("https");
+    req.authority = StringRef::from_lit("example.com");
+    req.path = StringRef::from_lit("/");
+    req.fs.add_header_token(StringRef::from_lit("cookie"),
+                            StringRef::from_lit("session=alpha"), false,
+                            http2::HD_COOKIE);
+    req.fs.add_header_token(StringRef::from_lit("cookie"),
+                            StringRef::from_lit("lang=en"), false,
+                            http2::HD_COOKIE);
+
+    CU_ASSERT(std::string("https://example.com/\nsession=alpha") + '\0' +
+                  "lang=en" ==
+              sf.create_key(req));
+  }
+
+  {
+    SingleFlight sf(StringRef::from_lit("accept-encoding::x-charlie"));
+    Request req(balloc);
+
+    req.method = HTTP_GET;
+    req.scheme = StringRef::from_lit("http");
+    req.authority = StringRef::from_lit("example.com");
+    req.path = StringRef::from_lit("/");
+
+    CU_ASSERT("http://example.com/\n\n" == sf.create_key(req));
+
+    req.fs.add_header_token(StringRef::from_lit("accept-encoding"),
+                            StringRef::from_lit("gzip"), false,
+                            http2::HD_ACCEPT_ENCODING);
+
+    CU_ASSERT("http://example.com/\ngzip\n" == sf.create_key(req));
+  }
+}
+
+void test_shrpx_single_flight_response_shareable(void) {
+  SingleFlight sf(StringRef::from_lit("accept-encoding:x-charlie"));
+  SingleFlight sf_nokey(StringRef{});
+
+  {
+    HeaderRefs headers;
+    add_header(headers, StringRef::from_lit("content-type"),
+               StringRef::from_lit("text/html"));
+    add_header(headers, StringRef::from_lit("cache-control"),
+               StringRef::from_lit("max-age=60"));
+
+    CU_ASSERT(sf.response_shareable(headers));
+    CU_ASSERT(sf_nokey.response_shareable(headers));
+  }
+
+  {
+    HeaderRefs headers;
+    add_header(headers, StringRef::from_lit("set-cookie"),
+               StringRef::from_lit("session=alpha"));
+
+    CU_ASSERT(!sf.response_shareable(headers));
+  }
+
+  {
+    HeaderRefs headers;
+    add_header(headers, StringRef::from_lit("cache-control"),
+               StringRef::from_lit("private"));
+
+    CU_ASSERT(!sf.response_shareable(headers));
+  }
+
+  // Vary is honored only if it lists the header fields in the key.
+  {
+    HeaderRefs headers;
+    add_header(headers, StringRef::from_lit("vary"),
+               StringRef::from_lit("Accept-Encoding , x-charlie"));
+
+    CU_ASSERT(sf.response_shareable(headers));
+    CU_ASSERT(!sf_nokey.response_shareable(headers));
+  }
+
+  {
+    HeaderRefs headers;
+    add_header(headers, StringRef::from_lit("vary"),
+               StringRef::from_lit("accept-encoding"));
+    add_header(headers, StringRef::from_lit("vary"),
+               StringRef::from_lit("accept-language"));
+
+    CU_ASSERT(!sf.response_shareable(headers));
+  }
+
+  {
+    HeaderRefs headers;
+    add_header(headers, StringRef::from_lit("vary"),
+               StringRef::from_lit("*"));
+
+    CU_ASSERT(!sf.response_shareable(headers));
+  }
+}
+
+void test_shrpx_single_flight_call(void) {
+  auto loop = EV_DEFAULT;
+  MemchunkPool mcpool;
+  auto sf = std::make_shared<SingleFlight>(StringRef{});
+
+  {
+    auto call = std::make_shared<SingleFlightCall>(loop, &mcpool, sf,
+                                                   std::string("alpha"));
+
+    CU_ASSERT(call.get() == sf->find(StringRef::from_lit("alpha")));
+    CU_ASSERT(nullptr == sf->find(StringRef::from_lit("bravo")));
+    CU_ASSERT(SingleFlightState::PENDING == call->get_state());
+
+    SingleFlightLink link{};
+    call->add_follower(&link);
+
+    CU_ASSERT(1 == call->get_num_followers());
+
+    call->remove_follower(&link);
+
+    CU_ASSERT(0 == call->get_num_followers());
+  }
+
+  // The call is removed from the table when it is deleted.
+  CU_ASSERT(0 == sf->get_num_calls());
+}
+
+} // namespace shrpx
@@ -60,6 +60,8 @@
 #include "shrpx_memcached_request.h"
 #include "shrpx_memcached_dispatcher.h"
 #include "shrpx_connection_handler.h"
+#include "shrpx_tls_session_store.h"
+#include "shrpx_private_key_pool.h"
 #include "util.h"
 #include "tls.h"
 #include "template.h"
@@ -314,6 +316,17 @@ int ocsp_resp_cb(SSL *ssl, void *arg) {
 } // namespace
 #endif // OPENSSL_IS_BORINGSSL
 
+namespace {
+std::vector<uint8_t> serialize_ssl_session(SSL_SESSION *session) {
+  auto len = i2d_SSL_SESSION(session, nullptr);
+  auto buf = std::vector<uint8_t>(len);
+  auto p = buf.data();
+  i2d_SSL_SESSION(session, &p);
+
+  return buf;
+}
+} // namespace
+
 constexpr auto MEMCACHED_SESSION_CACHE_KEY_PREFIX =
     StringRef::from_lit("nghttpx:tls-session-cache:");
 
@@ -472,6 +485,89 @@ SSL_SESSION *tls_session_get_cb(SSL *ssl,
 }
 } // namespace
 
+namespace {
+int tls_session_store_new_cb(SSL *ssl, SSL_SESSION *session) {
+  auto conn = static_cast<Connection *>(SSL_get_app_data(ssl));
+  auto handler = static_cast<ClientHandler *>(conn->data);
+  auto worker = handler->get_worker();
+  auto store =
+      worker->get_connection_handler()->get_frontend_tls_session_store();
+
+#ifdef TLS1_3_VERSION
+  if (SSL_version(ssl) == TLS1_3_VERSION) {
+    return 0;
+  }
+#endif // TLS1_3_VERSION
+
+  const unsigned char *id;
+  unsigned int idlen;
+
+  id = SSL_SESSION_get_id(session, &idlen);
+
+  if (idlen == 0) {
+    return 0;
+  }
+
+  if (LOG_ENABLED(INFO)) {
+    LOG(INFO) << "Store session, id=" << util::format_hex(id, idlen);
+  }
+
+  store->put(StringRef{id, static_cast<size_t>(idlen)},
+             serialize_ssl_session(session),
+             ev_now(conn->loop) + SSL_SESSION_get_timeout(session));
+
+  return 0;
+}
+} // namespace
+
+namespace {
+SSL_SESSION *tls_session_store_get_cb(SSL *ssl,
+#if OPENSSL_1_1_API || LIBRESSL_2_7_API
+                                      const unsigned char *id,
+#else  // !(OPENSSL_1_1_API || LIBRESSL_2_7_API)
+                                      unsigned char *id,
+#endif // !(OPENSSL_1_1_API || LIBRESSL_2_7_API)
+                                      int idlen, int *copy) {
+  auto conn = static_cast<Connection *>(SSL_get_app_data(ssl));
+  auto handler = static_cast<ClientHandler *>(conn->data);
+  auto worker = handler->get_worker();
+  auto store =
+      worker->get_connection_handler()->get_frontend_tls_session_store();
+
+  if (idlen == 0) {
+    return nullptr;
+  }
+
+  auto session_data = store->get(StringRef{id, static_cast<size_t>(idlen)},
+                                 ev_now(conn->loop));
+  if (session_data.empty()) {
+    if (LOG_ENABLED(INFO)) {
+      LOG(INFO) << "Session not found, id=" << util::format_hex(id, idlen);
+    }
+    return nullptr;
+  }
+
+  const uint8_t *p = session_data.data();
+
+  auto session = d2i_SSL_SESSION(nullptr, &p, session_data.size());
+  if (!session) {
+    if (LOG_ENABLED(INFO)) {
+      LOG(INFO) << "cannot materialize session";
+    }
+    return nullptr;
+  }
+
+  if (LOG_ENABLED(INFO)) {
+    LOG(INFO) << "Found stored session, id=" << util::format_hex(id, idlen);
+  }
+
+  // The caller takes the ownership of session.
+  *copy = 0;
+
+  return session;
+}
+} // namespace
+
 namespace {
 int ticket_key_cb(SSL *ssl, unsigned char *key_name, unsigned char *iv,
                   EVP_CIPHER_CTX *ctx, HMAC_CTX *hctx, int enc) {
@@ -823,11 +919,21 @@ SSL_CTX *create_ssl_context(const char *private_key_file, const char *cert_file,
 
   const unsigned char sid_ctx[] = "shrpx";
   SSL_CTX_set_session_id_context(ssl_ctx, sid_ctx, sizeof(sid_ctx) - 1);
-  SSL_CTX_set_session_cache_mode(ssl_ctx, SSL_SESS_CACHE_SERVER);
-
   if (!tlsconf.session_cache.memcached.host.empty()) {
+    SSL_CTX_set_session_cache_mode(ssl_ctx, SSL_SESS_CACHE_SERVER);
     SSL_CTX_sess_set_new_cb(ssl_ctx, tls_session_new_cb);
     SSL_CTX_sess_set_get_cb(ssl_ctx, tls_session_get_cb);
+  } else if (tlsconf.session_cache.size) {
+    // Sessions are stored in the store shared by all workers instead
+    // of the internal cache of OpenSSL, which is guarded by a single
+    // lock per SSL_CTX.
+    SSL_CTX_set_session_cache_mode(ssl_ctx,
+                                   SSL_SESS_CACHE_SERVER |
+                                       SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ssl_ctx, tls_session_store_new_cb);
+    SSL_CTX_sess_set_get_cb(ssl_ctx, tls_session_store_get_cb);
+  } else {
+    SSL_CTX_set_session_cache_mode(ssl_ctx, SSL_SESS_CACHE_SERVER);
   }
 
   SSL_CTX_set_timeout(ssl_ctx, tlsconf.session_timeout.count());
@@ -919,6 +1025,27 @@ SSL_CTX *create_ssl_context(const char *private_key_file, const char *cert_file,
     LOG(FATAL) << "SSL_CTX_use_PrivateKey_file failed: "
                << ERR_error_string(ERR_get_error(), nullptr);
   }
+
+  if (tlsconf.private_key_threads) {
+    auto pkey = SSL_CTX_get0_privatekey(ssl_ctx);
+    auto offload_pkey = pkey ? private_key_offload_wrap(pkey) : nullptr;
+    if (offload_pkey) {
+      if (SSL_CTX_use_PrivateKey(ssl_ctx, offload_pkey) != 1) {
+        LOG(FATAL) << "SSL_CTX_use_PrivateKey failed: "
+                   << ERR_error_string(ERR_get_error(), nullptr);
+        DIE();
+      }
+      EVP_PKEY_free(offload_pkey);
+#  ifdef SSL_MODE_ASYNC
+      // Private key operations pause the handshake, and it is resumed
+      // when signing thread finishes them.
+      SSL_CTX_set_mode(ssl_ctx, SSL_MODE_ASYNC);
+#  endif // SSL_MODE_ASYNC
+    } else {
+      LOG(WARN) << "Private key operations for " << private_key_file
+                << " are not offloaded to signing threads";
+    }
+  }
 #else  // HAVE_NEVERBLEED
   std::array<char, NEVERBLEED_ERRBUF_SIZE> errbuf;
   if (neverbleed_load_private_key_file(nb, ssl_ctx, private_key_file,
@@ -1864,17 +1991,6 @@ std::unique_ptr<CertLookupTree> create_cert_lookup_tree() {
   return std::make_unique<CertLookupTree>();
 }
 
-namespace {
-std::vector<uint8_t> serialize_ssl_session(SSL_SESSION *session) {
-  auto len = i2d_SSL_SESSION(session, nullptr);
-  auto buf = std::vector<uint8_t>(len);
-  auto p = buf.data();
-  i2d_SSL_SESSION(session, &p);
-
-  return buf;
-}
-} // namespace
-
 void try_cache_tls_session(TLSSessionCache *cache, SSL_SESSION *session,
                            ev_tstamp t) {
   if (cache->last_updated + 1_min > t) {
@@ -1891,9 +2007,25 @@ void try_cache_tls_session(TLSSessionCache *cache, SSL_SESSION *session,
 
   cache->session_data = serialize_ssl_session(session);
   cache->last_updated = t;
+
+  if (cache->store) {
+    cache->store->put(StringRef{cache->store_key}, cache->session_data,
+                      t + SSL_SESSION_get_timeout(session));
+  }
 }
 
-SSL_SESSION *reuse_tls_session(const TLSSessionCache &cache) {
+SSL_SESSION *reuse_tls_session(const TLSSessionCache &cache, ev_tstamp t) {
+  if (cache.store) {
+    auto session_data = cache.store->get(StringRef{cache.store_key}, t);
+    if (!session_data.empty()) {
+      const uint8_t *p = session_data.data();
+      auto session = d2i_SSL_SESSION(nullptr, &p, session_data.size());
+      if (session) {
+        return session;
+      }
+    }
+  }
+
   if (cache.session_data.empty()) {
     return nullptr;
   }
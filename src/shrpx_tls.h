@@ -48,17 +48,26 @@ namespace shrpx {
 class ClientHandler;
 class Worker;
 class DownstreamConnectionPool;
+class TLSSessionStore;
 struct DownstreamAddr;
 struct UpstreamAddr;
 
 namespace tls {
 
 struct TLSSessionCache {
+  TLSSessionCache() : last_updated(0.), store(nullptr) {}
+
   // ASN1 representation of SSL_SESSION object.  See
   // i2d_SSL_SESSION(3SSL).
   std::vector<uint8_t> session_data;
   // The last time stamp when this cache entry is created or updated.
   ev_tstamp last_updated;
+  // The session store shared by all workers.  If it is not nullptr,
+  // the session is also stored there under |store_key|, so that the
+  // connections to the same backend made by the other workers can
+  // resume it.
+  TLSSessionStore *store;
+  std::string store_key;
 };
 
 // This struct stores the additional information per SSL_CTX.  This is
@@ -251,9 +260,11 @@ bool tls_hostname_match(const StringRef &pattern, const StringRef &hostname);
 void try_cache_tls_session(TLSSessionCache *cache, SSL_SESSION *session,
                            ev_tstamp t);
 
-// Returns cached session associated |addr|.  If no cache entry is
-// found associated to |addr|, nullptr will be returned.
-SSL_SESSION *reuse_tls_session(const TLSSessionCache &addr);
+// Returns cached session associated |addr|.  The session in the
+// shared session store is preferred, because it might be newer.  |t|
+// is the current time.  If no cache entry is found associated to
+// |addr|, nullptr will be returned.
+SSL_SESSION *reuse_tls_session(const TLSSessionCache &addr, ev_tstamp t);
 
 // Loads certificate form file |filename|.  The caller should delete
 // the returned object using X509_free().
@@ -0,0 +1,168 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_tls_session_store.h"
+
+namespace shrpx {
+
+TLSSessionStore::TLSSessionStore(size_t capacity)
+    : hits_(0),
+      misses_(0),
+      stores_(0),
+      evictions_(0),
+      capacity_(capacity),
+      shard_capacity_((capacity + TLS_SESSION_STORE_NUM_SHARDS - 1) /
+                      TLS_SESSION_STORE_NUM_SHARDS) {}
+
+TLSSessionStore::Shard &TLSSessionStore::get_shard(const StringRef &key) {
+  return shards_[std::hash<StringRef>{}(key) % shards_.size()];
+}
+
+void TLSSessionStore::Shard::erase(TLSSessionStoreEntry *ent) {
+  lru.remove(ent);
+  entries.erase(entries.find(StringRef{ent->key}));
+}
+
+std::vector<uint8_t> TLSSessionStore::get(const StringRef &key,
+                                          ev_tstamp now) {
+  std::vector<uint8_t> session_data;
+
+  if (capacity_ != 0) {
+    auto &shard = get_shard(key);
+
+    std::lock_guard<std::mutex> g(shard.mu);
+
+    auto it = shard.entries.find(key);
+    if (it != std::end(shard.entries)) {
+      auto ent = (*it).second.get();
+      if (ent->expiry <= now) {
+        shard.erase(ent);
+      } else {
+        session_data = ent->session_data;
+
+        shard.lru.remove(ent);
+        shard.lru.append(ent);
+      }
+    }
+  }
+
+  if (session_data.empty()) {
+    misses_.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    hits_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  return session_data;
+}
+
+void TLSSessionStore::put(const StringRef &key,
+                          std::vector<uint8_t> session_data,
+                          ev_tstamp expiry) {
+  if (capacity_ == 0 || session_data.empty()) {
+    return;
+  }
+
+  auto &shard = get_shard(key);
+  size_t n = 0;
+
+  {
+    std::lock_guard<std::mutex> g(shard.mu);
+
+    auto it = shard.entries.find(key);
+    if (it != std::end(shard.entries)) {
+      auto ent = (*it).second.get();
+
+      ent->session_data = std::move(session_data);
+      ent->expiry = expiry;
+
+      shard.lru.remove(ent);
+      shard.lru.append(ent);
+    } else {
+      for (; shard.lru.size() >= shard_capacity_; ++n) {
+        shard.erase(shard.lru.head);
+      }
+
+      auto ent = std::make_unique<TLSSessionStoreEntry>();
+      ent->key = key.str();
+      ent->session_data = std::move(session_data);
+      ent->expiry = expiry;
+      ent->dlnext = ent->dlprev = nullptr;
+
+      shard.lru.append(ent.get());
+      shard.entries.emplace(StringRef{ent->key}, std::move(ent));
+    }
+  }
+
+  stores_.fetch_add(1, std::memory_order_relaxed);
+  evictions_.fetch_add(n, std::memory_order_relaxed);
+}
+
+void TLSSessionStore::remove(const StringRef &key) {
+  if (capacity_ == 0) {
+    return;
+  }
+
+  auto &shard = get_shard(key);
+
+  std::lock_guard<std::mutex> g(shard.mu);
+
+  auto it = shard.entries.find(key);
+  if (it == std::end(shard.entries)) {
+    return;
+  }
+
+  shard.erase((*it).second.get());
+}
+
+uint64_t TLSSessionStore::get_num_hits() const {
+  return hits_.load(std::memory_order_relaxed);
+}
+
+uint64_t TLSSessionStore::get_num_misses() const {
+  return misses_.load(std::memory_order_relaxed);
+}
+
+uint64_t TLSSessionStore::get_num_stores() const {
+  return stores_.load(std::memory_order_relaxed);
+}
+
+uint64_t TLSSessionStore::get_num_evictions() const {
+  return evictions_.load(std::memory_order_relaxed);
+}
+
+size_t TLSSessionStore::get_num_entries() {
+  size_t n = 0;
+
+  for (auto &shard : shards_) {
+    std::lock_guard<std::mutex> g(shard.mu);
+
+    n += shard.entries.size();
+  }
+
+  return n;
+}
+
+size_t TLSSessionStore::get_capacity() const { return capacity_; }
+
+} // namespace shrpx
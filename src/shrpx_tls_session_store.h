@@ -0,0 +1,115 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHRPX_TLS_SESSION_STORE_H
+#define SHRPX_TLS_SESSION_STORE_H
+
+#include "shrpx.h"
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include <ev.h>
+
+#include "template.h"
+
+using namespace nghttp2;
+
+namespace shrpx {
+
+// The number of shards of TLSSessionStore.  Each shard has its own
+// lock and LRU list.
+constexpr size_t TLS_SESSION_STORE_NUM_SHARDS = 16;
+
+// TLSSessionStoreEntry is a serialized TLS session in
+// TLSSessionStore.
+struct TLSSessionStoreEntry {
+  std::string key;
+  // ASN1 representation of SSL_SESSION object.  See
+  // i2d_SSL_SESSION(3SSL).
+  std::vector<uint8_t> session_data;
+  // The time when this session expires.
+  ev_tstamp expiry;
+  TLSSessionStoreEntry *dlnext, *dlprev;
+};
+
+// TLSSessionStore is an in-memory TLS session cache shared by all
+// workers, so that a session established by a worker can be resumed
+// by the others.  Keys are distributed to shards, so that workers
+// rarely contend for a lock.  The number of sessions is bounded, and
+// the least recently used one is evicted first.  If capacity is 0,
+// nothing is stored.
+class TLSSessionStore {
+public:
+  TLSSessionStore(size_t capacity);
+
+  // Returns the session stored for |key|.  It returns empty vector if
+  // there is no session, or it has been expired at |now|.
+  std::vector<uint8_t> get(const StringRef &key, ev_tstamp now);
+  // Stores |session_data| for |key|, which expires at |expiry|.  It
+  // replaces the session stored for |key|.
+  void put(const StringRef &key, std::vector<uint8_t> session_data,
+           ev_tstamp expiry);
+  void remove(const StringRef &key);
+
+  uint64_t get_num_hits() const;
+  uint64_t get_num_misses() const;
+  uint64_t get_num_stores() const;
+  uint64_t get_num_evictions() const;
+  // Returns the number of sessions stored.  This function locks all
+  // shards.
+  size_t get_num_entries();
+  size_t get_capacity() const;
+
+private:
+  struct Shard {
+    void erase(TLSSessionStoreEntry *ent);
+
+    std::mutex mu;
+    std::unordered_map<StringRef, std::unique_ptr<TLSSessionStoreEntry>>
+        entries;
+    // The least recently used entry comes first.
+    DList<TLSSessionStoreEntry> lru;
+  };
+
+  Shard &get_shard(const StringRef &key);
+
+  std::array<Shard, TLS_SESSION_STORE_NUM_SHARDS> shards_;
+  std::atomic<uint64_t> hits_;
+  std::atomic<uint64_t> misses_;
+  std::atomic<uint64_t> stores_;
+  std::atomic<uint64_t> evictions_;
+  size_t capacity_;
+  // The maximum number of sessions per shard.
+  size_t shard_capacity_;
+};
+
+} // namespace shrpx
+
+#endif // SHRPX_TLS_SESSION_STORE_H
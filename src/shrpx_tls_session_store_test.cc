@@ -0,0 +1,94 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2021 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_tls_session_store_test.h"
+
+#include <CUnit/CUnit.h>
+
+#include "shrpx_tls_session_store.h"
+#include "util.h"
+
+namespace shrpx {
+
+void test_shrpx_tls_session_store(void) {
+  TLSSessionStore store(1024);
+  auto key = StringRef::from_lit("session-id");
+  auto data = std::vector<uint8_t>{1, 2, 3};
+
+  CU_ASSERT(store.get(key, 100.).empty());
+  CU_ASSERT(1 == store.get_num_misses());
+
+  store.put(key, data, 110.);
+
+  CU_ASSERT(data == store.get(key, 100.));
+  CU_ASSERT(1 == store.get_num_hits());
+  CU_ASSERT(1 == store.get_num_stores());
+  CU_ASSERT(1 == store.get_num_entries());
+
+  // Newer session replaces the old one.
+  auto data2 = std::vector<uint8_t>{4, 5};
+  store.put(key, data2, 120.);
+
+  CU_ASSERT(data2 == store.get(key, 110.));
+  CU_ASSERT(1 == store.get_num_entries());
+
+  // Expired session is not returned, and removed.
+  CU_ASSERT(store.get(key, 120.).empty());
+  CU_ASSERT(0 == store.get_num_entries());
+
+  store.put(key, data, 130.);
+  store.remove(key);
+
+  CU_ASSERT(store.get(key, 100.).empty());
+
+  // Nothing is stored if capacity is 0.
+  TLSSessionStore disabled(0);
+  disabled.put(key, data, 110.);
+
+  CU_ASSERT(disabled.get(key, 100.).empty());
+  CU_ASSERT(0 == disabled.get_num_stores());
+}
+
+void test_shrpx_tls_session_store_eviction(void) {
+  TLSSessionStore store(TLS_SESSION_STORE_NUM_SHARDS);
+  auto data = std::vector<uint8_t>{1};
+
+  std::vector<std::string> keys;
+  for (size_t i = 0; i < 100; ++i) {
+    keys.push_back("session-" + util::utos(i));
+  }
+
+  for (auto &key : keys) {
+    store.put(StringRef{key}, data, 110.);
+  }
+
+  CU_ASSERT(store.get_num_entries() <= TLS_SESSION_STORE_NUM_SHARDS);
+  CU_ASSERT(100 == store.get_num_stores());
+  CU_ASSERT(store.get_num_stores() - store.get_num_entries() ==
+            store.get_num_evictions());
+  // The session stored last is never evicted.
+  CU_ASSERT(data == store.get(StringRef{keys.back()}, 100.));
+}
+
+} // namespace shrpx
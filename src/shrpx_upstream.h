@@ -36,6 +36,7 @@ namespace shrpx {
 class ClientHandler;
 class Downstream;
 class DownstreamConnection;
+struct Connection;
 
 class Upstream {
 public:
@@ -59,6 +60,19 @@ public:
   virtual int on_downstream_body(Downstream *downstream, const uint8_t *data,
                                  size_t len, bool flush) = 0;
   virtual int on_downstream_body_complete(Downstream *downstream) = 0;
+  // Returns true if the rest of response body of |downstream| can be
+  // moved from backend connection by on_downstream_body_splice().
+  virtual bool start_downstream_body_splice(Downstream *downstream) {
+    return false;
+  }
+  // Moves at most |len| bytes of response body of |downstream| from
+  // backend connection |conn| without copying it to user space.  It
+  // returns the number of bytes moved, 0 if no bytes can be moved
+  // now, or negative error code.
+  virtual ssize_t on_downstream_body_splice(Downstream *downstream,
+                                            Connection &conn, size_t len) {
+    return -1;
+  }
 
   virtual void on_handler_delete() = 0;
   // Called when downstream connection for |downstream| is reset.
@@ -66,6 +80,10 @@ public:
   // true, another connection attempt using new DownstreamConnection
   // is not allowed.
   virtual int on_downstream_reset(Downstream *downstream, bool no_retry) = 0;
+  // Called when |downstream|, which has waited for a slot of
+  // ConcurrencyLimiter, is admitted or rejected.  If this function
+  // returns nonzero, the ClientHandler is deleted.
+  virtual int on_downstream_admitted(Downstream *downstream) = 0;
 
   virtual void pause_read(IOCtrlReason reason) = 0;
   virtual int resume_read(IOCtrlReason reason, Downstream *downstream,
@@ -29,6 +29,7 @@
 #endif // HAVE_UNISTD_H
 
 #include <memory>
+#include <set>
 
 #include "shrpx_tls.h"
 #include "shrpx_log.h"
@@ -36,6 +37,8 @@
 #include "shrpx_http2_session.h"
 #include "shrpx_log_config.h"
 #include "shrpx_memcached_dispatcher.h"
+#include "shrpx_connection_handler.h"
+#include "shrpx_http_downstream_connection.h"
 #ifdef HAVE_MRUBY
 #  include "shrpx_mruby.h"
 #endif // HAVE_MRUBY
@@ -51,6 +54,20 @@ void eventcb(struct ev_loop *loop, ev_async *w, int revents) {
 }
 } // namespace
 
+namespace {
+void mcpool_trim_cb(struct ev_loop *loop, ev_timer *w, int revents) {
+  auto worker = static_cast<Worker *>(w->data);
+  worker->trim_mcpool();
+}
+} // namespace
+
+namespace {
+void metrics_timeoutcb(struct ev_loop *loop, ev_timer *w, int revents) {
+  auto worker = static_cast<Worker *>(w->data);
+  metrics_update_snapshot(worker);
+}
+} // namespace
+
 namespace {
 void mcpool_clear_cb(struct ev_loop *loop, ev_timer *w, int revents) {
   auto worker = static_cast<Worker *>(w->data);
@@ -80,9 +97,12 @@ DownstreamAddrGroup::~DownstreamAddrGroup() {}
 using DownstreamKey =
     std::tuple<std::vector<std::tuple<StringRef, StringRef, StringRef, size_t,
                                       size_t, Proto, uint32_t, uint32_t,
-                                      uint32_t, bool, bool, bool, bool>>,
+                                      uint32_t, bool, bool, bool, bool,
+                                      size_t, size_t, size_t, size_t>>,
                bool, SessionAffinity, StringRef, StringRef,
-               SessionAffinityCookieSecure, int64_t, int64_t, StringRef>;
+               SessionAffinityCookieSecure, int64_t, int64_t, StringRef,
+               LoadBalancing, StringRef, ev_tstamp, uint32_t, int32_t, bool,
+               ev_tstamp, bool, StringRef, bool, bool>;
 
 namespace {
 DownstreamKey
@@ -107,6 +127,10 @@ create_downstream_key(const std::shared_ptr<SharedDownstreamAddr> &shared_addr,
     std::get<10>(*p) = a.tls;
     std::get<11>(*p) = a.dns;
     std::get<12>(*p) = a.upgrade_scheme;
+    std::get<13>(*p) = a.pool_min_idle;
+    std::get<14>(*p) = a.pool_max_idle;
+    std::get<15>(*p) = a.http2_sessions;
+    std::get<16>(*p) = a.pipeline_depth;
     ++p;
   }
   std::sort(std::begin(addrs), std::end(addrs));
@@ -122,6 +146,17 @@ create_downstream_key(const std::shared_ptr<SharedDownstreamAddr> &shared_addr,
   std::get<6>(dkey) = timeout.read;
   std::get<7>(dkey) = timeout.write;
   std::get<8>(dkey) = mruby_file;
+  std::get<9>(dkey) = shared_addr->balance;
+  std::get<10>(dkey) = affinity.header.name;
+  std::get<11>(dkey) = shared_addr->hedge.delay;
+  std::get<12>(dkey) = shared_addr->hedge.percentile;
+  std::get<13>(dkey) = shared_addr->retry_budget;
+  std::get<14>(dkey) = shared_addr->adaptive_concurrency;
+  std::get<15>(dkey) = shared_addr->queue_timeout;
+  std::get<16>(dkey) = shared_addr->single_flight;
+  std::get<17>(dkey) = shared_addr->single_flight_key;
+  std::get<18>(dkey) = shared_addr->cache;
+  std::get<19>(dkey) = shared_addr->compress;
 
   return dkey;
 }
@@ -135,7 +170,7 @@ Worker::Worker(struct ev_loop *loop, SSL_CTX *sv_ssl_ctx, SSL_CTX *cl_ssl_ctx,
                std::shared_ptr<DownstreamConfig> downstreamconf)
     : randgen_(util::make_mt19937()),
       worker_stat_{},
-      dns_tracker_(loop),
+      dns_tracker_(loop, conn_handler->get_dns_cache()),
       loop_(loop),
       sv_ssl_ctx_(sv_ssl_ctx),
       cl_ssl_ctx_(cl_ssl_ctx),
@@ -143,7 +178,9 @@ Worker::Worker(struct ev_loop *loop, SSL_CTX *sv_ssl_ctx, SSL_CTX *cl_ssl_ctx,
       conn_handler_(conn_handler),
       ticket_keys_(ticket_keys),
       connect_blocker_(
-          std::make_unique<ConnectBlocker>(randgen_, loop_, nullptr, nullptr)),
+          std::make_unique<ConnectBlocker>(randgen_, loop_, nullptr, nullptr,
+                                           nullptr)),
+      accesslog_ring_(nullptr),
       graceful_shutdown_(false) {
   ev_async_init(&w_, eventcb);
   w_.data = this;
@@ -152,9 +189,24 @@ Worker::Worker(struct ev_loop *loop, SSL_CTX *sv_ssl_ctx, SSL_CTX *cl_ssl_ctx,
   ev_timer_init(&mcpool_clear_timer_, mcpool_clear_cb, 0., 0.);
   mcpool_clear_timer_.data = this;
 
+  auto &bufpoolconf = get_config()->conn.buffer_pool;
+
+  mcpool_.max_freelistsize = bufpoolconf.high_watermark;
+
+  ev_timer_init(&mcpool_trim_timer_, mcpool_trim_cb, 1., 1.);
+  mcpool_trim_timer_.data = this;
+  ev_timer_start(loop_, &mcpool_trim_timer_);
+
   ev_timer_init(&proc_wev_timer_, proc_wev_cb, 0., 0.);
   proc_wev_timer_.data = this;
 
+  ev_timer_init(&metrics_timer_, metrics_timeoutcb, 0., 1.);
+  metrics_timer_.data = this;
+
+  if (get_config()->api.enabled) {
+    ev_timer_start(loop_, &metrics_timer_);
+  }
+
   auto &session_cacheconf = get_config()->tls.session_cache;
 
   if (!session_cacheconf.memcached.host.empty()) {
@@ -164,6 +216,12 @@ Worker::Worker(struct ev_loop *loop, SSL_CTX *sv_ssl_ctx, SSL_CTX *cl_ssl_ctx,
         StringRef{session_cacheconf.memcached.host}, &mcpool_, randgen_);
   }
 
+  auto private_key_pool = conn_handler->get_private_key_pool();
+  if (private_key_pool) {
+    private_key_op_queue_ =
+        std::make_shared<PrivateKeyOpQueue>(loop, private_key_pool, &metrics_);
+  }
+
   replace_downstream_config(std::move(downstreamconf));
 }
 
@@ -201,14 +259,86 @@ void ensure_enqueue_addr(
 }
 } // namespace
 
+namespace {
+std::vector<std::pair<StringRef, std::string>>
+resolved_addrs(const SharedDownstreamAddr &shared_addr) {
+  std::vector<std::pair<StringRef, std::string>> v;
+  v.reserve(shared_addr.addrs.size());
+  for (auto &addr : shared_addr.addrs) {
+    v.emplace_back(addr.hostport,
+                   std::string(reinterpret_cast<const char *>(&addr.addr.su),
+                               addr.addr.len));
+  }
+  return v;
+}
+} // namespace
+
+namespace {
+// Returns true if backend group |a| created from the previous
+// configuration can be used in place of |b|, which has the same
+// DownstreamKey.  The addresses must be resolved to the same IP
+// addresses.  If session affinity is enabled, the order of addresses
+// must be the same, because affinity_table refers to them by index.
+bool reusable_shared_addr(const SharedDownstreamAddr &a,
+                          const SharedDownstreamAddr &b) {
+  if (a.affinity_table != b.affinity_table) {
+    return false;
+  }
+
+  auto va = resolved_addrs(a);
+  auto vb = resolved_addrs(b);
+
+  if (b.affinity.type == SessionAffinity::NONE) {
+    // Addresses of |a| have been shuffled.
+    std::sort(std::begin(va), std::end(va));
+    std::sort(std::begin(vb), std::end(vb));
+  }
+
+  return va == vb;
+}
+} // namespace
+
 void Worker::replace_downstream_config(
     std::shared_ptr<DownstreamConfig> downstreamconf) {
-  for (auto &g : downstream_addr_groups_) {
-    g->retired = true;
+  auto old_groups = std::move(downstream_addr_groups_);
+  // Keys of old groups refer to the old configuration.
+  auto old_downstreamconf = std::move(downstreamconf_);
+
+  // The old groups which created SharedDownstreamAddr.  Unless the
+  // group has mruby script, which might have been changed, the
+  // SharedDownstreamAddr is kept if the new configuration has the
+  // same backend group, along with its connection pools, live checks,
+  // and TLS session caches.
+  std::map<DownstreamKey, std::shared_ptr<DownstreamAddrGroup>>
+      reusable_groups;
+
+  for (size_t i = 0; i < old_groups.size(); ++i) {
+    auto &g = old_groups[i];
+    auto &mruby_file = old_downstreamconf->addr_groups[i].mruby_file;
+    if (!mruby_file.empty()) {
+      continue;
+    }
+    reusable_groups.emplace(create_downstream_key(g->shared_addr, mruby_file),
+                            g);
+  }
 
-    auto &shared_addr = g->shared_addr;
-    for (auto &addr : shared_addr->addrs) {
-      addr.dconn_pool->remove_all();
+  std::set<const DownstreamAddrGroup *> reused_groups;
+  std::set<const SharedDownstreamAddr *> reused_shared_addrs;
+
+  // TLS sessions of old addresses, which are carried over to the same
+  // backend in the groups created from scratch.
+  std::map<std::tuple<StringRef, StringRef, Proto>,
+           const tls::TLSSessionCache *>
+      tls_session_caches;
+
+  for (auto &g : old_groups) {
+    for (auto &addr : g->shared_addr->addrs) {
+      if (!addr.tls || addr.tls_session_cache.session_data.empty()) {
+        continue;
+      }
+      tls_session_caches.emplace(
+          std::make_tuple(addr.hostport, addr.sni, addr.proto),
+          &addr.tls_session_cache);
     }
   }
 
@@ -249,9 +379,27 @@ void Worker::replace_downstream_config(
             make_string_ref(shared_addr->balloc, src.affinity.cookie.path);
       }
       shared_addr->affinity.cookie.secure = src.affinity.cookie.secure;
+    } else if (src.affinity.type == SessionAffinity::HEADER) {
+      shared_addr->affinity.header.name =
+          make_string_ref(shared_addr->balloc, src.affinity.header.name);
     }
-    shared_addr->affinity_hash = src.affinity_hash;
+    shared_addr->affinity_table = src.affinity_table;
+    shared_addr->balance = src.balance;
+    shared_addr->hedge = src.hedge;
+    shared_addr->retry_budget = src.retry_budget;
+    shared_addr->retry_tokens.set_percent(src.retry_budget == -1
+                                              ? HEDGE_DEFAULT_RETRY_BUDGET
+                                              : src.retry_budget);
     shared_addr->redirect_if_not_tls = src.redirect_if_not_tls;
+    shared_addr->adaptive_concurrency = src.adaptive_concurrency;
+    shared_addr->queue_timeout = src.queue_timeout;
+    shared_addr->single_flight = src.single_flight;
+    shared_addr->cache = src.cache;
+    shared_addr->compress = src.compress;
+    if (!src.single_flight_key.empty()) {
+      shared_addr->single_flight_key =
+          make_string_ref(shared_addr->balloc, src.single_flight_key);
+    }
     shared_addr->timeout.read = src.timeout.read;
     shared_addr->timeout.write = src.timeout.write;
 
@@ -273,36 +421,14 @@ void Worker::replace_downstream_config(
       dst_addr.sni = make_string_ref(shared_addr->balloc, src_addr.sni);
       dst_addr.fall = src_addr.fall;
       dst_addr.rise = src_addr.rise;
+      dst_addr.pool_min_idle = src_addr.pool_min_idle;
+      dst_addr.pool_max_idle = src_addr.pool_max_idle;
+      dst_addr.http2_sessions = src_addr.http2_sessions;
+      dst_addr.pipeline_depth = src_addr.pipeline_depth;
       dst_addr.dns = src_addr.dns;
       dst_addr.upgrade_scheme = src_addr.upgrade_scheme;
-
-      auto shared_addr_ptr = shared_addr.get();
-
-      dst_addr.connect_blocker = std::make_unique<ConnectBlocker>(
-          randgen_, loop_, nullptr, [shared_addr_ptr, &dst_addr]() {
-            if (!dst_addr.queued) {
-              if (!dst_addr.wg) {
-                return;
-              }
-              ensure_enqueue_addr(shared_addr_ptr->pq, dst_addr.wg, &dst_addr);
-            }
-          });
-
-      dst_addr.live_check = std::make_unique<LiveCheck>(
-          loop_, cl_ssl_ctx_, this, &dst_addr, randgen_);
     }
 
-#ifdef HAVE_MRUBY
-    auto mruby_ctx_it = shared_mruby_ctxs.find(src.mruby_file);
-    if (mruby_ctx_it == std::end(shared_mruby_ctxs)) {
-      shared_addr->mruby_ctx = mruby::create_mruby_context(src.mruby_file);
-      assert(shared_addr->mruby_ctx);
-      shared_mruby_ctxs.emplace(src.mruby_file, shared_addr->mruby_ctx);
-    } else {
-      shared_addr->mruby_ctx = (*mruby_ctx_it).second;
-    }
-#endif // HAVE_MRUBY
-
     // share the connection if patterns have the same set of backend
     // addresses.
 
@@ -310,12 +436,106 @@ void Worker::replace_downstream_config(
     auto it = addr_groups_indexer.find(dkey);
 
     if (it == std::end(addr_groups_indexer)) {
-      std::shuffle(std::begin(shared_addr->addrs), std::end(shared_addr->addrs),
-                   randgen_);
+      auto rit = reusable_groups.find(dkey);
+      if (rit != std::end(reusable_groups) &&
+          reusable_shared_addr(*(*rit).second->shared_addr, *shared_addr)) {
+        // The group object which pre-connection refers to is kept
+        // rather than retired.
+        auto &g = (*rit).second;
+
+        if (LOG_ENABLED(INFO)) {
+          LOG(INFO) << dst->pattern << " reuses the backend group of "
+                    << g->pattern;
+        }
+
+        g->pattern = std::move(dst->pattern);
+        dst = std::move(g);
+        reusable_groups.erase(rit);
+
+        reused_groups.emplace(dst.get());
+        reused_shared_addrs.emplace(dst->shared_addr.get());
+        // |dkey| refers to the memory of |shared_addr| which is
+        // discarded.  Recreate it from the reused one.
+        addr_groups_indexer.emplace(
+            create_downstream_key(dst->shared_addr, src.mruby_file), i);
+
+        continue;
+      }
+
+#ifdef HAVE_MRUBY
+      auto mruby_ctx_it = shared_mruby_ctxs.find(src.mruby_file);
+      if (mruby_ctx_it == std::end(shared_mruby_ctxs)) {
+        shared_addr->mruby_ctx = mruby::create_mruby_context(src.mruby_file);
+        assert(shared_addr->mruby_ctx);
+        shared_mruby_ctxs.emplace(src.mruby_file, shared_addr->mruby_ctx);
+      } else {
+        shared_addr->mruby_ctx = (*mruby_ctx_it).second;
+      }
+#endif // HAVE_MRUBY
+
+      // affinity_table refers to addresses by their index in
+      // configuration.  Keep the order so that all workers map the
+      // same key to the same address.
+      if (shared_addr->affinity.type == SessionAffinity::NONE) {
+        std::shuffle(std::begin(shared_addr->addrs),
+                     std::end(shared_addr->addrs), randgen_);
+      }
+
+      auto shared_addr_ptr = shared_addr.get();
 
       size_t seq = 0;
       for (auto &addr : shared_addr->addrs) {
-        addr.dconn_pool = std::make_unique<DownstreamConnectionPool>();
+        // These objects refer to |addr|, so that they must be created
+        // after addresses are shuffled.  Connection failures and
+        // liveness of the backend are shared by all workers.
+        auto health = conn_handler_->get_backend_health_table()->get(
+            addr.hostport, addr.sni, addr.proto, addr.tls);
+
+        addr.connect_blocker = std::make_unique<ConnectBlocker>(
+            randgen_, loop_, nullptr,
+            [shared_addr_ptr, &addr]() {
+              if (!addr.queued) {
+                if (!addr.wg) {
+                  return;
+                }
+                ensure_enqueue_addr(shared_addr_ptr->pq, addr.wg, &addr);
+              }
+            },
+            std::move(health));
+
+        addr.live_check = std::make_unique<LiveCheck>(loop_, cl_ssl_ctx_, this,
+                                                      &addr, randgen_);
+
+        if (addr.tls) {
+          auto cit = tls_session_caches.find(
+              std::make_tuple(addr.hostport, addr.sni, addr.proto));
+          if (cit != std::end(tls_session_caches)) {
+            addr.tls_session_cache = *(*cit).second;
+          }
+
+          auto store = conn_handler_->get_backend_tls_session_store();
+          if (store->get_capacity()) {
+            auto &cache = addr.tls_session_cache;
+            cache.store = store;
+            cache.store_key = addr.hostport.str();
+            cache.store_key += ';';
+            cache.store_key += addr.sni;
+            cache.store_key += ';';
+            cache.store_key += addr.proto == Proto::HTTP2 ? "h2" : "h1";
+          }
+        }
+
+        std::function<int(size_t)> refill_func;
+        if (addr.pool_min_idle) {
+          refill_func = [this, group = std::weak_ptr<DownstreamAddrGroup>(dst),
+                         &addr](size_t n) {
+            return preconnect_downstream_connections(group.lock(), &addr, n);
+          };
+        }
+        addr.dconn_pool = std::make_unique<DownstreamConnectionPool>(
+            loop_, randgen_, addr.pool_min_idle, addr.pool_max_idle,
+            std::move(refill_func));
+        addr.dconn_pool->schedule_refill();
         addr.seq = seq++;
       }
 
@@ -353,6 +573,16 @@ void Worker::replace_downstream_config(
         }
       }
 
+      if (shared_addr->adaptive_concurrency) {
+        shared_addr->concurrency_limiter = std::make_shared<ConcurrencyLimiter>(
+            loop_, shared_addr->queue_timeout);
+      }
+
+      if (shared_addr->single_flight) {
+        shared_addr->single_flight_calls =
+            std::make_shared<SingleFlight>(shared_addr->single_flight_key);
+      }
+
       dst->shared_addr = shared_addr;
 
       addr_groups_indexer.emplace(std::move(dkey), i);
@@ -365,12 +595,66 @@ void Worker::replace_downstream_config(
       dst->shared_addr = g->shared_addr;
     }
   }
+
+  for (auto &g : old_groups) {
+    if (reused_groups.count(g.get())) {
+      continue;
+    }
+
+    g->retired = true;
+
+    auto &shared_addr = g->shared_addr;
+    if (reused_shared_addrs.count(shared_addr.get())) {
+      continue;
+    }
+
+    for (auto &addr : shared_addr->addrs) {
+      addr.dconn_pool->remove_all();
+    }
+  }
 }
 
 Worker::~Worker() {
+  if (private_key_op_queue_) {
+    private_key_op_queue_->close();
+  }
   ev_async_stop(loop_, &w_);
   ev_timer_stop(loop_, &mcpool_clear_timer_);
+  ev_timer_stop(loop_, &mcpool_trim_timer_);
   ev_timer_stop(loop_, &proc_wev_timer_);
+  ev_timer_stop(loop_, &metrics_timer_);
+}
+
+int Worker::preconnect_downstream_connections(
+    const std::shared_ptr<DownstreamAddrGroup> &group, DownstreamAddr *addr,
+    size_t n) {
+  if (!group || group->retired || graceful_shutdown_) {
+    return 0;
+  }
+
+  if (connect_blocker_->blocked() || addr->connect_blocker->blocked()) {
+    return -1;
+  }
+
+  if (LOG_ENABLED(INFO)) {
+    WLOG(INFO, this) << "Pre-connect " << n << " connection(s) to "
+                     << addr->hostport;
+  }
+
+  for (; n; --n) {
+    auto dconn =
+        std::make_unique<HttpDownstreamConnection>(group, addr, loop_, this);
+    auto p = dconn.get();
+
+    addr->dconn_pool->add_warming_connection(std::move(dconn));
+
+    if (p->preconnect() != 0) {
+      addr->dconn_pool->remove_warming_connection(p);
+      return -1;
+    }
+  }
+
+  return 0;
 }
 
 void Worker::schedule_clear_mcpool() {
@@ -380,6 +664,18 @@ void Worker::schedule_clear_mcpool() {
   ev_timer_start(loop_, &mcpool_clear_timer_);
 }
 
+void Worker::trim_mcpool() {
+  auto low_watermark = get_config()->conn.buffer_pool.low_watermark;
+
+  if (mcpool_.freelistsize <= low_watermark) {
+    return;
+  }
+
+  // Release half of the excess at a time so that a burst of traffic
+  // which follows shortly can still reuse the rest.
+  mcpool_.shrink(low_watermark + (mcpool_.freelistsize - low_watermark) / 2);
+}
+
 void Worker::wait() {
 #ifndef NOTHREADS
   fut_.get();
@@ -389,6 +685,7 @@ void Worker::wait() {
 void Worker::run_async() {
 #ifndef NOTHREADS
   fut_ = std::async(std::launch::async, [this] {
+    log_config()->accesslog_ring = accesslog_ring_;
     (void)reopen_log_files(get_config()->logging);
     ev_run(loop_);
     delete_log_config();
@@ -396,6 +693,14 @@ void Worker::run_async() {
 #endif // !NOTHREADS
 }
 
+void Worker::set_accesslog_ring(AccessLogRing *ring) {
+  accesslog_ring_ = ring;
+}
+
+AccessLogRing *Worker::get_accesslog_ring() const { return accesslog_ring_; }
+
+WorkerMetrics &Worker::get_metrics() { return metrics_; }
+
 void Worker::send(const WorkerEvent &event) {
   {
     std::lock_guard<std::mutex> g(m_);
@@ -406,6 +711,10 @@ void Worker::send(const WorkerEvent &event) {
   ev_async_send(loop_, &w_);
 }
 
+PrivateKeyOpQueue *Worker::get_private_key_op_queue() const {
+  return private_key_op_queue_.get();
+}
+
 void Worker::process_events() {
   WorkerEvent wev;
   {
@@ -472,6 +781,11 @@ void Worker::process_events() {
 
     reopen_log_files(config->logging);
 
+    WLOG(NOTICE, this) << "Buffer pool: allocated=" << mcpool_.poolsize
+                       << ", free=" << mcpool_.freelistsize
+                       << ", peak=" << mcpool_.peak_poolsize
+                       << ", released=" << mcpool_.releasedsize;
+
     break;
   case WorkerEventType::GRACEFUL_SHUTDOWN:
     WLOG(NOTICE, this) << "Graceful shutdown commencing";
@@ -741,7 +1055,9 @@ void downstream_failure(DownstreamAddr *addr, const Address *raddr) {
 
     connect_blocker->offline();
 
-    if (addr->rise) {
+    // Only one worker checks liveness of the backend.  The others
+    // learn the result through the shared state.
+    if (connect_blocker->acquire_probe() && addr->rise) {
       addr->live_check->schedule();
     }
   }
@@ -50,6 +50,12 @@
 #include "shrpx_live_check.h"
 #include "shrpx_connect_blocker.h"
 #include "shrpx_dns_tracker.h"
+#include "shrpx_metrics.h"
+#include "shrpx_hedge.h"
+#include "shrpx_concurrency_limiter.h"
+#include "shrpx_single_flight.h"
+#include "shrpx_outlier_detector.h"
+#include "shrpx_private_key_pool.h"
 #include "allocator.h"
 
 using namespace nghttp2;
@@ -57,10 +63,12 @@ using namespace nghttp2;
 namespace shrpx {
 
 class Http2Session;
+class HttpDownstreamConnection;
 class ConnectBlocker;
 class MemcachedDispatcher;
 struct UpstreamAddr;
 class ConnectionHandler;
+class AccessLogRing;
 
 #ifdef HAVE_MRUBY
 namespace mruby {
@@ -97,6 +105,15 @@ struct DownstreamAddr {
   std::unique_ptr<DownstreamConnectionPool> dconn_pool;
   size_t fall;
   size_t rise;
+  // The number of idle connections kept established in advance.
+  size_t pool_min_idle;
+  // The maximum number of idle connections.  0 means unlimited.
+  size_t pool_max_idle;
+  // The number of HTTP/2 sessions which streams are spread over.
+  size_t http2_sessions;
+  // The maximum number of requests in flight on one HTTP/1
+  // connection.  1 disables pipelining.
+  size_t pipeline_depth;
   // Client side TLS session cache
   tls::TLSSessionCache tls_session_cache;
   // List of Http2Session which is not fully utilized (i.e., the
@@ -104,10 +121,29 @@ struct DownstreamAddr {
   // coalesce as much stream as possible in one Http2Session to fully
   // utilize TCP connection.
   DList<Http2Session> http2_extra_freelist;
+  // List of HttpDownstreamConnection which can take more pipelined
+  // requests.
+  DList<HttpDownstreamConnection> http1_pipeline_freelist;
   WeightGroup *wg;
   // total number of streams created in HTTP/2 connections for this
   // address.
   size_t num_dconn;
+  // The number of Http2Session objects created for this address,
+  // including the ones which are not in |http2_extra_freelist|.
+  size_t num_http2_session;
+  // The number of responses received from this address.  This is
+  // reset when backend configuration is replaced.
+  uint64_t num_responses;
+  // The number of requests which are assigned to this address, and
+  // have not finished yet.
+  size_t num_inflight;
+  // Peak EWMA of response latency in seconds.  0 if no response has
+  // been received yet.
+  ev_tstamp latency_ewma;
+  // The time when |latency_ewma| was last updated.
+  ev_tstamp latency_ewma_stamp;
+  // The outcome of recent requests and ejection state.
+  OutlierDetector outlier_detector;
   // the sequence number of this address to randomize the order access
   // threads.
   size_t seq;
@@ -190,7 +226,16 @@ struct SharedDownstreamAddr {
   SharedDownstreamAddr()
       : balloc(1024, 1024),
         affinity{SessionAffinity::NONE},
+        balance{LoadBalancing::ROUND_ROBIN},
+        hedge{},
+        retry_budget{-1},
+        queue_timeout{0.},
+        next_addr{0},
         redirect_if_not_tls{false},
+        adaptive_concurrency{false},
+        single_flight{false},
+        cache{false},
+        compress{false},
         timeout{} {}
 
   SharedDownstreamAddr(const SharedDownstreamAddr &) = delete;
@@ -204,18 +249,54 @@ struct SharedDownstreamAddr {
   std::priority_queue<WeightGroupEntry, std::vector<WeightGroupEntry>,
                       WeightGroupEntryGreater>
       pq;
-  // Bunch of session affinity hash.  Only used if affinity ==
-  // SessionAffinity::IP.
-  std::vector<AffinityHash> affinity_hash;
+  // Maglev lookup table which maps session affinity hash to an index
+  // into addrs.  Only used if affinity != SessionAffinity::NONE.
+  std::vector<uint32_t> affinity_table;
 #ifdef HAVE_MRUBY
   std::shared_ptr<mruby::MRubyContext> mruby_ctx;
 #endif // HAVE_MRUBY
   // Configuration for session affinity
   AffinityConfig affinity;
+  // Load balancing method used if session affinity is disabled.
+  LoadBalancing balance;
+  // Hedged request configuration.
+  HedgeConfig hedge;
+  // The ratio of retried and hedged requests to requests in percent.
+  // -1 if retries are not limited.
+  int32_t retry_budget;
+  // Token bucket which limits retries and hedged requests.
+  RetryBudget retry_tokens;
+  // Response latency of this group, which is used to compute the
+  // delay of hedged request.
+  RecentLatencyHistogram latency_histogram;
+  // Limits the number of outstanding requests to this group if
+  // adaptive concurrency limit is enabled.  Otherwise nullptr.
+  std::shared_ptr<ConcurrencyLimiter> concurrency_limiter;
+  // The maximum duration a request waits for a slot of
+  // concurrency_limiter.
+  ev_tstamp queue_timeout;
+  // The requests in flight which identical requests can wait for if
+  // single-flight is enabled.  Otherwise nullptr.
+  std::shared_ptr<SingleFlight> single_flight_calls;
+  // The names of request header fields, separated by ':', which are
+  // included in the key of single_flight_calls.
+  StringRef single_flight_key;
+  // The index of address where the next scan starts.  Used to break
+  // ties in load balancing methods other than round robin.
+  size_t next_addr;
   // Session affinity
   // true if this group requires that client connection must be TLS,
   // and the request must be redirected to https URI.
   bool redirect_if_not_tls;
+  // true if the number of outstanding requests is limited by
+  // concurrency_limiter.
+  bool adaptive_concurrency;
+  // true if identical GET requests are coalesced into one.
+  bool single_flight;
+  // true if responses are stored in response cache.
+  bool cache;
+  // true if response body is compressed if client accepts it.
+  bool compress;
   // Timeouts for backend connection.
   struct {
     ev_tstamp read;
@@ -294,6 +375,9 @@ public:
 
   MemchunkPool *get_mcpool();
   void schedule_clear_mcpool();
+  // Releases a part of unused buffers in mcpool_ if they exceed the
+  // low watermark.
+  void trim_mcpool();
 
   MemcachedDispatcher *get_session_cache_memcached_dispatcher();
 
@@ -315,10 +399,28 @@ public:
   void
   replace_downstream_config(std::shared_ptr<DownstreamConfig> downstreamconf);
 
+  // Starts making |n| connections to |addr| in |group| in advance,
+  // and adds them to its connection pool.  This function returns 0
+  // if it succeeds, or -1 if the backend is not available now.
+  int preconnect_downstream_connections(
+      const std::shared_ptr<DownstreamAddrGroup> &group, DownstreamAddr *addr,
+      size_t n);
+
   ConnectionHandler *get_connection_handler() const;
 
   DNSTracker *get_dns_tracker();
 
+  // Sets AccessLogRing to which this worker queues access log
+  // records.  This function must be called before run_async().
+  void set_accesslog_ring(AccessLogRing *ring);
+  AccessLogRing *get_accesslog_ring() const;
+
+  WorkerMetrics &get_metrics();
+
+  // Returns the queue to offload private key operations, or nullptr
+  // if they are not offloaded.
+  PrivateKeyOpQueue *get_private_key_op_queue() const;
+
 private:
 #ifndef NOTHREADS
   std::future<void> fut_;
@@ -328,13 +430,18 @@ private:
   std::mt19937 randgen_;
   ev_async w_;
   ev_timer mcpool_clear_timer_;
+  ev_timer mcpool_trim_timer_;
   ev_timer proc_wev_timer_;
+  // Periodically updates snapshot in metrics_ if API is enabled.
+  ev_timer metrics_timer_;
   MemchunkPool mcpool_;
   WorkerStat worker_stat_;
+  WorkerMetrics metrics_;
   DNSTracker dns_tracker_;
 
   std::shared_ptr<DownstreamConfig> downstreamconf_;
   std::unique_ptr<MemcachedDispatcher> session_cache_memcached_dispatcher_;
+  std::shared_ptr<PrivateKeyOpQueue> private_key_op_queue_;
 #ifdef HAVE_MRUBY
   std::unique_ptr<mruby::MRubyContext> mruby_ctx_;
 #endif // HAVE_MRUBY
@@ -355,6 +462,7 @@ private:
   // Worker level blocker for downstream connection.  For example,
   // this is used when file decriptor is exhausted.
   std::unique_ptr<ConnectBlocker> connect_blocker_;
+  AccessLogRing *accesslog_ring_;
 
   bool graceful_shutdown_;
 };
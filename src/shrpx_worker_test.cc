@@ -28,13 +28,19 @@
 #  include <unistd.h>
 #endif // HAVE_UNISTD_H
 
+#include <arpa/inet.h>
+
 #include <cstdlib>
 
 #include <CUnit/CUnit.h>
 
 #include "shrpx_worker.h"
+#include "shrpx_connection_handler.h"
 #include "shrpx_connect_blocker.h"
+#include "shrpx_live_check.h"
+#include "shrpx_downstream_connection_pool.h"
 #include "shrpx_log.h"
+#include "util.h"
 
 namespace shrpx {
 
@@ -244,4 +250,126 @@ void test_shrpx_worker_match_downstream_addr_group(void) {
                       StringRef{}, groups, 255, balloc));
 }
 
+namespace {
+// Creates DownstreamConfig which has a backend group per pattern in
+// |patterns|.  The group i has the backend 127.0.0.1:ports[i].
+std::shared_ptr<DownstreamConfig>
+create_downstream_config(const std::vector<StringRef> &patterns,
+                         const std::vector<uint16_t> &ports) {
+  auto downstreamconf = std::make_shared<DownstreamConfig>();
+  auto &balloc = downstreamconf->balloc;
+
+  for (size_t i = 0; i < patterns.size(); ++i) {
+    downstreamconf->addr_groups.emplace_back(
+        make_string_ref(balloc, patterns[i]));
+
+    auto &g = downstreamconf->addr_groups.back();
+
+    DownstreamAddrConfig addr{};
+    addr.host = make_string_ref(balloc, StringRef::from_lit("127.0.0.1"));
+    addr.port = ports[i];
+    addr.hostport = util::make_hostport(balloc, addr.host, addr.port);
+    addr.fall = 1;
+    addr.rise = 1;
+    addr.weight = 1;
+    addr.group_weight = 1;
+    addr.http2_sessions = 1;
+    addr.pipeline_depth = 1;
+    addr.proto = Proto::HTTP1;
+
+    auto &sin = addr.addr.su.in;
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(addr.port);
+    inet_pton(AF_INET, "127.0.0.1", &sin.sin_addr);
+    addr.addr.len = sizeof(sin);
+
+    g.addrs.push_back(addr);
+  }
+
+  return downstreamconf;
+}
+} // namespace
+
+void test_shrpx_worker_replace_downstream_config(void) {
+  auto loop = EV_DEFAULT;
+  auto gen = util::make_mt19937();
+  ConnectionHandler conn_handler(loop, gen);
+
+  auto a = StringRef::from_lit("a.example/");
+  auto b = StringRef::from_lit("b.example/");
+  auto c = StringRef::from_lit("c.example/");
+
+  // "a.example/" and "c.example/" share the same backend.
+  Worker worker(loop, nullptr, nullptr, nullptr, nullptr, nullptr,
+                &conn_handler,
+                create_downstream_config({a, b, c}, {3001, 3002, 3001}));
+
+  auto groups = worker.get_downstream_addr_groups();
+
+  CU_ASSERT(3 == groups.size());
+  CU_ASSERT(groups[0]->shared_addr == groups[2]->shared_addr);
+  CU_ASSERT(groups[0]->shared_addr != groups[1]->shared_addr);
+
+  auto &addr_a = groups[0]->shared_addr->addrs[0];
+  auto &addr_b = groups[1]->shared_addr->addrs[0];
+  auto dconn_pool_a = addr_a.dconn_pool.get();
+  auto live_check_a = addr_a.live_check.get();
+  auto connect_blocker_a = addr_a.connect_blocker.get();
+  auto dconn_pool_b = addr_b.dconn_pool.get();
+
+  addr_a.connect_blocker->eject(60.);
+
+  CU_ASSERT(addr_a.connect_blocker->blocked());
+
+  // Identical configuration keeps all groups.
+  worker.replace_downstream_config(
+      create_downstream_config({a, b, c}, {3001, 3002, 3001}));
+
+  {
+    auto &new_groups = worker.get_downstream_addr_groups();
+
+    CU_ASSERT(3 == new_groups.size());
+    CU_ASSERT(groups[0] == new_groups[0]);
+    CU_ASSERT(groups[1] == new_groups[1]);
+    CU_ASSERT(groups[0]->shared_addr == new_groups[2]->shared_addr);
+    CU_ASSERT(!new_groups[0]->retired);
+    CU_ASSERT(!new_groups[1]->retired);
+    CU_ASSERT(a == StringRef{new_groups[0]->pattern});
+
+    auto &addr = new_groups[0]->shared_addr->addrs[0];
+
+    CU_ASSERT(dconn_pool_a == addr.dconn_pool.get());
+    CU_ASSERT(live_check_a == addr.live_check.get());
+    CU_ASSERT(connect_blocker_a == addr.connect_blocker.get());
+    CU_ASSERT(addr.connect_blocker->blocked());
+    CU_ASSERT(dconn_pool_b ==
+              new_groups[1]->shared_addr->addrs[0].dconn_pool.get());
+  }
+
+  // Changing the backend of "b.example/" only replaces its group.
+  // The groups are also reordered.
+  worker.replace_downstream_config(
+      create_downstream_config({c, a, b}, {3001, 3001, 3003}));
+
+  {
+    auto &new_groups = worker.get_downstream_addr_groups();
+
+    CU_ASSERT(3 == new_groups.size());
+    CU_ASSERT(new_groups[0]->shared_addr == new_groups[1]->shared_addr);
+    CU_ASSERT(groups[0]->shared_addr == new_groups[0]->shared_addr);
+    CU_ASSERT(groups[1] != new_groups[2]);
+    CU_ASSERT(groups[1]->retired);
+    CU_ASSERT(!new_groups[0]->retired);
+    CU_ASSERT(!new_groups[1]->retired);
+    CU_ASSERT(!new_groups[2]->retired);
+
+    auto &addr = new_groups[0]->shared_addr->addrs[0];
+
+    CU_ASSERT(dconn_pool_a == addr.dconn_pool.get());
+    CU_ASSERT(connect_blocker_a == addr.connect_blocker.get());
+    CU_ASSERT(addr.connect_blocker->blocked());
+    CU_ASSERT(3003 == new_groups[2]->shared_addr->addrs[0].port);
+  }
+}
+
 } // namespace shrpx
@@ -32,6 +32,7 @@
 namespace shrpx {
 
 void test_shrpx_worker_match_downstream_addr_group(void);
+void test_shrpx_worker_replace_downstream_config(void);
 
 } // namespace shrpx
 